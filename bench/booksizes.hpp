@@ -0,0 +1,14 @@
+#ifndef BOOKSIZES_HPP
+#define BOOKSIZES_HPP
+
+#include <benchmark/benchmark.h>
+
+// Arguments of the benchmarks run against a loaded book: resting orders x listings x reject percent, read back as
+// state.range(0), state.range(1) and state.range(2).
+inline void book_sizes(benchmark::internal::Benchmark * benchmark)
+{
+    benchmark->ArgNames({"resting", "listings", "reject%"});
+    benchmark->ArgsProduct({{1'000, 100'000}, {1, 100}, {0, 10, 50}});
+}
+
+#endif //BOOKSIZES_HPP
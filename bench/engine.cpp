@@ -0,0 +1,50 @@
+#include "../server/engine.hpp"
+
+#include <benchmark/benchmark.h>
+#include <poll.h>
+
+// Throughput of the sharded risk engine with state.range(0) worker threads. 64 sessions each send a stream of
+// NewOrder/DeleteOrder pairs, the benchmark thread plays the network thread: it submits and drains responses.
+
+namespace
+{
+const uint64_t SESSIONS = 64;
+const uint64_t BATCH = 1 << 16;
+
+::Message make_message(uint64_t sequence)
+{
+    auto message = ::Message{};
+    auto order_id = sequence / 2;
+    if (sequence % 2 == 0)
+        message.payload = Messages::NewOrder{Messages::NewOrder::MESSAGE_TYPE, order_id % 128, order_id, 1, 100, 'B'};
+    else
+        message.payload = Messages::DeleteOrder{Messages::DeleteOrder::MESSAGE_TYPE, order_id};
+    return message;
+}
+
+void engine_throughput(benchmark::State & state)
+{
+    uint64_t received = 0;
+    auto engine = Engine(static_cast<size_t>(state.range(0)), 1'000'000, 1'000'000,
+                         [&received](uint64_t, const OrderStore::Response &, const LatencyTrace &) { ++received; });
+    for (uint64_t session = 0; session < SESSIONS; ++session)
+        engine.open(session);
+
+    uint64_t sequence = 0;
+    for (auto _ : state) {
+        auto target = received + BATCH;
+        for (uint64_t i = 0; i < BATCH; ++i, ++sequence) {
+            // Pairs go to the same session so the delete finds its order
+            engine.submit((sequence / 2) % SESSIONS, make_message(sequence));
+        }
+        while (received < target) {
+            auto fd = pollfd{engine.notify_fd(), POLLIN, 0};
+            poll(&fd, 1, 100);
+            engine.drain();
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * BATCH);
+}
+} // unnamed namespace
+
+BENCHMARK(engine_throughput)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->UseRealTime();
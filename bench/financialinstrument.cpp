@@ -0,0 +1,155 @@
+#include "../server/financialintrument.hpp"
+#include "booksizes.hpp"
+
+#include <benchmark/benchmark.h>
+#include <random>
+#include <vector>
+
+// Single operations on instruments that already hold state.range(0) resting orders, spread over state.range(1)
+// instruments, with state.range(2) percent of the operations rejected. The operations of a batch go round-robin over
+// the instruments, whatever a batch added is removed again with the timer paused so every batch sees the same book.
+// The non-throwing try_* variants are measured, as the server uses them.
+
+namespace
+{
+const size_t BATCH = 1024;
+const int64_t REJECTED_QUANTITY = int64_t{1} << 40; // beyond any limit
+const uint64_t PRICE = 100;
+
+using Side = FinancialInstrument::Side;
+using Result = FinancialInstrument::Result;
+
+struct Book
+{
+    std::vector<FinancialInstrument> instruments;
+    std::vector<bool> rejected; // per operation of a batch
+    uint64_t resting;
+    uint64_t limit;
+
+    explicit Book(const benchmark::State & state)
+        : instruments(static_cast<size_t>(state.range(1)))
+        , resting(static_cast<uint64_t>(state.range(0)))
+    {
+        // Every resting order has quantity 1, leave room for a batch of accepted ones on top
+        limit = resting / instruments.size() + BATCH + 1;
+        for (uint64_t id = 0; id < resting; ++id)
+            add(id, 1);
+
+        auto random = std::mt19937(42);
+        auto percent = std::uniform_int_distribution<int64_t>(0, 99);
+        for (size_t i = 0; i < BATCH; ++i)
+            rejected.push_back(percent(random) < state.range(2));
+    }
+
+    // Even ids rest on the buy side, odd ones on the sell side
+    static Side side(uint64_t id) { return id % 2 == 0 ? Side::BUY : Side::SELL; }
+    FinancialInstrument & instrument(uint64_t id) { return instruments[id % instruments.size()]; }
+
+    Result add(uint64_t id, int64_t quantity)
+    {
+        auto order = FinancialInstrument::Order{id, quantity, PRICE};
+        return side(id) == Side::BUY ? instrument(id).try_add_buy(order, limit)
+                                     : instrument(id).try_add_sell(order, limit);
+    }
+};
+
+void set_counters(benchmark::State & state)
+{
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * BATCH));
+}
+
+void add_order(benchmark::State & state, Side side)
+{
+    auto book = Book(state);
+    // New ids above the resting ones, on the requested side
+    auto first = book.resting + (side == Side::BUY ? 0 : 1) + book.resting % 2;
+    for (auto _ : state) {
+        for (size_t i = 0; i < BATCH; ++i) {
+            auto id = first + 2 * i;
+            auto order = FinancialInstrument::Order{id, book.rejected[i] ? REJECTED_QUANTITY : 1, PRICE};
+            auto & instrument = book.instrument(id);
+            benchmark::DoNotOptimize(side == Side::BUY ? instrument.try_add_buy(order, book.limit)
+                                                       : instrument.try_add_sell(order, book.limit));
+        }
+        state.PauseTiming();
+        for (size_t i = 0; i < BATCH; ++i)
+            book.instrument(first + 2 * i).delete_order(first + 2 * i, side);
+        state.ResumeTiming();
+    }
+    set_counters(state);
+}
+
+void instrument_add_buy(benchmark::State & state)
+{
+    add_order(state, Side::BUY);
+}
+
+void instrument_add_sell(benchmark::State & state)
+{
+    add_order(state, Side::SELL);
+}
+
+// Accepted modifications flip resting orders between quantity 1 and 2, rejected ones ask for too much
+void instrument_modify_order(benchmark::State & state)
+{
+    auto book = Book(state);
+    uint64_t quantity = 2;
+    uint64_t next = 0;
+    for (auto _ : state) {
+        for (size_t i = 0; i < BATCH; ++i) {
+            auto id = next++ % book.resting;
+            auto new_quantity = book.rejected[i] ? static_cast<uint64_t>(REJECTED_QUANTITY) : quantity;
+            benchmark::DoNotOptimize(
+                book.instrument(id).try_modify_order(id, Book::side(id), new_quantity, book.limit, book.limit));
+            if (id + 1 == book.resting)
+                quantity = 3 - quantity;
+        }
+    }
+    set_counters(state);
+}
+
+// Accepted deletes remove resting orders, rejected ones name an unknown id
+void instrument_delete_order(benchmark::State & state)
+{
+    auto book = Book(state);
+    uint64_t next = 0;
+    std::vector<uint64_t> deleted;
+    for (auto _ : state) {
+        deleted.clear();
+        for (size_t i = 0; i < BATCH; ++i) {
+            auto id = book.rejected[i] ? book.resting + i : next++ % book.resting;
+            auto found = book.instrument(id).delete_order(id, Book::side(id));
+            benchmark::DoNotOptimize(found);
+            if (found)
+                deleted.push_back(id);
+        }
+        state.PauseTiming();
+        for (auto id : deleted)
+            book.add(id, 1);
+        state.ResumeTiming();
+    }
+    set_counters(state);
+}
+
+// Accepted trades match a resting order, after the first pass they replace the trade recorded with the same id.
+// Rejected ones match no order.
+void instrument_add_trade(benchmark::State & state)
+{
+    auto book = Book(state);
+    uint64_t next = 0;
+    for (auto _ : state) {
+        for (size_t i = 0; i < BATCH; ++i) {
+            auto id = book.rejected[i] ? book.resting + i : next++ % book.resting;
+            auto trade = FinancialInstrument::Order{id, 1, PRICE};
+            benchmark::DoNotOptimize(book.instrument(id).try_add_trade(trade, book.limit, book.limit));
+        }
+    }
+    set_counters(state);
+}
+} // unnamed namespace
+
+BENCHMARK(instrument_add_buy)->Apply(book_sizes);
+BENCHMARK(instrument_add_sell)->Apply(book_sizes);
+BENCHMARK(instrument_modify_order)->Apply(book_sizes);
+BENCHMARK(instrument_delete_order)->Apply(book_sizes);
+BENCHMARK(instrument_add_trade)->Apply(book_sizes);
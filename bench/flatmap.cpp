@@ -0,0 +1,72 @@
+#include "../server/financialintrument.hpp"
+
+#include <benchmark/benchmark.h>
+#include <unordered_map>
+
+// Compares FlatMap against the std::unordered_map it replaced as FinancialInstrument::OrderMap, each holding
+// state.range(0) resting orders.
+
+namespace
+{
+using Order = FinancialInstrument::Order;
+using NodeMap = std::unordered_map<uint64_t, Order>;
+using FlatOrderMap = FlatMap<Order>;
+
+template<typename Map>
+Map make_book(uint64_t resting)
+{
+    auto map = Map();
+    for (uint64_t id = 0; id < resting; ++id)
+        map.emplace(id, Order{id, 1, 100});
+    return map;
+}
+
+// Steady-state churn: cancel the oldest order and add a new one, keeping the book size constant.
+template<typename Map>
+void add_delete(benchmark::State & state)
+{
+    auto resting = static_cast<uint64_t>(state.range(0));
+    auto map = make_book<Map>(resting);
+    auto next_id = resting;
+    for (auto _ : state) {
+        map.erase(next_id - resting);
+        map.emplace(next_id, Order{next_id, 1, 100});
+        ++next_id;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+template<typename Map>
+void modify(benchmark::State & state)
+{
+    auto resting = static_cast<uint64_t>(state.range(0));
+    auto map = make_book<Map>(resting);
+    uint64_t id = 0;
+    for (auto _ : state) {
+        map.find(id)->second.quantity += 1;
+        id = (id + 7919) % resting;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+template<typename Map>
+void iterate(benchmark::State & state)
+{
+    auto map = make_book<Map>(static_cast<uint64_t>(state.range(0)));
+    for (auto _ : state) {
+        int64_t sum = 0;
+        for (const auto & it : map)
+            sum += it.second.quantity;
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+} // unnamed namespace
+
+#define ORDER_MAP_BENCHMARK(func) \
+    BENCHMARK_TEMPLATE(func, NodeMap)->Arg(1'000)->Arg(100'000)->Arg(1'000'000); \
+    BENCHMARK_TEMPLATE(func, FlatOrderMap)->Arg(1'000)->Arg(100'000)->Arg(1'000'000)
+
+ORDER_MAP_BENCHMARK(add_delete);
+ORDER_MAP_BENCHMARK(modify);
+ORDER_MAP_BENCHMARK(iterate);
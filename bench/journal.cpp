@@ -0,0 +1,30 @@
+#include "../encoder.hpp"
+#include "../server/journal.hpp"
+
+#include <benchmark/benchmark.h>
+#include <filesystem>
+
+// Cost of journaling one NewOrder frame on the appending thread, including the segment rotations and the group
+// commit wake-ups; the fdatasync calls themselves run on the flusher thread.
+
+namespace
+{
+void append(benchmark::State & state)
+{
+    char path[] = "/tmp/journal-bench-XXXXXX";
+    auto directory = std::string(mkdtemp(path));
+    {
+        auto options = JournalOptions{directory, 16 * 1024 * 1024, static_cast<size_t>(state.range(0))};
+        auto journal = Journal(options);
+        auto encoder = Encoder(1);
+        char frame[Encoder::MAX_FRAME_SIZE];
+        auto size = encoder.encode(frame, Messages::NewOrder{Messages::NewOrder::MESSAGE_TYPE, 1, 2, 3, 4, 'B'}, 0, 0);
+        for (auto _ : state)
+            journal.append(1, frame, size);
+        state.SetItemsProcessed(state.iterations());
+    }
+    std::filesystem::remove_all(directory);
+}
+} // unnamed namespace
+
+BENCHMARK(append)->Arg(64)->Arg(1024)->Arg(16384);
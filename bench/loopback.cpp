@@ -0,0 +1,180 @@
+#include "../client/client.hpp"
+#include "../encoder.hpp"
+#include "../parser.hpp"
+#include "../receivebuffer.hpp"
+#include "../sendbuffer.hpp"
+#include "../server/server.hpp"
+
+#include <benchmark/benchmark.h>
+#include <arpa/inet.h>
+#include <csignal>
+#include <cstdio>
+#include <memory>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Round trips through a real server over loopback TCP, with the epoll backend (io_uring=0) or the io_uring one
+// (io_uring=1). The server runs in a child process on the same host. Every connection has `window` messages in flight,
+// NewOrder/DeleteOrder pairs so that the books stay empty; one benchmark iteration sends a window on every connection
+// and waits for all the responses. window=1 measures the latency of a round trip, larger windows the throughput.
+//
+// client_round_trip sends one message at a time through a Client, over TCP (shared_memory=0) or over shared memory
+// (shared_memory=1), and waits for its response: the latency an application sees.
+//
+// Meaningful on a machine with a core each for the server and the benchmark.
+
+namespace
+{
+const uint16_t PROTOCOL_VERSION = 1;
+uint16_t next_port = 23400; // a port per server, none is reused while the previous one lingers in TIME_WAIT
+
+pid_t start_server(uint16_t port, bool io_uring)
+{
+    std::fflush(nullptr);
+    auto pid = fork();
+    if (pid == -1)
+        throw std::runtime_error("Could not start the server");
+    if (pid == 0) {
+        try {
+            auto options = ServerOptions{};
+            options.port = port;
+            options.io_uring = io_uring;
+            options.shared_memory = true;
+            auto server = Server(1'000'000, 1'000'000, options);
+            server.start();
+        }
+        catch (const std::exception & err) {
+            std::fprintf(stderr, "[ERR] %s\n", err.what());
+        }
+        _exit(1);
+    }
+    return pid;
+}
+
+int connect_to(uint16_t port)
+{
+    auto address = sockaddr_in{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    // The server may still be starting up
+    for (int attempt = 0; attempt < 500; ++attempt) {
+        auto fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0) {
+            auto nodelay = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+            return fd;
+        }
+        close(fd);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    throw std::runtime_error("Could not connect to the server");
+}
+
+struct Connection
+{
+    int fd;
+    ReceiveBuffer input;
+    SendBuffer output;
+    uint64_t next_order_id = 1;
+    uint32_t sequence_number = 0;
+};
+
+void loopback(benchmark::State & state)
+{
+    auto io_uring = state.range(0) != 0;
+    auto connection_count = static_cast<size_t>(state.range(1));
+    auto window = static_cast<size_t>(state.range(2));
+    auto port = next_port++;
+    auto server = start_server(port, io_uring);
+
+    auto encoder = Encoder(PROTOCOL_VERSION);
+    auto parser = Parser(PROTOCOL_VERSION);
+    auto connections = std::vector<Connection>();
+    for (size_t i = 0; i < connection_count; ++i)
+        connections.push_back(Connection{connect_to(port), ReceiveBuffer(), SendBuffer()});
+
+    for (auto _ : state) {
+        for (auto & connection : connections) {
+            for (size_t i = 0; i < window; ++i) {
+                auto order_id = connection.next_order_id + i / 2;
+                if (i % 2 == 0)
+                    encoder.encode(connection.output, Messages::NewOrder{Messages::NewOrder::MESSAGE_TYPE, 1,
+                                   order_id, 1, 100, 'B'}, connection.sequence_number++, 0);
+                else
+                    encoder.encode(connection.output, Messages::DeleteOrder{Messages::DeleteOrder::MESSAGE_TYPE,
+                                   order_id}, connection.sequence_number++, 0);
+            }
+            connection.next_order_id += (window + 1) / 2;
+            if (!connection.output.flush(connection.fd) || connection.output.pending() != 0)
+                state.SkipWithError("Could not send the window");
+        }
+        for (auto & connection : connections) {
+            size_t responses = 0;
+            while (responses < window) {
+                auto bytes = read(connection.fd, connection.input.write_data(), connection.input.write_space());
+                if (bytes <= 0) {
+                    state.SkipWithError("Lost the connection");
+                    break;
+                }
+                connection.input.commit(static_cast<size_t>(bytes));
+                auto batch = parser.decode_batch(connection.input.read_data(), connection.input.pending(),
+                    [&responses](const Messages::Header &, const auto &) { ++responses; });
+                connection.input.consume(connection.input.pending() - batch.remaining);
+            }
+        }
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * connection_count * window));
+
+    for (auto & connection : connections)
+        close(connection.fd);
+    kill(server, SIGKILL);
+    waitpid(server, nullptr, 0);
+}
+
+void client_round_trip(benchmark::State & state)
+{
+    auto transport = state.range(0) != 0 ? Client::Transport::SHARED_MEMORY : Client::Transport::TCP;
+    auto port = next_port++;
+    auto server = start_server(port, false);
+    close(connect_to(port)); // up and running
+
+    auto client = Client(1, "127.0.0.1", port, transport);
+    uint64_t order_id = 1;
+    auto answered = false;
+    auto on_response = [&answered](const Messages::OrderResponse &) { answered = true; };
+    for (auto _ : state) {
+        // Every other message deletes the order the previous one placed, the book stays empty
+        answered = false;
+        if (order_id % 2 == 1)
+            client.send(Messages::NewOrder{Messages::NewOrder::MESSAGE_TYPE, 1, order_id / 2, 1, 100, 'B'},
+                        on_response);
+        else
+            client.send(Messages::DeleteOrder{Messages::DeleteOrder::MESSAGE_TYPE, order_id / 2 - 1}, on_response);
+        ++order_id;
+        while (!answered)
+            client.wait(std::chrono::milliseconds(100));
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+
+    kill(server, SIGKILL);
+    waitpid(server, nullptr, 0);
+}
+} // unnamed namespace
+
+BENCHMARK(loopback)
+    ->ArgNames({"io_uring", "connections", "window"})
+    ->ArgsProduct({{0, 1}, {1, 16}, {1, 64}})
+    ->UseRealTime();
+
+BENCHMARK(client_round_trip)
+    ->ArgName("shared_memory")
+    ->Arg(0)
+    ->Arg(1)
+    ->UseRealTime();
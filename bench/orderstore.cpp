@@ -0,0 +1,128 @@
+#include "../server/orderstore.hpp"
+#include "booksizes.hpp"
+
+#include <benchmark/benchmark.h>
+#include <random>
+#include <vector>
+
+// OrderStore::consume per message type on a session that already holds state.range(0) resting orders over
+// state.range(1) listings, with state.range(2) percent of the messages rejected. Same set-up as the FinancialInstrument
+// benchmarks, here with the order index and the risk table on top.
+
+namespace
+{
+const size_t BATCH = 1024;
+const uint64_t REJECTED_QUANTITY = uint64_t{1} << 40; // beyond any limit
+const uint64_t PRICE = 100;
+
+struct Session
+{
+    std::vector<bool> rejected; // per message of a batch
+    uint64_t resting;
+    uint64_t listings;
+    OrderStore store;
+
+    explicit Session(const benchmark::State & state)
+        : resting(static_cast<uint64_t>(state.range(0)))
+        , listings(static_cast<uint64_t>(state.range(1)))
+        , store(static_cast<int>(resting / listings + BATCH + 1), static_cast<int>(resting / listings + BATCH + 1))
+    {
+        for (uint64_t id = 0; id < resting; ++id)
+            store.consume(new_order(id, 1));
+
+        auto random = std::mt19937(42);
+        auto percent = std::uniform_int_distribution<int64_t>(0, 99);
+        for (size_t i = 0; i < BATCH; ++i)
+            rejected.push_back(percent(random) < state.range(2));
+    }
+
+    // Even ids are buys, odd ones sells
+    Messages::NewOrder new_order(uint64_t id, uint64_t quantity) const
+    {
+        return {Messages::NewOrder::MESSAGE_TYPE, id % listings, id, quantity, PRICE, id % 2 == 0 ? 'B' : 'S'};
+    }
+};
+
+void set_counters(benchmark::State & state)
+{
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * BATCH));
+}
+
+void store_new_order(benchmark::State & state)
+{
+    auto session = Session(state);
+    for (auto _ : state) {
+        for (size_t i = 0; i < BATCH; ++i) {
+            auto quantity = session.rejected[i] ? REJECTED_QUANTITY : 1;
+            benchmark::DoNotOptimize(session.store.consume(session.new_order(session.resting + i, quantity)));
+        }
+        state.PauseTiming();
+        for (size_t i = 0; i < BATCH; ++i)
+            session.store.consume(Messages::DeleteOrder{Messages::DeleteOrder::MESSAGE_TYPE, session.resting + i});
+        state.ResumeTiming();
+    }
+    set_counters(state);
+}
+
+// Accepted deletes remove resting orders, rejected ones name an unknown id
+void store_delete_order(benchmark::State & state)
+{
+    auto session = Session(state);
+    uint64_t next = 0;
+    std::vector<uint64_t> deleted;
+    for (auto _ : state) {
+        deleted.clear();
+        for (size_t i = 0; i < BATCH; ++i) {
+            auto id = session.rejected[i] ? session.resting + i : next++ % session.resting;
+            auto response = session.store.consume(Messages::DeleteOrder{Messages::DeleteOrder::MESSAGE_TYPE, id});
+            benchmark::DoNotOptimize(response);
+            if (response.status == Messages::OrderResponse::Status::ACCEPTED)
+                deleted.push_back(id);
+        }
+        state.PauseTiming();
+        for (auto id : deleted)
+            session.store.consume(session.new_order(id, 1));
+        state.ResumeTiming();
+    }
+    set_counters(state);
+}
+
+// Accepted modifications flip resting orders between quantity 1 and 2, rejected ones ask for too much
+void store_modify_order(benchmark::State & state)
+{
+    auto session = Session(state);
+    uint64_t quantity = 2;
+    uint64_t next = 0;
+    for (auto _ : state) {
+        for (size_t i = 0; i < BATCH; ++i) {
+            auto id = next++ % session.resting;
+            auto modify = Messages::ModifyOrderQuantity{Messages::ModifyOrderQuantity::MESSAGE_TYPE, id,
+                                                        session.rejected[i] ? REJECTED_QUANTITY : quantity};
+            benchmark::DoNotOptimize(session.store.consume(modify));
+            if (id + 1 == session.resting)
+                quantity = 3 - quantity;
+        }
+    }
+    set_counters(state);
+}
+
+// Accepted trades match a resting order, rejected ones match no order
+void store_trade(benchmark::State & state)
+{
+    auto session = Session(state);
+    uint64_t next = 0;
+    for (auto _ : state) {
+        for (size_t i = 0; i < BATCH; ++i) {
+            auto id = session.rejected[i] ? session.resting + i : next++ % session.resting;
+            auto trade = Messages::Trade{Messages::Trade::MESSAGE_TYPE, id % session.listings, id, 1, PRICE};
+            benchmark::DoNotOptimize(session.store.consume(trade));
+        }
+    }
+    set_counters(state);
+}
+} // unnamed namespace
+
+BENCHMARK(store_new_order)->Apply(book_sizes);
+BENCHMARK(store_delete_order)->Apply(book_sizes);
+BENCHMARK(store_modify_order)->Apply(book_sizes);
+BENCHMARK(store_trade)->Apply(book_sizes);
@@ -0,0 +1,130 @@
+#include "../parser.hpp"
+#include "../server/orderstore.hpp"
+#include "booksizes.hpp"
+
+#include <benchmark/benchmark.h>
+#include <cstring>
+#include <random>
+#include <vector>
+
+// Compares decoding a frame into a Message and visiting it against dispatching the packed payload in place, one
+// frame at a time or a whole buffer at once, all feeding the same OrderStore. Orders alternate between being added and
+// deleted so the store keeps its size. The full-path benchmarks take the orders resting in the store, the listings
+// and the percentage of orders rejected for exceeding the limits as arguments.
+
+namespace
+{
+const uint64_t LISTINGS = 64;
+const uint64_t REJECTED_QUANTITY = uint64_t{1} << 40; // beyond any limit
+
+std::vector<char> make_frames(size_t count, uint64_t listings = LISTINGS, int64_t reject_percent = 0)
+{
+    auto random = std::mt19937(42);
+    auto percent = std::uniform_int_distribution<int64_t>(0, 99);
+    auto bytes = std::vector<char>();
+    for (uint64_t id = 0; id < count; ++id) {
+        auto header = Messages::Header{1, 0, static_cast<uint32_t>(id), 0};
+        auto quantity = percent(random) < reject_percent ? REJECTED_QUANTITY : 1;
+        auto add = Messages::NewOrder{Messages::NewOrder::MESSAGE_TYPE, id % listings, id, quantity, 100, 'B'};
+        auto remove = Messages::DeleteOrder{Messages::DeleteOrder::MESSAGE_TYPE, id};
+        for (auto [payload, size] :
+             { std::pair<const void *, uint16_t>{&add, sizeof(add)}, {&remove, sizeof(remove)} }) {
+            header.payloadSize = size;
+            auto offset = bytes.size();
+            bytes.resize(offset + sizeof(header) + size);
+            std::memcpy(bytes.data() + offset, &header, sizeof(header));
+            std::memcpy(bytes.data() + offset + sizeof(header), payload, size);
+        }
+    }
+    return bytes;
+}
+
+// A store holding state.range(0) resting orders over state.range(1) listings and frames rejected state.range(2)
+// percent of the time
+struct Workload
+{
+    std::vector<char> frames;
+    OrderStore store;
+
+    explicit Workload(const benchmark::State & state)
+        : frames(make_frames(1024, static_cast<uint64_t>(state.range(1)), state.range(2)))
+        , store(static_cast<int>(state.range(0) + 2), static_cast<int>(state.range(0) + 2))
+    {
+        auto listings = static_cast<uint64_t>(state.range(1));
+        for (uint64_t i = 0; i < static_cast<uint64_t>(state.range(0)); ++i) {
+            auto id = 1024 + i; // above the ids in the frames
+            store.consume(Messages::NewOrder{Messages::NewOrder::MESSAGE_TYPE, id % listings, id, 1, 100, 'S'});
+        }
+    }
+};
+
+template<typename Consume>
+void run(benchmark::State & state, Consume consume)
+{
+    auto workload = Workload(state);
+    auto & frames = workload.frames;
+    auto & store = workload.store;
+    auto parser = Parser(1);
+    for (auto _ : state) {
+        for (size_t offset = 0; offset < frames.size();) {
+            auto frame = frames.data() + offset;
+            benchmark::DoNotOptimize(consume(parser, store, frame));
+            uint16_t payload_size;
+            std::memcpy(&payload_size, frame + offsetof(Messages::Header, payloadSize), sizeof(payload_size));
+            offset += sizeof(Messages::Header) + payload_size;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * 2048);
+}
+
+void decode(benchmark::State & state)
+{
+    run(state, [](Parser & parser, OrderStore & store, const char * frame) {
+        return store.consume(parser.decode(frame));
+    });
+}
+
+void dispatch(benchmark::State & state)
+{
+    run(state, [](Parser & parser, OrderStore & store, const char * frame) {
+        return parser.dispatch(frame, [&](const Messages::Header &, const auto & payload) {
+            return store.consume(payload);
+        });
+    });
+}
+
+void decode_batch(benchmark::State & state)
+{
+    auto workload = Workload(state);
+    auto & store = workload.store;
+    auto parser = Parser(1);
+    for (auto _ : state) {
+        auto batch = parser.decode_batch(
+            workload.frames.data(), workload.frames.size(), [&](const Messages::Header &, const auto & payload) {
+                benchmark::DoNotOptimize(store.consume(payload));
+            });
+        benchmark::DoNotOptimize(batch);
+    }
+    state.SetItemsProcessed(state.iterations() * 2048);
+}
+
+// Framing and header checks alone, without the risk checks
+void decode_batch_only(benchmark::State & state)
+{
+    auto frames = make_frames(1024);
+    auto parser = Parser(1);
+    for (auto _ : state) {
+        auto batch = parser.decode_batch(
+            frames.data(), frames.size(), [](const Messages::Header &, const auto & payload) {
+                benchmark::DoNotOptimize(&payload);
+            });
+        benchmark::DoNotOptimize(batch);
+    }
+    state.SetItemsProcessed(state.iterations() * 2048);
+}
+} // unnamed namespace
+
+BENCHMARK(decode)->Apply(book_sizes);
+BENCHMARK(dispatch)->Apply(book_sizes);
+BENCHMARK(decode_batch)->Apply(book_sizes);
+BENCHMARK(decode_batch_only);
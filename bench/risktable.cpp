@@ -0,0 +1,37 @@
+#include "../server/risktable.hpp"
+
+#include <benchmark/benchmark.h>
+
+// Session-wide aggregates over state.range(0) listings.
+
+namespace
+{
+RiskTable make_table(int64_t listings)
+{
+    auto table = RiskTable();
+    for (int64_t listing = 0; listing < listings; ++listing) {
+        auto index = table.add(static_cast<uint64_t>(listing));
+        table.update(index, listing % 100, (listing * 7) % 100, listing % 13 - 6);
+    }
+    return table;
+}
+
+void total_buy_side(benchmark::State & state)
+{
+    auto table = make_table(state.range(0));
+    for (auto _ : state)
+        benchmark::DoNotOptimize(table.total_buy_side());
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void near_limit_scan(benchmark::State & state)
+{
+    auto table = make_table(state.range(0));
+    for (auto _ : state)
+        benchmark::DoNotOptimize(table.at_or_above(90, 90));
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+} // unnamed namespace
+
+BENCHMARK(total_buy_side)->Arg(1'000)->Arg(10'000)->Arg(100'000);
+BENCHMARK(near_limit_scan)->Arg(1'000)->Arg(10'000)->Arg(100'000);
@@ -1,45 +1,235 @@
 #include "client.hpp"
 
-#include <sys/socket.h>
 #include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <thread>
+#include <type_traits>
 #include <unistd.h>
-#include <vector>
-#include <iostream>
+#include <variant>
 
-Client::Client()
+Client::Client(size_t window, const std::string & host, uint16_t port, Transport transport)
+    : window_(window)
 {
-    server_socket_ = socket(AF_INET, SOCK_STREAM, 0);
+    if (window_ == 0)
+        throw std::runtime_error("The window must hold at least one message");
+    if (transport == Transport::SHARED_MEMORY)
+        connect_shm(port);
+    else
+        connect_tcp(host, port);
+}
+
+Client::~Client()
+{
+    close(server_socket_);
+    if (shm_) {
+        close(doorbell_);
+        close(server_doorbell_);
+    }
+}
+
+void Client::connect_tcp(const std::string & host, uint16_t port)
+{
+    server_socket_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
     if (server_socket_ == -1)
         throw std::runtime_error("Error creating client socket");
 
     struct sockaddr_in serv_addr{};
     serv_addr.sin_family = INTERNET_PROTOCOL;
-    serv_addr.sin_port = htons(PORT_NUMBER);
-    inet_pton(AF_INET, ADDRESS, &serv_addr.sin_addr);
+    serv_addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host.c_str(), &serv_addr.sin_addr) != 1) {
+        close(server_socket_);
+        throw std::runtime_error("Invalid server address " + host);
+    }
 
     auto sock_addr = reinterpret_cast<sockaddr*>(&serv_addr);
     auto sock_len = socklen_t{sizeof(serv_addr)};
     auto server_con = connect(server_socket_, sock_addr, sock_len);
-    if (server_con == -1)
+    if (server_con == -1) {
+        close(server_socket_);
         throw std::runtime_error("Could not connect to the server");
+    }
+
+    // Small frames go out as soon as process() writes them, and nothing after the connect blocks
+    int one = 1;
+    setsockopt(server_socket_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(server_socket_, F_SETFL, fcntl(server_socket_, F_GETFL) | O_NONBLOCK);
 }
 
-Client::~Client()
+void Client::connect_shm(uint16_t port)
 {
-    close(server_socket_);
+    static std::atomic<unsigned> sessions{0};
+    auto name = "/flow-" + std::to_string(getpid()) + "-" + std::to_string(sessions++);
+    shm_ = std::make_unique<ShmChannel>(name);
+    if (std::thread::hardware_concurrency() > 1)
+        shm_spin_ = SHM_SPIN;
+    doorbell_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (doorbell_ == -1)
+        throw std::runtime_error("Error creating client socket");
+    try {
+        server_socket_ = shm_->connect(port, doorbell_, server_doorbell_);
+    }
+    catch (...) {
+        close(doorbell_);
+        throw;
+    }
 }
 
-void Client::sendMessage(const Message & message)
+bool Client::send(const Message & message, ResponseCallback on_response)
 {
-    send(server_socket_, &message, sizeof(message), 0);
-    sleep(1);
+    return std::visit([&](const auto & payload) {
+        using Payload = std::decay_t<decltype(payload)>;
+        if constexpr (std::is_same_v<Payload, Messages::NewOrder> || std::is_same_v<Payload, Messages::DeleteOrder>
+                      || std::is_same_v<Payload, Messages::ModifyOrderQuantity>
+                      || std::is_same_v<Payload, Messages::Trade>)
+            return queue(payload, message.header.sequenceNumber, message.header.timestamp, on_response);
+        else
+            throw std::logic_error("Only orders and trades are answered with an OrderResponse");
+        return false;
+    }, message.payload);
+}
+
+void Client::request_session(SessionCallback on_session)
+{
+    resume(Messages::SessionRequest::CURRENT, 0, 0, std::move(on_session));
+}
 
-    char buffer[BUFFER_SIZE] = {};
-    read(server_socket_, buffer, BUFFER_SIZE);
-    auto msg = parser_.decode(buffer);
-    if (std::holds_alternative<Messages::OrderResponse>(msg.payload)) {
-        auto response = std::get<Messages::OrderResponse>(msg.payload);
-        auto status = response.status == Messages::OrderResponse::Status::ACCEPTED ? "ACCEPTED" : "REJECTED";
-        std::cout << "Status: " << status << " OrderId: " << response.orderId << "\n";
+void Client::resume(uint64_t session, uint64_t token, uint32_t next_sequence_number, SessionCallback on_session)
+{
+    auto request = Messages::SessionRequest{Messages::SessionRequest::MESSAGE_TYPE, session, token,
+                                            next_sequence_number};
+    encoder_.encode(output_, request, sequence_number_++, timestamp());
+    session_requests_.push_back(std::move(on_session));
+}
+
+size_t Client::process()
+{
+    if (shm_)
+        return process_shm();
+    if (output_.pending() != 0 && !output_.flush(server_socket_))
+        throw std::runtime_error("Connection to the server lost");
+
+    size_t delivered = 0;
+    while (true) {
+        auto bytes_received = read(server_socket_, input_.write_data(), input_.write_space());
+        if (bytes_received == -1 && errno == EINTR)
+            continue;
+        if (bytes_received == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return delivered;
+        if (bytes_received <= 0)
+            throw std::runtime_error("Connection to the server lost");
+        input_.commit(bytes_received);
+        input_.consume(input_.pending() - decode(input_.read_data(), input_.pending(), delivered));
+    }
+}
+
+size_t Client::process_shm()
+{
+    auto written = false;
+    while (output_.pending() != 0) {
+        auto bytes = output_.drain(shm_->write_data(), shm_->write_space());
+        if (bytes == 0)
+            break; // the ring is full until the server catches up
+        shm_->commit(bytes);
+        written = true;
+    }
+    if (written && shm_->peer_waiting()) {
+        uint64_t ring = 1;
+        [[maybe_unused]] auto bytes = write(server_doorbell_, &ring, sizeof(ring));
+    }
+
+    // Copied out of the ring before decoding, like the server does with the other ring
+    size_t delivered = 0;
+    while (auto bytes = shm_->read(input_.write_data(), input_.write_space())) {
+        input_.commit(bytes);
+        input_.consume(input_.pending() - decode(input_.read_data(), input_.pending(), delivered));
+    }
+    return delivered;
+}
+
+size_t Client::decode(const char * data, size_t size, size_t & delivered)
+{
+    auto batch = parser_.decode_batch(data, size, [&](const Messages::Header & header, const auto & payload) {
+        using Payload = std::decay_t<decltype(payload)>;
+        if constexpr (std::is_same_v<Payload, Messages::OrderResponse>) {
+            next_response_ = header.sequenceNumber + 1;
+            deliver(payload);
+            ++delivered;
+        }
+        else if constexpr (std::is_same_v<Payload, Messages::SessionResponse>) {
+            // Resent responses follow from the number given
+            if (payload.status == Messages::OrderResponse::Status::ACCEPTED)
+                next_response_ = payload.nextSequenceNumber;
+            if (!session_requests_.empty()) {
+                auto on_session = std::move(session_requests_.front());
+                session_requests_.pop_front();
+                if (on_session)
+                    on_session(payload);
+            }
+            ++delivered;
+        }
+        else if constexpr (std::is_same_v<Payload, Messages::DropCopy>) {
+            if (on_drop_copy_)
+                on_drop_copy_(header, payload);
+            ++delivered;
+        }
+    });
+    return batch.remaining;
+}
+
+size_t Client::wait(std::chrono::milliseconds timeout)
+{
+    if (shm_)
+        return wait_shm(timeout);
+    auto fd = pollfd{server_socket_, static_cast<short>(POLLIN | (want_write() ? POLLOUT : 0)), 0};
+    if (poll(&fd, 1, static_cast<int>(timeout.count())) == -1 && errno != EINTR)
+        throw std::runtime_error("Waiting for the server failed");
+    return process();
+}
+
+size_t Client::wait_shm(std::chrono::milliseconds timeout)
+{
+    auto spin_until = std::chrono::steady_clock::now() + std::min<std::chrono::microseconds>(shm_spin_, timeout);
+    auto delivered = process();
+    while (delivered == 0 && std::chrono::steady_clock::now() < spin_until)
+        delivered = process();
+    // Output the ring had no room for is retried by spinning, the server does not ring when it frees space
+    if (delivered != 0 || want_write())
+        return delivered;
+    if (!shm_->arm())
+        return process();
+
+    pollfd fds[] = {{doorbell_, POLLIN, 0}, {server_socket_, POLLRDHUP, 0}};
+    if (poll(fds, 2, static_cast<int>(timeout.count())) == -1 && errno != EINTR)
+        throw std::runtime_error("Waiting for the server failed");
+    shm_->disarm();
+    uint64_t rings;
+    [[maybe_unused]] auto bytes = read(doorbell_, &rings, sizeof(rings));
+    if (fds[1].revents & (POLLRDHUP | POLLHUP | POLLERR))
+        throw std::runtime_error("Connection to the server lost");
+    return process();
+}
+
+void Client::deliver(const Messages::OrderResponse & response)
+{
+    // Normally the oldest message, the search only covers a server answering out of order
+    auto pending = in_flight_.begin();
+    while (pending != in_flight_.end() && pending->order_id != response.orderId)
+        ++pending;
+    if (pending == in_flight_.end()) {
+        if (on_unmatched_)
+            on_unmatched_(response); // e.g. resent after resuming the session
+        return;
     }
+    auto on_response = std::move(pending->on_response);
+    in_flight_.erase(pending);
+    if (on_response)
+        on_response(response);
 }
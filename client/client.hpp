@@ -1,29 +1,155 @@
 #ifndef CLIENT_HPP
 #define CLIENT_HPP
 
+#include "../encoder.hpp"
 #include "../messages.hpp"
 #include "../parser.hpp"
+#include "../receivebuffer.hpp"
+#include "../sendbuffer.hpp"
+#include "../shmchannel.hpp"
+#include "../timestamp.hpp"
 
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
 #include <sys/socket.h>
 
+// Asynchronous session with the server. send() only queues the message, process() writes the queue and hands every
+// OrderResponse received to the callback of the message it answers, matched by order id (the trade id for a Trade).
+// At most `window` messages are unanswered at a time, send() refuses more instead of blocking.
+//
+// Meant to be driven from the caller's event loop: poll fd() for POLLIN, and for POLLOUT while want_write(), then call
+// process(). wait() does both for callers without a loop of their own. Not thread-safe, callbacks run inside process().
+//
+// Over shared memory (a server on the same host, see ShmChannel) there is no socket to poll: spin on process(), or
+// call wait(), which spins for a moment before sleeping on a doorbell the server rings. fd() is that doorbell, only
+// rung while wait() sleeps, and a lost server is only noticed by wait().
+//
+// A server keeping sessions past their connection lets a client that reconnects take its session back: learn the
+// session and its token with request_session() once connected and keep next_response(), then resume() on the new
+// connection before sending anything. The responses the old connection missed come again, to the on_unmatched()
+// callback as this client did not send what they answer.
+//
+// Connected to the drop-copy port of the server instead (see DropCopy), a client sends nothing and gets every risk
+// decision through the callback given to on_drop_copy().
 class Client
 {
 public:
-    Client();
+    using ResponseCallback = std::function<void(const Messages::OrderResponse & response)>;
+    using DropCopyCallback = std::function<void(const Messages::Header & header, const Messages::DropCopy & decision)>;
+    using SessionCallback = std::function<void(const Messages::SessionResponse & response)>;
+
+    enum class Transport
+    {
+        TCP,
+        SHARED_MEMORY, // `host` is ignored, `port` names the server
+    };
+
+    explicit Client(size_t window = DEFAULT_WINDOW, const std::string & host = ADDRESS, uint16_t port = PORT_NUMBER,
+                    Transport transport = Transport::TCP);
     ~Client();
-    void sendMessage(const Message & message);
+    Client(const Client &) = delete;
+    Client & operator=(const Client &) = delete;
+
+    // Queues the message, stamped with the next sequence number and the current time. Returns false, queuing
+    // nothing, while the window is full.
+    template<typename Payload>
+    bool send(const Payload & payload, ResponseCallback on_response);
+    // Same, keeping the sequence number and timestamp of the message.
+    bool send(const Message & message, ResponseCallback on_response);
+
+    // Writes what is queued and delivers the responses received so far, without blocking. Returns the number of
+    // responses delivered. Throws std::runtime_error once the connection is lost.
+    size_t process();
+    // Waits up to `timeout` for the socket (or the shared-memory ring) to become ready, then processes.
+    size_t wait(std::chrono::milliseconds timeout);
+
+    // Asks which session the connection has and its token, or with those and the sequence number of the first
+    // response not received, resumes it. The callback gets the answer, see Messages::SessionRequest. Not limited by
+    // the window.
+    void request_session(SessionCallback on_session);
+    void resume(uint64_t session, uint64_t token, uint32_t next_sequence_number, SessionCallback on_session);
+    // The sequence number of the next OrderResponse, to resume the session from.
+    uint32_t next_response() const { return next_response_; }
+    // Receives the OrderResponses that answer nothing sent through this client.
+    void on_unmatched(ResponseCallback on_response) { on_unmatched_ = std::move(on_response); }
+
+    // Receives the DropCopy frames from now on, each counting as a response delivered.
+    void on_drop_copy(DropCopyCallback on_decision) { on_drop_copy_ = std::move(on_decision); }
+
+    int fd() const { return shm_ ? doorbell_ : server_socket_; }
+    bool want_write() const { return output_.pending() != 0; }
+    size_t in_flight() const { return in_flight_.size(); }
+    size_t window() const { return window_; }
 
 private:
     static const uint16_t INTERNET_PROTOCOL = AF_INET; // IPv4
     inline static const char * ADDRESS = "127.0.0.1";
     static const uint16_t PORT_NUMBER = 1234;
     static const uint16_t PROTOCOL_VERSION = 1;
+    static const size_t DEFAULT_WINDOW = 1024;
+    static constexpr std::chrono::microseconds SHM_SPIN{50}; // wait() polls the ring this long before sleeping
 
-    static const uint16_t BUFFER_SIZE = 64;
+    struct Pending
+    {
+        uint64_t order_id;
+        ResponseCallback on_response;
+    };
+
+    static uint64_t order_id(const Messages::NewOrder & payload) { return payload.orderId; }
+    static uint64_t order_id(const Messages::DeleteOrder & payload) { return payload.orderId; }
+    static uint64_t order_id(const Messages::ModifyOrderQuantity & payload) { return payload.orderId; }
+    static uint64_t order_id(const Messages::Trade & payload) { return payload.tradeId; }
+
+    void connect_tcp(const std::string & host, uint16_t port);
+    void connect_shm(uint16_t port);
+    size_t process_shm();
+    size_t wait_shm(std::chrono::milliseconds timeout);
+    size_t decode(const char * data, size_t size, size_t & delivered);
+
+    template<typename Payload>
+    bool queue(const Payload & payload, uint32_t sequence_number, uint64_t timestamp, ResponseCallback & on_response);
+    void deliver(const Messages::OrderResponse & response);
 
     Parser parser_{PROTOCOL_VERSION};
+    Encoder encoder_{PROTOCOL_VERSION};
+    ReceiveBuffer input_;
+    SendBuffer output_;
+    std::deque<Pending> in_flight_; // oldest first, the server answers a session in order
+    DropCopyCallback on_drop_copy_;
+    std::deque<SessionCallback> session_requests_; // unanswered, oldest first
+    ResponseCallback on_unmatched_;
+    uint32_t next_response_ = 0;
+    size_t window_;
+    uint32_t sequence_number_ = 0;
 
-    int server_socket_ = -1;
+    int server_socket_ = -1; // over shared memory, the Unix socket the session was set up through
+    std::unique_ptr<ShmChannel> shm_;
+    std::chrono::microseconds shm_spin_{0}; // SHM_SPIN, none on a single core where it only delays the server
+    int doorbell_ = -1;        // rung by the server
+    int server_doorbell_ = -1; // rung for the server
 };
 
+template<typename Payload>
+bool Client::send(const Payload & payload, ResponseCallback on_response)
+{
+    if (!queue(payload, sequence_number_, timestamp(), on_response))
+        return false;
+    ++sequence_number_;
+    return true;
+}
+
+template<typename Payload>
+bool Client::queue(const Payload & payload, uint32_t sequence_number, uint64_t timestamp,
+                   ResponseCallback & on_response)
+{
+    if (in_flight_.size() >= window_)
+        return false;
+    encoder_.encode(output_, payload, sequence_number, timestamp);
+    in_flight_.push_back({order_id(payload), std::move(on_response)});
+    return true;
+}
+
 #endif // FLOW_CLIENT_HPP
@@ -0,0 +1,343 @@
+#include "loadgenerator.hpp"
+#include "../percentile.hpp"
+#include "../timestamp.hpp"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <iomanip>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdexcept>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <type_traits>
+#include <unistd.h>
+
+namespace
+{
+const int MAX_EVENTS = 256;
+const auto DRAIN_TIMEOUT = std::chrono::seconds(2); // for the last responses once sending has stopped
+
+const char * KIND_NAMES[] = {"NewOrder", "ModifyOrderQuantity", "DeleteOrder", "Trade"};
+} // unnamed namespace
+
+LoadGenerator::LoadGenerator(LoadOptions options)
+    : options_(std::move(options))
+{
+    if (options_.connections == 0 || options_.window == 0)
+        throw std::runtime_error("At least one connection and a window of one message are required");
+    if (options_.mix[0] + options_.mix[1] + options_.mix[2] + options_.mix[3] == 0 || options_.listings == 0)
+        throw std::runtime_error("The message mix and the listings must not be empty");
+    if (options_.open_loop && options_.rate <= 0)
+        throw std::runtime_error("Open-loop load needs a rate");
+    if (options_.rate > 0)
+        interval_ = std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(static_cast<double>(options_.connections) / options_.rate));
+    epoll_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_ == -1)
+        throw std::runtime_error("Could not create the event loop");
+}
+
+LoadGenerator::~LoadGenerator()
+{
+    for (auto & connection : connections_)
+        close(connection.fd);
+    close(epoll_);
+}
+
+void LoadGenerator::connect_all()
+{
+    auto address = sockaddr_in{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(options_.port);
+    if (inet_pton(AF_INET, options_.host.c_str(), &address.sin_addr) != 1)
+        throw std::runtime_error("Invalid server address " + options_.host);
+
+    connections_.resize(options_.connections);
+    for (size_t i = 0; i < connections_.size(); ++i) {
+        auto & connection = connections_[i];
+        connection.fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (connection.fd == -1)
+            throw std::runtime_error("Error creating client socket");
+        if (connect(connection.fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == -1)
+            throw std::runtime_error("Could not connect to the server");
+        int one = 1;
+        setsockopt(connection.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        // Non-blocking only once connected, responses are read from the event loop
+        if (fcntl(connection.fd, F_SETFL, fcntl(connection.fd, F_GETFL) | O_NONBLOCK) == -1)
+            throw std::runtime_error("Could not make a connection non-blocking");
+        auto event = epoll_event{};
+        event.events = EPOLLIN;
+        event.data.u64 = i;
+        if (epoll_ctl(epoll_, EPOLL_CTL_ADD, connection.fd, &event) == -1)
+            throw std::runtime_error("Could not watch a connection");
+        connection.resting.reserve(options_.max_resting);
+    }
+}
+
+void LoadGenerator::run()
+{
+    connect_all();
+    auto start = Clock::now();
+    auto stop = start + options_.duration;
+    auto count = static_cast<int64_t>(connections_.size());
+    for (int64_t i = 0; i < count; ++i)
+        connections_[i].next_send = start + interval_ * i / count; // spread out so they do not send in lockstep
+
+    epoll_event events[MAX_EVENTS];
+    while (true) {
+        auto now = Clock::now();
+        auto sending = now < stop;
+        auto outstanding = false;
+        for (auto & connection : connections_) {
+            send_due(connection, now, sending);
+            if (connection.output.pending() != 0 && !connection.output.flush(connection.fd))
+                throw std::runtime_error("Connection to the server lost");
+            outstanding = outstanding || !connection.in_flight.empty();
+        }
+        if (!sending && (!outstanding || now >= stop + DRAIN_TIMEOUT))
+            break;
+
+        // Sleep until the next message is due, or a response arrives. A full window that is never answered still
+        // wakes up when sending stops.
+        auto timeout = 10;
+        if (sending) {
+            auto next = stop;
+            if (options_.rate > 0) {
+                next = std::min(next, std::min_element(connections_.begin(), connections_.end(),
+                    [](const Connection & a, const Connection & b) { return a.next_send < b.next_send; })->next_send);
+            }
+            timeout = static_cast<int>(std::max<int64_t>(
+                0, std::chrono::duration_cast<std::chrono::milliseconds>(next - Clock::now()).count()));
+        }
+        auto ready = epoll_wait(epoll_, events, MAX_EVENTS, timeout);
+        if (ready == -1 && errno != EINTR)
+            throw std::runtime_error("Waiting for responses failed");
+        for (int i = 0; i < ready; ++i)
+            receive(connections_[events[i].data.u64]);
+    }
+    elapsed_ = std::min(Clock::now(), stop) - start;
+    for (const auto & connection : connections_)
+        unanswered_ += connection.in_flight.size();
+}
+
+void LoadGenerator::send_due(Connection & connection, Clock::time_point now, bool sending)
+{
+    if (!sending)
+        return;
+    if (options_.rate <= 0) {
+        while (connection.in_flight.size() < options_.window)
+            send_one(connection, now);
+        return;
+    }
+    while (connection.next_send <= now) {
+        if (options_.open_loop) {
+            send_one(connection, connection.next_send);
+        }
+        else if (connection.in_flight.size() < options_.window) {
+            send_one(connection, now);
+        }
+        else {
+            // Closed loop: the rate is only a cap, a slot missed for a full window is not made up for
+            connection.next_send = now + interval_;
+            return;
+        }
+        connection.next_send += interval_;
+    }
+}
+
+auto LoadGenerator::pick_kind(const Connection & connection) -> Kind
+{
+    if (connection.resting.size() >= options_.max_resting)
+        return Kind::DELETE;
+    auto total = options_.mix[0] + options_.mix[1] + options_.mix[2] + options_.mix[3];
+    auto draw = std::uniform_int_distribution<unsigned>(0, total - 1)(random_);
+    auto kind = Kind::NEW;
+    for (size_t i = 0; i < KINDS; ++i) {
+        if (draw < options_.mix[i]) {
+            kind = static_cast<Kind>(i);
+            break;
+        }
+        draw -= options_.mix[i];
+    }
+    // Only orders the server has accepted are modified, deleted or traded
+    return connection.resting.empty() ? Kind::NEW : kind;
+}
+
+auto LoadGenerator::take_resting(Connection & connection) -> Order
+{
+    // A random one, swapped out of the way until its response tells whether it still rests
+    auto index = std::uniform_int_distribution<size_t>(0, connection.resting.size() - 1)(random_);
+    auto order = connection.resting[index];
+    connection.resting[index] = connection.resting.back();
+    connection.resting.pop_back();
+    return order;
+}
+
+void LoadGenerator::send_one(Connection & connection, Clock::time_point sent)
+{
+    auto kind = pick_kind(connection);
+    auto in_flight = InFlight{kind, {}, 0, sent};
+    auto sequence_number = connection.sequence_number++;
+    switch (kind) {
+        case Kind::NEW: {
+            auto & order = in_flight.order;
+            order.id = connection.next_order_id++;
+            order.listing = std::uniform_int_distribution<uint64_t>(0, options_.listings - 1)(random_);
+            order.quantity = std::uniform_int_distribution<uint64_t>(1, 10)(random_);
+            order.price = std::uniform_int_distribution<uint64_t>(100, 110)(random_);
+            order.side = random_() % 2 == 0 ? 'B' : 'S';
+            auto payload = Messages::NewOrder{Messages::NewOrder::MESSAGE_TYPE, order.listing, order.id,
+                                              order.quantity, order.price, order.side};
+            encoder_.encode(connection.output, payload, sequence_number, timestamp());
+            break;
+        }
+        case Kind::MODIFY: {
+            in_flight.order = take_resting(connection);
+            in_flight.new_quantity = std::uniform_int_distribution<uint64_t>(1, 10)(random_);
+            auto payload = Messages::ModifyOrderQuantity{Messages::ModifyOrderQuantity::MESSAGE_TYPE,
+                                                         in_flight.order.id, in_flight.new_quantity};
+            encoder_.encode(connection.output, payload, sequence_number, timestamp());
+            break;
+        }
+        case Kind::DELETE: {
+            in_flight.order = take_resting(connection);
+            auto payload = Messages::DeleteOrder{Messages::DeleteOrder::MESSAGE_TYPE, in_flight.order.id};
+            encoder_.encode(connection.output, payload, sequence_number, timestamp());
+            break;
+        }
+        case Kind::TRADE: {
+            // Matches the resting order exactly, as the server requires
+            in_flight.order = take_resting(connection);
+            const auto & order = in_flight.order;
+            auto payload = Messages::Trade{Messages::Trade::MESSAGE_TYPE, order.listing, order.id, order.quantity,
+                                           order.price};
+            encoder_.encode(connection.output, payload, sequence_number, timestamp());
+            break;
+        }
+    }
+    connection.in_flight.push_back(in_flight);
+    ++sent_;
+}
+
+void LoadGenerator::receive(Connection & connection)
+{
+    auto & input = connection.input;
+    while (true) {
+        auto bytes_received = read(connection.fd, input.write_data(), input.write_space());
+        if (bytes_received == -1 && errno == EINTR)
+            continue;
+        if (bytes_received == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        if (bytes_received <= 0)
+            throw std::runtime_error("Connection to the server lost");
+        input.commit(bytes_received);
+
+        auto now = Clock::now();
+        auto batch = parser_.decode_batch(input.read_data(), input.pending(),
+            [&](const Messages::Header &, const auto & payload) {
+                if constexpr (std::is_same_v<std::decay_t<decltype(payload)>, Messages::OrderResponse>)
+                    on_response(connection, payload, now);
+            });
+        input.consume(input.pending() - batch.remaining);
+    }
+}
+
+void LoadGenerator::on_response(Connection & connection, const Messages::OrderResponse & response,
+                                Clock::time_point now)
+{
+    // Normally the oldest message, the search only covers a server answering out of order
+    auto match = std::find_if(connection.in_flight.begin(), connection.in_flight.end(),
+                              [&](const InFlight & in_flight) { return in_flight.order.id == response.orderId; });
+    if (match == connection.in_flight.end()) {
+        ++mismatched_;
+        return;
+    }
+    auto in_flight = *match;
+    connection.in_flight.erase(match);
+
+    auto accepted = response.status == Messages::OrderResponse::Status::ACCEPTED;
+    auto & stats = stats_[static_cast<size_t>(in_flight.kind)];
+    auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(now - in_flight.sent).count();
+    stats.latencies.push_back(static_cast<uint32_t>(std::min<int64_t>(latency, UINT32_MAX)));
+    ++(accepted ? stats.accepted : stats.rejected);
+    if (!accepted)
+        ++rejections_[static_cast<size_t>(response.reason) % REASONS];
+
+    // Put the order back where later messages can name it, unless it is gone
+    auto & order = in_flight.order;
+    switch (in_flight.kind) {
+        case Kind::NEW:
+            if (accepted)
+                connection.resting.push_back(order);
+            break;
+        case Kind::MODIFY:
+            if (accepted)
+                order.quantity = in_flight.new_quantity;
+            connection.resting.push_back(order);
+            break;
+        case Kind::DELETE:
+            if (!accepted)
+                connection.resting.push_back(order);
+            break;
+        case Kind::TRADE:
+            connection.resting.push_back(order);
+            break;
+    }
+}
+
+uint64_t LoadGenerator::answered() const
+{
+    uint64_t answered = 0;
+    for (const auto & stats : stats_)
+        answered += stats.latencies.size();
+    return answered;
+}
+
+void LoadGenerator::report(std::ostream & out) const
+{
+    auto seconds = std::chrono::duration<double>(elapsed_).count();
+    auto received = answered();
+    auto all = std::vector<uint32_t>{};
+    for (const auto & stats : stats_)
+        all.insert(all.end(), stats.latencies.begin(), stats.latencies.end());
+    out << "Sent " << sent_ << " messages over " << connections_.size() << " connection(s) in " << std::fixed
+        << std::setprecision(3) << seconds << " s (" << std::setprecision(0)
+        << (seconds > 0 ? static_cast<double>(sent_) / seconds : 0.0) << " msgs/s), " << received
+        << " answered, " << unanswered_ << " unanswered, " << mismatched_ << " unmatched response(s)\n\n";
+
+    out << std::left << std::setw(22) << "type" << std::right << std::setw(10) << "count" << std::setw(10)
+        << "accepted" << std::setw(10) << "rejected" << std::setw(10) << "p50 us" << std::setw(10) << "p90 us"
+        << std::setw(10) << "p99 us" << std::setw(11) << "p99.9 us" << std::setw(10) << "max us" << "\n";
+    auto row = [&](const char * name, std::vector<uint32_t> latencies, uint64_t accepted, uint64_t rejected) {
+        if (latencies.empty())
+            return;
+        std::sort(latencies.begin(), latencies.end());
+        out << std::left << std::setw(22) << name << std::right << std::setw(10) << latencies.size()
+            << std::setw(10) << accepted << std::setw(10) << rejected << std::setprecision(1);
+        for (auto fraction : {0.5, 0.9, 0.99, 0.999, 1.0})
+            out << std::setw(fraction == 0.999 ? 11 : 10) << percentile(latencies, fraction) / 1000.0;
+        out << "\n";
+    };
+    uint64_t accepted = 0;
+    uint64_t rejected = 0;
+    for (size_t kind = 0; kind < KINDS; ++kind) {
+        row(KIND_NAMES[kind], stats_[kind].latencies, stats_[kind].accepted, stats_[kind].rejected);
+        accepted += stats_[kind].accepted;
+        rejected += stats_[kind].rejected;
+    }
+    row("all", std::move(all), accepted, rejected);
+
+    if (rejected == 0)
+        return;
+    out << "\nRejected for";
+    for (size_t reason = 0; reason < REASONS; ++reason) {
+        if (rejections_[reason] != 0)
+            out << " " << Messages::reason_name(static_cast<Messages::OrderResponse::Reason>(reason)) << ": "
+                << rejections_[reason];
+    }
+    out << "\n";
+}
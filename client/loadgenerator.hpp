@@ -0,0 +1,143 @@
+#ifndef LOADGENERATOR_HPP
+#define LOADGENERATOR_HPP
+
+#include "../encoder.hpp"
+#include "../parser.hpp"
+#include "../receivebuffer.hpp"
+#include "../sendbuffer.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <ostream>
+#include <random>
+#include <string>
+#include <vector>
+
+struct LoadOptions
+{
+    std::string host = "127.0.0.1";
+    uint16_t port = 1234;
+    size_t connections = 1;
+
+    // Messages sent but not yet answered, per connection. Sending pauses while the window is full.
+    size_t window = 64;
+
+    // Messages per second over all connections, 0 sends whenever the window has room.
+    double rate = 0;
+
+    // Send on schedule whatever the window, latencies then count from the scheduled time so that a slow server is not
+    // hidden by sending less. Needs a rate.
+    bool open_loop = false;
+
+    std::chrono::seconds duration{10};
+
+    // Relative weights of NewOrder, ModifyOrderQuantity, DeleteOrder and Trade.
+    std::array<unsigned, 4> mix{70, 10, 15, 5};
+
+    uint64_t listings = 100;
+    size_t max_resting = 1000; // orders resting per connection, beyond that new orders turn into deletes
+};
+
+// Drives the server over many connections from a single thread and measures round trips. Modifies, deletes and trades
+// only name orders the server has accepted, so the traffic is realistic rather than mostly rejected. Every message is
+// answered by one OrderResponse, matched with the oldest unanswered message of its connection naming the same order id.
+// The responses of a session normally come back in order, so that is the first one.
+class LoadGenerator
+{
+public:
+    explicit LoadGenerator(LoadOptions options);
+    ~LoadGenerator();
+    LoadGenerator(const LoadGenerator &) = delete;
+    LoadGenerator & operator=(const LoadGenerator &) = delete;
+
+    void run();
+    void report(std::ostream & out) const;
+
+    // Totals of the run
+    uint64_t sent() const { return sent_; }
+    uint64_t answered() const;
+    uint64_t unmatched() const { return mismatched_; }
+    uint64_t unanswered() const { return unanswered_; }
+    uint64_t rejected(Messages::OrderResponse::Reason reason) const
+    {
+        return rejections_[static_cast<size_t>(reason) % REASONS];
+    }
+
+private:
+    static const uint16_t PROTOCOL_VERSION = 1;
+    static const size_t RECEIVE_BUFFER_SIZE = 64 * 1024;
+    using Clock = std::chrono::steady_clock;
+
+    enum class Kind
+    {
+        NEW,
+        MODIFY,
+        DELETE,
+        TRADE,
+    };
+    static constexpr size_t KINDS = 4;
+    static constexpr size_t REASONS = 4; // of Messages::OrderResponse::Reason
+
+    struct Order
+    {
+        uint64_t id;
+        uint64_t listing;
+        uint64_t quantity;
+        uint64_t price;
+        char side;
+    };
+
+    struct InFlight
+    {
+        Kind kind;
+        Order order;           // as it rests, or is to rest for a NewOrder
+        uint64_t new_quantity; // for a ModifyOrderQuantity
+        Clock::time_point sent;
+    };
+
+    struct Connection
+    {
+        int fd = -1;
+        ReceiveBuffer input{RECEIVE_BUFFER_SIZE};
+        SendBuffer output;
+        std::deque<InFlight> in_flight;
+        std::vector<Order> resting; // accepted and not named by a message in flight
+        uint64_t next_order_id = 1;
+        uint32_t sequence_number = 0;
+        Clock::time_point next_send;
+    };
+
+    struct KindStats
+    {
+        std::vector<uint32_t> latencies; // round trips in nanoseconds
+        uint64_t accepted = 0;
+        uint64_t rejected = 0;
+    };
+
+    void connect_all();
+    void send_due(Connection & connection, Clock::time_point now, bool sending);
+    void send_one(Connection & connection, Clock::time_point sent);
+    void receive(Connection & connection);
+    void on_response(Connection & connection, const Messages::OrderResponse & response, Clock::time_point now);
+    Kind pick_kind(const Connection & connection);
+    Order take_resting(Connection & connection);
+
+    LoadOptions options_;
+    Parser parser_{PROTOCOL_VERSION};
+    Encoder encoder_{PROTOCOL_VERSION};
+    std::vector<Connection> connections_;
+    int epoll_ = -1;
+    Clock::duration interval_{}; // between two messages of a connection when there is a rate
+    std::mt19937_64 random_{42};
+
+    std::array<KindStats, KINDS> stats_;
+    std::array<uint64_t, REASONS> rejections_{}; // by reason
+    uint64_t sent_ = 0;
+    uint64_t mismatched_ = 0;
+    uint64_t unanswered_ = 0;
+    Clock::duration elapsed_{};
+};
+
+#endif //LOADGENERATOR_HPP
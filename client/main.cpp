@@ -1,33 +1,208 @@
 #include "client.hpp"
+#include "loadgenerator.hpp"
 
 #include <chrono>
+#include <cstring>
 #include <iostream>
-#include <unistd.h>
+#include <sstream>
 
-int main()
+namespace
+{
+void usage()
+{
+    std::cerr << "Usage: client [--connections N] [--window N] [--rate MSGS_PER_S] [--open-loop] [--duration S]\n"
+                 "              [--mix NEW:MODIFY:DELETE:TRADE] [--listings N] [--host ADDRESS] [--port PORT]\n"
+                 "       client --interactive [--shm] [--resume SESSION:TOKEN:NEXT] [--host ADDRESS] [--port PORT]\n"
+                 "       client --drop-copy [--shm] [--host ADDRESS] [--port DROP_COPY_PORT]\n";
+}
+
+std::array<unsigned, 4> parse_mix(const std::string & text)
+{
+    auto mix = std::array<unsigned, 4>{};
+    auto in = std::istringstream(text);
+    auto part = std::string{};
+    for (auto & weight : mix) {
+        if (!std::getline(in, part, ':'))
+            throw std::runtime_error("The mix needs four weights, e.g. 70:10:15:5");
+        weight = static_cast<unsigned>(std::stoul(part));
+    }
+    return mix;
+}
+
+struct Resume
+{
+    uint64_t session;
+    uint64_t token;
+    uint32_t next;
+};
+
+// Session to resume, as SESSION:TOKEN:NEXT with NEXT the sequence number of the first response not received
+Resume parse_resume(const std::string & text)
+{
+    auto first = text.find(':');
+    auto second = first == std::string::npos ? first : text.find(':', first + 1);
+    if (second == std::string::npos)
+        throw std::runtime_error("Resume a session as SESSION:TOKEN:NEXT, e.g. 3:9141525826409867839:120");
+    return {std::stoull(text.substr(0, first)), std::stoull(text.substr(first + 1, second - first - 1)),
+            static_cast<uint32_t>(std::stoul(text.substr(second + 1)))};
+}
+
+// Sends one NewOrder per key press and prints the response, over TCP or shared memory. Prints where to resume the
+// session from after a reconnect, with --resume, which gets the responses the previous connection missed again.
+void interactive(const LoadOptions & options, Client::Transport transport, const std::string & resume)
+{
+    auto client = Client(1, options.host, options.port, transport);
+    auto session = uint64_t{0};
+    auto token = uint64_t{0};
+    auto known = false;
+    auto print = [&](const Messages::OrderResponse & response) {
+        auto status = response.status == Messages::OrderResponse::Status::ACCEPTED ? "ACCEPTED" : "REJECTED";
+        std::cout << "Status: " << status;
+        if (response.reason != Messages::OrderResponse::Reason::NONE)
+            std::cout << " (" << Messages::reason_name(response.reason) << ")";
+        std::cout << " OrderId: " << response.orderId << " (resume with " << session << ":" << token << ":"
+                  << client.next_response() << ")\n";
+    };
+    auto answer = Messages::SessionResponse{};
+    auto on_session = [&](const Messages::SessionResponse & response) {
+        // Printed ahead of the responses resent after it
+        answer = response;
+        known = true;
+        session = response.session;
+        token = response.token;
+        if (response.status == Messages::OrderResponse::Status::ACCEPTED)
+            std::cout << "Session: " << session << " Token: " << token << " Next response: "
+                      << response.nextSequenceNumber << "\n";
+    };
+    client.on_unmatched(print);
+    if (resume.empty()) {
+        client.request_session(on_session);
+    }
+    else {
+        auto resumed = parse_resume(resume);
+        client.resume(resumed.session, resumed.token, resumed.next, on_session);
+    }
+    while (!known)
+        client.wait(std::chrono::milliseconds(100));
+    if (answer.status != Messages::OrderResponse::Status::ACCEPTED)
+        throw std::runtime_error("The server refused to resume session " + std::to_string(answer.session));
+
+    uint64_t order_id = 1;
+    while (true) {
+        std::string input;
+        std::cout << "\nPress any key to send.. ";
+        if (!(std::cin >> input))
+            return;
+        auto answered = false;
+        client.send(Messages::NewOrder{Messages::NewOrder::MESSAGE_TYPE, 1, order_id++, 7, 3, 'B'},
+                    [&](const Messages::OrderResponse & response) {
+                        print(response);
+                        answered = true;
+                    });
+        while (!answered)
+            client.wait(std::chrono::milliseconds(100));
+    }
+}
+
+// Prints every risk decision published on the drop-copy feed
+void drop_copy(const LoadOptions & options, Client::Transport transport)
+{
+    auto client = Client(1, options.host, options.port, transport);
+    auto expected = uint32_t{0};
+    client.on_drop_copy([&](const Messages::Header & header, const Messages::DropCopy & decision) {
+        if (header.sequenceNumber != expected)
+            std::cout << "Gap: " << header.sequenceNumber - expected << " decision(s) missed or conflated\n";
+        expected = header.sequenceNumber + 1;
+        auto status = decision.status == Messages::OrderResponse::Status::ACCEPTED ? "ACCEPTED" : "REJECTED";
+        std::cout << "#" << header.sequenceNumber << " Session: " << decision.session
+                  << " Type: " << static_cast<unsigned>(decision.decidedType) << " OrderId: " << decision.orderId
+                  << " Status: " << status << " Reason: " << Messages::reason_name(decision.reason)
+                  << " ListingId: " << decision.listingId << " Buy: " << decision.buySide
+                  << " Sell: " << decision.sellSide << " NetPos: " << decision.netPos << "\n";
+    });
+    while (true)
+        client.wait(std::chrono::milliseconds(100));
+}
+} // unnamed namespace
+
+int main(int argc, char * argv[])
 {
-    using namespace std::chrono;
     try {
-        auto client = Client();
-        sleep(1);
-
-        while (true) {
-            std::string input;
-            std::cout << "\nPress any key to resend.. ";
-            std::cin >> input;
-            auto ts = duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count();
-            auto hdr = Messages::Header{1, 35, static_cast<uint32_t>(1), static_cast<uint64_t>(ts)};
-            auto pld = Messages::NewOrder{Messages::NewOrder::MESSAGE_TYPE, 1, static_cast<uint32_t>(1), 7, 3, 'B'};
-            auto msg = Message{hdr, pld};
-            client.sendMessage(msg);
-            sleep(1);
+        auto options = LoadOptions{};
+        auto interactive_session = false;
+        auto drop_copy_session = false;
+        auto resume = std::string{};
+        auto transport = Client::Transport::TCP;
+        for (int i = 1; i < argc; ++i) {
+            auto has_value = i + 1 < argc;
+            if (std::strcmp(argv[i], "--interactive") == 0) {
+                interactive_session = true;
+            }
+            else if (std::strcmp(argv[i], "--drop-copy") == 0) {
+                drop_copy_session = true;
+            }
+            else if (std::strcmp(argv[i], "--resume") == 0 && has_value) {
+                resume = argv[++i];
+            }
+            else if (std::strcmp(argv[i], "--shm") == 0) {
+                transport = Client::Transport::SHARED_MEMORY;
+            }
+            else if (std::strcmp(argv[i], "--connections") == 0 && has_value) {
+                options.connections = std::stoul(argv[++i]);
+            }
+            else if (std::strcmp(argv[i], "--window") == 0 && has_value) {
+                options.window = std::stoul(argv[++i]);
+            }
+            else if (std::strcmp(argv[i], "--rate") == 0 && has_value) {
+                options.rate = std::stod(argv[++i]);
+            }
+            else if (std::strcmp(argv[i], "--open-loop") == 0) {
+                options.open_loop = true;
+            }
+            else if (std::strcmp(argv[i], "--duration") == 0 && has_value) {
+                options.duration = std::chrono::seconds(std::stoul(argv[++i]));
+            }
+            else if (std::strcmp(argv[i], "--mix") == 0 && has_value) {
+                options.mix = parse_mix(argv[++i]);
+            }
+            else if (std::strcmp(argv[i], "--listings") == 0 && has_value) {
+                options.listings = std::stoull(argv[++i]);
+            }
+            else if (std::strcmp(argv[i], "--host") == 0 && has_value) {
+                options.host = argv[++i];
+            }
+            else if (std::strcmp(argv[i], "--port") == 0 && has_value) {
+                options.port = static_cast<uint16_t>(std::stoul(argv[++i]));
+            }
+            else {
+                usage();
+                return 1;
+            }
+        }
+
+        if (drop_copy_session) {
+            drop_copy(options, transport);
+            return 0;
+        }
+        if (interactive_session) {
+            interactive(options, transport, resume);
+            return 0;
+        }
+        if (transport != Client::Transport::TCP) {
+            usage(); // the load generator drives its own TCP connections
+            return 1;
         }
+        auto generator = LoadGenerator(options);
+        generator.run();
+        generator.report(std::cout);
     }
-    catch(const std::runtime_error & err) {
+    catch(const std::exception & err) {
         std::cerr << "[ERR] " << err.what() << "\n";
+        return 1;
     }
     catch(...) {
         std::cerr << "[ERR] Unknown error, exiting..\n";
+        return 1;
     }
     return 0;
-}
\ No newline at end of file
+}
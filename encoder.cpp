@@ -0,0 +1,15 @@
+#include "encoder.hpp"
+
+#include <variant>
+
+Encoder::Encoder(uint16_t protocol_version)
+    : protocol_version_(protocol_version)
+{
+}
+
+size_t Encoder::encode(char * buffer, const Message & message) const
+{
+    return std::visit([&](const auto & payload) {
+        return encode(buffer, payload, message.header.sequenceNumber, message.header.timestamp);
+    }, message.payload);
+}
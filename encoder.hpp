@@ -0,0 +1,56 @@
+#ifndef ENCODER_HPP
+#define ENCODER_HPP
+
+#include "messages.hpp"
+#include "sendbuffer.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+// The mirror of Parser: writes wire frames, i.e. the packed Header followed by the packed payload struct, at their
+// exact size. payloadSize is taken from the size of the payload struct. Nothing is allocated, frames go into a buffer
+// provided by the caller or straight into a connection's SendBuffer.
+class Encoder
+{
+public:
+    Encoder(uint16_t protocol_version);
+
+    template<typename Payload>
+    static constexpr size_t frame_size() { return sizeof(Messages::Header) + sizeof(Payload); }
+
+    // Enough room for a frame of any message type.
+    static constexpr size_t MAX_FRAME_SIZE = sizeof(Messages::Header) + std::max({sizeof(Messages::NewOrder),
+        sizeof(Messages::DeleteOrder), sizeof(Messages::ModifyOrderQuantity), sizeof(Messages::Trade),
+        sizeof(Messages::OrderResponse), sizeof(Messages::StatsRequest), sizeof(Messages::StatsResponse),
+        sizeof(Messages::DropCopy), sizeof(Messages::SessionRequest), sizeof(Messages::SessionResponse)});
+
+    // Writes the frame to `buffer`, which must hold frame_size<Payload>() bytes. Returns the bytes written.
+    template<typename Payload>
+    size_t encode(char * buffer, const Payload & payload, uint32_t sequence_number, uint64_t timestamp) const;
+
+    // Appends the frame to the connection's send queue. Returns the bytes written.
+    template<typename Payload>
+    size_t encode(SendBuffer & output, const Payload & payload, uint32_t sequence_number, uint64_t timestamp) const
+    {
+        return encode(output.append(frame_size<Payload>()), payload, sequence_number, timestamp);
+    }
+
+    // Writes the frame for a Message, keeping its sequence number and timestamp. `buffer` must hold MAX_FRAME_SIZE
+    // bytes. Returns the bytes written.
+    size_t encode(char * buffer, const Message & message) const;
+
+private:
+    uint16_t protocol_version_;
+};
+
+template<typename Payload>
+size_t Encoder::encode(char * buffer, const Payload & payload, uint32_t sequence_number, uint64_t timestamp) const
+{
+    auto header = Messages::Header{protocol_version_, sizeof(Payload), sequence_number, timestamp};
+    std::memcpy(buffer, &header, sizeof(header));
+    std::memcpy(buffer + sizeof(header), &payload, sizeof(payload));
+    return frame_size<Payload>();
+}
+
+#endif //ENCODER_HPP
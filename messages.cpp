@@ -1 +1,21 @@
 #include "messages.hpp"
+
+namespace Messages
+{
+
+const char * reason_name(OrderResponse::Reason reason)
+{
+    switch (reason) {
+        case OrderResponse::Reason::NONE:
+            return "none";
+        case OrderResponse::Reason::SESSION_LIMIT:
+            return "session limit";
+        case OrderResponse::Reason::FIRM_LIMIT:
+            return "firm limit";
+        case OrderResponse::Reason::INVALID:
+            return "invalid";
+    }
+    return "unknown";
+}
+
+}
@@ -64,14 +64,116 @@ struct OrderResponse
         ACCEPTED = 0,
         REJECTED = 1,
     };
+    // Why an order was rejected, NONE when it was accepted
+    enum class Reason : uint16_t
+    {
+        NONE = 0,
+        SESSION_LIMIT = 1, // the order would breach the session's max buy or sell
+        FIRM_LIMIT = 2,    // the order fits the session but would breach the firm-wide limit
+        INVALID = 3,       // unknown order id, unmatched trade, etc.
+    };
     uint16_t messageType;
     uint64_t orderId;
     Status status;
+    Reason reason;
+} __attribute__ ((__packed__));
+static_assert(sizeof(OrderResponse) == 14, "The OrderResponse size is not correct");
+
+// "none", "session limit", "firm limit" or "invalid", for reports
+const char * reason_name(OrderResponse::Reason reason);
+
+// Asks the server for the latency statistics of the session and of every message type.
+struct StatsRequest
+{
+    static constexpr uint16_t MESSAGE_TYPE = 6;
+    uint16_t messageType;
+} __attribute__ ((__packed__));
+static_assert(sizeof(StatsRequest) == 2, "The StatsRequest size is not correct");
+
+// One answer to a StatsRequest per subject and stage: how long the server held the messages between two points, in
+// nanoseconds. The subject is a message type, or 0 for the requesting session.
+struct StatsResponse
+{
+    static constexpr uint16_t MESSAGE_TYPE = 7;
+    enum class Stage : uint16_t
+    {
+        READ_TO_DECODE = 0,
+        DECODE_TO_CONSUME = 1,
+        CONSUME_TO_SEND = 2,
+    };
+    uint16_t messageType;
+    uint16_t subject;
+    Stage stage;
+    uint64_t count;
+    uint64_t interval; // nanoseconds over which `count` messages were seen, for the throughput
+    uint64_t p50;
+    uint64_t p99;
+    uint64_t p999;
+    uint64_t max;
+} __attribute__ ((__packed__));
+static_assert(sizeof(StatsResponse) == 54, "The StatsResponse size is not correct");
+
+// Published on the server's drop-copy feed for every risk decision: the message decided on, the decision, and the
+// exposure of the listing concerned once the decision took effect. The frame's own header carries the sequence number
+// of the feed, a gap in it means decisions were conflated away or lost.
+struct DropCopy
+{
+    static constexpr uint16_t MESSAGE_TYPE = 8;
+    uint16_t messageType;
+    uint64_t session;
+    uint16_t decidedType;    // NewOrder, DeleteOrder, ModifyOrderQuantity or Trade
+    uint32_t sequenceNumber; // from the header of the message decided on
+    uint64_t timestamp;      // from the header of the message decided on
+    uint64_t orderId;        // the trade id for a Trade
+    uint64_t quantity;       // the new quantity for a ModifyOrderQuantity, 0 for a DeleteOrder
+    uint64_t price;          // 0 for a DeleteOrder or ModifyOrderQuantity
+    char side;               // of a NewOrder, 0 otherwise
+    OrderResponse::Status status;
+    OrderResponse::Reason reason;
+    uint64_t listingId;      // 0 when the message named no known listing, e.g. deleting an unknown order
+    int64_t buySide;
+    int64_t sellSide;
+    int64_t netPos;
+} __attribute__ ((__packed__));
+static_assert(sizeof(DropCopy) == 85, "The DropCopy size is not correct");
+
+// Sessions outlive their connection for a while when the server is configured to keep them. The OrderResponses of a
+// session are numbered in their header from 0, across connections, and the server keeps the latest ones. A client
+// that reconnects sends this before any order to take its session back, with the number of the first response it
+// did not get, and receives the responses from there on again after the SessionResponse. Other responses repeat the
+// number of the next OrderResponse.
+//
+// With CURRENT as the session it only asks which session the connection has, to resume it later. Resuming takes the
+// token the server gave out with the session, which cannot be guessed from the session id.
+struct SessionRequest
+{
+    static constexpr uint16_t MESSAGE_TYPE = 9;
+    static constexpr uint64_t CURRENT = UINT64_MAX;
+    uint16_t messageType;
+    uint64_t session;
+    uint64_t token;
+    uint32_t nextSequenceNumber;
+} __attribute__ ((__packed__));
+static_assert(sizeof(SessionRequest) == 22, "The SessionRequest size is not correct");
+
+// The session of the connection from now on and its token, rejected (with a token of 0) when the session is unknown,
+// expired, still connected, the token is wrong, or the connection has sent orders already. The resent responses
+// start at `nextSequenceNumber`, later than asked for when the older ones are no longer kept.
+struct SessionResponse
+{
+    static constexpr uint16_t MESSAGE_TYPE = 10;
+    uint16_t messageType;
+    uint64_t session;
+    uint64_t token;
+    uint32_t nextSequenceNumber;
+    OrderResponse::Status status;
 } __attribute__ ((__packed__));
-static_assert(sizeof(OrderResponse) == 12, "The OrderResponse size is not correct");
+static_assert(sizeof(SessionResponse) == 24, "The SessionResponse size is not correct");
 
 using Payload = std::variant<Messages::NewOrder, Messages::DeleteOrder,Messages::Trade,
-                             Messages::ModifyOrderQuantity, Messages::OrderResponse>;
+                             Messages::ModifyOrderQuantity, Messages::OrderResponse, Messages::StatsRequest,
+                             Messages::StatsResponse, Messages::DropCopy, Messages::SessionRequest,
+                             Messages::SessionResponse>;
 }
 
 struct Message
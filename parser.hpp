@@ -3,15 +3,167 @@
 
 #include "messages.hpp"
 
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+
 class Parser
 {
 public:
     Parser(uint16_t protocol_version);
+
+    // Copies the frame at `data` into a Message. Throws std::runtime_error if the frame is not valid.
     Message decode(const char * data);
 
+    // Checks the frame at `data` where it is and calls handler(header, payload) with references to the packed structs
+    // inside the buffer, so nothing is copied. The payload type comes from a table of message types built at compile
+    // time. Every overload of the handler must return the same type. Throws std::runtime_error if the frame is not
+    // valid.
+    template<typename Handler>
+    auto dispatch(const char * data, Handler && handler) const;
+
+    struct Batch
+    {
+        size_t messages;  // complete frames consumed, including the invalid ones
+        size_t invalid;   // frames skipped for a bad version, message type or payload size
+        size_t remaining; // bytes of a trailing partial frame, left for the caller to keep
+    };
+
+    // Dispatches every complete frame in `size` bytes of back-to-back frames, as dispatch() would, skipping the
+    // invalid ones instead of throwing. Frames are handled in blocks: the boundaries are found first, then the headers
+    // of the whole block are checked in one branch-free loop, and only a block that fails it is checked frame by
+    // frame. Throws std::runtime_error if a frame is too short to hold a message type, as the stream cannot be
+    // resynchronised. The handler must not throw, or the position in the stream is lost.
+    template<typename Handler>
+    Batch decode_batch(const char * data, size_t size, Handler && handler) const;
+
 private:
+    static const size_t BATCH_BLOCK = 64;
+
+    bool valid(const char * data) const;
+    template<typename Handler>
+    static auto call(const char * data, Handler & handler);
+
     uint16_t protocol_version_;
 };
 
+namespace ParserTable
+{
+// Every payload type the protocol defines, the table below is indexed by their MESSAGE_TYPE
+using Payloads = std::tuple<Messages::NewOrder, Messages::DeleteOrder, Messages::ModifyOrderQuantity,
+                            Messages::Trade, Messages::OrderResponse, Messages::StatsRequest,
+                            Messages::StatsResponse, Messages::DropCopy, Messages::SessionRequest,
+                            Messages::SessionResponse>;
+constexpr size_t SIZE = 16; // a power of two above the largest MESSAGE_TYPE
+
+template<typename... Ts>
+constexpr std::array<uint16_t, SIZE> payload_sizes(std::tuple<Ts...> *)
+{
+    auto sizes = std::array<uint16_t, SIZE>{}; // zero for unknown types
+    ((sizes[Ts::MESSAGE_TYPE] = sizeof(Ts)), ...);
+    return sizes;
+}
+constexpr auto PAYLOAD_SIZES = payload_sizes(static_cast<Payloads *>(nullptr));
+
+// The packed structs have an alignment of 1, so they can be viewed anywhere in the receive buffer
+template<typename Result, typename Handler, typename Payload>
+Result invoke(Handler & handler, const Messages::Header & header, const char * payload)
+{
+    return handler(header, *reinterpret_cast<const Payload *>(payload));
+}
+
+template<typename Handler, typename... Ts>
+constexpr auto handlers(std::tuple<Ts...> *)
+{
+    using Result = std::invoke_result_t<Handler &, const Messages::Header &, const std::tuple_element_t<0, Payloads> &>;
+    using Entry = Result (*)(Handler &, const Messages::Header &, const char *);
+    auto table = std::array<Entry, SIZE>{};
+    ((table[Ts::MESSAGE_TYPE] = &invoke<Result, Handler, Ts>), ...);
+    return table;
+}
+} // namespace ParserTable
+
+inline bool Parser::valid(const char * data) const
+{
+    // Branch-free so that checking a block of headers compiles down to a tight loop
+    Messages::Header header;
+    uint16_t message_type;
+    std::memcpy(&header, data, sizeof(header));
+    std::memcpy(&message_type, data + sizeof(header), sizeof(message_type));
+    auto expected_size = ParserTable::PAYLOAD_SIZES[message_type & (ParserTable::SIZE - 1)];
+    return (header.version == protocol_version_) & (message_type < ParserTable::SIZE) & (expected_size != 0)
+         & (header.payloadSize == expected_size);
+}
+
+template<typename Handler>
+auto Parser::call(const char * data, Handler & handler)
+{
+    static constexpr auto HANDLERS = ParserTable::handlers<Handler>(static_cast<ParserTable::Payloads *>(nullptr));
+    uint16_t message_type;
+    std::memcpy(&message_type, data + sizeof(Messages::Header), sizeof(message_type));
+    const auto & header = *reinterpret_cast<const Messages::Header *>(data);
+    // valid() checked the type, the mask keeps the index inside the table whatever the caller passes
+    return HANDLERS[message_type & (ParserTable::SIZE - 1)](handler, header, data + sizeof(Messages::Header));
+}
+
+template<typename Handler>
+auto Parser::dispatch(const char * data, Handler && handler) const
+{
+    if (!valid(data)) {
+        // Work out which check failed for the error message
+        Messages::Header header;
+        uint16_t message_type;
+        std::memcpy(&header, data, sizeof(header));
+        std::memcpy(&message_type, data + sizeof(header), sizeof(message_type));
+        if (header.version != protocol_version_)
+            throw std::runtime_error("Unsupported protocol version");
+        if (message_type >= ParserTable::SIZE || ParserTable::PAYLOAD_SIZES[message_type] == 0)
+            throw std::runtime_error("Unsupported message type");
+        throw std::runtime_error("Payload size does not match the message type");
+    }
+    return call(data, handler);
+}
+
+template<typename Handler>
+auto Parser::decode_batch(const char * data, size_t size, Handler && handler) const -> Batch
+{
+    auto batch = Batch{0, 0, 0};
+    size_t offset = 0;
+    size_t frames[BATCH_BLOCK];
+    while (true) {
+        // Find the frames of the next block
+        size_t count = 0;
+        while (count < BATCH_BLOCK && size - offset >= sizeof(Messages::Header)) {
+            uint16_t payload_size;
+            std::memcpy(&payload_size, data + offset + offsetof(Messages::Header, payloadSize), sizeof(payload_size));
+            if (payload_size < sizeof(uint16_t))
+                throw std::runtime_error("Corrupt frame in the message stream");
+            auto frame_size = sizeof(Messages::Header) + payload_size;
+            if (size - offset < frame_size)
+                break;
+            frames[count++] = offset;
+            offset += frame_size;
+        }
+        if (count == 0)
+            break;
+
+        auto block_valid = true;
+        for (size_t i = 0; i < count; ++i)
+            block_valid &= valid(data + frames[i]);
+
+        for (size_t i = 0; i < count; ++i) {
+            if (block_valid || valid(data + frames[i]))
+                call(data + frames[i], handler);
+            else
+                ++batch.invalid;
+        }
+        batch.messages += count;
+    }
+    batch.remaining = size - offset;
+    return batch;
+}
 
 #endif //PARSER_HPP
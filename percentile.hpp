@@ -0,0 +1,15 @@
+#ifndef PERCENTILE_HPP
+#define PERCENTILE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// The value at `fraction` (e.g. 0.99) of the way through latencies sorted in ascending order, which must not be empty.
+inline uint32_t percentile(const std::vector<uint32_t> & sorted, double fraction)
+{
+    auto index = static_cast<size_t>(fraction * (sorted.size() - 1));
+    return sorted[index];
+}
+
+#endif //PERCENTILE_HPP
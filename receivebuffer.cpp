@@ -0,0 +1,39 @@
+#include "receivebuffer.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+ReceiveBuffer::ReceiveBuffer(size_t capacity)
+    : data_(capacity)
+{
+}
+
+char * ReceiveBuffer::write_data()
+{
+    if (begin_ != 0) {
+        std::memmove(data_.data(), data_.data() + begin_, pending());
+        end_ -= begin_;
+        begin_ = 0;
+    }
+    return data_.data() + end_;
+}
+
+size_t ReceiveBuffer::write_space()
+{
+    write_data();
+    if (end_ == data_.size())
+        throw std::runtime_error("Corrupt frame in the receive stream");
+    return data_.size() - end_;
+}
+
+void ReceiveBuffer::commit(size_t bytes)
+{
+    end_ += bytes;
+}
+
+void ReceiveBuffer::consume(size_t bytes)
+{
+    begin_ += bytes;
+    if (begin_ == end_)
+        begin_ = end_ = 0;
+}
@@ -0,0 +1,35 @@
+#ifndef RECEIVEBUFFER_HPP
+#define RECEIVEBUFFER_HPP
+
+#include <cstddef>
+#include <vector>
+
+// Reassembles wire frames (Header followed by Header::payloadSize bytes) from a byte stream. The socket is read
+// straight into the free space at the back, complete frames are decoded in place from the front, and a partial
+// frame at the end stays buffered until the rest of it arrives. The leftover tail is moved back to the start of the
+// buffer before the next read, which is cheap as it is always shorter than one frame.
+class ReceiveBuffer
+{
+public:
+    explicit ReceiveBuffer(size_t capacity = 64 * 1024);
+
+    // Where to read into and how much may be read. Compacts the buffer first. write_space() throws
+    // std::runtime_error if the buffer is full, as the frame at the front can then never be completed.
+    char * write_data();
+    size_t write_space();
+    // Marks `bytes` written at write_data() as received.
+    void commit(size_t bytes);
+
+    // The buffered bytes, for handing whole runs of frames to Parser::decode_batch.
+    const char * read_data() const { return data_.data() + begin_; }
+    size_t pending() const { return end_ - begin_; }
+    // Drops `bytes` from the front once the frames in them have been handled.
+    void consume(size_t bytes);
+
+private:
+    std::vector<char> data_;
+    size_t begin_ = 0;
+    size_t end_ = 0;
+};
+
+#endif //RECEIVEBUFFER_HPP
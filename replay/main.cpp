@@ -0,0 +1,56 @@
+#include "replayer.hpp"
+
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <limits>
+
+namespace
+{
+void usage()
+{
+    std::cerr << "Usage: replay <frame file | journal directory> [--max-buy N] [--max-sell N] [--paced [SPEED]]\n";
+}
+} // unnamed namespace
+
+int main(int argc, char * argv[])
+{
+    try {
+        if (argc < 2) {
+            usage();
+            return 1;
+        }
+        auto options = ReplayOptions{};
+        options.max_buy = std::numeric_limits<int>::max();
+        options.max_sell = std::numeric_limits<int>::max();
+        for (int i = 2; i < argc; ++i) {
+            if (std::strcmp(argv[i], "--max-buy") == 0 && i + 1 < argc) {
+                options.max_buy = std::stoull(argv[++i]);
+            }
+            else if (std::strcmp(argv[i], "--max-sell") == 0 && i + 1 < argc) {
+                options.max_sell = std::stoull(argv[++i]);
+            }
+            else if (std::strcmp(argv[i], "--paced") == 0) {
+                options.paced = true;
+                if (i + 1 < argc && argv[i + 1][0] != '-')
+                    options.speed = std::stod(argv[++i]);
+            }
+            else {
+                usage();
+                return 1;
+            }
+        }
+
+        auto replayer = Replayer(options);
+        if (std::filesystem::is_directory(argv[1]))
+            replayer.replay_journal(argv[1]);
+        else
+            replayer.replay_file(argv[1]);
+        replayer.report(std::cout);
+    }
+    catch(const std::exception & err) {
+        std::cerr << "[ERR] " << err.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,178 @@
+#include "replayer.hpp"
+#include "../percentile.hpp"
+#include "../server/journal.hpp"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+
+namespace
+{
+const char * type_name(size_t type)
+{
+    switch (type) {
+        case Messages::NewOrder::MESSAGE_TYPE:
+            return "NewOrder";
+        case Messages::DeleteOrder::MESSAGE_TYPE:
+            return "DeleteOrder";
+        case Messages::ModifyOrderQuantity::MESSAGE_TYPE:
+            return "ModifyOrderQuantity";
+        case Messages::Trade::MESSAGE_TYPE:
+            return "Trade";
+        default:
+            return "Other";
+    }
+}
+} // unnamed namespace
+
+Replayer::Replayer(ReplayOptions options)
+    : options_(options)
+{
+}
+
+template<typename Payload>
+void Replayer::consume(OrderStore & store, const Messages::Header & header, const Payload & payload)
+{
+    if (options_.paced)
+        pace(header.timestamp);
+
+    auto & stats = stats_[Payload::MESSAGE_TYPE];
+    auto response = OrderStore::Response{};
+    auto start = Clock::now();
+    try {
+        response = store.consume(payload);
+    }
+    catch (const std::runtime_error &) { /* e.g. an OrderResponse, not a risk message */ }
+    auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+
+    stats.latencies.push_back(static_cast<uint32_t>(std::min<int64_t>(latency, UINT32_MAX)));
+    if (!response.no_response && response.status == Messages::OrderResponse::Status::ACCEPTED)
+        ++stats.accepted;
+    else if (!response.no_response) {
+        ++stats.rejected;
+        ++rejections_[static_cast<size_t>(response.reason) % rejections_.size()];
+    }
+    ++messages_;
+}
+
+void Replayer::pace(uint64_t timestamp)
+{
+    if (!started_) {
+        started_ = true;
+        first_timestamp_ = timestamp;
+        first_time_ = Clock::now();
+        return;
+    }
+    if (timestamp <= first_timestamp_)
+        return;
+    auto offset = std::chrono::nanoseconds(static_cast<int64_t>((timestamp - first_timestamp_) / options_.speed));
+    auto asleep = Clock::now();
+    std::this_thread::sleep_until(first_time_ + offset);
+    paced_ += Clock::now() - asleep;
+}
+
+void Replayer::replay_file(const std::string & path)
+{
+    auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        throw std::runtime_error("Could not open " + path);
+    struct stat status{};
+    fstat(fd, &status);
+    auto size = static_cast<size_t>(status.st_size);
+    auto mapped = size != 0 ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0) : nullptr;
+    ::close(fd);
+    if (mapped == MAP_FAILED)
+        throw std::runtime_error("Could not map " + path);
+    if (!mapped)
+        return;
+
+    auto store = OrderStore(options_.max_buy, options_.max_sell);
+    auto start = Clock::now();
+    auto batch = parser_.decode_batch(static_cast<const char *>(mapped), size,
+        [&](const Messages::Header & header, const auto & payload) { consume(store, header, payload); });
+    elapsed_ += Clock::now() - start;
+    munmap(mapped, size);
+
+    invalid_ += batch.invalid;
+    if (batch.remaining != 0)
+        std::cerr << "[WARN] " << batch.remaining << " trailing bytes do not form a complete frame\n";
+}
+
+void Replayer::replay_journal(const std::string & directory)
+{
+    auto sessions = std::unordered_map<uint64_t, std::unique_ptr<OrderStore>>{};
+    auto start = Clock::now();
+    Journal::read(directory, [&](const Journal::RecordHeader & record, const char * data) {
+        switch (record.kind) {
+            case Journal::RecordKind::OPEN:
+                sessions[record.session] = std::make_unique<OrderStore>(options_.max_buy, options_.max_sell);
+                return;
+            case Journal::RecordKind::CLOSE:
+                sessions.erase(record.session);
+                return;
+            case Journal::RecordKind::MESSAGE:
+                break;
+            case Journal::RecordKind::END:
+                return;
+        }
+        auto store = sessions.find(record.session);
+        if (store == sessions.end())
+            return;
+        try {
+            parser_.dispatch(data, [&](const Messages::Header & header, const auto & payload) {
+                consume(*store->second, header, payload);
+            });
+        }
+        catch (const std::runtime_error &) {
+            ++invalid_;
+        }
+    });
+    elapsed_ += Clock::now() - start;
+}
+
+void Replayer::report(std::ostream & out) const
+{
+    // The rate is over the busy time, a paced replay spends most of the elapsed time asleep
+    auto seconds = std::chrono::duration<double>(elapsed_).count();
+    auto busy = std::chrono::duration<double>(this->busy()).count();
+    out << "Replayed " << messages_ << " messages in " << std::fixed << std::setprecision(3) << seconds << " s, "
+        << busy << " s busy (" << std::setprecision(0) << (busy > 0 ? messages_ / busy : 0) << " msgs/s), "
+        << invalid_ << " invalid\n\n";
+
+    out << std::left << std::setw(20) << "type" << std::right << std::setw(10) << "count" << std::setw(10)
+        << "accepted" << std::setw(10) << "rejected" << std::setw(9) << "p50 ns" << std::setw(9) << "p90 ns"
+        << std::setw(9) << "p99 ns" << std::setw(10) << "p99.9 ns" << std::setw(10) << "max ns" << "\n";
+    for (size_t type = 0; type < stats_.size(); ++type) {
+        const auto & stats = stats_[type];
+        if (stats.latencies.empty())
+            continue;
+        auto sorted = stats.latencies;
+        std::sort(sorted.begin(), sorted.end());
+        out << std::left << std::setw(20) << type_name(type) << std::right << std::setw(10) << sorted.size()
+            << std::setw(10) << stats.accepted << std::setw(10) << stats.rejected << std::setw(9)
+            << percentile(sorted, 0.5) << std::setw(9) << percentile(sorted, 0.9) << std::setw(9)
+            << percentile(sorted, 0.99) << std::setw(10) << percentile(sorted, 0.999) << std::setw(10)
+            << sorted.back() << "\n";
+    }
+
+    auto rejected = uint64_t{0};
+    for (auto count : rejections_)
+        rejected += count;
+    if (rejected == 0)
+        return;
+    out << "\nRejected for";
+    for (size_t reason = 0; reason < rejections_.size(); ++reason) {
+        if (rejections_[reason] != 0)
+            out << " " << Messages::reason_name(static_cast<Messages::OrderResponse::Reason>(reason)) << ": "
+                << rejections_[reason];
+    }
+    out << "\n";
+}
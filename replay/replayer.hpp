@@ -0,0 +1,81 @@
+#ifndef REPLAYER_HPP
+#define REPLAYER_HPP
+
+#include "../parser.hpp"
+#include "../server/orderstore.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+struct ReplayOptions
+{
+    uint64_t max_buy = 0;
+    uint64_t max_sell = 0;
+
+    // Sleep between messages to reproduce the gaps between their Header::timestamp values, divided by `speed`.
+    // Otherwise the messages are replayed as fast as possible.
+    bool paced = false;
+    double speed = 1.0;
+};
+
+// Drives OrderStore::consume from captured traffic, without sockets or threads in the way, and measures how long the
+// risk checks take per message type.
+class Replayer
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit Replayer(ReplayOptions options);
+
+    // A file of back-to-back wire frames, all consumed by a single session.
+    void replay_file(const std::string & path);
+    // A server journal, every journaled session gets its own OrderStore.
+    void replay_journal(const std::string & directory);
+
+    void report(std::ostream & out) const;
+
+    // Totals so far. The busy time leaves out the pacing sleeps, which the elapsed time includes.
+    uint64_t messages() const { return messages_; }
+    uint64_t invalid() const { return invalid_; }
+    uint64_t accepted(uint16_t type) const { return type < stats_.size() ? stats_[type].accepted : 0; }
+    uint64_t rejected(uint16_t type) const { return type < stats_.size() ? stats_[type].rejected : 0; }
+    uint64_t rejected(Messages::OrderResponse::Reason reason) const
+    {
+        return rejections_[static_cast<size_t>(reason) % rejections_.size()];
+    }
+    Clock::duration elapsed() const { return elapsed_; }
+    Clock::duration busy() const { return elapsed_ - paced_; }
+
+private:
+    static const uint16_t PROTOCOL_VERSION = 1;
+
+    struct TypeStats
+    {
+        std::vector<uint32_t> latencies; // nanoseconds spent in OrderStore::consume
+        uint64_t accepted = 0;
+        uint64_t rejected = 0;
+    };
+
+    template<typename Payload>
+    void consume(OrderStore & store, const Messages::Header & header, const Payload & payload);
+    void pace(uint64_t timestamp);
+
+    ReplayOptions options_;
+    Parser parser_{PROTOCOL_VERSION};
+    std::array<TypeStats, 8> stats_; // indexed by message type
+    std::array<uint64_t, 4> rejections_{}; // indexed by Messages::OrderResponse::Reason
+    uint64_t messages_ = 0;
+    uint64_t invalid_ = 0;
+    Clock::duration elapsed_{};
+    Clock::duration paced_{}; // asleep in pace()
+
+    bool started_ = false;
+    uint64_t first_timestamp_ = 0;
+    Clock::time_point first_time_;
+};
+
+#endif //REPLAYER_HPP
@@ -0,0 +1,84 @@
+#include "sendbuffer.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+SendBuffer::SendBuffer(size_t chunk_size)
+    : chunk_size_(chunk_size)
+{
+}
+
+char * SendBuffer::append(size_t bytes)
+{
+    if (bytes > chunk_size_)
+        throw std::logic_error("Frame larger than the send buffer chunk");
+
+    if (chunks_.empty() || chunks_.back().end + bytes > chunk_size_) {
+        if (spare_.empty()) {
+            chunks_.push_back(Chunk{std::vector<char>(chunk_size_)});
+        }
+        else {
+            chunks_.push_back(std::move(spare_.back()));
+            spare_.pop_back();
+        }
+    }
+    auto & chunk = chunks_.back();
+    auto data = chunk.data.data() + chunk.end;
+    chunk.end += bytes;
+    pending_ += bytes;
+    return data;
+}
+
+bool SendBuffer::flush(int fd)
+{
+    while (pending_ != 0) {
+        iovec iov[MAX_IOV];
+        auto count = 0;
+        for (auto it = chunks_.begin(); it != chunks_.end() && count < MAX_IOV; ++it, ++count)
+            iov[count] = { it->data.data() + it->begin, it->end - it->begin };
+
+        auto message = msghdr{};
+        message.msg_iov = iov;
+        message.msg_iovlen = count;
+        auto bytes_sent = sendmsg(fd, &message, MSG_NOSIGNAL);
+        if (bytes_sent == -1) {
+            if (errno == EINTR)
+                continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        consume(bytes_sent);
+    }
+    return true;
+}
+
+size_t SendBuffer::drain(char * destination, size_t bytes)
+{
+    auto copied = size_t{0};
+    for (auto it = chunks_.begin(); it != chunks_.end() && copied < bytes; ++it) {
+        auto size = std::min(bytes - copied, it->end - it->begin);
+        std::copy_n(it->data.data() + it->begin, size, destination + copied);
+        copied += size;
+    }
+    consume(copied);
+    return copied;
+}
+
+void SendBuffer::consume(size_t bytes)
+{
+    pending_ -= bytes;
+    while (bytes != 0) {
+        auto & chunk = chunks_.front();
+        auto sent = std::min(bytes, chunk.end - chunk.begin);
+        chunk.begin += sent;
+        bytes -= sent;
+        if (chunk.begin != chunk.end)
+            break;
+        chunk.begin = chunk.end = 0;
+        if (spare_.size() < MAX_SPARE)
+            spare_.push_back(std::move(chunk));
+        chunks_.pop_front();
+    }
+}
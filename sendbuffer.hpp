@@ -0,0 +1,47 @@
+#ifndef SENDBUFFER_HPP
+#define SENDBUFFER_HPP
+
+#include <cstddef>
+#include <deque>
+#include <vector>
+
+// Queues outgoing wire frames for one socket. Frames are written back to back into fixed-size chunks and the queued
+// chunks go out together in a single sendmsg() (the socket flavour of writev) per flush, so a burst of responses
+// costs a handful of syscalls. Whatever the socket does not accept stays queued for the next flush. Sent chunks are
+// kept for reuse, so a connection with a steady flow of responses stops allocating.
+class SendBuffer
+{
+public:
+    explicit SendBuffer(size_t chunk_size = 16 * 1024);
+
+    // Contiguous space for a frame of `bytes` at the back of the queue, the caller writes all of it.
+    char * append(size_t bytes);
+
+    size_t pending() const { return pending_; }
+
+    // Sends as much as the socket accepts. Returns false on a connection error, a full socket buffer is not one.
+    bool flush(int fd);
+    // Moves up to `bytes` from the front of the queue to `destination` and returns how many, for sending them by other
+    // means than flush().
+    size_t drain(char * destination, size_t bytes);
+
+private:
+    static const int MAX_IOV = 64; // chunks handed to one sendmsg()
+    static const size_t MAX_SPARE = 4;
+
+    struct Chunk
+    {
+        std::vector<char> data;
+        size_t begin = 0;
+        size_t end = 0;
+    };
+
+    void consume(size_t bytes);
+
+    size_t chunk_size_;
+    size_t pending_ = 0;
+    std::deque<Chunk> chunks_;
+    std::vector<Chunk> spare_;
+};
+
+#endif //SENDBUFFER_HPP
@@ -0,0 +1,285 @@
+#include "dropcopy.hpp"
+#include "../timestamp.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <iostream>
+#include <netinet/in.h>
+#include <stdexcept>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace
+{
+// Reads and throws away whatever is buffered on the socket. Returns false once it is closed or failed.
+bool discard_input(int socket)
+{
+    char discarded[256];
+    while (true) {
+        auto bytes = read(socket, discarded, sizeof(discarded));
+        if (bytes > 0 || (bytes == -1 && errno == EINTR))
+            continue;
+        return bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+}
+} // unnamed namespace
+
+DropCopy::DropCopy(size_t producers, const DropCopyOptions & options)
+    : options_(options)
+{
+    for (size_t i = 0; i < producers; ++i)
+        queues_.push_back(std::make_unique<Queue>(options_.queue_capacity));
+
+    socket_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    auto address = sockaddr_in{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(options_.port);
+    address.sin_addr.s_addr = INADDR_ANY;
+    if (socket_ == -1 || bind(socket_, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == -1
+        || listen(socket_, SOMAXCONN) == -1)
+        throw std::runtime_error("Could not listen for drop-copy subscribers");
+
+    epoll_ = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_ == -1 || wake_fd_ == -1)
+        throw std::runtime_error("Could not create the drop-copy event loop");
+    if (!watch(socket_) || !watch(wake_fd_))
+        throw std::runtime_error("Could not create the drop-copy event loop");
+
+    if (options_.shared_memory) {
+        shm_socket_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        auto length = socklen_t{};
+        auto shm_address = ShmChannel::rendezvous_address(options_.port, length);
+        if (shm_socket_ == -1 || bind(shm_socket_, reinterpret_cast<sockaddr *>(&shm_address), length) == -1
+            || listen(shm_socket_, SOMAXCONN) == -1 || !watch(shm_socket_))
+            throw std::runtime_error("Could not listen for drop-copy subscribers over shared memory");
+    }
+    thread_ = std::thread([this]() { run(); });
+}
+
+DropCopy::~DropCopy()
+{
+    stopping_.store(true);
+    uint64_t one = 1;
+    [[maybe_unused]] auto written = write(wake_fd_, &one, sizeof(one));
+    thread_.join();
+    for (auto & subscriber : subscribers_) {
+        close(subscriber.first);
+        if (subscriber.second->doorbell != -1)
+            close(subscriber.second->doorbell);
+    }
+    for (auto fd : handshakes_)
+        close(fd);
+    for (auto fd : {socket_, shm_socket_, epoll_, wake_fd_})
+        close(fd);
+}
+
+uint64_t DropCopy::lost() const
+{
+    uint64_t lost = 0;
+    for (const auto & queue : queues_)
+        lost += queue->lost.load(std::memory_order_relaxed);
+    return lost;
+}
+
+void DropCopy::run()
+{
+    epoll_event events[64];
+    while (!stopping_.load()) {
+        auto busy = drain();
+        for (auto & subscriber : subscribers_)
+            flush(subscriber.first, *subscriber.second);
+
+        auto ready = epoll_wait(epoll_, events, 64, busy ? 0 : POLL_INTERVAL_MS);
+        for (int i = 0; i < ready; ++i) {
+            auto fd = events[i].data.fd;
+            if (fd == socket_ || fd == shm_socket_) {
+                accept(fd);
+            }
+            else if (fd == wake_fd_) {
+                uint64_t value;
+                [[maybe_unused]] auto bytes = read(wake_fd_, &value, sizeof(value));
+            }
+            else if (handshakes_.count(fd) != 0) {
+                handshake(fd);
+            }
+            else {
+                // Whatever a TCP subscriber sends is discarded, the socket of a shared-memory one only ever becomes
+                // readable once it is gone
+                auto subscriber = subscribers_.find(fd);
+                if (subscriber == subscribers_.end() || subscriber->second->shm || !discard_input(fd))
+                    gone_.push_back(fd);
+            }
+        }
+        for (auto fd : gone_)
+            close_subscriber(fd);
+        gone_.clear();
+    }
+}
+
+bool DropCopy::drain()
+{
+    auto busy = false;
+    char frame[Encoder::frame_size<Messages::DropCopy>()];
+    auto published = Published{};
+    for (auto & queue : queues_) {
+        for (size_t i = 0; i < MAX_DRAIN && queue->decisions.try_pop(published); ++i) {
+            busy = true;
+            // Skip the numbers of the decisions lost since the previous one, subscribers see the gap
+            sequence_number_ += static_cast<uint32_t>(published.number - queue->drained);
+            queue->drained = published.number + 1;
+            auto & decision = published.decision;
+            auto sequence_number = sequence_number_++;
+            auto size = encoder_.encode(frame, decision, sequence_number, timestamp());
+            for (auto & subscriber : subscribers_)
+                deliver(subscriber.first, *subscriber.second, frame, size, sequence_number, decision);
+            published_.store(published_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+    }
+    return busy;
+}
+
+void DropCopy::deliver(int socket, Subscriber & subscriber, const char * frame, size_t size, uint32_t sequence_number,
+                       const Messages::DropCopy & decision)
+{
+    if (subscriber.dropped)
+        return;
+    if (!subscriber.conflating && subscriber.output.pending() > options_.max_backlog) {
+        if (!options_.conflate) {
+            std::cerr << "[WARN] Drop-copy subscriber is not keeping up, dropping subscriber\n";
+            dropped_.store(dropped_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            subscriber.dropped = true;
+            gone_.push_back(socket);
+            return;
+        }
+        std::cerr << "[WARN] Drop-copy subscriber is not keeping up, conflating its decisions\n";
+        subscriber.conflating = true;
+    }
+    if (subscriber.conflating) {
+        subscriber.latest[{decision.session, decision.listingId}] = Conflated{sequence_number, decision};
+        return;
+    }
+    std::copy_n(frame, size, subscriber.output.append(size));
+}
+
+void DropCopy::flush(int socket, Subscriber & subscriber)
+{
+    if (subscriber.dropped)
+        return;
+    auto & output = subscriber.output;
+    if (subscriber.shm) {
+        auto & channel = *subscriber.shm;
+        auto written = false;
+        while (output.pending() != 0) {
+            auto bytes = output.drain(channel.write_data(), channel.write_space());
+            if (bytes == 0)
+                break;
+            channel.commit(bytes);
+            written = true;
+        }
+        if (written && channel.peer_waiting()) {
+            uint64_t ring = 1;
+            [[maybe_unused]] auto bytes = write(subscriber.doorbell, &ring, sizeof(ring));
+        }
+    }
+    else if (output.pending() != 0 && !output.flush(socket)) {
+        gone_.push_back(socket);
+        return;
+    }
+
+    if (subscriber.conflating && output.pending() == 0) {
+        // Caught up: the latest decision per session and listing follows, in the order of the feed
+        auto latest = std::vector<const Conflated *>();
+        for (const auto & entry : subscriber.latest)
+            latest.push_back(&entry.second);
+        std::sort(latest.begin(), latest.end(), [](const Conflated * left, const Conflated * right) {
+            return left->sequence_number < right->sequence_number;
+        });
+        for (const auto * conflated : latest)
+            encoder_.encode(output, conflated->decision, conflated->sequence_number, timestamp());
+        subscriber.latest.clear();
+        subscriber.conflating = false;
+    }
+}
+
+void DropCopy::accept(int listener)
+{
+    while (true) {
+        auto socket = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (socket == -1) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            return;
+        }
+        if (listener == shm_socket_ && !same_user(socket)) {
+            std::cerr << "[WARN] Drop-copy subscriber runs as another user, refusing it\n";
+            close(socket);
+            continue;
+        }
+        if (!watch(socket)) {
+            close(socket);
+            continue;
+        }
+        if (listener == shm_socket_) {
+            handshakes_.insert(socket);
+            continue;
+        }
+        subscribers_[socket] = std::make_unique<Subscriber>();
+        subscriber_count_.store(subscribers_.size(), std::memory_order_relaxed);
+    }
+}
+
+void DropCopy::handshake(int socket)
+{
+    int fds[2];
+    if (!receive_descriptors(socket, fds, 2)) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            gone_.push_back(socket);
+        return;
+    }
+    handshakes_.erase(socket);
+    auto subscriber = std::make_unique<Subscriber>();
+    try {
+        subscriber->shm = std::make_unique<ShmChannel>(fds[0]);
+    }
+    catch (const std::runtime_error & err) {
+        std::cerr << "[WARN] " << err.what() << ", refusing drop-copy subscriber\n";
+        close(fds[0]);
+        close(fds[1]);
+        close(socket);
+        return;
+    }
+    subscriber->doorbell = fds[1];
+    subscribers_[socket] = std::move(subscriber);
+    subscriber_count_.store(subscribers_.size(), std::memory_order_relaxed);
+    // Subscribers have nothing to ring the publisher for, they get its wake-up descriptor, which at most makes it
+    // look at its queues early
+    if (!send_descriptors(socket, &wake_fd_, 1))
+        gone_.push_back(socket);
+}
+
+bool DropCopy::watch(int socket)
+{
+    auto event = epoll_event{};
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.fd = socket;
+    return epoll_ctl(epoll_, EPOLL_CTL_ADD, socket, &event) == 0;
+}
+
+void DropCopy::close_subscriber(int socket)
+{
+    auto subscriber = subscribers_.find(socket);
+    if (subscriber != subscribers_.end()) {
+        if (subscriber->second->doorbell != -1)
+            close(subscriber->second->doorbell);
+        subscribers_.erase(subscriber);
+    }
+    else if (handshakes_.erase(socket) == 0) {
+        return; // closed already, e.g. listed twice
+    }
+    close(socket);
+    subscriber_count_.store(subscribers_.size(), std::memory_order_relaxed);
+}
@@ -0,0 +1,173 @@
+#ifndef DROPCOPY_HPP
+#define DROPCOPY_HPP
+
+#include "orderstore.hpp"
+#include "spscqueue.hpp"
+#include "../encoder.hpp"
+#include "../messages.hpp"
+#include "../sendbuffer.hpp"
+#include "../shmchannel.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <variant>
+#include <vector>
+
+struct DropCopyOptions
+{
+    // Subscribers connect over TCP to this port, or with `shared_memory` also to the rendezvous named after it (see
+    // ShmChannel), if they run as the same user. 0 disables the feed.
+    uint16_t port = 0;
+    bool shared_memory = false;
+
+    // A subscriber more than `max_backlog` bytes behind is dropped, or with `conflate` only gets the latest decision
+    // per session and listing until it has caught up.
+    bool conflate = false;
+    size_t max_backlog = 1024 * 1024;
+
+    // Decisions each publishing thread can have waiting for the publisher, those that find no room are lost.
+    size_t queue_capacity = 1 << 14;
+};
+
+// Drop-copy feed of the risk decisions. The threads deciding (the network thread, or each risk worker) publish()
+// into a lock-free queue of their own, which never blocks: a decision that finds its queue full is counted and lost.
+// A publisher thread drains the queues, stamps every decision with the next sequence number of the feed and sends
+// it to every subscriber as a DropCopy frame. Lost decisions keep their sequence numbers, so subscribers see them as
+// a gap once the next decision of the same thread is published. Subscribers only listen, whatever they send is
+// ignored.
+//
+// The publisher polls the queues, so publishing costs the risk loop no system call: it sleeps at most
+// POLL_INTERVAL_MS when there is nothing to drain.
+class DropCopy
+{
+public:
+    // `producers` queues, one per thread that publishes.
+    DropCopy(size_t producers, const DropCopyOptions & options);
+    ~DropCopy();
+    DropCopy(const DropCopy &) = delete;
+    DropCopy & operator=(const DropCopy &) = delete;
+
+    void publish(size_t producer, const Messages::DropCopy & decision)
+    {
+        auto & queue = *queues_[producer];
+        if (!queue.decisions.try_push(Published{queue.decided++, decision}))
+            queue.lost.store(queue.lost.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    uint64_t published() const { return published_.load(std::memory_order_relaxed); }
+    uint64_t lost() const; // at publish() for want of room in a queue
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); } // slow subscribers
+    size_t subscribers() const { return subscriber_count_.load(std::memory_order_relaxed); }
+
+private:
+    static const uint16_t PROTOCOL_VERSION = 1;
+    static const int POLL_INTERVAL_MS = 1;
+    static const size_t MAX_DRAIN = 4096; // decisions taken from a queue before the others get a turn
+
+    struct Published
+    {
+        uint64_t number; // counts the decisions of the producer, lost ones included
+        Messages::DropCopy decision;
+    };
+
+    struct Queue
+    {
+        explicit Queue(size_t capacity)
+            : decisions(capacity)
+        {}
+
+        SpscQueue<Published> decisions;
+        uint64_t decided = 0;          // owned by the producer
+        std::atomic<uint64_t> lost{0}; // written by the producer only
+        uint64_t drained = 0;          // owned by the publisher, the number of the next decision expected
+    };
+
+    struct Conflated
+    {
+        uint32_t sequence_number;
+        Messages::DropCopy decision;
+    };
+
+    struct Subscriber
+    {
+        SendBuffer output;
+        std::unique_ptr<ShmChannel> shm;
+        int doorbell = -1;
+        bool conflating = false;
+        bool dropped = false; // closed at the end of the pass
+        std::map<std::pair<uint64_t, uint64_t>, Conflated> latest; // by session and listing, while conflating
+    };
+
+    void run();
+    bool drain();
+    // Queues the frame, or conflates or drops the subscriber once `max_backlog` is queued already.
+    void deliver(int socket, Subscriber & subscriber, const char * frame, size_t size, uint32_t sequence_number,
+                 const Messages::DropCopy & decision);
+    void flush(int socket, Subscriber & subscriber);
+    void accept(int listener);
+    void handshake(int socket);
+    bool watch(int socket);
+    void close_subscriber(int socket);
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    DropCopyOptions options_;
+    Encoder encoder_{PROTOCOL_VERSION};
+
+    // Owned by the publisher thread
+    std::unordered_map<int, std::unique_ptr<Subscriber>> subscribers_;
+    std::unordered_set<int> handshakes_; // shared-memory subscribers whose descriptors are still to come
+    std::vector<int> gone_;              // subscribers to close once the current pass is over
+    uint32_t sequence_number_ = 0;
+
+    std::atomic<uint64_t> published_{0};
+    std::atomic<uint64_t> dropped_{0};
+    std::atomic<size_t> subscriber_count_{0};
+    std::atomic<bool> stopping_{false};
+    int socket_ = -1;
+    int shm_socket_ = -1;
+    int epoll_ = -1;
+    int wake_fd_ = -1; // stops the publisher, also handed to shared-memory subscribers as the doorbell to ring
+    std::thread thread_;
+};
+
+// The record of a decision on `payload` by `store`, to publish.
+template<typename Payload>
+Messages::DropCopy drop_copy_record(uint64_t session, const Messages::Header & header, const Payload & payload,
+                                    const OrderStore::Response & response, const OrderStore & store)
+{
+    auto exposure = store.last_exposure();
+    auto record = Messages::DropCopy{Messages::DropCopy::MESSAGE_TYPE, session, Payload::MESSAGE_TYPE,
+                                     header.sequenceNumber, header.timestamp, response.order_id, 0, 0, 0,
+                                     response.status, response.reason, exposure.listing_id, exposure.buy_side,
+                                     exposure.sell_side, exposure.net_pos};
+    if constexpr (std::is_same_v<Payload, Messages::NewOrder>) {
+        record.quantity = payload.orderQuantity;
+        record.price = payload.orderPrice;
+        record.side = payload.side;
+    }
+    else if constexpr (std::is_same_v<Payload, Messages::ModifyOrderQuantity>) {
+        record.quantity = payload.newQuantity;
+    }
+    else if constexpr (std::is_same_v<Payload, Messages::Trade>) {
+        record.quantity = payload.tradeQuantity;
+        record.price = payload.tradePrice;
+    }
+    return record;
+}
+
+inline Messages::DropCopy drop_copy_record(uint64_t session, const Message & message,
+                                           const OrderStore::Response & response, const OrderStore & store)
+{
+    return std::visit([&](const auto & payload) {
+        return drop_copy_record(session, message.header, payload, response, store);
+    }, message.payload);
+}
+
+#endif //DROPCOPY_HPP
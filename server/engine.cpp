@@ -0,0 +1,226 @@
+#include "engine.hpp"
+
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace
+{
+const int SPIN_LIMIT = 1000; // empty polls before a worker goes to sleep
+
+void signal(int fd)
+{
+    uint64_t one = 1;
+    [[maybe_unused]] auto written = write(fd, &one, sizeof(one));
+}
+
+void wait(int fd)
+{
+    uint64_t value;
+    [[maybe_unused]] auto bytes = read(fd, &value, sizeof(value));
+}
+} // unnamed namespace
+
+Engine::Engine(size_t workers, int max_buy, int max_sell, ResponseHandler handler, FirmLimits * firm_limits,
+               DropCopy * drop_copy)
+    : max_buy_(max_buy)
+    , max_sell_(max_sell)
+    , handler_(std::move(handler))
+    , firm_limits_(firm_limits)
+    , drop_copy_(drop_copy)
+{
+    if (workers == 0)
+        throw std::runtime_error("At least one risk worker is required");
+    notify_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (notify_fd_ == -1)
+        throw std::runtime_error("Could not create the engine notification descriptor");
+
+    for (size_t i = 0; i < workers; ++i) {
+        auto worker = std::make_unique<Worker>();
+        worker->index = i;
+        worker->wake_fd = eventfd(0, EFD_CLOEXEC);
+        if (worker->wake_fd == -1)
+            throw std::runtime_error("Could not create a worker wake-up descriptor");
+        workers_.push_back(std::move(worker));
+    }
+    for (auto & worker : workers_)
+        worker->thread = std::thread([this, &worker = *worker]() { run(worker); });
+}
+
+Engine::~Engine()
+{
+    for (auto & worker : workers_)
+        push(*worker, Job{Job::Kind::STOP, 0, {}, nullptr, nullptr, {}, nullptr});
+    for (auto & worker : workers_) {
+        worker->thread.join();
+        ::close(worker->wake_fd);
+    }
+    ::close(notify_fd_);
+}
+
+void Engine::open(uint64_t session, std::unique_ptr<OrderStore> store)
+{
+    auto connection = std::make_shared<Connection>();
+    connections_[session] = connection;
+    push(worker_for(session), Job{Job::Kind::OPEN, session, {}, std::move(connection), nullptr, {}, std::move(store)});
+}
+
+void Engine::close(uint64_t session)
+{
+    // Responses still in flight for the session are dropped together with the connection
+    auto connection = connections_.find(session);
+    if (connection != connections_.end()) {
+        connection->second->closed.store(true);
+        connections_.erase(connection);
+    }
+    push(worker_for(session), Job{Job::Kind::CLOSE, session, {}, nullptr, nullptr, {}, nullptr});
+}
+
+void Engine::submit(uint64_t session, Message && message, const LatencyTrace & trace)
+{
+    push(worker_for(session), Job{Job::Kind::MESSAGE, session, std::move(message), nullptr, nullptr, trace, nullptr});
+}
+
+void Engine::snapshot(std::shared_ptr<Snapshot> snapshot)
+{
+    for (auto & worker : workers_)
+        push(*worker, Job{Job::Kind::SNAPSHOT, 0, {}, nullptr, snapshot, {}, nullptr});
+}
+
+void Engine::drain()
+{
+    clear_notification();
+    for (auto & worker : workers_) {
+        uint64_t session;
+        while (worker->ready.try_pop(session)) {
+            auto connection = connections_.find(session);
+            if (connection == connections_.end())
+                continue; // closed in the meantime
+            // Unschedule before draining, a response pushed after this point schedules the session again
+            connection->second->scheduled.store(false, std::memory_order_seq_cst);
+            auto outcome = Outcome{};
+            while (connection->second->responses.try_pop(outcome))
+                handler_(session, outcome.response, outcome.trace);
+        }
+    }
+}
+
+void Engine::push(Worker & worker, Job && job)
+{
+    while (!worker.jobs.try_push(std::move(job)))
+        drain();
+    wake(worker);
+}
+
+void Engine::wake(Worker & worker)
+{
+    // Pairs with the fence in run(): either the worker sees the new job, or this sees it sleeping
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (worker.sleeping.load(std::memory_order_relaxed) && worker.sleeping.exchange(false))
+        signal(worker.wake_fd);
+}
+
+void Engine::notify()
+{
+    if (!notified_.exchange(true))
+        signal(notify_fd_);
+}
+
+void Engine::clear_notification()
+{
+    // Reset the counter before the flag: a notify() in between either still finds the flag set and its responses
+    // are drained next, or signals again. The other way round, its signal would be read here and lost.
+    uint64_t value;
+    [[maybe_unused]] auto bytes = read(notify_fd_, &value, sizeof(value)); // non-blocking
+    notified_.exchange(false); // acquires the responses pushed before a notify() that found the flag set
+}
+
+void Engine::run(Worker & worker)
+{
+    auto job = Job{};
+    auto pending = false; // responses produced since the last notification
+    auto idle = 0;
+    while (true) {
+        if (worker.jobs.try_pop(job)) {
+            idle = 0;
+            if (job.kind == Job::Kind::STOP)
+                break;
+            process(worker, job);
+            pending = pending || job.kind == Job::Kind::MESSAGE;
+            continue;
+        }
+
+        // The queue ran dry: let the I/O thread pick up the whole batch with a single wake-up
+        if (pending) {
+            notify();
+            pending = false;
+        }
+        if (++idle < SPIN_LIMIT)
+            continue;
+
+        worker.sleeping.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (worker.jobs.empty())
+            wait(worker.wake_fd);
+        worker.sleeping.store(false, std::memory_order_relaxed);
+        idle = 0;
+    }
+    worker.sessions.clear();
+}
+
+void Engine::process(Worker & worker, Job & job)
+{
+    switch (job.kind) {
+        case Job::Kind::OPEN:
+            if (!job.store)
+                job.store = std::make_unique<OrderStore>(max_buy_, max_sell_, firm_limits_);
+            worker.sessions[job.session] = Session{std::move(job.store), std::move(job.connection)};
+            return;
+        case Job::Kind::CLOSE:
+            worker.sessions.erase(job.session);
+            return;
+        case Job::Kind::SNAPSHOT:
+            for (const auto & session : worker.sessions)
+                job.snapshot->add(session.first, *session.second.store);
+            job.snapshot->part_done();
+            job.snapshot.reset();
+            return;
+        case Job::Kind::MESSAGE:
+            break;
+        case Job::Kind::STOP:
+            return;
+    }
+
+    auto session = worker.sessions.find(job.session);
+    if (session == worker.sessions.end())
+        return;
+    auto response = OrderStore::Response{};
+    try {
+        response = session->second.store->consume(std::move(job.message));
+    }
+    catch (const std::runtime_error &) { /* unsupported message type */ }
+    if (response.no_response)
+        return;
+    job.trace.consumed = LatencyClock::now();
+    if (drop_copy_) {
+        // The payloads are trivially copyable, moving the message into the store left it intact
+        auto & store = *session->second.store;
+        drop_copy_->publish(worker.index + 1, drop_copy_record(job.session, job.message, response, store));
+    }
+
+    // When the I/O thread falls behind, make sure it has been told there is something to drain before waiting
+    auto & connection = *session->second.connection;
+    auto outcome = Outcome{response, job.trace};
+    while (!connection.responses.try_push(std::move(outcome))) {
+        if (connection.closed.load())
+            return;
+        notify();
+        std::this_thread::yield();
+    }
+    if (!connection.scheduled.exchange(true)) {
+        while (!worker.ready.try_push(uint64_t{job.session})) {
+            notify();
+            std::this_thread::yield();
+        }
+    }
+}
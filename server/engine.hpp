@@ -0,0 +1,131 @@
+#ifndef ENGINE_HPP
+#define ENGINE_HPP
+
+#include "dropcopy.hpp"
+#include "firmlimits.hpp"
+#include "latency.hpp"
+#include "orderstore.hpp"
+#include "snapshot.hpp"
+#include "spscqueue.hpp"
+#include "../messages.hpp"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Runs the risk checks on a pool of worker threads. Every session is pinned to one worker which owns its
+// OrderStore, so the risk state is never shared between threads and needs no locking.
+//
+// All public methods must be called from a single network I/O thread. Decoded messages travel to the workers over
+// one SPSC queue per worker; responses come back over one SPSC queue per session. The workers signal notify_fd()
+// (an eventfd) when responses are ready, at most once per drain, so the I/O thread can wait on it with its sockets.
+class Engine
+{
+public:
+    // Also gets the trace of the message, with the time the worker finished the risk checks filled in.
+    using ResponseHandler =
+        std::function<void(uint64_t session, const OrderStore::Response & response, const LatencyTrace & trace)>;
+
+    // Worker i publishes its decisions to queue i + 1 of `drop_copy`, if any.
+    Engine(size_t workers, int max_buy, int max_sell, ResponseHandler handler, FirmLimits * firm_limits = nullptr,
+           DropCopy * drop_copy = nullptr);
+    ~Engine();
+    Engine(const Engine &) = delete;
+    Engine & operator=(const Engine &) = delete;
+
+    // Starts the session with `store`, e.g. one recovered from the journal, or with a fresh one.
+    void open(uint64_t session, std::unique_ptr<OrderStore> store = nullptr);
+    void close(uint64_t session);
+
+    // Queues the message for the session's worker. While the worker's queue is full, pending responses are drained
+    // so a worker blocked on a full response queue can make progress.
+    void submit(uint64_t session, Message && message, const LatencyTrace & trace = {});
+
+    // Has every worker add its sessions to the snapshot once it has processed the messages submitted so far.
+    void snapshot(std::shared_ptr<Snapshot> snapshot);
+
+    // Hands every response produced since the last call to the response handler.
+    void drain();
+
+    int notify_fd() const { return notify_fd_; }
+    size_t workers() const { return workers_.size(); }
+
+private:
+    static const size_t QUEUE_CAPACITY = 1 << 14;
+    static const size_t RESPONSE_CAPACITY = 1 << 12;
+    static const size_t READY_CAPACITY = 1 << 16;
+
+    struct Outcome
+    {
+        OrderStore::Response response;
+        LatencyTrace trace;
+    };
+
+    // Output side of a session, shared between its worker (producer) and the I/O thread (consumer).
+    struct Connection
+    {
+        SpscQueue<Outcome> responses{RESPONSE_CAPACITY};
+        std::atomic<bool> scheduled{false}; // already listed in the worker's ready queue
+        std::atomic<bool> closed{false};    // the I/O thread stopped draining it
+    };
+
+    struct Job
+    {
+        enum class Kind
+        {
+            OPEN,
+            MESSAGE,
+            CLOSE,
+            SNAPSHOT,
+            STOP,
+        };
+        Kind kind;
+        uint64_t session;
+        Message message;
+        std::shared_ptr<Connection> connection;
+        std::shared_ptr<Snapshot> snapshot;
+        LatencyTrace trace;
+        std::unique_ptr<OrderStore> store; // to open the session with
+    };
+
+    struct Session
+    {
+        std::unique_ptr<OrderStore> store;
+        std::shared_ptr<Connection> connection;
+    };
+
+    struct Worker
+    {
+        size_t index;
+        SpscQueue<Job> jobs{QUEUE_CAPACITY};
+        SpscQueue<uint64_t> ready{READY_CAPACITY}; // sessions with pending responses
+        std::atomic<bool> sleeping{false};
+        int wake_fd = -1;
+        std::unordered_map<uint64_t, Session> sessions; // owned by the worker thread
+        std::thread thread;
+    };
+
+    Worker & worker_for(uint64_t session) { return *workers_[session % workers_.size()]; }
+    void push(Worker & worker, Job && job);
+    void wake(Worker & worker);
+    void notify();
+    void clear_notification();
+    void run(Worker & worker);
+    void process(Worker & worker, Job & job);
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::unordered_map<uint64_t, std::shared_ptr<Connection>> connections_; // owned by the I/O thread
+    int max_buy_;
+    int max_sell_;
+    ResponseHandler handler_;
+    FirmLimits * firm_limits_;
+    DropCopy * drop_copy_;
+
+    int notify_fd_ = -1;
+    std::atomic<bool> notified_{false};
+};
+
+#endif //ENGINE_HPP
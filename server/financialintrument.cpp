@@ -1,121 +1,329 @@
 #include "financialintrument.hpp"
 
+#include <cassert>
+#include <cstring>
+#include <limits>
 #include <numeric>
+#include <stdexcept>
 
 namespace
 {
+    // Orders only count against the limit of their own side
+    constexpr auto NO_LIMIT = std::numeric_limits<uint64_t>::max();
+
     auto SUM_FUNC = [](const int64_t acc, const std::pair<uint64_t, FinancialInstrument::Order> & it) {
         return acc + it.second.quantity;
     };
+
+    int64_t buy_exposure(int64_t buy_qty, int64_t net_pos)
+    {
+        return std::max(buy_qty, net_pos + buy_qty);
+    }
+
+    int64_t sell_exposure(int64_t sell_qty, int64_t net_pos)
+    {
+        return std::max(sell_qty, sell_qty - net_pos);
+    }
+
+    bool exceeds(int64_t exposure, uint64_t max)
+    {
+        return exposure >= 0 && static_cast<uint64_t>(exposure) >= max;
+    }
+
+    void throw_on_reject(FinancialInstrument::Result result)
+    {
+        using Result = FinancialInstrument::Result;
+        switch (result) {
+            case Result::ACCEPTED:
+            case Result::UNKNOWN_ORDER:
+                return;
+            case Result::EXCEEDED_MAX_BUY:
+                throw std::logic_error("Exceeded max buy quantity threshold");
+            case Result::EXCEEDED_MAX_SELL:
+                throw std::logic_error("Exceeded max sell quantity threshold");
+            case Result::NO_MATCHING_ORDER:
+                throw std::logic_error("No buy or sell order matching the trade");
+        }
+    }
 } // unnamed namespace
 
-void FinancialInstrument::add_buy(Order && order, uint64_t max_buy)
+auto FinancialInstrument::try_add_buy(const Order & order, uint64_t max_buy) -> Result
+{
+    auto existing = buy_orders_.find(order.id);
+    auto prev_quantity = existing != buy_orders_.end() ? existing->second.quantity : 0;
+    auto delta = order.quantity - prev_quantity;
+    if (exceeds(buy_exposure(buy_qty_ + delta, net_pos_), max_buy))
+        return Result::EXCEEDED_MAX_BUY;
+
+    if (existing != buy_orders_.end())
+        existing->second = order;
+    else
+        buy_orders_.emplace(order.id, order);
+    update_buy(delta);
+    return Result::ACCEPTED;
+}
+
+auto FinancialInstrument::try_add_sell(const Order & order, uint64_t max_sell) -> Result
+{
+    auto existing = sell_orders_.find(order.id);
+    auto prev_quantity = existing != sell_orders_.end() ? existing->second.quantity : 0;
+    auto delta = order.quantity - prev_quantity;
+    if (exceeds(sell_exposure(sell_qty_ + delta, net_pos_), max_sell))
+        return Result::EXCEEDED_MAX_SELL;
+
+    if (existing != sell_orders_.end())
+        existing->second = order;
+    else
+        sell_orders_.emplace(order.id, order);
+    update_sell(delta);
+    return Result::ACCEPTED;
+}
+
+auto FinancialInstrument::try_add_trade(Order order, uint64_t max_buy, uint64_t max_sell) -> Result
+{
+    auto signed_result = sign_trade(order);
+    if (signed_result != Result::ACCEPTED)
+        return signed_result;
+
+    auto existing = trade_orders_.find(order.id);
+    auto prev_quantity = existing != trade_orders_.end() ? existing->second.quantity : 0;
+    auto delta = order.quantity - prev_quantity;
+    if (exceeds(buy_exposure(buy_qty_, net_pos_ + delta), max_buy))
+        return Result::EXCEEDED_MAX_BUY;
+    if (exceeds(sell_exposure(sell_qty_, net_pos_ + delta), max_sell))
+        return Result::EXCEEDED_MAX_SELL;
+
+    if (existing != trade_orders_.end())
+        existing->second = order;
+    else
+        trade_orders_.emplace(order.id, order);
+    update_trade(delta);
+    return Result::ACCEPTED;
+}
+
+auto FinancialInstrument::try_modify_order(uint64_t id, Side side, uint64_t quantity, uint64_t max_buy,
+                                           uint64_t max_sell) -> Result
 {
-    buy_orders_[order.id] = order;
-    update_buy();
-    if (buy_side_ >= max_buy) {
-        buy_orders_.erase(order.id);
-        update_buy();
-        throw std::logic_error("Exceeded max buy quantity threshold");
+    auto new_quantity = static_cast<int64_t>(quantity);
+    if (side == Side::BUY) {
+        auto buy_order = buy_orders_.find(id);
+        if (buy_order == buy_orders_.end())
+            return Result::UNKNOWN_ORDER;
+        auto delta = new_quantity - buy_order->second.quantity;
+        if (exceeds(buy_exposure(buy_qty_ + delta, net_pos_), max_buy))
+            return Result::EXCEEDED_MAX_BUY;
+        buy_order->second.quantity = new_quantity;
+        update_buy(delta);
+        return Result::ACCEPTED;
     }
+    auto sell_order = sell_orders_.find(id);
+    if (sell_order == sell_orders_.end())
+        return Result::UNKNOWN_ORDER;
+    auto delta = new_quantity - sell_order->second.quantity;
+    if (exceeds(sell_exposure(sell_qty_ + delta, net_pos_), max_sell))
+        return Result::EXCEEDED_MAX_SELL;
+    sell_order->second.quantity = new_quantity;
+    update_sell(delta);
+    return Result::ACCEPTED;
+}
+
+auto FinancialInstrument::preview_add(Side side, const Order & order, uint64_t max_buy, uint64_t max_sell) const
+    -> Preview
+{
+    const auto & orders = side == Side::BUY ? buy_orders_ : sell_orders_;
+    auto existing = orders.find(order.id);
+    auto delta = order.quantity - (existing != orders.end() ? existing->second.quantity : 0);
+    if (side == Side::BUY)
+        return preview(delta, 0, 0, max_buy, NO_LIMIT);
+    return preview(0, delta, 0, NO_LIMIT, max_sell);
+}
+
+auto FinancialInstrument::preview_trade(Order order, uint64_t max_buy, uint64_t max_sell) const -> Preview
+{
+    auto signed_result = sign_trade(order);
+    if (signed_result != Result::ACCEPTED)
+        return { signed_result, buy_side_, sell_side_ };
+    auto existing = trade_orders_.find(order.id);
+    auto delta = order.quantity - (existing != trade_orders_.end() ? existing->second.quantity : 0);
+    return preview(0, 0, delta, max_buy, max_sell);
+}
+
+auto FinancialInstrument::preview_modify(uint64_t id, Side side, uint64_t quantity, uint64_t max_buy,
+                                         uint64_t max_sell) const -> Preview
+{
+    const auto & orders = side == Side::BUY ? buy_orders_ : sell_orders_;
+    auto existing = orders.find(id);
+    if (existing == orders.end())
+        return { Result::UNKNOWN_ORDER, buy_side_, sell_side_ };
+    auto delta = static_cast<int64_t>(quantity) - existing->second.quantity;
+    if (side == Side::BUY)
+        return preview(delta, 0, 0, max_buy, NO_LIMIT);
+    return preview(0, delta, 0, NO_LIMIT, max_sell);
+}
+
+void FinancialInstrument::add_buy(Order && order, uint64_t max_buy)
+{
+    throw_on_reject(try_add_buy(order, max_buy));
 }
 
 void FinancialInstrument::add_sell(Order && order, uint64_t max_sell)
 {
-    sell_orders_[order.id] = order;
-    update_sell();
-    if (sell_side_ >= max_sell) {
-        sell_orders_.erase(order.id);
-        update_sell();
-        throw std::logic_error("Exceeded max sell quantity threshold");
-    }
+    throw_on_reject(try_add_sell(order, max_sell));
 }
 
 void FinancialInstrument::add_trade(Order && order, uint64_t max_buy, uint64_t max_sell)
 {
-    // Implicitly find the sign of the trade (negative for short, positive for long) by finding a corresponding
-    // buy or sell order.
-    auto buy_match = buy_orders_.find(order.id);
-    if (buy_match != buy_orders_.end() && order == buy_match->second) {
-        order.quantity = (inverted_ ? 1 : -1) * order.quantity;
-    }
-    else {
-        auto sell_match = sell_orders_.find(order.id);
-        if (sell_match != sell_orders_.end() && order == sell_match->second)
-            order.quantity = (inverted_ ? -1 : 1) * order.quantity;
-        else
-            throw std::logic_error("No buy or sell order matching the trade");
-    }
-    trade_orders_[order.id] = order;
-    update_trade();
-    if (buy_side_ >= max_buy || sell_side_ >= max_sell) {
-        trade_orders_.erase(order.id);
-        update_trade();
-        throw std::logic_error("Exceeded max buy or sell quantity threshold");
-    }
+    throw_on_reject(try_add_trade(order, max_buy, max_sell));
 }
 
 bool FinancialInstrument::delete_order(uint64_t id)
 {
-    auto buy_order = buy_orders_.find(id);
-    if (buy_order != buy_orders_.end()) {
+    return delete_order(id, Side::BUY) || delete_order(id, Side::SELL);
+}
+
+bool FinancialInstrument::delete_order(uint64_t id, Side side)
+{
+    if (side == Side::BUY) {
+        auto buy_order = buy_orders_.find(id);
+        if (buy_order == buy_orders_.end())
+            return false;
+        auto quantity = buy_order->second.quantity;
         buy_orders_.erase(buy_order);
-        update_buy();
+        update_buy(-quantity);
         return true;
     }
     auto sell_order = sell_orders_.find(id);
-    if (sell_order != sell_orders_.end()) {
-        sell_orders_.erase(sell_order);
-        update_sell();
-        return true;
-    }
-    return false;
+    if (sell_order == sell_orders_.end())
+        return false;
+    auto quantity = sell_order->second.quantity;
+    sell_orders_.erase(sell_order);
+    update_sell(-quantity);
+    return true;
 }
 
 bool FinancialInstrument::modify_order(uint64_t id, uint64_t quantity, uint64_t max_buy, uint64_t max_sell)
 {
-    auto buy_order = buy_orders_.find(id);
-    if (buy_order != buy_orders_.end()) {
-        auto prev_quantity = buy_orders_[id].quantity;
-        buy_orders_[id].quantity = quantity;
-        update_buy();
-        if (buy_side_ >= max_buy) {
-            buy_orders_[id].quantity = prev_quantity;
-            update_buy();
-            throw std::logic_error("Exceeded max buy quantity threshold");
+    return modify_order(id, Side::BUY, quantity, max_buy, max_sell)
+        || modify_order(id, Side::SELL, quantity, max_buy, max_sell);
+}
+
+bool FinancialInstrument::modify_order(uint64_t id, Side side, uint64_t quantity, uint64_t max_buy, uint64_t max_sell)
+{
+    auto result = try_modify_order(id, side, quantity, max_buy, max_sell);
+    throw_on_reject(result);
+    return result == Result::ACCEPTED;
+}
+
+size_t FinancialInstrument::image_size() const
+{
+    return sizeof(Image) + (buy_orders_.size() + sell_orders_.size() + trade_orders_.size()) * sizeof(Order);
+}
+
+void FinancialInstrument::save(char * out) const
+{
+    auto image = Image{net_pos_, buy_qty_, sell_qty_, buy_side_, sell_side_, static_cast<uint32_t>(buy_orders_.size()),
+                       static_cast<uint32_t>(sell_orders_.size()), static_cast<uint32_t>(trade_orders_.size()),
+                       inverted_};
+    std::memcpy(out, &image, sizeof(image));
+    out += sizeof(image);
+    for (const auto * orders : { &buy_orders_, &sell_orders_, &trade_orders_ }) {
+        for (const auto & entry : *orders) {
+            std::memcpy(out, &entry.second, sizeof(Order));
+            out += sizeof(Order);
         }
-        return true;
     }
-    auto sell_order = sell_orders_.find(id);
-    if (sell_order != sell_orders_.end()) {
-        auto prev_quantity = sell_orders_[id].quantity;
-        sell_orders_[id].quantity = quantity;
-        update_sell();
-        if (sell_side_ >= max_sell) {
-            sell_orders_[id].quantity = prev_quantity;
-            update_sell();
-            throw std::logic_error("Exceeded max sell quantity threshold");
+}
+
+size_t FinancialInstrument::load(const char * data, size_t size)
+{
+    auto image = Image{};
+    if (size < sizeof(image))
+        throw std::runtime_error("Truncated instrument image");
+    std::memcpy(&image, data, sizeof(image));
+    auto orders_size = (size_t{image.buy_count} + image.sell_count + image.trade_count) * sizeof(Order);
+    if (size - sizeof(image) < orders_size)
+        throw std::runtime_error("Truncated instrument image");
+    auto in = data + sizeof(image);
+    auto load_orders = [&](OrderMap & orders, uint32_t count) {
+        orders.clear();
+        orders.reserve(count);
+        for (uint32_t i = 0; i < count; ++i, in += sizeof(Order)) {
+            auto order = Order{};
+            std::memcpy(&order, in, sizeof(order));
+            orders.emplace(order.id, order);
         }
-        return true;
+    };
+    load_orders(buy_orders_, image.buy_count);
+    load_orders(sell_orders_, image.sell_count);
+    load_orders(trade_orders_, image.trade_count);
+
+    net_pos_ = image.net_pos;
+    buy_qty_ = image.buy_qty;
+    sell_qty_ = image.sell_qty;
+    buy_side_ = image.buy_side;
+    sell_side_ = image.sell_side;
+    inverted_ = image.inverted != 0;
+    assert(exposure_consistent());
+    return in - data;
+}
+
+auto FinancialInstrument::sign_trade(Order & order) const -> Result
+{
+    // Implicitly find the sign of the trade (negative for short, positive for long) by finding a corresponding
+    // buy or sell order.
+    auto buy_match = buy_orders_.find(order.id);
+    if (buy_match != buy_orders_.end() && order == buy_match->second) {
+        order.quantity = (inverted_ ? 1 : -1) * order.quantity;
+        return Result::ACCEPTED;
     }
-    return false;
+    auto sell_match = sell_orders_.find(order.id);
+    if (sell_match != sell_orders_.end() && order == sell_match->second) {
+        order.quantity = (inverted_ ? -1 : 1) * order.quantity;
+        return Result::ACCEPTED;
+    }
+    return Result::NO_MATCHING_ORDER;
+}
+
+auto FinancialInstrument::preview(int64_t buy_delta, int64_t sell_delta, int64_t net_delta, uint64_t max_buy,
+                                  uint64_t max_sell) const -> Preview
+{
+    auto buy_side = buy_exposure(buy_qty_ + buy_delta, net_pos_ + net_delta);
+    auto sell_side = sell_exposure(sell_qty_ + sell_delta, net_pos_ + net_delta);
+    if (exceeds(buy_side, max_buy))
+        return { Result::EXCEEDED_MAX_BUY, buy_side, sell_side };
+    if (exceeds(sell_side, max_sell))
+        return { Result::EXCEEDED_MAX_SELL, buy_side, sell_side };
+    return { Result::ACCEPTED, buy_side, sell_side };
+}
+
+bool FinancialInstrument::exposure_consistent() const
+{
+    auto buy_qty = std::accumulate(buy_orders_.cbegin(), buy_orders_.cend(), int64_t{0}, SUM_FUNC);
+    auto sell_qty = std::accumulate(sell_orders_.cbegin(), sell_orders_.cend(), int64_t{0}, SUM_FUNC);
+    auto net_pos = std::accumulate(trade_orders_.cbegin(), trade_orders_.cend(), int64_t{0}, SUM_FUNC);
+    return buy_qty == buy_qty_ && sell_qty == sell_qty_ && net_pos == net_pos_
+        && buy_side_ == buy_exposure(buy_qty, net_pos)
+        && sell_side_ == sell_exposure(sell_qty, net_pos);
 }
 
-void FinancialInstrument::update_buy()
+void FinancialInstrument::update_buy(int64_t delta)
 {
-    buy_qty_ = std::accumulate(buy_orders_.cbegin(), buy_orders_.cend(), 0, SUM_FUNC);
-    buy_side_ = std::max(buy_qty_, net_pos_ + buy_qty_);
+    buy_qty_ += delta;
+    buy_side_ = buy_exposure(buy_qty_, net_pos_);
+    assert(exposure_consistent());
 }
 
-void FinancialInstrument::update_sell()
+void FinancialInstrument::update_sell(int64_t delta)
 {
-    sell_qty_ = std::accumulate(sell_orders_.cbegin(), sell_orders_.cend(), 0, SUM_FUNC);
-    sell_side_ = std::max(sell_qty_, sell_qty_ - net_pos_);
+    sell_qty_ += delta;
+    sell_side_ = sell_exposure(sell_qty_, net_pos_);
+    assert(exposure_consistent());
 }
 
-void FinancialInstrument::update_trade()
+void FinancialInstrument::update_trade(int64_t delta)
 {
-    net_pos_ = std::accumulate(trade_orders_.cbegin(), trade_orders_.cend(), 0, SUM_FUNC);
-    buy_side_ = std::max(buy_qty_, net_pos_ + buy_qty_);
-    sell_side_ = std::max(sell_qty_, sell_qty_ - net_pos_);
+    net_pos_ += delta;
+    buy_side_ = buy_exposure(buy_qty_, net_pos_);
+    sell_side_ = sell_exposure(sell_qty_, net_pos_);
+    assert(exposure_consistent());
 }
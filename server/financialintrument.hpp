@@ -1,10 +1,9 @@
 #ifndef FINANCIALINTRUMENT_HPP
 #define FINANCIALINTRUMENT_HPP
 
+#include "flatmap.hpp"
 #include "../messages.hpp"
 
-#include <unordered_map>
-
 class FinancialInstrument
 {
 public:
@@ -14,6 +13,40 @@ public:
         int64_t quantity;
         uint64_t price;
     };
+    enum class Side : char
+    {
+        BUY = 'B',
+        SELL = 'S',
+    };
+    enum class Result
+    {
+        ACCEPTED,
+        EXCEEDED_MAX_BUY,
+        EXCEEDED_MAX_SELL,
+        NO_MATCHING_ORDER,
+        UNKNOWN_ORDER,
+    };
+
+    // Check-then-commit variants: the exposure the order would lead to is evaluated first and the order maps are only
+    // touched if it stays within the limits. Nothing is thrown, the reason for a rejection is in the returned value.
+    Result try_add_buy(const Order & order, uint64_t max_buy);
+    Result try_add_sell(const Order & order, uint64_t max_sell);
+    Result try_add_trade(Order order, uint64_t max_buy, uint64_t max_sell);
+    Result try_modify_order(uint64_t id, Side side, uint64_t quantity, uint64_t max_buy, uint64_t max_sell);
+
+    // Exposure the instrument would end up with if the matching try_* call were made now. Nothing is applied, this
+    // lets a caller run further checks (e.g. firm-wide limits) before committing.
+    struct Preview
+    {
+        Result result;
+        int64_t buy_side;
+        int64_t sell_side;
+    };
+    Preview preview_add(Side side, const Order & order, uint64_t max_buy, uint64_t max_sell) const;
+    Preview preview_trade(Order order, uint64_t max_buy, uint64_t max_sell) const;
+    Preview preview_modify(uint64_t id, Side side, uint64_t quantity, uint64_t max_buy, uint64_t max_sell) const;
+
+    // Throwing wrappers around the above, std::logic_error is raised on a rejection.
     void add_buy(Order && order, uint64_t max_buy);
     void add_sell(Order && order, uint64_t max_sell);
     void add_trade(Order && order, uint64_t max_buy, uint64_t max_sell);
@@ -21,21 +54,56 @@ public:
     bool delete_order(uint64_t id);
     bool modify_order(uint64_t id, uint64_t quantity, uint64_t max_buy, uint64_t max_sell);
 
-    using OrderMap = std::unordered_map<uint64_t, Order>;
+    // Same as above but skip probing the other side when the caller already knows where the order rests.
+    bool delete_order(uint64_t id, Side side);
+    bool modify_order(uint64_t id, Side side, uint64_t quantity, uint64_t max_buy, uint64_t max_sell);
+
+    using OrderMap = FlatMap<Order>;
     const OrderMap & trades() { return trade_orders_; }
     const OrderMap & buys() { return buy_orders_; }
     const OrderMap & sells() { return sell_orders_; }
 
+    int64_t net_pos() const { return net_pos_; }
+    int64_t buy_side() const { return buy_side_; }
+    int64_t sell_side() const { return sell_side_; }
+
+    // Snapshot image: the counters followed by the buy, sell and trade orders as plain Order arrays, so restoring needs
+    // no decoding. save() writes exactly image_size() bytes, load() returns the number of bytes it read out of at most
+    // `size` and throws std::runtime_error if the image does not fit them.
+    struct Image
+    {
+        int64_t net_pos;
+        int64_t buy_qty;
+        int64_t sell_qty;
+        int64_t buy_side;
+        int64_t sell_side;
+        uint32_t buy_count;
+        uint32_t sell_count;
+        uint32_t trade_count;
+        uint32_t inverted;
+    };
+    size_t image_size() const;
+    void save(char * out) const;
+    size_t load(const char * data, size_t size);
+
+    // Recomputes the exposure from scratch and compares it with the running totals. O(n), meant for debug builds
+    // and tests only - the running totals are kept up to date incrementally on every mutation.
+    bool exposure_consistent() const;
+
 private:
-    void update_buy();
-    void update_sell();
-    void update_trade();
-
-    int64_t net_pos_;
-    int64_t buy_qty_;
-    int64_t sell_qty_;
-    int64_t buy_side_;
-    int64_t sell_side_;
+    Result sign_trade(Order & order) const;
+    Preview preview(int64_t buy_delta, int64_t sell_delta, int64_t net_delta, uint64_t max_buy,
+                    uint64_t max_sell) const;
+
+    void update_buy(int64_t delta);
+    void update_sell(int64_t delta);
+    void update_trade(int64_t delta);
+
+    int64_t net_pos_ = 0;
+    int64_t buy_qty_ = 0;
+    int64_t sell_qty_ = 0;
+    int64_t buy_side_ = 0;
+    int64_t sell_side_ = 0;
 
     OrderMap trade_orders_;
     OrderMap buy_orders_;
@@ -0,0 +1,57 @@
+#include "firmlimits.hpp"
+
+namespace
+{
+// Adds a positive delta only if the result stays below the limit.
+bool reserve(std::atomic<int64_t> & counter, int64_t delta, int64_t limit)
+{
+    auto current = counter.load(std::memory_order_relaxed);
+    do {
+        if (current + delta >= limit)
+            return false;
+    } while (!counter.compare_exchange_weak(current, current + delta, std::memory_order_acq_rel,
+                                            std::memory_order_relaxed));
+    return true;
+}
+} // unnamed namespace
+
+FirmLimits::FirmLimits(uint64_t max_buy, uint64_t max_sell)
+    : max_buy_(static_cast<int64_t>(max_buy))
+    , max_sell_(static_cast<int64_t>(max_sell))
+{
+}
+
+auto FirmLimits::exposure(uint64_t listing_id) -> Exposure &
+{
+    auto & shard = shards_[listing_id % SHARD_COUNT];
+    auto lock = std::lock_guard<std::mutex>(shard.mutex);
+    auto & exposure = shard.listings[listing_id];
+    if (!exposure)
+        exposure = std::make_unique<Exposure>();
+    return *exposure;
+}
+
+bool FirmLimits::try_apply(Exposure & exposure, int64_t buy_delta, int64_t sell_delta)
+{
+    // Reserve the increases first so a rejection never has to undo a decrease
+    if (buy_delta > 0 && !reserve(exposure.buy_side, buy_delta, max_buy_))
+        return false;
+    if (sell_delta > 0 && !reserve(exposure.sell_side, sell_delta, max_sell_)) {
+        if (buy_delta > 0)
+            exposure.buy_side.fetch_sub(buy_delta, std::memory_order_acq_rel);
+        return false;
+    }
+    if (buy_delta < 0)
+        exposure.buy_side.fetch_add(buy_delta, std::memory_order_acq_rel);
+    if (sell_delta < 0)
+        exposure.sell_side.fetch_add(sell_delta, std::memory_order_acq_rel);
+    return true;
+}
+
+void FirmLimits::apply(Exposure & exposure, int64_t buy_delta, int64_t sell_delta)
+{
+    if (buy_delta != 0)
+        exposure.buy_side.fetch_add(buy_delta, std::memory_order_acq_rel);
+    if (sell_delta != 0)
+        exposure.sell_side.fetch_add(sell_delta, std::memory_order_acq_rel);
+}
@@ -0,0 +1,50 @@
+#ifndef FIRMLIMITS_HPP
+#define FIRMLIMITS_HPP
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+// Per-listing exposure aggregated over every client session, checked against firm-wide limits. Each session adds
+// the change of its own buy and sell side to the shared counters.
+//
+// The counters are lock-free atomics, updated with a compare-and-swap so concurrent sessions never push a listing
+// past the limit. The only locking is on the sharded listing registry, which a session goes through once per
+// listing to obtain a stable reference to its counters; the hot path touches atomics only.
+class FirmLimits
+{
+public:
+    struct alignas(64) Exposure // one cache line per listing to avoid false sharing between listings
+    {
+        std::atomic<int64_t> buy_side{0};
+        std::atomic<int64_t> sell_side{0};
+    };
+
+    FirmLimits(uint64_t max_buy, uint64_t max_sell);
+
+    // The returned reference stays valid for the lifetime of this object.
+    Exposure & exposure(uint64_t listing_id);
+
+    // Applies both deltas if the increases fit within the firm limits, otherwise leaves the counters unchanged.
+    // Decreases are always accepted.
+    bool try_apply(Exposure & exposure, int64_t buy_delta, int64_t sell_delta);
+    void apply(Exposure & exposure, int64_t buy_delta, int64_t sell_delta);
+
+private:
+    static const size_t SHARD_COUNT = 64;
+
+    struct Shard
+    {
+        std::mutex mutex;
+        std::unordered_map<uint64_t, std::unique_ptr<Exposure>> listings;
+    };
+
+    std::array<Shard, SHARD_COUNT> shards_;
+    int64_t max_buy_;
+    int64_t max_sell_;
+};
+
+#endif //FIRMLIMITS_HPP
@@ -0,0 +1,190 @@
+#ifndef FLATMAP_HPP
+#define FLATMAP_HPP
+
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+// Open-addressing hash map keyed by uint64_t. Values are kept densely packed in a single vector (deleting swaps the
+// last entry into the hole), while a separate power-of-two slot array maps keys to positions in it using linear
+// probing with backward-shift deletion, so there are no tombstones to clean up. Neither array is ever shrunk, hence
+// once a table has grown to its working size inserts and deletes do not allocate.
+//
+// Iteration yields std::pair<uint64_t, Value> in no particular order. Any insert or erase invalidates iterators.
+template<typename Value>
+class FlatMap
+{
+public:
+    using key_type = uint64_t;
+    using mapped_type = Value;
+    using value_type = std::pair<uint64_t, Value>;
+    using iterator = typename std::vector<value_type>::iterator;
+    using const_iterator = typename std::vector<value_type>::const_iterator;
+
+    FlatMap() = default;
+
+    iterator begin() { return entries_.begin(); }
+    iterator end() { return entries_.end(); }
+    const_iterator begin() const { return entries_.begin(); }
+    const_iterator end() const { return entries_.end(); }
+    const_iterator cbegin() const { return entries_.cbegin(); }
+    const_iterator cend() const { return entries_.cend(); }
+
+    size_t size() const { return entries_.size(); }
+    bool empty() const { return entries_.empty(); }
+
+    iterator find(uint64_t key)
+    {
+        auto slot = find_slot(key);
+        return slot == NOT_FOUND ? entries_.end() : entries_.begin() + slots_[slot].index;
+    }
+
+    const_iterator find(uint64_t key) const
+    {
+        auto slot = find_slot(key);
+        return slot == NOT_FOUND ? entries_.cend() : entries_.cbegin() + slots_[slot].index;
+    }
+
+    Value & at(uint64_t key)
+    {
+        auto it = find(key);
+        if (it == end())
+            throw std::out_of_range("FlatMap::at");
+        return it->second;
+    }
+
+    const Value & at(uint64_t key) const
+    {
+        auto it = find(key);
+        if (it == end())
+            throw std::out_of_range("FlatMap::at");
+        return it->second;
+    }
+
+    std::pair<iterator, bool> try_emplace(uint64_t key, const Value & value)
+    {
+        if ((entries_.size() + 1) * MAX_LOAD_DEN > slots_.size() * MAX_LOAD_NUM)
+            rehash(slots_.empty() ? MIN_CAPACITY : slots_.size() * 2);
+
+        auto slot = home_slot(key);
+        while (slots_[slot].index != EMPTY) {
+            if (slots_[slot].key == key)
+                return { entries_.begin() + slots_[slot].index, false };
+            slot = (slot + 1) & mask_;
+        }
+        slots_[slot] = { key, static_cast<uint32_t>(entries_.size()) };
+        entries_.emplace_back(key, value);
+        return { entries_.end() - 1, true };
+    }
+
+    Value & operator[](uint64_t key) { return try_emplace(key, Value{}).first->second; }
+
+    std::pair<iterator, bool> emplace(uint64_t key, const Value & value) { return try_emplace(key, value); }
+
+    size_t erase(uint64_t key)
+    {
+        auto slot = find_slot(key);
+        if (slot == NOT_FOUND)
+            return 0;
+        erase_slot(slot);
+        return 1;
+    }
+
+    void erase(const_iterator it) { erase(it->first); }
+
+    // Pre-size both arrays so that the first `count` inserts never reallocate.
+    void reserve(size_t count)
+    {
+        entries_.reserve(count);
+        auto capacity = slots_.empty() ? MIN_CAPACITY : slots_.size();
+        while (count * MAX_LOAD_DEN > capacity * MAX_LOAD_NUM)
+            capacity *= 2;
+        if (capacity != slots_.size())
+            rehash(capacity);
+    }
+
+    // Drops all entries but keeps the memory around for reuse.
+    void clear()
+    {
+        entries_.clear();
+        for (auto & slot : slots_)
+            slot.index = EMPTY;
+    }
+
+private:
+    struct Slot
+    {
+        uint64_t key;
+        uint32_t index;
+    };
+
+    static constexpr uint32_t EMPTY = UINT32_MAX;
+    static constexpr size_t NOT_FOUND = SIZE_MAX;
+    static constexpr size_t MIN_CAPACITY = 16;
+    static constexpr size_t MAX_LOAD_NUM = 3; // grow past a 3/4 load factor
+    static constexpr size_t MAX_LOAD_DEN = 4;
+
+    // Fibonacci hashing spreads the mostly sequential order ids over the whole table.
+    size_t home_slot(uint64_t key) const { return (key * 0x9E3779B97F4A7C15ull) >> shift_; }
+
+    size_t find_slot(uint64_t key) const
+    {
+        if (entries_.empty())
+            return NOT_FOUND;
+        auto slot = home_slot(key);
+        while (slots_[slot].index != EMPTY) {
+            if (slots_[slot].key == key)
+                return slot;
+            slot = (slot + 1) & mask_;
+        }
+        return NOT_FOUND;
+    }
+
+    void erase_slot(size_t slot)
+    {
+        // Fill the hole in the dense array with the last entry and repoint its slot.
+        auto index = slots_[slot].index;
+        auto last = static_cast<uint32_t>(entries_.size() - 1);
+        if (index != last) {
+            entries_[index] = std::move(entries_[last]);
+            slots_[find_slot(entries_[index].first)].index = index;
+        }
+        entries_.pop_back();
+
+        // Backward-shift the rest of the probe chain so lookups never need tombstones.
+        auto hole = slot;
+        auto next = (hole + 1) & mask_;
+        while (slots_[next].index != EMPTY) {
+            auto home = home_slot(slots_[next].key);
+            if (((next - home) & mask_) >= ((next - hole) & mask_)) {
+                slots_[hole] = slots_[next];
+                hole = next;
+            }
+            next = (next + 1) & mask_;
+        }
+        slots_[hole].index = EMPTY;
+    }
+
+    void rehash(size_t capacity)
+    {
+        slots_.assign(capacity, Slot{0, EMPTY});
+        mask_ = capacity - 1;
+        shift_ = 64;
+        for (auto c = capacity; c > 1; c >>= 1)
+            --shift_;
+        for (uint32_t index = 0; index < entries_.size(); ++index) {
+            auto slot = home_slot(entries_[index].first);
+            while (slots_[slot].index != EMPTY)
+                slot = (slot + 1) & mask_;
+            slots_[slot] = { entries_[index].first, index };
+        }
+    }
+
+    std::vector<value_type> entries_;
+    std::vector<Slot> slots_;
+    size_t mask_ = 0;
+    unsigned shift_ = 64;
+};
+
+#endif //FLATMAP_HPP
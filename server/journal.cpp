@@ -0,0 +1,384 @@
+#include "journal.hpp"
+#include "../messages.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+const char * SEGMENT_PREFIX = "journal-";
+const char * SEGMENT_SUFFIX = ".seg";
+
+size_t padded_size(size_t size)
+{
+    return (sizeof(Journal::RecordHeader) + size + 7) & ~size_t{7};
+}
+
+// CRC32C (Castagnoli), which SSE 4.2 computes eight bytes per instruction
+std::array<uint32_t, 256> make_crc32c_table()
+{
+    auto table = std::array<uint32_t, 256>{};
+    for (uint32_t byte = 0; byte < 256; ++byte) {
+        auto crc = byte;
+        for (int bit = 0; bit < 8; ++bit)
+            crc = crc & 1 ? (crc >> 1) ^ 0x82F63B78 : crc >> 1;
+        table[byte] = crc;
+    }
+    return table;
+}
+
+uint32_t crc32c_table(uint32_t crc, const char * data, size_t size)
+{
+    static const auto table = make_crc32c_table();
+    for (size_t i = 0; i < size; ++i)
+        crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) uint32_t crc32c_sse42(uint32_t crc, const char * data, size_t size)
+{
+    uint64_t wide = crc;
+    for (; size >= sizeof(uint64_t); size -= sizeof(uint64_t), data += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, data, sizeof(word));
+        wide = __builtin_ia32_crc32di(wide, word);
+    }
+    crc = static_cast<uint32_t>(wide);
+    for (; size != 0; --size, ++data)
+        crc = __builtin_ia32_crc32qi(crc, static_cast<uint8_t>(*data));
+    return crc;
+}
+#endif
+
+uint32_t crc32c(uint32_t crc, const char * data, size_t size)
+{
+#if defined(__x86_64__)
+    static const auto hardware = __builtin_cpu_supports("sse4.2");
+    if (hardware)
+        return crc32c_sse42(crc, data, size);
+#endif
+    return crc32c_table(crc, data, size);
+}
+
+uint32_t checksum(Journal::RecordHeader record, const char * data)
+{
+    record.checksum = 0;
+    auto crc = crc32c(~uint32_t{0}, reinterpret_cast<const char *>(&record), sizeof(record));
+    return ~crc32c(crc, data, record.size);
+}
+
+bool complete(const Journal::RecordHeader & record, const char * data)
+{
+    switch (record.kind) {
+        case Journal::RecordKind::OPEN:
+        case Journal::RecordKind::CLOSE:
+            return record.size == 0;
+        case Journal::RecordKind::MESSAGE: {
+            // A frame is only complete if its own size agrees with the record
+            if (record.size < sizeof(Messages::Header))
+                return false;
+            uint16_t payload_size;
+            std::memcpy(&payload_size, data + offsetof(Messages::Header, payloadSize), sizeof(payload_size));
+            return sizeof(Messages::Header) + payload_size == record.size;
+        }
+        default:
+            return false;
+    }
+}
+} // unnamed namespace
+
+Journal::Journal(JournalOptions options)
+    : options_(std::move(options))
+{
+    std::filesystem::create_directories(options_.directory);
+    auto existing = segments(options_.directory);
+    next_index_ = existing.empty() ? 0 : existing.back().first + 1;
+    current_ = create_segment(next_index_++);
+    notify_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (notify_fd_ == -1) {
+        release(current_);
+        throw std::runtime_error("Could not create the journal notifications");
+    }
+    flusher_ = std::thread([this]() { run(); });
+}
+
+Journal::~Journal()
+{
+    {
+        auto lock = std::lock_guard<std::mutex>(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_one();
+    flusher_.join();
+
+    // Trim the preallocated tail, the unused prepared segment is not needed at all
+    [[maybe_unused]] auto truncated = ftruncate(current_.fd, offset_);
+    fdatasync(current_.fd);
+    release(current_);
+    if (next_.fd != -1) {
+        unlink(next_.path.c_str());
+        release(next_);
+    }
+    ::close(notify_fd_);
+}
+
+void Journal::append(uint64_t session, RecordKind kind, const char * data, size_t size)
+{
+    auto record_size = padded_size(size);
+    if (record_size > options_.segment_size)
+        throw std::logic_error("Journal record larger than a segment");
+    if (offset_ + record_size > current_.size)
+        rotate();
+
+    // The header goes in last, so a record is never seen before its data has been written
+    auto record = current_.data + offset_;
+    if (size != 0)
+        std::memcpy(record + sizeof(RecordHeader), data, size);
+    auto header = RecordHeader{session, kind, static_cast<uint32_t>(size)};
+    header.checksum = checksum(header, data);
+    std::memcpy(record, &header, sizeof(header));
+    offset_ += record_size;
+    appended_.store(appended_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+
+    if (++ungrouped_ >= options_.group_size) {
+        ungrouped_ = 0;
+        {
+            auto lock = std::lock_guard<std::mutex>(mutex_);
+            sync_requested_ = true;
+        }
+        wake_.notify_one();
+    }
+}
+
+void Journal::rotate()
+{
+    auto lock = std::unique_lock<std::mutex>(mutex_);
+    if (next_.fd == -1) {
+        // The flusher fell behind, create the segment here rather than wait for it. A segment it is still creating
+        // gets a later index once it is done.
+        auto index = next_index_++;
+        lock.unlock();
+        auto segment = create_segment(index);
+        lock.lock();
+        next_ = std::move(segment);
+    }
+    retired_.push_back(std::move(current_));
+    current_ = std::move(next_);
+    next_ = Segment{};
+    offset_ = 0;
+    sync_requested_ = true; // sync the retired segment and prepare the next one
+    lock.unlock();
+    wake_.notify_one();
+}
+
+void Journal::sync()
+{
+    auto target = appended_.load(std::memory_order_acquire);
+    auto lock = std::unique_lock<std::mutex>(mutex_);
+    sync_requested_ = true;
+    wake_.notify_one();
+    synced_.wait(lock, [&]() { return durable_.load(std::memory_order_relaxed) >= target; });
+}
+
+void Journal::request_sync()
+{
+    {
+        auto lock = std::lock_guard<std::mutex>(mutex_);
+        sync_requested_ = true;
+    }
+    wake_.notify_one();
+}
+
+void Journal::run()
+{
+    auto lock = std::unique_lock<std::mutex>(mutex_);
+    while (true) {
+        wake_.wait_for(lock, options_.window, [&]() { return sync_requested_ || stopping_; });
+        sync_requested_ = false;
+        auto stopping = stopping_;
+
+        // Every record counted here is in a retired segment or the current one, as rotating takes the lock
+        auto target = appended_.load(std::memory_order_acquire);
+        auto retired = std::move(retired_);
+        retired_.clear();
+        auto current_fd = current_.fd;
+        auto sync_current = target > durable_.load(std::memory_order_relaxed);
+        auto prepare = next_.fd == -1 && !stopping;
+        auto index = prepare ? next_index_++ : 0;
+        lock.unlock();
+
+        // Only this thread closes segments, so current_fd stays open even if the segment is rotated out meanwhile
+        for (auto & segment : retired) {
+            fdatasync(segment.fd);
+            release(segment);
+        }
+        if (sync_current)
+            fdatasync(current_fd);
+        auto prepared = Segment{};
+        if (prepare) {
+            try {
+                prepared = create_segment(index);
+            }
+            catch (const std::runtime_error & err) {
+                std::cerr << "[WARN] " << err.what() << "\n"; // rotate() will try again
+            }
+        }
+
+        lock.lock();
+        while (prepared.fd != -1 && prepared.index < current_.index) {
+            // A rotation overtook the preparation and created a later segment itself, segments are used in order
+            auto later = next_index_++;
+            lock.unlock();
+            renumber_segment(prepared, later);
+            lock.lock();
+        }
+        if (prepared.fd != -1)
+            next_ = std::move(prepared);
+        if (target > durable_.load(std::memory_order_relaxed)) {
+            durable_.store(target, std::memory_order_release);
+            uint64_t one = 1;
+            [[maybe_unused]] auto written = write(notify_fd_, &one, sizeof(one));
+        }
+        synced_.notify_all();
+        if (stopping)
+            return;
+    }
+}
+
+auto Journal::create_segment(uint64_t index) const -> Segment
+{
+    auto segment = Segment{};
+    segment.index = index;
+    segment.path = segment_path(index);
+    segment.size = options_.segment_size;
+    segment.fd = ::open(segment.path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (segment.fd == -1)
+        throw std::runtime_error("Could not create journal segment " + segment.path);
+
+    // Allocate the blocks and fault the pages in now, so appending never waits for either
+    if (posix_fallocate(segment.fd, 0, segment.size) != 0) {
+        release(segment);
+        throw std::runtime_error("Could not preallocate journal segment " + segment.path);
+    }
+    auto data = mmap(nullptr, segment.size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, segment.fd, 0);
+    if (data == MAP_FAILED) {
+        release(segment);
+        throw std::runtime_error("Could not map journal segment " + segment.path);
+    }
+    segment.data = static_cast<char *>(data);
+    sync_directory(); // make the new file itself durable
+    return segment;
+}
+
+void Journal::renumber_segment(Segment & segment, uint64_t index) const
+{
+    auto path = segment_path(index);
+    if (rename(segment.path.c_str(), path.c_str()) != 0) {
+        std::cerr << "[WARN] Could not rename journal segment " << segment.path << "\n"; // rotate() will create one
+        unlink(segment.path.c_str());
+        release(segment);
+        return;
+    }
+    segment.index = index;
+    segment.path = std::move(path);
+    sync_directory();
+}
+
+std::string Journal::segment_path(uint64_t index) const
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "%s%08llu%s", SEGMENT_PREFIX, static_cast<unsigned long long>(index),
+                  SEGMENT_SUFFIX);
+    return (std::filesystem::path(options_.directory) / name).string();
+}
+
+void Journal::sync_directory() const
+{
+    auto directory = ::open(options_.directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (directory != -1) {
+        fsync(directory);
+        ::close(directory);
+    }
+}
+
+void Journal::release(Segment & segment)
+{
+    if (segment.data)
+        munmap(segment.data, segment.size);
+    if (segment.fd != -1)
+        ::close(segment.fd);
+    segment.data = nullptr;
+    segment.fd = -1;
+}
+
+auto Journal::segments(const std::string & directory) -> std::vector<std::pair<uint64_t, std::string>>
+{
+    auto found = std::vector<std::pair<uint64_t, std::string>>{};
+    if (!std::filesystem::is_directory(directory))
+        return found;
+    for (const auto & entry : std::filesystem::directory_iterator(directory)) {
+        auto name = entry.path().filename().string();
+        if (name.rfind(SEGMENT_PREFIX, 0) == 0 && entry.path().extension() == SEGMENT_SUFFIX)
+            found.emplace_back(std::stoull(name.substr(std::strlen(SEGMENT_PREFIX))), entry.path().string());
+    }
+    std::sort(found.begin(), found.end());
+    return found;
+}
+
+void Journal::read(const std::string & directory, const Visitor & visit, Position from)
+{
+    for (const auto & [index, path] : segments(directory)) {
+        if (index < from.segment)
+            continue;
+        auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+            throw std::runtime_error("Could not open journal segment " + path);
+        struct stat status{};
+        fstat(fd, &status);
+        auto size = static_cast<size_t>(status.st_size);
+        if (size == 0) {
+            ::close(fd);
+            continue;
+        }
+        auto mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED)
+            throw std::runtime_error("Could not map journal segment " + path);
+
+        auto data = static_cast<const char *>(mapped);
+        size_t offset = index == from.segment ? from.offset : 0;
+        while (offset + sizeof(RecordHeader) <= size) {
+            RecordHeader record;
+            std::memcpy(&record, data + offset, sizeof(record));
+            auto record_size = padded_size(record.size);
+            if (record.kind == RecordKind::END || offset + record_size > size
+                || !complete(record, data + offset + sizeof(record))
+                || record.checksum != checksum(record, data + offset + sizeof(record)))
+                break;
+            visit(record, data + offset + sizeof(record));
+            offset += record_size;
+        }
+        munmap(mapped, size);
+    }
+}
+
+void Journal::prune(const std::string & directory, uint64_t before)
+{
+    for (const auto & [index, path] : segments(directory)) {
+        if (index >= before)
+            break;
+        std::filesystem::remove(path);
+    }
+}
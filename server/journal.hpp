@@ -0,0 +1,139 @@
+#ifndef JOURNAL_HPP
+#define JOURNAL_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+struct JournalOptions
+{
+    std::string directory; // an empty directory disables the journal
+    size_t segment_size = 64 * 1024 * 1024;
+
+    // Group commit: the flusher syncs once this many records have been appended, or once the window has passed. The
+    // server holds the responses of a connection until the records they answer are durable and asks for a sync at the
+    // end of every loop iteration that held one, so an acknowledged order is never lost to a crash.
+    size_t group_size = 1024;
+    std::chrono::microseconds window{1000};
+};
+
+// Append-only log of the inbound session traffic, so the risk state can be rebuilt after a restart.
+//
+// Records are copied into a memory-mapped segment file that was preallocated and faulted in ahead of time. Appending
+// is a memcpy and never blocks on the disk. A background flusher makes the records durable with one fdatasync per
+// group of records or time window, and prepares the next segment so rotating is just a pointer swap. The segments are
+// named journal-<index>.seg and a new journal always starts a new segment after the existing ones.
+//
+// Only the appending thread may call open(), close() and append().
+class Journal
+{
+public:
+    enum class RecordKind : uint32_t
+    {
+        END = 0, // unwritten, zero-filled space at the end of a segment
+        OPEN = 1,
+        MESSAGE = 2, // followed by the raw wire frame
+        CLOSE = 3,
+    };
+
+    struct RecordHeader
+    {
+        uint64_t session;
+        RecordKind kind;
+        uint32_t size;         // bytes following the header, records are padded to 8 bytes
+        uint32_t checksum = 0; // CRC32C of the header, with a checksum of 0, and of the bytes following it
+        uint32_t reserved = 0;
+    };
+
+    // Where the next record goes, e.g. to replay only what was journaled after a snapshot.
+    struct Position
+    {
+        uint64_t segment;
+        uint64_t offset;
+    };
+
+    explicit Journal(JournalOptions options);
+    ~Journal(); // makes every record durable
+    Journal(const Journal &) = delete;
+    Journal & operator=(const Journal &) = delete;
+
+    void open(uint64_t session) { append(session, RecordKind::OPEN, nullptr, 0); }
+    void close(uint64_t session) { append(session, RecordKind::CLOSE, nullptr, 0); }
+    void append(uint64_t session, const char * frame, size_t size)
+    {
+        append(session, RecordKind::MESSAGE, frame, size);
+    }
+
+    // Blocks until every record appended so far is durable.
+    void sync();
+    // Has the flusher sync what was appended so far without waiting for it.
+    void request_sync();
+
+    // Records appended so far, and how many of them are known to be durable
+    uint64_t appended() const { return appended_.load(std::memory_order_acquire); }
+    uint64_t durable() const { return durable_.load(std::memory_order_acquire); }
+    // Readable (an eventfd) whenever more records have become durable
+    int notify_fd() const { return notify_fd_; }
+
+    Position position() const { return { current_.index, offset_ }; }
+
+    // Calls visit(record, data) for every record in the segments of `directory` from position `from` on, oldest
+    // first. Reading a segment stops at the first record that is incomplete or fails its checksum, e.g. because it was
+    // not yet synced when the process died.
+    using Visitor = std::function<void(const RecordHeader & record, const char * data)>;
+    static void read(const std::string & directory, const Visitor & visit, Position from = {0, 0});
+
+    // Removes the segments of `directory` before segment `before`, e.g. once no snapshot left needs them replayed.
+    static void prune(const std::string & directory, uint64_t before);
+
+private:
+    struct Segment
+    {
+        uint64_t index = 0;
+        std::string path;
+        int fd = -1;
+        char * data = nullptr;
+        size_t size = 0;
+    };
+
+    void append(uint64_t session, RecordKind kind, const char * data, size_t size);
+    void rotate();
+    Segment create_segment(uint64_t index) const;
+    void renumber_segment(Segment & segment, uint64_t index) const;
+    std::string segment_path(uint64_t index) const;
+    void sync_directory() const;
+    static std::vector<std::pair<uint64_t, std::string>> segments(const std::string & directory);
+    static void release(Segment & segment);
+    void run();
+
+    JournalOptions options_;
+
+    // Owned by the appending thread, which only changes current_ under the mutex
+    Segment current_;
+    size_t offset_ = 0;
+    size_t ungrouped_ = 0; // records since the flusher was last woken up
+
+    std::atomic<uint64_t> appended_{0}; // records appended so far
+
+    // Shared with the flusher
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable synced_;
+    std::vector<Segment> retired_; // rotated out, still to be synced and unmapped
+    Segment next_;                 // prepared ahead of the next rotation
+    uint64_t next_index_;
+    std::atomic<uint64_t> durable_{0}; // records known to be on disk, only advanced under the mutex
+    bool sync_requested_ = false;
+    bool stopping_ = false;
+    std::thread flusher_;
+    int notify_fd_ = -1;
+};
+
+#endif //JOURNAL_HPP
@@ -0,0 +1,53 @@
+#include "latency.hpp"
+
+#include <cmath>
+#include <iomanip>
+
+namespace
+{
+const char * STAGE_NAMES[LatencyStats::STAGES] = {"read-decode", "decode-consume", "consume-send"};
+} // unnamed namespace
+
+uint64_t LatencyHistogram::highest(size_t index)
+{
+    if (index < SUB_BUCKETS)
+        return index;
+    auto exponent = static_cast<unsigned>(index / SUB_BUCKETS) + SUB_BITS - 1;
+    auto shift = exponent - SUB_BITS;
+    auto lowest = (SUB_BUCKETS + index % SUB_BUCKETS) << shift;
+    return lowest + (uint64_t{1} << shift) - 1;
+}
+
+uint64_t LatencyHistogram::percentile(double percent) const
+{
+    if (count_ == 0)
+        return 0;
+    auto rank = static_cast<uint64_t>(std::ceil(percent / 100.0 * static_cast<double>(count_)));
+    rank = rank == 0 ? 1 : rank;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; ++i) {
+        seen += counts_[i];
+        if (seen >= rank)
+            return i + 1 < BUCKETS && highest(i) < max_ ? highest(i) : max_; // the last bucket has no upper bound
+    }
+    return max_;
+}
+
+void LatencyStats::print_heading(std::ostream & out)
+{
+    out << std::left << std::setw(22) << "subject" << std::setw(16) << "stage" << std::right << std::setw(10)
+        << "count" << std::setw(12) << "msgs/s" << std::setw(10) << "p50 ns" << std::setw(10) << "p99 ns"
+        << std::setw(11) << "p99.9 ns" << std::setw(12) << "max ns" << "\n";
+}
+
+void LatencyStats::print(std::ostream & out, const char * subject, uint64_t interval) const
+{
+    for (size_t i = 0; i < STAGES; ++i) {
+        const auto & histogram = stages_[i];
+        auto rate = interval != 0 ? static_cast<double>(histogram.count()) * 1e9 / static_cast<double>(interval) : 0.0;
+        out << std::left << std::setw(22) << subject << std::setw(16) << STAGE_NAMES[i] << std::right
+            << std::setw(10) << histogram.count() << std::setw(12) << std::fixed << std::setprecision(1) << rate
+            << std::setw(10) << histogram.percentile(50) << std::setw(10) << histogram.percentile(99)
+            << std::setw(11) << histogram.percentile(99.9) << std::setw(12) << histogram.max() << "\n";
+    }
+}
@@ -0,0 +1,102 @@
+#ifndef LATENCY_HPP
+#define LATENCY_HPP
+
+#include "../messages.hpp"
+
+#include <array>
+#include <cstdint>
+#include <ostream>
+#include <time.h>
+
+// Monotonic nanoseconds, comparable between threads. Served from the vDSO, so reading it is a few tens of
+// nanoseconds and never a system call.
+struct LatencyClock
+{
+    static uint64_t now()
+    {
+        timespec time;
+        clock_gettime(CLOCK_MONOTONIC, &time);
+        return static_cast<uint64_t>(time.tv_sec) * 1'000'000'000 + static_cast<uint64_t>(time.tv_nsec);
+    }
+};
+
+// Fixed-size histogram of nanosecond latencies in the style of HdrHistogram: values below 16 get a bucket each, above
+// that every power of two is split into 16 buckets, so a percentile is within 1/16 of the true value. Values beyond
+// ~68 s share the last bucket, the maximum is kept exactly. Recording is an index computation and two increments.
+//
+// Not synchronised, each histogram has a single thread writing and reading it.
+class LatencyHistogram
+{
+public:
+    void record(uint64_t nanoseconds)
+    {
+        ++counts_[index(nanoseconds)];
+        ++count_;
+        max_ = nanoseconds > max_ ? nanoseconds : max_;
+    }
+
+    uint64_t count() const { return count_; }
+    uint64_t max() const { return max_; }
+
+    // Highest value that falls in the same bucket as the given percentile (0 to 100) of the recorded ones, 0 when
+    // nothing was recorded.
+    uint64_t percentile(double percent) const;
+
+private:
+    static constexpr unsigned SUB_BITS = 4;
+    static constexpr uint64_t SUB_BUCKETS = uint64_t{1} << SUB_BITS;
+    static constexpr unsigned MAX_EXPONENT = 35; // largest power of two with buckets of its own
+    static constexpr size_t BUCKETS = (MAX_EXPONENT - SUB_BITS + 2) * SUB_BUCKETS;
+
+    static size_t index(uint64_t value)
+    {
+        if (value < SUB_BUCKETS)
+            return value;
+        unsigned exponent = 63 - __builtin_clzll(value);
+        if (exponent > MAX_EXPONENT)
+            return BUCKETS - 1;
+        auto shift = exponent - SUB_BITS;
+        return (exponent - SUB_BITS + 1) * SUB_BUCKETS + ((value >> shift) & (SUB_BUCKETS - 1));
+    }
+    static uint64_t highest(size_t index);
+
+    std::array<uint64_t, BUCKETS> counts_{};
+    uint64_t count_ = 0;
+    uint64_t max_ = 0;
+};
+
+// When a message reached each point the server measures between, in LatencyClock nanoseconds.
+struct LatencyTrace
+{
+    uint16_t type = 0; // message type
+    uint64_t read = 0;
+    uint64_t decoded = 0;
+    uint64_t consumed = 0;
+};
+
+// The three stages a message goes through in the server, read-to-decode, decode-to-consume (including the hand-over
+// to a risk worker) and consume-to-send (until the response has been written to the socket).
+class LatencyStats
+{
+public:
+    using Stage = Messages::StatsResponse::Stage;
+    static constexpr size_t STAGES = 3;
+
+    void record(const LatencyTrace & trace, uint64_t sent)
+    {
+        stages_[0].record(trace.decoded - trace.read);
+        stages_[1].record(trace.consumed - trace.decoded);
+        stages_[2].record(sent - trace.consumed);
+    }
+
+    const LatencyHistogram & stage(Stage stage) const { return stages_[static_cast<size_t>(stage)]; }
+
+    // One row per stage: count, throughput over `interval` nanoseconds and the percentiles.
+    void print(std::ostream & out, const char * subject, uint64_t interval) const;
+    static void print_heading(std::ostream & out);
+
+private:
+    std::array<LatencyHistogram, STAGES> stages_;
+};
+
+#endif //LATENCY_HPP
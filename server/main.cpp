@@ -1,11 +1,37 @@
 #include "server.hpp"
 
+#include <csignal>
+#include <cstring>
 #include <iostream>
+#include <pthread.h>
 
-int main()
+int main(int argc, char * argv[])
 {
+    // Shared-memory sessions and drop-copy subscribers, and the statistics per session, are only there when asked for
+    auto shared_memory = false;
+    auto session_stats = false;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--shm") == 0) {
+            shared_memory = true;
+        }
+        else if (std::strcmp(argv[i], "--session-stats") == 0) {
+            session_stats = true;
+        }
+        else {
+            std::cerr << "Usage: server [--shm] [--session-stats]\n";
+            return 1;
+        }
+    }
+
+    // The server reads SIGUSR1 from a descriptor. Blocked before the server starts any thread, which all inherit it.
+    auto signals = sigset_t{};
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
     try {
-        std::string max_buy, max_sell;
+        std::string max_buy, max_sell, firm_max_buy, firm_max_sell, workers, max_connections, journal,
+            snapshot_interval, busy_poll_cpu, backend, drop_copy_port, drop_copy_policy, session_linger;
 
         std::cout << "Enter max buy threshold: ";
         std::cin >> max_buy;
@@ -13,7 +39,60 @@ int main()
         std::cout << "Enter max sell threshold: ";
         std::cin >> max_sell;
 
-        auto server = Server(std::stoull(max_buy), std::stoull(max_sell));
+        std::cout << "Enter firm-wide max buy threshold (0 to disable): ";
+        std::cin >> firm_max_buy;
+
+        std::cout << "Enter firm-wide max sell threshold (0 to disable): ";
+        std::cin >> firm_max_sell;
+
+        std::cout << "Enter number of risk worker threads (0 to run on the network thread): ";
+        std::cin >> workers;
+
+        std::cout << "Enter max concurrent connections: ";
+        std::cin >> max_connections;
+
+        std::cout << "Enter journal directory (- to disable): ";
+        std::cin >> journal;
+
+        std::cout << "Enter snapshot interval in seconds (0 to disable): ";
+        std::cin >> snapshot_interval;
+
+        std::cout << "Enter a core to busy-poll on (-1 to sleep in between events): ";
+        std::cin >> busy_poll_cpu;
+
+        std::cout << "Enter the socket I/O backend (epoll or io_uring): ";
+        std::cin >> backend;
+
+        std::cout << "Enter the drop-copy port (0 to disable): ";
+        std::cin >> drop_copy_port;
+
+        std::cout << "Enter what happens to a slow drop-copy subscriber (drop or conflate): ";
+        std::cin >> drop_copy_policy;
+
+        std::cout << "Enter how many seconds a session outlives its connection (0 to end it with the connection): ";
+        std::cin >> session_linger;
+
+        auto options = ServerOptions{};
+        options.firm_max_buy = std::stoull(firm_max_buy);
+        options.firm_max_sell = std::stoull(firm_max_sell);
+        options.workers = std::stoull(workers);
+        options.max_connections = std::stoull(max_connections);
+        if (journal != "-")
+            options.journal.directory = journal;
+        options.snapshot_interval = std::chrono::seconds(std::stoull(snapshot_interval));
+        options.busy_poll_cpu = std::stoi(busy_poll_cpu);
+        if (backend != "epoll" && backend != "io_uring")
+            throw std::runtime_error("Unknown I/O backend " + backend);
+        options.io_uring = backend == "io_uring";
+        options.shared_memory = shared_memory;
+        options.drop_copy.shared_memory = shared_memory;
+        options.drop_copy.port = static_cast<uint16_t>(std::stoul(drop_copy_port));
+        if (drop_copy_policy != "drop" && drop_copy_policy != "conflate")
+            throw std::runtime_error("Unknown drop-copy policy " + drop_copy_policy);
+        options.drop_copy.conflate = drop_copy_policy == "conflate";
+        options.session_linger = std::chrono::seconds(std::stoull(session_linger));
+        options.session_stats = session_stats;
+        auto server = Server(std::stoull(max_buy), std::stoull(max_sell), options);
         server.start();
     }
     catch(const std::runtime_error & err) {
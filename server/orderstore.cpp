@@ -1,84 +1,238 @@
 #include "orderstore.hpp"
 
+#include <cstring>
+#include <stdexcept>
 #include <variant>
 
 using OrderStatus = Messages::OrderResponse::Status;
+using Reason = OrderStore::Response::Reason;
 
-OrderStore::OrderStore(int max_buy, int max_sell)
+namespace
+{
+Reason reason_for(FinancialInstrument::Result result)
+{
+    switch (result) {
+        case FinancialInstrument::Result::ACCEPTED:
+            return Reason::NONE;
+        case FinancialInstrument::Result::EXCEEDED_MAX_BUY:
+        case FinancialInstrument::Result::EXCEEDED_MAX_SELL:
+            return Reason::SESSION_LIMIT;
+        default:
+            return Reason::INVALID;
+    }
+}
+} // unnamed namespace
+
+OrderStore::OrderStore(int max_buy, int max_sell, FirmLimits * firm_limits)
     : max_buy_(max_buy)
     , max_sell_(max_sell)
+    , firm_limits_(firm_limits)
 {
 }
 
-// Ref.: https://en.cppreference.com/w/cpp/utility/variant/variant
-template<class... Ts> struct overload : Ts... { using Ts::operator()...; };
-template<class... Ts> overload(Ts...) -> overload<Ts...>;
+OrderStore::~OrderStore()
+{
+    if (!firm_limits_)
+        return;
+    for (uint32_t index = 0; index < firm_exposure_.size(); ++index)
+        firm_limits_->apply(*firm_exposure_[index], -risk_.buy_side(index), -risk_.sell_side(index));
+}
 
 auto OrderStore::consume(Message && message) -> Response
 {
-    auto response = Response{};
-    std::visit(overload{
-        [&](Messages::NewOrder payload) { response = handle_add(std::move(payload)); },
-        [&](Messages::DeleteOrder payload) { response = handle_delete(std::move(payload)); },
-        [&](Messages::ModifyOrderQuantity payload) { response = handle_modify(std::move(payload)); },
-        [&](Messages::Trade payload) { response = handle_trade(std::move(payload)); },
-        [](auto arg) { throw std::runtime_error("Unsupported message type"); }
+    return std::visit([this](const auto & payload) { return consume(payload); }, message.payload);
+}
 
-    }, message.payload);
-    return response;
+std::vector<uint64_t> OrderStore::listings_near_limit(double fraction) const
+{
+    auto buy_threshold = static_cast<int64_t>(max_buy_ * (1.0 - fraction));
+    auto sell_threshold = static_cast<int64_t>(max_sell_ * (1.0 - fraction));
+    auto listings = std::vector<uint64_t>{};
+    for (auto index : risk_.at_or_above(buy_threshold, sell_threshold))
+        listings.push_back(risk_.listing_id(index));
+    return listings;
 }
 
-auto OrderStore::handle_add(Messages::NewOrder && payload) -> Response
+size_t OrderStore::image_size() const
 {
-    auto & instrument = instruments_[payload.listingId];
-    try {
-        auto signed_quantity = static_cast<int64_t>(payload.orderQuantity);
-        if (payload.side == 'B')
-            instrument.add_buy({payload.orderId, signed_quantity, payload.orderPrice}, max_buy_);
-        else if (payload.side == 'S')
-            instrument.add_sell({payload.orderId, signed_quantity, payload.orderPrice}, max_sell_);
-        return { OrderStatus::ACCEPTED, payload.orderId };
+    auto size = sizeof(uint64_t);
+    for (const auto & instrument : instruments_)
+        size += sizeof(uint64_t) + instrument.second.image_size();
+    return size;
+}
+
+void OrderStore::save(char * out) const
+{
+    uint64_t count = instruments_.size();
+    std::memcpy(out, &count, sizeof(count));
+    out += sizeof(count);
+    for (const auto & instrument : instruments_) {
+        std::memcpy(out, &instrument.first, sizeof(instrument.first));
+        out += sizeof(instrument.first);
+        instrument.second.save(out);
+        out += instrument.second.image_size();
     }
-    catch (const std::logic_error &) { /* threshold exceeded */ }
-    return { OrderStatus::REJECTED, payload.orderId };
 }
 
-auto OrderStore::handle_delete(Messages::DeleteOrder && payload) -> Response
+void OrderStore::load(const char * data, size_t size)
+{
+    auto end = data + size;
+    uint64_t count;
+    if (size < sizeof(count))
+        throw std::runtime_error("Truncated session image");
+    std::memcpy(&count, data, sizeof(count));
+    auto in = data + sizeof(count);
+    for (uint64_t i = 0; i < count; ++i) {
+        uint64_t listing_id;
+        if (static_cast<size_t>(end - in) < sizeof(listing_id))
+            throw std::runtime_error("Truncated session image");
+        std::memcpy(&listing_id, in, sizeof(listing_id));
+        in += sizeof(listing_id);
+        auto listing = intern(listing_id);
+        auto & instrument = instrument_at(listing);
+        in += instrument.load(in, end - in);
+
+        sync_risk(listing);
+        for (const auto & order : instrument.buys())
+            order_index_[order.first] = { listing, FinancialInstrument::Side::BUY };
+        for (const auto & order : instrument.sells())
+            order_index_[order.first] = { listing, FinancialInstrument::Side::SELL };
+        if (firm_limits_)
+            firm_limits_->apply(*firm_exposure_[listing], instrument.buy_side(), instrument.sell_side());
+    }
+}
+
+auto OrderStore::last_exposure() const -> Exposure
+{
+    if (last_listing_ == NO_LISTING)
+        return {};
+    return {risk_.listing_id(last_listing_), risk_.buy_side(last_listing_), risk_.sell_side(last_listing_),
+            risk_.net_pos(last_listing_)};
+}
+
+uint32_t OrderStore::intern(uint64_t listing_id)
+{
+    auto existing = instruments_.find(listing_id);
+    if (existing != instruments_.end())
+        return static_cast<uint32_t>(existing - instruments_.begin());
+    instruments_.emplace(listing_id, FinancialInstrument{});
+    if (firm_limits_)
+        firm_exposure_.push_back(&firm_limits_->exposure(listing_id));
+    return risk_.add(listing_id);
+}
+
+void OrderStore::sync_risk(uint32_t index)
 {
-    try {
-        for (auto & instrument : instruments_) {
-            if (instrument.second.delete_order(payload.orderId))
-                return { OrderStatus::ACCEPTED, payload.orderId };
-        }
+    const auto & updated = instrument_at(index);
+    risk_.update(index, updated.buy_side(), updated.sell_side(), updated.net_pos());
+}
+
+bool OrderStore::reserve_firm(uint32_t index, const FinancialInstrument::Preview & preview)
+{
+    return firm_limits_->try_apply(*firm_exposure_[index], preview.buy_side - risk_.buy_side(index),
+                                   preview.sell_side - risk_.sell_side(index));
+}
+
+auto OrderStore::handle_add(const Messages::NewOrder & payload) -> Response
+{
+    auto listing = intern(payload.listingId);
+    last_listing_ = listing;
+    auto & instrument = instrument_at(listing);
+    if (payload.side != 'B' && payload.side != 'S')
+        return { OrderStatus::ACCEPTED, payload.orderId };
+
+    // An order id may only be reused to replace an order resting on the same listing and side
+    auto side = static_cast<FinancialInstrument::Side>(payload.side);
+    auto location = order_index_.find(payload.orderId);
+    if (location != order_index_.end()
+        && (location->second.listing != listing || location->second.side != side))
+        return { OrderStatus::REJECTED, payload.orderId, Reason::INVALID };
+
+    auto signed_quantity = static_cast<int64_t>(payload.orderQuantity);
+    auto order = FinancialInstrument::Order{payload.orderId, signed_quantity, payload.orderPrice};
+    if (firm_limits_) {
+        auto preview = instrument.preview_add(side, order, max_buy_, max_sell_);
+        if (preview.result != FinancialInstrument::Result::ACCEPTED)
+            return { OrderStatus::REJECTED, payload.orderId, reason_for(preview.result) };
+        if (!reserve_firm(listing, preview))
+            return { OrderStatus::REJECTED, payload.orderId, Reason::FIRM_LIMIT };
     }
-    catch (const std::logic_error &) { /* threshold exceeded */ }
-    return { OrderStatus::REJECTED, payload.orderId };
+    auto result = side == FinancialInstrument::Side::BUY ? instrument.try_add_buy(order, max_buy_)
+                                                         : instrument.try_add_sell(order, max_sell_);
+    if (result != FinancialInstrument::Result::ACCEPTED)
+        return { OrderStatus::REJECTED, payload.orderId, reason_for(result) };
+    sync_risk(listing);
+    order_index_[payload.orderId] = { listing, side };
+    return { OrderStatus::ACCEPTED, payload.orderId };
 }
 
-auto OrderStore::handle_modify(Messages::ModifyOrderQuantity && payload) -> Response
+auto OrderStore::handle_delete(const Messages::DeleteOrder & payload) -> Response
 {
+    last_listing_ = NO_LISTING;
+    auto location = order_index_.find(payload.orderId);
+    if (location == order_index_.end())
+        return { OrderStatus::REJECTED, payload.orderId, Reason::INVALID };
+
+    auto listing = location->second.listing;
+    last_listing_ = listing;
+    auto & instrument = instrument_at(listing);
+    if (!instrument.delete_order(payload.orderId, location->second.side))
+        return { OrderStatus::REJECTED, payload.orderId, Reason::INVALID };
+    if (firm_limits_)
+        firm_limits_->apply(*firm_exposure_[listing], instrument.buy_side() - risk_.buy_side(listing),
+                            instrument.sell_side() - risk_.sell_side(listing));
+    sync_risk(listing);
+    order_index_.erase(location);
+    return { OrderStatus::ACCEPTED, payload.orderId };
+}
+
+auto OrderStore::handle_modify(const Messages::ModifyOrderQuantity & payload) -> Response
+{
+    last_listing_ = NO_LISTING;
     if (payload.newQuantity == 0)
-        return { OrderStatus::REJECTED, payload.orderId };
-    try {
-        for (auto & instrument : instruments_) {
-            if (instrument.second.modify_order(payload.orderId, payload.newQuantity, max_buy_, max_sell_))
-                return { OrderStatus::ACCEPTED, payload.orderId };
-        }
+        return { OrderStatus::REJECTED, payload.orderId, Reason::INVALID };
+    auto location = order_index_.find(payload.orderId);
+    if (location == order_index_.end())
+        return { OrderStatus::REJECTED, payload.orderId, Reason::INVALID };
+
+    auto listing = location->second.listing;
+    last_listing_ = listing;
+    auto side = location->second.side;
+    auto & instrument = instrument_at(listing);
+    if (firm_limits_) {
+        auto preview = instrument.preview_modify(payload.orderId, side, payload.newQuantity, max_buy_, max_sell_);
+        if (preview.result != FinancialInstrument::Result::ACCEPTED)
+            return { OrderStatus::REJECTED, payload.orderId, reason_for(preview.result) };
+        if (!reserve_firm(listing, preview))
+            return { OrderStatus::REJECTED, payload.orderId, Reason::FIRM_LIMIT };
     }
-    catch (const std::logic_error &) { /* threshold exceeded */ }
-    return { OrderStatus::REJECTED, payload.orderId };
+    auto result = instrument.try_modify_order(payload.orderId, side, payload.newQuantity, max_buy_, max_sell_);
+    if (result != FinancialInstrument::Result::ACCEPTED)
+        return { OrderStatus::REJECTED, payload.orderId, reason_for(result) };
+    sync_risk(listing);
+    return { OrderStatus::ACCEPTED, payload.orderId };
 }
 
-auto OrderStore::handle_trade(Messages::Trade && payload) -> Response
+auto OrderStore::handle_trade(const Messages::Trade & payload) -> Response
 {
+    last_listing_ = NO_LISTING;
     if (payload.tradeQuantity == 0 || payload.tradePrice == 0)
-        return { OrderStatus::REJECTED, payload.tradeId };
-    auto & instrument = instruments_[payload.listingId];
-    try {
-        auto signed_quantity = static_cast<int64_t>(payload.tradeQuantity);
-        instrument.add_trade({payload.tradeId, signed_quantity, payload.tradePrice}, max_buy_, max_sell_);
-        return { OrderStatus::ACCEPTED, payload.tradeId };
+        return { OrderStatus::REJECTED, payload.tradeId, Reason::INVALID };
+    auto listing = intern(payload.listingId);
+    last_listing_ = listing;
+    auto & instrument = instrument_at(listing);
+    auto signed_quantity = static_cast<int64_t>(payload.tradeQuantity);
+    auto trade = FinancialInstrument::Order{payload.tradeId, signed_quantity, payload.tradePrice};
+    if (firm_limits_) {
+        auto preview = instrument.preview_trade(trade, max_buy_, max_sell_);
+        if (preview.result != FinancialInstrument::Result::ACCEPTED)
+            return { OrderStatus::REJECTED, payload.tradeId, reason_for(preview.result) };
+        if (!reserve_firm(listing, preview))
+            return { OrderStatus::REJECTED, payload.tradeId, Reason::FIRM_LIMIT };
     }
-    catch (const std::logic_error &) { /* threshold exceeded or no matching trade found */ }
-    return { OrderStatus::REJECTED, payload.tradeId };
+    auto result = instrument.try_add_trade(trade, max_buy_, max_sell_);
+    if (result != FinancialInstrument::Result::ACCEPTED)
+        return { OrderStatus::REJECTED, payload.tradeId, reason_for(result) };
+    sync_risk(listing);
+    return { OrderStatus::ACCEPTED, payload.tradeId };
 }
@@ -2,41 +2,109 @@
 #define ORDERSTORE_HPP
 
 #include "financialintrument.hpp"
+#include "firmlimits.hpp"
+#include "risktable.hpp"
 #include "../messages.hpp"
 
-#include <unordered_map>
+#include <stdexcept>
+#include <vector>
 
 class OrderStore
 {
 public:
     struct Response
     {
-        Response(Messages::OrderResponse::Status status, uint64_t order_id)
+        using Reason = Messages::OrderResponse::Reason;
+        Response(Messages::OrderResponse::Status status, uint64_t order_id, Reason reason = Reason::NONE)
             : status(status)
             , order_id(order_id)
             , no_response(false)
+            , reason(reason)
         {}
         Response() = default;
         Messages::OrderResponse::Status status;
         uint64_t order_id;
         bool no_response = true;
+        Reason reason = Reason::NONE;
     };
-    OrderStore(int max_buy, int max_sell);
+    // When `firm_limits` is given, every accepted order must also fit the firm-wide limits shared with the other
+    // sessions, and the exposure of this session is released from them on destruction.
+    OrderStore(int max_buy, int max_sell, FirmLimits * firm_limits = nullptr);
+    ~OrderStore();
+    OrderStore(const OrderStore &) = delete;
+    OrderStore & operator=(const OrderStore &) = delete;
+
     Response consume(Message && message);
 
+    // Risk-check a payload in place, e.g. as viewed in the receive buffer by Parser::dispatch.
+    Response consume(const Messages::NewOrder & payload) { return handle_add(payload); }
+    Response consume(const Messages::DeleteOrder & payload) { return handle_delete(payload); }
+    Response consume(const Messages::ModifyOrderQuantity & payload) { return handle_modify(payload); }
+    Response consume(const Messages::Trade & payload) { return handle_trade(payload); }
+    template<typename Payload>
+    Response consume(const Payload &) { throw std::runtime_error("Unsupported message type"); }
+
+    // Exposure of the listing the last message consumed was about, once it has been decided on. All zero when it named
+    // no known listing, e.g. deleting an unknown order.
+    struct Exposure
+    {
+        uint64_t listing_id = 0;
+        int64_t buy_side = 0;
+        int64_t sell_side = 0;
+        int64_t net_pos = 0;
+    };
+    Exposure last_exposure() const;
+
+    // Session-wide exposure, summed over every listing.
+    int64_t total_buy_side() const { return risk_.total_buy_side(); }
+    int64_t total_sell_side() const { return risk_.total_sell_side(); }
+    int64_t total_net_pos() const { return risk_.total_net_pos(); }
+
+    // Snapshot image of the session: the listing count, then each listing id followed by the image of its
+    // instrument. save() writes exactly image_size() bytes. load() is meant for a fresh store, it also adds the
+    // restored exposure to the firm-wide limits.
+    size_t image_size() const;
+    void save(char * out) const;
+    void load(const char * data, size_t size);
+
+    // Listings whose buy or sell side is within `fraction` (e.g. 0.1 for 10%) of the session limit.
+    std::vector<uint64_t> listings_near_limit(double fraction) const;
+
 protected:
-    using IntrumentMap = std::unordered_map<uint64_t, FinancialInstrument>;
+    // Instruments are never removed, so an instrument's position in the map doubles as its compact listing index.
+    using IntrumentMap = FlatMap<FinancialInstrument>;
     IntrumentMap & test_instruments() { return instruments_; }
 
 private:
-    Response handle_add(Messages::NewOrder && payload);
-    Response handle_delete(Messages::DeleteOrder && payload);
-    Response handle_modify(Messages::ModifyOrderQuantity && payload);
-    Response handle_trade(Messages::Trade && payload);
+    Response handle_add(const Messages::NewOrder & payload);
+    Response handle_delete(const Messages::DeleteOrder & payload);
+    Response handle_modify(const Messages::ModifyOrderQuantity & payload);
+    Response handle_trade(const Messages::Trade & payload);
+
+    uint32_t intern(uint64_t listing_id);
+    FinancialInstrument & instrument_at(uint32_t index) { return (instruments_.begin() + index)->second; }
+    void sync_risk(uint32_t index);
+    bool reserve_firm(uint32_t index, const FinancialInstrument::Preview & preview);
+
+    // Where a resting order lives, so deletes and modifies go straight to the owning instrument and side.
+    struct OrderLocation
+    {
+        uint32_t listing;
+        FinancialInstrument::Side side;
+    };
+    using OrderIndex = FlatMap<OrderLocation>;
+
+    static constexpr uint32_t NO_LISTING = UINT32_MAX;
 
     IntrumentMap instruments_;
+    RiskTable risk_;
+    OrderIndex order_index_;
+    uint32_t last_listing_ = NO_LISTING; // for last_exposure()
     int max_buy_;
     int max_sell_;
+
+    FirmLimits * firm_limits_;
+    std::vector<FirmLimits::Exposure *> firm_exposure_; // indexed like risk_
 };
 
 #endif // ORDERSTORE_HPP
@@ -0,0 +1,23 @@
+#include "responsering.hpp"
+
+ResponseRing::ResponseRing(size_t capacity, uint32_t next_sequence_number)
+    : next_(next_sequence_number)
+{
+    if (capacity == 0)
+        return;
+    size_t size = 1;
+    while (size < capacity)
+        size *= 2;
+    entries_.resize(size);
+    mask_ = size - 1;
+}
+
+uint32_t ResponseRing::record(const Messages::OrderResponse & response, uint64_t timestamp)
+{
+    if (!entries_.empty()) {
+        entries_[next_ & mask_] = Entry{timestamp, response};
+        if (count_ < entries_.size())
+            ++count_;
+    }
+    return next_++;
+}
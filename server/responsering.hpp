@@ -0,0 +1,56 @@
+#ifndef RESPONSERING_HPP
+#define RESPONSERING_HPP
+
+#include "../messages.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Numbers the OrderResponses of a session and keeps the latest `capacity` of them (rounded up to a power of two), in
+// a ring indexed by sequence number, for a client resuming the session to get them again. A capacity of 0 only
+// numbers them.
+//
+// Not synchronised, owned by the network thread like the rest of the session's output.
+class ResponseRing
+{
+public:
+    explicit ResponseRing(size_t capacity, uint32_t next_sequence_number = 0);
+
+    uint32_t next_sequence_number() const { return next_; }
+    // The oldest sequence number still kept.
+    uint32_t first_sequence_number() const { return next_ - count_; }
+
+    // Keeps the response, sent with the returned sequence number and `timestamp`.
+    uint32_t record(const Messages::OrderResponse & response, uint64_t timestamp);
+
+    // Where a replay from `from`, at most the next sequence number, starts: there, or at the oldest response kept
+    // when the ones before it are gone.
+    uint32_t replay_start(uint32_t from) const { return next_ - from > count_ ? first_sequence_number() : from; }
+    // Calls visit(sequence_number, timestamp, response) for every response kept from replay_start(from) on.
+    template<typename Visitor>
+    void replay(uint32_t from, Visitor && visit) const;
+
+private:
+    struct Entry
+    {
+        uint64_t timestamp;
+        Messages::OrderResponse response;
+    };
+
+    std::vector<Entry> entries_;
+    size_t mask_ = 0;
+    uint32_t next_;
+    uint32_t count_ = 0; // kept, up to the capacity
+};
+
+template<typename Visitor>
+void ResponseRing::replay(uint32_t from, Visitor && visit) const
+{
+    for (auto sequence_number = replay_start(from); sequence_number != next_; ++sequence_number) {
+        const auto & entry = entries_[sequence_number & mask_];
+        visit(sequence_number, entry.timestamp, entry.response);
+    }
+}
+
+#endif //RESPONSERING_HPP
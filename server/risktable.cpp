@@ -0,0 +1,103 @@
+#include "risktable.hpp"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace
+{
+int64_t sum(const std::vector<int64_t> & values)
+{
+    // Plain indexed loop over a contiguous array, vectorised by the compiler.
+    const auto * data = values.data();
+    int64_t total = 0;
+    for (size_t i = 0; i < values.size(); ++i)
+        total += data[i];
+    return total;
+}
+
+// Branchless compaction of the listings from `start` on: every index is written, but the cursor only advances for
+// matches. This keeps the scan free of mispredicted branches when matches are sparse and scattered. Returns the new
+// match count.
+size_t scan(const int64_t * buy, const int64_t * sell, size_t start, size_t size, int64_t buy_threshold,
+            int64_t sell_threshold, uint32_t * out, size_t count)
+{
+    for (auto i = start; i < size; ++i) {
+        out[count] = static_cast<uint32_t>(i);
+        count += (buy[i] >= buy_threshold) | (sell[i] >= sell_threshold);
+    }
+    return count;
+}
+
+#if defined(__x86_64__)
+// The compiler does not vectorise the scalar scan, whose cursor carries a dependency from one listing to the next.
+// Here four listings are compared at once into a match mask, blocks without a match (the common case) are skipped
+// and the others compacted. `size` is a multiple of four.
+__attribute__((target("avx2"))) size_t scan_avx2(const int64_t * buy, const int64_t * sell, size_t size,
+                                                 int64_t buy_threshold, int64_t sell_threshold, uint32_t * out,
+                                                 size_t count)
+{
+    const auto buy_limit = _mm256_set1_epi64x(buy_threshold);
+    const auto sell_limit = _mm256_set1_epi64x(sell_threshold);
+    for (size_t start = 0; start < size; start += 4) {
+        auto buy_side = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(buy + start));
+        auto sell_side = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(sell + start));
+        // A listing below both thresholds does not match
+        auto below = _mm256_and_si256(_mm256_cmpgt_epi64(buy_limit, buy_side),
+                                      _mm256_cmpgt_epi64(sell_limit, sell_side));
+        auto mask = ~_mm256_movemask_pd(_mm256_castsi256_pd(below)) & 0xF;
+        if (mask == 0)
+            continue;
+        for (unsigned j = 0; j < 4; ++j) {
+            out[count] = static_cast<uint32_t>(start + j);
+            count += (mask >> j) & 1;
+        }
+    }
+    return count;
+}
+#endif
+} // unnamed namespace
+
+uint32_t RiskTable::add(uint64_t listing_id)
+{
+    listing_ids_.push_back(listing_id);
+    buy_side_.push_back(0);
+    sell_side_.push_back(0);
+    net_pos_.push_back(0);
+    return static_cast<uint32_t>(listing_ids_.size() - 1);
+}
+
+int64_t RiskTable::total_buy_side() const
+{
+    return sum(buy_side_);
+}
+
+int64_t RiskTable::total_sell_side() const
+{
+    return sum(sell_side_);
+}
+
+int64_t RiskTable::total_net_pos() const
+{
+    return sum(net_pos_);
+}
+
+std::vector<uint32_t> RiskTable::at_or_above(int64_t buy_threshold, int64_t sell_threshold) const
+{
+    // Room for every index plus the one a compaction writes past the last match
+    auto matches = std::vector<uint32_t>(size() + 1);
+    const auto * buy = buy_side_.data();
+    const auto * sell = sell_side_.data();
+    size_t count = 0;
+    size_t start = 0;
+#if defined(__x86_64__)
+    static const auto avx2 = __builtin_cpu_supports("avx2");
+    if (avx2) {
+        start = size() & ~size_t{3};
+        count = scan_avx2(buy, sell, start, buy_threshold, sell_threshold, matches.data(), count);
+    }
+#endif
+    count = scan(buy, sell, start, size(), buy_threshold, sell_threshold, matches.data(), count);
+    matches.resize(count);
+    return matches;
+}
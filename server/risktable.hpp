@@ -0,0 +1,44 @@
+#ifndef RISKTABLE_HPP
+#define RISKTABLE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Struct-of-arrays copy of the per-instrument exposure, indexed by the compact listing index assigned by the
+// OrderStore. Keeping each counter in its own contiguous array lets session-wide aggregates run as straight loops the
+// compiler vectorises, and the limit scan compare several listings per instruction, instead of walking every
+// FinancialInstrument.
+class RiskTable
+{
+public:
+    uint32_t add(uint64_t listing_id);
+    void update(uint32_t index, int64_t buy_side, int64_t sell_side, int64_t net_pos)
+    {
+        buy_side_[index] = buy_side;
+        sell_side_[index] = sell_side;
+        net_pos_[index] = net_pos;
+    }
+
+    size_t size() const { return listing_ids_.size(); }
+    uint64_t listing_id(uint32_t index) const { return listing_ids_[index]; }
+    int64_t buy_side(uint32_t index) const { return buy_side_[index]; }
+    int64_t sell_side(uint32_t index) const { return sell_side_[index]; }
+    int64_t net_pos(uint32_t index) const { return net_pos_[index]; }
+
+    int64_t total_buy_side() const;
+    int64_t total_sell_side() const;
+    int64_t total_net_pos() const;
+
+    // Compact indices of all listings whose buy side is at least `buy_threshold` or sell side at least
+    // `sell_threshold`, in index order.
+    std::vector<uint32_t> at_or_above(int64_t buy_threshold, int64_t sell_threshold) const;
+
+private:
+    std::vector<uint64_t> listing_ids_;
+    std::vector<int64_t> buy_side_;
+    std::vector<int64_t> sell_side_;
+    std::vector<int64_t> net_pos_;
+};
+
+#endif //RISKTABLE_HPP
@@ -1,10 +1,25 @@
 #include "server.hpp"
+#include "../timestamp.hpp"
 
+#include <algorithm>
+#include <cerrno>
 #include <chrono>
 #include <cstdlib>
 #include <cstring>
 #include <cstdio>
+#include <limits>
+#include <csignal>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <thread>
 #include <unistd.h>
 #include <variant>
 
@@ -20,23 +35,98 @@ void make_local_address(struct sockaddr_in * addr, uint16_t port)
     addr->sin_addr.s_addr = INADDR_ANY; // bind to all interfaces
 }
 
-uint64_t timestamp() {
-    using namespace std::chrono;
-    return duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count();
+uint64_t limit_or_unlimited(uint64_t max)
+{
+    return max != 0 ? max : static_cast<uint64_t>(std::numeric_limits<int64_t>::max());
 }
 } // unnamed namespace
 
-Server::Server(uint64_t max_buy, uint64_t max_sell)
-    : max_buy_(max_buy)
+Server::Server(uint64_t max_buy, uint64_t max_sell, ServerOptions options)
+    : session_key_(options.journal.directory)
+    , max_buy_(max_buy)
     , max_sell_(max_sell)
+    , max_connections_(options.max_connections)
+    , receive_buffer_size_(options.receive_buffer_size)
+    , session_linger_(std::chrono::duration_cast<std::chrono::nanoseconds>(options.session_linger).count())
+    , session_stats_(options.session_stats)
+    , resend_capacity_(options.session_linger.count() != 0 ? options.resend_capacity : 0)
+    , busy_poll_cpu_(options.busy_poll_cpu)
+    , socket_busy_poll_(options.socket_busy_poll)
+    , socket_buffer_size_(options.socket_buffer_size)
+    , shm_spin_(std::thread::hardware_concurrency() > 1 ? SHM_SPIN : 0)
 {
-    socket_ = socket(INTERNET_PROTOCOL, TRANSPORT_PROTOCOL, 0);
+    // SIGUSR1 is read from a descriptor in the event loop, the caller has blocked it
+    auto signals = sigset_t{};
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    signal_fd_ = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd_ == -1)
+        throw std::runtime_error("Could not watch for the statistics signal");
+
+    if (options.firm_max_buy != 0 || options.firm_max_sell != 0)
+        firm_limits_ = std::make_unique<FirmLimits>(limit_or_unlimited(options.firm_max_buy),
+                                                    limit_or_unlimited(options.firm_max_sell));
+    auto recovered = Snapshot::Recovered{};
+    if (!options.journal.directory.empty()) {
+        recovered = Snapshot::recover(options.journal.directory, max_buy_, max_sell_, firm_limits_.get());
+        next_session_ = recovered.next_session;
+        journal_ = std::make_unique<Journal>(options.journal);
+        if (options.snapshot_interval.count() != 0) {
+            snapshot_directory_ = options.journal.directory;
+            if (options.workers != 0)
+                snapshot_writer_ = std::make_unique<SnapshotWriter>(options.journal.directory);
+        }
+    }
+    if (options.drop_copy.port != 0) {
+        // A queue for this thread and one for every risk worker
+        drop_copy_ = std::make_unique<DropCopy>(options.workers + 1, options.drop_copy);
+    }
+    if (options.workers != 0) {
+        auto on_response = [this](uint64_t session, const OrderStore::Response & response,
+                                  const LatencyTrace & trace) {
+            auto client_socket = session_sockets_.find(session);
+            if (client_socket != session_sockets_.end()) {
+                respond(client_socket->second, response, trace);
+                return;
+            }
+            // Kept for the client to get once it resumes the session
+            auto detached = detached_.find(session);
+            if (detached != detached_.end() && !response.no_response) {
+                detached->second.sent.record(Messages::OrderResponse{Messages::OrderResponse::MESSAGE_TYPE,
+                                                                     response.order_id, response.status,
+                                                                     response.reason},
+                                             timestamp());
+            }
+        };
+        engine_ = std::make_unique<Engine>(options.workers, max_buy_, max_sell_, on_response, firm_limits_.get(),
+                                           drop_copy_.get());
+    }
+
+    // Recovered sessions wait for their clients like detached ones and expire the same way, releasing their exposure.
+    // Without a linger they would never be resumed, so they end right away.
+    if (!recovered.sessions.empty()) {
+        std::cerr << "[INFO] Recovered " << recovered.sessions.size() << " session(s) from the journal"
+                  << (session_linger_ == 0 ? ", ended as sessions do not linger\n" : "\n");
+    }
+    for (auto & [session, store] : recovered.sessions) {
+        if (session_linger_ == 0) {
+            journal_->close(session);
+            continue;
+        }
+        auto detached = Detached{std::move(store), ResponseRing(resend_capacity_), LatencyClock::now(), true};
+        if (engine_)
+            engine_->open(session, std::move(detached.store));
+        detached_.emplace(session, std::move(detached));
+    }
+    recovered.sessions.clear();
+
+    socket_ = socket(INTERNET_PROTOCOL, TRANSPORT_PROTOCOL | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (socket_ == -1)
         throw std::runtime_error("Master socket not created");
 
     // generate a local address
     auto address = sockaddr_in{};
-    make_local_address(&address, PORT_NUMBER);
+    make_local_address(&address, options.port);
     auto address_length = sizeof(address);
     auto sock_address = reinterpret_cast<sockaddr*>(&address);
 
@@ -45,154 +135,1057 @@ Server::Server(uint64_t max_buy, uint64_t max_sell)
     if (bind_success == -1)
         throw std::runtime_error("Could not bind to the local machine");
 
-    // listen on the bound address and restrict max number of active clients
-    auto listen_success = listen(socket_, 3);
+    // listen on the bound address
+    auto listen_success = listen(socket_, SOMAXCONN);
     if (listen_success == -1)
         throw std::runtime_error("Could not listen on the local address");
+
+    if (!snapshot_directory_.empty()) {
+        snapshot_timer_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        auto interval = itimerspec{};
+        interval.it_interval.tv_sec = options.snapshot_interval.count();
+        interval.it_value = interval.it_interval;
+        if (snapshot_timer_ == -1 || timerfd_settime(snapshot_timer_, 0, &interval, nullptr) == -1)
+            throw std::runtime_error("Could not create the snapshot timer");
+    }
+    if (session_linger_ != 0) {
+        // Detached sessions are expired to within a second
+        session_timer_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        auto interval = itimerspec{};
+        interval.it_interval.tv_sec = 1;
+        interval.it_value = interval.it_interval;
+        if (session_timer_ == -1 || timerfd_settime(session_timer_, 0, &interval, nullptr) == -1)
+            throw std::runtime_error("Could not create the session timer");
+    }
+
+    if (options.shared_memory) {
+        shm_socket_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        auto length = socklen_t{};
+        auto shm_address = ShmChannel::rendezvous_address(options.port, length);
+        if (shm_socket_ == -1 || bind(shm_socket_, reinterpret_cast<sockaddr *>(&shm_address), length) == -1
+            || listen(shm_socket_, SOMAXCONN) == -1)
+            throw std::runtime_error("Could not listen for shared-memory sessions");
+        shm_epoll_ = epoll_create1(EPOLL_CLOEXEC);
+        shm_doorbell_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        auto event = epoll_event{};
+        event.events = EPOLLIN;
+        event.data.fd = shm_socket_;
+        if (shm_epoll_ == -1 || shm_doorbell_ == -1 || epoll_ctl(shm_epoll_, EPOLL_CTL_ADD, shm_socket_, &event) == -1)
+            throw std::runtime_error("Could not watch for shared-memory sessions");
+    }
+
+    // The io_uring backend watches the same descriptors with operations submitted once the loop starts
+    if (options.io_uring) {
+        uring_ = std::make_unique<Uring>(URING_ENTRIES);
+        receive_buffers_ = std::make_unique<ProvidedBuffers>(*uring_, 0, RECEIVE_BUFFERS, RECEIVE_BUFFER_SIZE,
+                                                             user_data(Operation::PROVIDE, 0));
+        send_buffers_ = std::make_unique<FixedBuffers>(*uring_, SEND_BUFFERS, SEND_BUFFER_SIZE);
+        sends_.resize(SEND_BUFFERS);
+        return;
+    }
+
+    // register the listening socket (and the engine notifications) with the event loop
+    epoll_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_ == -1)
+        throw std::runtime_error("Could not create the event loop");
+    auto event = epoll_event{};
+    event.events = EPOLLIN | EPOLLET;
+    event.data.fd = socket_;
+    if (epoll_ctl(epoll_, EPOLL_CTL_ADD, socket_, &event) == -1)
+        throw std::runtime_error("Could not watch the master socket");
+    if (engine_) {
+        event.data.fd = engine_->notify_fd();
+        if (epoll_ctl(epoll_, EPOLL_CTL_ADD, engine_->notify_fd(), &event) == -1)
+            throw std::runtime_error("Could not watch the risk engine");
+    }
+    if (journal_) {
+        event.data.fd = journal_->notify_fd();
+        if (epoll_ctl(epoll_, EPOLL_CTL_ADD, journal_->notify_fd(), &event) == -1)
+            throw std::runtime_error("Could not watch the journal");
+    }
+    event.data.fd = signal_fd_;
+    if (epoll_ctl(epoll_, EPOLL_CTL_ADD, signal_fd_, &event) == -1)
+        throw std::runtime_error("Could not watch for the statistics signal");
+    if (snapshot_timer_ != -1) {
+        event.data.fd = snapshot_timer_;
+        if (epoll_ctl(epoll_, EPOLL_CTL_ADD, snapshot_timer_, &event) == -1)
+            throw std::runtime_error("Could not watch the snapshot timer");
+    }
+    if (session_timer_ != -1) {
+        event.data.fd = session_timer_;
+        if (epoll_ctl(epoll_, EPOLL_CTL_ADD, session_timer_, &event) == -1)
+            throw std::runtime_error("Could not watch the session timer");
+    }
+    for (auto fd : {shm_epoll_, shm_doorbell_}) {
+        event.data.fd = fd;
+        if (fd != -1 && epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &event) == -1)
+            throw std::runtime_error("Could not watch for shared-memory sessions");
+    }
 }
 
 Server::~Server()
 {
-    for (auto & client : clients_)
+    engine_.reset();
+    for (auto & client : clients_) {
         close(client.first);
+        if (client.second->doorbell != -1)
+            close(client.second->doorbell);
+    }
+    for (auto fd : shm_handshakes_)
+        close(fd);
+    for (auto fd : {shm_socket_, shm_epoll_, shm_doorbell_}) {
+        if (fd != -1)
+            close(fd);
+    }
     close(socket_);
+    if (epoll_ != -1)
+        close(epoll_);
+    if (snapshot_timer_ != -1)
+        close(snapshot_timer_);
+    if (session_timer_ != -1)
+        close(session_timer_);
+    close(signal_fd_);
+    if (snapshot_child_ != -1)
+        waitpid(snapshot_child_, nullptr, 0);
 }
 
 void Server::start()
 {
-    auto client_address = sockaddr_in{};
-    make_local_address(&client_address, PORT_NUMBER);
-    auto client_len = sizeof(client_address);
+    auto busy_poll = busy_poll_cpu_ >= 0;
+    if (busy_poll) {
+        auto cpus = cpu_set_t{};
+        CPU_ZERO(&cpus);
+        CPU_SET(busy_poll_cpu_, &cpus);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+            throw std::runtime_error("Could not pin the network thread to core " + std::to_string(busy_poll_cpu_));
+        std::cerr << "[INFO] Busy-polling on core " << busy_poll_cpu_ << "\n";
+    }
 
-    fd_set socket_set;
-    int client_sockets[MAX_CONCURRENT_CLIENTS];
-    for (int & client_socket : client_sockets)
-        client_socket = 0;
+    if (uring_)
+        run_uring(busy_poll);
+    else
+        run_epoll(busy_poll);
+}
 
+void Server::run_epoll(bool busy_poll)
+{
+    epoll_event events[MAX_EVENTS];
     while(true)
     {
-        // Reset the socket set
-        FD_ZERO(&socket_set);
-        FD_SET(socket_, &socket_set);
-
-        // Add valid client sockets to the set
-        int last_active_socket = socket_;
-        for (int client_socket : client_sockets) {
-            if(client_socket > 0) {
-                FD_SET(client_socket, &socket_set);
-                last_active_socket = client_socket;
-            }
+        auto ready = epoll_wait(epoll_, events, MAX_EVENTS, may_sleep(busy_poll) ? -1 : 0);
+        ++loop_.iterations;
+        if (ready == -1) {
+            if (errno != EINTR)
+                throw std::runtime_error("Waiting for socket events failed");
+            ready = 0;
+        }
+        auto working_since = LatencyClock::now();
+        if (!poll_shared_memory() && ready == 0 && flush_pending_.empty()) {
+            ++loop_.idle;
+            continue;
         }
+        loop_.events += ready;
 
-        auto timeout = timeval{5 * 60, 0}; // timeout after 5 minutes of no activity
-        auto active_sockets = select(last_active_socket + 1, &socket_set, nullptr, nullptr, &timeout);
-        if (active_sockets == -1)
-            throw std::runtime_error("No active sockets found");
-
-        // Handle new connections
-        if (FD_ISSET(socket_, &socket_set)) {
-            auto new_socket = accept(socket_, (sockaddr*)&client_address, (socklen_t*)&client_len);
-            if (new_socket == -1)
-                throw std::runtime_error("Could not establish connection with the client");
-
-            // Add the client to the first empty socket slot
-            for (auto & client_socket : client_sockets) {
-                if(client_socket == 0) {
-                    client_socket = new_socket;
-                    clients_[client_socket] = std::make_unique<OrderStore>(max_buy_, max_sell_);
-                    break;
-                }
+        // Only sockets with pending events are visited
+        for (int i = 0; i < ready; ++i) {
+            auto fd = events[i].data.fd;
+            if (fd == socket_) {
+                accept_clients();
+                continue;
+            }
+            if (notified(fd))
+                continue;
+            if (events[i].events & EPOLLOUT) {
+                // The socket has room again for responses a previous flush could not send
+                auto client = clients_.find(fd);
+                if (client != clients_.end() && client->second->output.pending() != 0)
+                    schedule_flush(fd, *client->second);
             }
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                read_client(fd);
         }
 
-        // Handle reads from existing connections
-        for (int & client_socket : client_sockets) {
-            if (FD_ISSET(client_socket, &socket_set)) {
-                char buffer[BUFFER_SIZE] = {};
-                auto bytes_received = read(client_socket, buffer, BUFFER_SIZE);
-
-                // If the client connection was terminated
-                if (bytes_received == 0) {
-                    getpeername(client_socket , (struct sockaddr*)&client_address , (socklen_t*)&client_len);
-                    clients_.erase(client_socket);
-                    close(client_socket);
-                    client_socket = 0;
-                }
-
-                // If a new message incoming - parse and handle in the OrderStore
-                else {
-                    auto message = parser_.decode(buffer);
-                    auto response = clients_[client_socket]->consume(std::move(message));
-                    if (!response.no_response) {
-                        auto msg = Message{};
-                        msg.header = { PROTOCOL_VERSION, sizeof(Messages::OrderResponse),
-                                       sequence_number_++, timestamp() };
-                        msg.payload = Messages::OrderResponse{Messages::OrderResponse::MESSAGE_TYPE,
-                                                              response.order_id, response.status};
-                        send(client_socket, &msg, sizeof(msg), 0);
-                    }
-                }
-            }
+        // Everything produced by this batch of events goes out with one write per client
+        flush_clients();
+        loop_.working += LatencyClock::now() - working_since;
+    }
+}
+
+void Server::run_uring(bool busy_poll)
+{
+    arm_accept();
+    if (engine_)
+        arm_poll(engine_->notify_fd());
+    if (journal_)
+        arm_poll(journal_->notify_fd());
+    arm_poll(signal_fd_);
+    if (snapshot_timer_ != -1)
+        arm_poll(snapshot_timer_);
+    if (session_timer_ != -1)
+        arm_poll(session_timer_);
+    for (auto fd : {shm_epoll_, shm_doorbell_}) {
+        if (fd != -1)
+            arm_poll(fd);
+    }
+
+    while (true)
+    {
+        // The sends and re-armed receives of the previous iteration go in with the same system call that waits
+        uring_->submit(may_sleep(busy_poll) ? 1 : 0);
+        ++loop_.iterations;
+        auto working_since = LatencyClock::now();
+        auto completions = uring_->complete([this](const io_uring_cqe & cqe) { on_completion(cqe); });
+        if (!poll_shared_memory() && completions == 0 && flush_pending_.empty()) {
+            ++loop_.idle;
+            continue;
         }
+        loop_.events += completions;
+
+        // Everything produced by this batch of completions is queued as one send per client
+        flush_clients();
+        loop_.working += LatencyClock::now() - working_since;
     }
 }
 
-// Ref.: https://beej.us/guide/bgnet/html//index.html
-/*
-void start()
+bool Server::notified(int fd)
 {
-    // Initialise the socket set
-    auto master = fd_set{};
-    FD_ZERO(&master);
-    FD_SET(socket_, &master);
+    if (engine_ && fd == engine_->notify_fd()) {
+        engine_->drain(); // queue the responses the risk workers have produced
+        return true;
+    }
+    if (journal_ && fd == journal_->notify_fd()) {
+        uint64_t syncs; // the held clients check again what is durable
+        [[maybe_unused]] auto bytes = read(fd, &syncs, sizeof(syncs));
+        flush_pending_.insert(flush_pending_.end(), awaiting_durable_.begin(), awaiting_durable_.end());
+        awaiting_durable_.clear();
+        return true;
+    }
+    if (fd == snapshot_timer_) {
+        uint64_t expirations;
+        [[maybe_unused]] auto bytes = read(snapshot_timer_, &expirations, sizeof(expirations));
+        take_snapshot();
+        return true;
+    }
+    if (fd == session_timer_) {
+        uint64_t expirations;
+        [[maybe_unused]] auto bytes = read(session_timer_, &expirations, sizeof(expirations));
+        expire_sessions();
+        return true;
+    }
+    if (fd == shm_epoll_) {
+        shm_events();
+        return true;
+    }
+    if (fd == shm_doorbell_) {
+        uint64_t rings; // the rings themselves are polled on every iteration
+        [[maybe_unused]] auto bytes = read(shm_doorbell_, &rings, sizeof(rings));
+        return true;
+    }
+    if (fd == signal_fd_) {
+        signalfd_siginfo info;
+        while (read(signal_fd_, &info, sizeof(info)) == sizeof(info)) {}
+        print_stats(std::cerr);
+        return true;
+    }
+    return false;
+}
 
-    for (;;) {
-        auto copy = master;
-        auto socket_count = select(0, &copy, nullptr, nullptr, nullptr);
-        if (socket_count == -1)
-            break;
+void Server::accept_clients()
+{
+    // Edge-triggered: accept everything queued, the listening socket will not be reported again until a new
+    // connection arrives
+    while (true) {
+        auto new_socket = accept4(socket_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (new_socket == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            throw std::runtime_error("Could not establish connection with the client");
+        }
+        open_client(new_socket);
+    }
+}
 
-        // Iterate connected socket
-        for (int socket = 0; socket < MAX_CONCURRENT_CLIENTS + 1; ++socket) {
+void Server::open_client(int client_socket)
+{
+    if (clients_.size() >= max_connections_) {
+        std::cerr << "[WARN] Connection limit of " << max_connections_ << " reached, refusing client\n";
+        close(client_socket);
+        return;
+    }
 
-            if (!FD_ISSET(socket, &copy)) {
-                std::cerr << "Socket " << socket << "not set\n";
+    tune_socket(client_socket);
+    if (!uring_) {
+        auto event = epoll_event{};
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.fd = client_socket;
+        if (epoll_ctl(epoll_, EPOLL_CTL_ADD, client_socket, &event) == -1) {
+            close(client_socket);
+            return;
+        }
+    }
+    auto & client = open_session(client_socket);
+    if (uring_)
+        arm_receive(client_socket, client.connection);
+}
+
+Server::Client & Server::open_session(int client_socket)
+{
+    auto session = next_session_++;
+    auto client = std::make_unique<Client>(session, next_connection_++, receive_buffer_size_);
+    client->opened = LatencyClock::now();
+    if (session_stats_)
+        client->latency = std::make_unique<LatencyStats>();
+    client->sent = ResponseRing(resend_capacity_);
+    session_sockets_[session] = client_socket;
+    connection_sockets_[client->connection] = client_socket;
+    if (journal_)
+        journal_->open(session);
+    if (engine_)
+        engine_->open(session);
+    else
+        client->store = std::make_unique<OrderStore>(max_buy_, max_sell_, firm_limits_.get());
+    return *(clients_[client_socket] = std::move(client));
+}
+
+void Server::tune_socket(int client_socket)
+{
+    auto set = [client_socket](int level, int name, int value) {
+        return setsockopt(client_socket, level, name, &value, sizeof(value)) == 0;
+    };
+    // Responses are small frames that should leave as soon as they are flushed
+    auto tuned = set(IPPROTO_TCP, TCP_NODELAY, 1);
+    if (busy_poll_cpu_ >= 0)
+        tuned &= set(SOL_SOCKET, SO_BUSY_POLL, socket_busy_poll_); // above net.core.busy_poll needs CAP_NET_ADMIN
+    if (socket_buffer_size_ != 0) {
+        tuned &= set(SOL_SOCKET, SO_RCVBUF, socket_buffer_size_);
+        tuned &= set(SOL_SOCKET, SO_SNDBUF, socket_buffer_size_);
+    }
+    if (!tuned && !tuning_failed_) {
+        tuning_failed_ = true;
+        std::cerr << "[WARN] Could not apply every socket option: " << std::strerror(errno) << "\n";
+    }
+}
+
+void Server::read_client(int client_socket)
+{
+    // An event for a socket disconnected earlier in the same batch of events
+    auto found = clients_.find(client_socket);
+    if (found == clients_.end())
+        return;
+    auto & client = *found->second;
+    auto & input = client.input;
+
+    // Edge-triggered: read until the socket is drained
+    try {
+        while (true) {
+            auto bytes_received = read(client_socket, input.write_data(), input.write_space());
+            if (bytes_received == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return;
+            if (bytes_received == -1 && errno == EINTR)
                 continue;
+
+            // If the client connection was terminated
+            if (bytes_received <= 0) {
+                disconnect(client_socket);
+                return;
             }
+            input.commit(bytes_received);
+            read_time_ = LatencyClock::now();
+
+            // Handle every complete message, a trailing partial one waits for the next read
+            input.consume(input.pending() - decode(client_socket, client, input.read_data(), input.pending()));
+        }
+    }
+    catch (const std::runtime_error & err) {
+        std::cerr << "[WARN] " << err.what() << ", dropping client\n";
+        disconnect(client_socket);
+    }
+}
+
+size_t Server::decode(int client_socket, Client & client, const char * data, size_t size)
+{
+    auto batch = parser_.decode_batch(data, size, [&](const Messages::Header & header, const auto & payload) {
+        consume(client_socket, client, header, payload);
+    });
+    if (batch.invalid != 0)
+        std::cerr << "[WARN] " << batch.invalid << " invalid message(s) ignored\n";
+    return batch.remaining;
+}
+
+void Server::disconnect(int client_socket)
+{
+    auto client = clients_.find(client_socket);
+    if (client != clients_.end()) {
+        auto session = client->second->session;
+        session_sockets_.erase(session);
+        connection_sockets_.erase(client->second->connection);
+        if (session_linger_ != 0) {
+            // The engine goes on with what the client sent, the responses are kept for when it resumes
+            detached_.insert_or_assign(session, Detached{std::move(client->second->store),
+                                                         std::move(client->second->sent), LatencyClock::now()});
+        }
+        else {
+            end_session(session);
+        }
+        if (awaiting_journal(*client->second))
+            journal_->sync(); // the last responses are only sent once what they answer is durable
+        if (client->second->shm) {
+            write_shared_memory(*client->second);
+            close(client->second->doorbell);
+            shm_clients_.erase(std::find(shm_clients_.begin(), shm_clients_.end(), client_socket));
+            clients_.erase(client);
+            close(client_socket); // also removes it from the shared-memory epoll set
+            return;
+        }
+        client->second->output.flush(client_socket); // best effort, e.g. for a client that half-closed after sending
+        clients_.erase(client);
+    }
+    // The operations in flight on the socket keep it open until they complete, which the shutdown makes them do.
+    // Their completions then find the session gone.
+    if (uring_)
+        shutdown(client_socket, SHUT_RDWR);
+    close(client_socket); // also removes it from the epoll set
+}
+
+void Server::end_session(uint64_t session)
+{
+    if (journal_)
+        journal_->close(session);
+    if (engine_)
+        engine_->close(session);
+}
 
-            // If visiting the master socket, then try to accept new connections
-            if (socket == socket_) {
-                std::cerr << "Accepting at the master socket" << std::endl;
-                auto client_socket = accept(socket_, nullptr, nullptr);
-                if (client_socket != -1)
-                    FD_SET(client_socket, &master);
+void Server::resume(int client_socket, Client & client, const Messages::SessionRequest & request)
+{
+    using Status = Messages::OrderResponse::Status;
+    auto answer = Messages::SessionResponse{Messages::SessionResponse::MESSAGE_TYPE, client.session,
+                                            session_key_.token(client.session), client.sent.next_sequence_number(),
+                                            Status::ACCEPTED};
+    auto resumed = false;
+    if (request.session != Messages::SessionRequest::CURRENT) {
+        resumed = client.resumable && take_over(client_socket, client, request);
+        if (resumed) {
+            answer.session = client.session;
+            answer.token = request.token;
+            answer.nextSequenceNumber = client.sent.replay_start(request.nextSequenceNumber);
+            client.resumable = false;
+        }
+        else {
+            answer.session = request.session;
+            answer.token = 0;
+            answer.status = Status::REJECTED;
+        }
+    }
+    encoder_.encode(client.output, answer, client.sent.next_sequence_number(), timestamp());
+    if (resumed) {
+        // The resent responses may answer records the journal has not synced yet
+        if (journal_)
+            client.journaled = journal_->appended();
+        client.sent.replay(request.nextSequenceNumber, [&](uint32_t sequence_number, uint64_t sent,
+                                                           const Messages::OrderResponse & response) {
+            encoder_.encode(client.output, response, sequence_number, sent);
+        });
+    }
+}
+
+bool Server::take_over(int client_socket, Client & client, const Messages::SessionRequest & request)
+{
+    auto session = request.session;
+    auto next_sequence_number = request.nextSequenceNumber;
+    if (request.token != session_key_.token(session))
+        return false;
+
+    // A session still connected elsewhere is only given up once its connection is found gone
+    auto detached = detached_.find(session);
+    if (detached == detached_.end())
+        return false;
+    auto ahead = static_cast<int32_t>(next_sequence_number - detached->second.sent.next_sequence_number());
+    if (ahead > 0 && !detached->second.recovered)
+        return false; // asks for responses never sent
+
+    // The session the connection opened with gives way, unused
+    session_sockets_.erase(client.session);
+    end_session(client.session);
+    client.store.reset();
+    client.session = session;
+    session_sockets_[session] = client_socket;
+    client.store = std::move(detached->second.store);
+    client.sent = std::move(detached->second.sent);
+    if (detached->second.recovered) {
+        // The responses went with the previous run, numbering goes on from the client's
+        client.sent = ResponseRing(resend_capacity_, next_sequence_number);
+    }
+    detached_.erase(detached);
+    return true;
+}
+
+void Server::expire_sessions()
+{
+    auto now = LatencyClock::now();
+    for (auto detached = detached_.begin(); detached != detached_.end();) {
+        if (now - detached->second.since < session_linger_) {
+            ++detached;
+            continue;
+        }
+        end_session(detached->first);
+        detached = detached_.erase(detached);
+    }
+}
+
+void Server::shm_events()
+{
+    epoll_event events[MAX_EVENTS];
+    int ready;
+    do {
+        ready = epoll_wait(shm_epoll_, events, MAX_EVENTS, 0);
+        for (int i = 0; i < ready; ++i) {
+            auto fd = events[i].data.fd;
+            if (fd == shm_socket_) {
+                accept_shm();
+                continue;
+            }
+            if (shm_handshakes_.count(fd) == 0) {
+                // The client never writes to the socket of a session, it is readable once the client is gone
+                disconnect(fd);
+                continue;
             }
-            // If visiting a client socket, then listen for incoming messages
-            else {
-                std::cerr << "Client socket #" << socket << std::endl;
-                char buffer[BUFFER_SIZE] = {};
-                auto bytes_received = read(socket, buffer, BUFFER_SIZE);
-
-                // Handle closed connection
-                if (bytes_received <= 0) {
-                    clients_.erase(socket);
-                    close(socket);
-                    FD_CLR(socket, &master);
-                }
-                // Otherwise parse and handle the message
-                else {
-                    auto message = parser_.decode(buffer);
-                    auto response = orderStore_.consume(std::move(message));
-                    if (response.no_response)
-                        continue;
-
-                    auto msg = Message{};
-                    msg.header = {PROTOCOL_VERSION, sizeof(Messages::OrderResponse), sequence_number_++, timestamp()};
-                    msg.payload = Messages::OrderResponse{ Messages::OrderResponse::MESSAGE_TYPE,
-                                                           response.order_id, response.status };
-                    send(socket, &msg, sizeof(msg), 0);
-                }
+            int fds[2];
+            if (!receive_descriptors(fd, fds, 2)) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    continue;
+                shm_handshakes_.erase(fd);
+                close(fd);
+                continue;
             }
+            shm_handshakes_.erase(fd);
+            attach_shm(fd, fds[0], fds[1]);
+        }
+    } while (ready == MAX_EVENTS);
+}
+
+void Server::accept_shm()
+{
+    while (true) {
+        auto new_socket = accept4(shm_socket_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (new_socket == -1) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            return;
+        }
+        if (!same_user(new_socket)) {
+            std::cerr << "[WARN] Shared-memory client runs as another user, refusing it\n";
+            close(new_socket);
+            continue;
+        }
+        auto event = epoll_event{};
+        event.events = EPOLLIN | EPOLLRDHUP;
+        event.data.fd = new_socket;
+        if (epoll_ctl(shm_epoll_, EPOLL_CTL_ADD, new_socket, &event) == -1) {
+            close(new_socket);
+            continue;
         }
+        shm_handshakes_.insert(new_socket);
     }
-}*/
+}
+
+void Server::attach_shm(int client_socket, int file, int doorbell)
+{
+    auto refuse = [&](const std::string & reason) {
+        std::cerr << "[WARN] " << reason << ", refusing shared-memory client\n";
+        close(file);
+        close(doorbell);
+        close(client_socket);
+    };
+    if (clients_.size() >= max_connections_)
+        return refuse("Connection limit of " + std::to_string(max_connections_) + " reached");
+    std::unique_ptr<ShmChannel> channel;
+    try {
+        channel = std::make_unique<ShmChannel>(file);
+    }
+    catch (const std::runtime_error & err) {
+        return refuse(err.what());
+    }
+    // The client starts sending once it has the doorbell to ring
+    if (!send_descriptors(client_socket, &shm_doorbell_, 1)) {
+        channel.reset();
+        close(doorbell);
+        close(client_socket);
+        return;
+    }
+    auto & client = open_session(client_socket);
+    client.shm = std::move(channel);
+    client.doorbell = doorbell;
+    shm_clients_.push_back(client_socket);
+    shm_active_ = LatencyClock::now();
+}
+
+bool Server::may_sleep(bool busy_poll)
+{
+    if (busy_poll || !flush_pending_.empty())
+        return false;
+    if (shm_clients_.empty())
+        return true;
+    // The next message of a busy session is likely right behind the last one
+    if (LatencyClock::now() - shm_active_ < shm_spin_)
+        return false;
+    shm_armed_ = true;
+    for (auto client_socket : shm_clients_) {
+        if (!clients_[client_socket]->shm->arm())
+            return false;
+    }
+    return true;
+}
+
+bool Server::poll_shared_memory()
+{
+    if (shm_armed_) {
+        for (auto client_socket : shm_clients_)
+            clients_[client_socket]->shm->disarm();
+        shm_armed_ = false;
+    }
+
+    auto active = false;
+    for (size_t i = 0; i < shm_clients_.size(); ++i) {
+        auto client_socket = shm_clients_[i];
+        auto & client = *clients_[client_socket];
+        auto & channel = *client.shm;
+        try {
+            if (channel.pending() == 0)
+                continue;
+            active = true;
+            read_time_ = LatencyClock::now();
+            // Copied out of the ring first, the client could otherwise change a frame after it was checked
+            auto & input = client.input;
+            while (auto bytes = channel.read(input.write_data(), input.write_space())) {
+                input.commit(bytes);
+                input.consume(input.pending() - decode(client_socket, client, input.read_data(), input.pending()));
+            }
+        }
+        catch (const std::runtime_error & err) {
+            std::cerr << "[WARN] " << err.what() << ", dropping client\n";
+            disconnect(client_socket);
+            --i;
+        }
+    }
+    if (active)
+        shm_active_ = LatencyClock::now();
+    return active;
+}
+
+void Server::write_shared_memory(Client & client)
+{
+    auto & channel = *client.shm;
+    auto written = false;
+    while (client.output.pending() != 0) {
+        auto bytes = client.output.drain(channel.write_data(), channel.write_space());
+        if (bytes == 0)
+            break; // the ring is full, the rest waits for the client to read
+        channel.commit(bytes);
+        written = true;
+    }
+    if (written && channel.peer_waiting()) {
+        uint64_t ring = 1;
+        [[maybe_unused]] auto bytes = write(client.doorbell, &ring, sizeof(ring));
+    }
+}
+
+void Server::on_completion(const io_uring_cqe & cqe)
+{
+    auto value = cqe.user_data & ((uint64_t{1} << 56) - 1);
+    switch (static_cast<Operation>(cqe.user_data >> 56)) {
+    case Operation::ACCEPT:
+        on_accept(cqe);
+        break;
+    case Operation::RECEIVE:
+        on_receive(value, cqe);
+        break;
+    case Operation::SEND:
+        on_send(static_cast<uint16_t>(value), cqe);
+        break;
+    case Operation::POLL:
+        notified(static_cast<int>(value));
+        if (!(cqe.flags & IORING_CQE_F_MORE))
+            arm_poll(static_cast<int>(value));
+        break;
+    case Operation::PROVIDE:
+        std::cerr << "[WARN] Could not provide receive buffers: " << std::strerror(-cqe.res) << "\n";
+        break;
+    }
+}
+
+void Server::on_accept(const io_uring_cqe & cqe)
+{
+    if (cqe.res >= 0)
+        open_client(cqe.res);
+    else if (cqe.res != -EINTR && cqe.res != -EAGAIN && cqe.res != -ECONNABORTED)
+        throw std::runtime_error("Could not establish connection with the client");
+    if (!(cqe.flags & IORING_CQE_F_MORE))
+        arm_accept();
+}
+
+void Server::on_receive(uint64_t connection, const io_uring_cqe & cqe)
+{
+    auto has_buffer = (cqe.flags & IORING_CQE_F_BUFFER) != 0;
+    auto buffer = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+    auto client_socket = connection_sockets_.find(connection);
+    if (client_socket == connection_sockets_.end()) {
+        // Disconnected while the receive was in flight
+        if (has_buffer)
+            receive_buffers_->recycle(buffer);
+        return;
+    }
+    auto fd = client_socket->second;
+
+    if (cqe.res > 0) {
+        read_time_ = LatencyClock::now();
+        receive(fd, *clients_[fd], receive_buffers_->data(buffer), static_cast<size_t>(cqe.res));
+        receive_buffers_->recycle(buffer);
+        // The kernel ends a multishot receive now and then, e.g. when its completions overflow
+        if (!(cqe.flags & IORING_CQE_F_MORE) && connection_sockets_.count(connection) != 0)
+            arm_receive(fd, connection);
+        return;
+    }
+    if (has_buffer)
+        receive_buffers_->recycle(buffer);
+    if (cqe.res == -ENOBUFS) {
+        // Every buffer was lent out, they have all been handed back by now
+        arm_receive(fd, connection);
+        return;
+    }
+    disconnect(fd); // closed by the client, or failed
+}
+
+void Server::receive(int client_socket, Client & client, const char * data, size_t size)
+{
+    auto & input = client.input;
+    try {
+        // With nothing buffered the frames are decoded straight out of the provided buffer, only a trailing partial
+        // one is copied to wait for the rest
+        if (input.pending() == 0) {
+            auto remaining = decode(client_socket, client, data, size);
+            data += size - remaining;
+            size = remaining;
+        }
+        while (size != 0) {
+            auto bytes = std::min(size, input.write_space());
+            std::memcpy(input.write_data(), data, bytes);
+            input.commit(bytes);
+            data += bytes;
+            size -= bytes;
+            input.consume(input.pending() - decode(client_socket, client, input.read_data(), input.pending()));
+        }
+    }
+    catch (const std::runtime_error & err) {
+        std::cerr << "[WARN] " << err.what() << ", dropping client\n";
+        disconnect(client_socket);
+    }
+}
+
+void Server::on_send(uint16_t buffer, const io_uring_cqe & cqe)
+{
+    auto & send = sends_[buffer];
+    if (cqe.flags & IORING_CQE_F_NOTIF) {
+        if (--send.notifications == 0 && send.done)
+            release_send_buffer(buffer);
+        return;
+    }
+    if (cqe.flags & IORING_CQE_F_MORE)
+        ++send.notifications;
+
+    auto client_socket = connection_sockets_.find(send.connection);
+    auto connected = client_socket != connection_sockets_.end();
+    if (connected && cqe.res > 0 && send.sent + static_cast<uint32_t>(cqe.res) < send.size) {
+        // The socket buffer filled up, the rest goes out once it has room
+        send.sent += static_cast<uint32_t>(cqe.res);
+        submit_send(buffer);
+        return;
+    }
+    send.done = true;
+    if (send.notifications == 0)
+        release_send_buffer(buffer);
+    if (!connected)
+        return;
+
+    auto fd = client_socket->second;
+    if (cqe.res < 0) {
+        disconnect(fd);
+        return;
+    }
+    // The next send can start, the bytes of this one are queued on the socket in order
+    auto & client = *clients_[fd];
+    client.sending = false;
+    if (client.output.pending() != 0)
+        schedule_flush(fd, client);
+    else
+        record_sent(client);
+}
+
+void Server::release_send_buffer(uint16_t buffer)
+{
+    send_buffers_->release(buffer);
+    while (!send_waiters_.empty()) {
+        auto waiter = connection_sockets_.find(send_waiters_.front());
+        send_waiters_.pop_front();
+        if (waiter != connection_sockets_.end()) {
+            schedule_flush(waiter->second, *clients_[waiter->second]);
+            return;
+        }
+    }
+}
+
+void Server::arm_accept()
+{
+    auto & sqe = uring_->prepare(IORING_OP_ACCEPT, socket_, user_data(Operation::ACCEPT, 0));
+    sqe.ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe.accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+}
+
+void Server::arm_receive(int client_socket, uint64_t connection)
+{
+    auto & sqe = uring_->prepare(IORING_OP_RECV, client_socket, user_data(Operation::RECEIVE, connection));
+    sqe.ioprio = IORING_RECV_MULTISHOT;
+    sqe.flags = IOSQE_BUFFER_SELECT;
+    sqe.buf_group = receive_buffers_->group();
+}
+
+void Server::arm_poll(int fd)
+{
+    auto & sqe = uring_->prepare(IORING_OP_POLL_ADD, fd, user_data(Operation::POLL, static_cast<uint64_t>(fd)));
+    sqe.len = IORING_POLL_ADD_MULTI;
+    sqe.poll32_events = POLLIN;
+}
+
+void Server::send_output(int client_socket, Client & client)
+{
+    // One send in flight per client keeps the responses in order
+    if (client.sending || client.output.pending() == 0)
+        return;
+    auto buffer = send_buffers_->take();
+    if (buffer == FixedBuffers::NONE) {
+        send_waiters_.push_back(client.connection);
+        return;
+    }
+    auto size = client.output.drain(send_buffers_->data(buffer), send_buffers_->size());
+    sends_[buffer] = Send{client.connection, client_socket, static_cast<uint32_t>(size), 0, 0, false};
+    client.sending = true;
+    submit_send(buffer);
+}
+
+void Server::submit_send(uint16_t buffer)
+{
+    const auto & send = sends_[buffer];
+    auto & sqe = uring_->prepare(IORING_OP_SEND_ZC, send.client_socket, user_data(Operation::SEND, buffer));
+    sqe.addr = reinterpret_cast<uint64_t>(send_buffers_->data(buffer) + send.sent);
+    sqe.len = send.size - send.sent;
+    sqe.msg_flags = MSG_NOSIGNAL;
+    sqe.ioprio = IORING_RECVSEND_FIXED_BUF;
+    sqe.buf_index = buffer;
+}
+
+void Server::respond(int client_socket, const OrderStore::Response & response, const LatencyTrace & trace)
+{
+    if (response.no_response)
+        return;
+    auto client = clients_.find(client_socket);
+    if (client == clients_.end())
+        return;
+
+    // Serialise the frame straight into the connection's output queue at its packed wire size
+    auto payload = Messages::OrderResponse{Messages::OrderResponse::MESSAGE_TYPE, response.order_id, response.status,
+                                           response.reason};
+    auto & output = client->second->output;
+    auto sent = timestamp();
+    encoder_.encode(output, payload, client->second->sent.record(payload, sent), sent);
+    client->second->unsent.push_back(trace);
+
+    // A connection failure is left for flush_clients() to act on, the client may still be in use by the caller
+    if (output.pending() >= FLUSH_THRESHOLD && !awaiting_journal(*client->second)) {
+        if (client->second->shm)
+            write_shared_memory(*client->second);
+        else if (!uring_)
+            output.flush(client_socket);
+    }
+    schedule_flush(client_socket, *client->second);
+}
+
+void Server::schedule_flush(int client_socket, Client & client)
+{
+    if (client.flush_scheduled)
+        return;
+    client.flush_scheduled = true;
+    flush_pending_.push_back(client_socket);
+}
+
+void Server::flush_clients()
+{
+    // Swapped out, a client whose output does not fit its shared-memory ring is scheduled again for the next iteration
+    flushing_.swap(flush_pending_);
+    for (auto client_socket : flushing_) {
+        auto client = clients_.find(client_socket);
+        if (client == clients_.end())
+            continue; // disconnected in the meantime
+        if (awaiting_journal(*client->second)) {
+            awaiting_durable_.push_back(client_socket); // still scheduled, until the journal has synced
+            continue;
+        }
+        auto & output = client->second->output;
+        client->second->flush_scheduled = false;
+        if (client->second->shm) {
+            write_shared_memory(*client->second);
+            if (output.pending() == 0)
+                record_sent(*client->second);
+            else
+                schedule_flush(client_socket, *client->second);
+        }
+        else if (uring_) {
+            send_output(client_socket, *client->second);
+        }
+        else if (!output.flush(client_socket)) {
+            disconnect(client_socket);
+            continue;
+        }
+        else if (output.pending() == 0) {
+            record_sent(*client->second);
+        }
+        // Anything left waits for EPOLLOUT (or the send in flight), unless the client lets it pile up
+        if (output.pending() > MAX_PENDING_OUTPUT) {
+            std::cerr << "[WARN] Client is not reading its responses, dropping client\n";
+            disconnect(client_socket);
+        }
+    }
+    flushing_.clear();
+    if (!awaiting_durable_.empty())
+        journal_->request_sync(); // one sync for everything this iteration journaled
+}
+
+void Server::record_sent(Client & client)
+{
+    // A response counts as sent once everything queued before it has been written, the responses of a partially
+    // written queue are recorded together when the rest follows
+    auto sent = LatencyClock::now();
+    for (const auto & trace : client.unsent) {
+        if (client.latency)
+            client.latency->record(trace, sent);
+        type_latency_[trace.type].record(trace, sent);
+    }
+    client.unsent.clear();
+}
+
+void Server::send_stats(int client_socket, Client & client)
+{
+    auto now = LatencyClock::now();
+    auto send = [&](uint16_t subject, const LatencyStats & stats, uint64_t interval) {
+        for (size_t stage = 0; stage < LatencyStats::STAGES; ++stage) {
+            const auto & histogram = stats.stage(static_cast<LatencyStats::Stage>(stage));
+            auto payload = Messages::StatsResponse{Messages::StatsResponse::MESSAGE_TYPE, subject,
+                                                   static_cast<LatencyStats::Stage>(stage), histogram.count(),
+                                                   interval, histogram.percentile(50), histogram.percentile(99),
+                                                   histogram.percentile(99.9), histogram.max()};
+            encoder_.encode(client.output, payload, client.sent.next_sequence_number(), timestamp());
+        }
+    };
+    if (client.latency)
+        send(0, *client.latency, now - client.opened);
+    for (uint16_t type = 1; type < type_latency_.size(); ++type) {
+        if (type_latency_[type].stage(LatencyStats::Stage::READ_TO_DECODE).count() != 0)
+            send(type, type_latency_[type], now - started_);
+    }
+    schedule_flush(client_socket, client);
+}
+
+void Server::print_stats(std::ostream & out) const
+{
+    auto now = LatencyClock::now();
+    auto uptime = static_cast<double>(now - started_) / 1e9;
+    out << "[STATS] " << messages_received_ << " message(s) received in " << uptime << " s ("
+        << static_cast<double>(messages_received_) / uptime << " msgs/s), " << clients_.size() << " client(s), "
+        << shm_clients_.size() << " over shared memory, " << detached_.size() << " detached session(s)\n";
+    auto percent = [](uint64_t part, uint64_t whole) {
+        return whole != 0 ? 100.0 * static_cast<double>(part) / static_cast<double>(whole) : 0.0;
+    };
+    out << "[STATS] event loop (" << (uring_ ? "io_uring" : "epoll") << "): " << loop_.iterations << " iteration(s), "
+        << loop_.idle << " idle (" << percent(loop_.idle, loop_.iterations) << "%), " << loop_.events
+        << " event(s), handling them took " << percent(loop_.working, now - started_) << "% of the time\n";
+    if (drop_copy_) {
+        out << "[STATS] drop copy: " << drop_copy_->published() << " decision(s) published, " << drop_copy_->lost()
+            << " lost, " << drop_copy_->subscribers() << " subscriber(s), " << drop_copy_->dropped()
+            << " dropped for falling behind\n";
+    }
+    LatencyStats::print_heading(out);
+    const char * type_names[ParserTable::SIZE] = {"", "NewOrder", "DeleteOrder", "ModifyOrderQuantity", "Trade",
+                                                  "OrderResponse", "StatsRequest", "StatsResponse", "DropCopy",
+                                                  "SessionRequest", "SessionResponse"};
+    for (size_t type = 1; type < type_latency_.size(); ++type) {
+        if (type_latency_[type].stage(LatencyStats::Stage::READ_TO_DECODE).count() != 0)
+            type_latency_[type].print(out, type_names[type], now - started_);
+    }
+    for (const auto & client : clients_) {
+        if (!client.second->latency)
+            continue;
+        auto subject = "session " + std::to_string(client.second->session);
+        client.second->latency->print(out, subject.c_str(), now - client.second->opened);
+    }
+}
+
+void Server::take_snapshot()
+{
+    // Nothing was journaled since the last one
+    auto position = journal_->position();
+    if (position.segment == last_snapshot_.segment && position.offset == last_snapshot_.offset)
+        return;
+
+    if (engine_) {
+        // One part from every risk worker, which own the sessions, and an empty one from this thread
+        last_snapshot_ = position;
+        auto writer = snapshot_writer_.get();
+        auto snapshot = std::make_shared<Snapshot>(position, engine_->workers() + 1,
+                                                   [writer](std::shared_ptr<Snapshot> done) {
+                                                       writer->submit(std::move(done));
+                                                   });
+        engine_->snapshot(snapshot);
+        snapshot->part_done();
+        return;
+    }
+
+    // This thread owns every session. A child process gets a copy-on-write image of them as they are now and does
+    // the serialization and the writing, so the loop only pays for the fork. One at a time, a snapshot still being
+    // written makes this one wait for the next tick.
+    if (snapshot_child_ != -1) {
+        if (waitpid(snapshot_child_, nullptr, WNOHANG) == 0)
+            return;
+        snapshot_child_ = -1;
+    }
+    auto child = fork();
+    if (child == -1) {
+        std::cerr << "[WARN] Could not start writing a snapshot\n";
+        return;
+    }
+    last_snapshot_ = position;
+    if (child != 0) {
+        snapshot_child_ = child;
+        return;
+    }
+    // The copies of the client and listening sockets, the event loop, the timers, the journal segments and the
+    // drop-copy feed would keep them open after the server closes them. The snapshot only opens files of its own.
+    // Kernels before 5.9 lack close_range(), the copies then go when the child exits.
+    close_range(3, ~0U, 0);
+    auto status = 0;
+    try {
+        auto snapshot = std::make_shared<Snapshot>(position, 1, [](std::shared_ptr<Snapshot>) {});
+        for (const auto & [session, detached] : detached_)
+            snapshot->add(session, *detached.store);
+        for (const auto & client : clients_) {
+            if (client.second->store)
+                snapshot->add(client.second->session, *client.second->store);
+        }
+        snapshot->write(snapshot_directory_);
+        std::cerr << "[INFO] Snapshot of " << snapshot->sessions() << " session(s) written\n";
+    }
+    catch (const std::exception & err) {
+        std::cerr << "[WARN] " << err.what() << "\n";
+        status = 1;
+    }
+    _exit(status);
+}
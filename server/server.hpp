@@ -1,18 +1,99 @@
 #ifndef SERVER_HPP
 #define SERVER_HPP
 
+#include "../encoder.hpp"
 #include "../messages.hpp"
+#include "dropcopy.hpp"
+#include "engine.hpp"
+#include "journal.hpp"
+#include "latency.hpp"
 #include "orderstore.hpp"
+#include "responsering.hpp"
+#include "sessionkey.hpp"
+#include "snapshot.hpp"
+#include "uring.hpp"
 #include "../parser.hpp"
+#include "../receivebuffer.hpp"
+#include "../sendbuffer.hpp"
+#include "../shmchannel.hpp"
 
 #include <sys/socket.h>
+#include <sys/types.h>
+#include <array>
+#include <chrono>
+#include <deque>
+#include <type_traits>
+#include <iostream>
+#include <memory>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
+struct ServerOptions
+{
+    // Non-zero firm limits enable firm-wide checks shared by all client sessions.
+    uint64_t firm_max_buy = 0;
+    uint64_t firm_max_sell = 0;
+
+    // Number of risk worker threads, 0 runs the risk checks on the network thread.
+    size_t workers = 0;
+
+    // Connections beyond this many are closed straight after being accepted.
+    size_t max_connections = 4096;
+
+    // Per-connection receive buffer, also the most a single read() asks for.
+    size_t receive_buffer_size = 64 * 1024;
+
+    // Journal of the inbound traffic, disabled unless a directory is given. On start-up the sessions that were open
+    // when the journal was last written are recovered from it.
+    JournalOptions journal;
+
+    // Time between snapshots of every session, which shorten the recovery to the journal written since. Zero
+    // disables them, they also need the journal.
+    std::chrono::seconds snapshot_interval{0};
+
+    // Low-latency mode: with a core given, the network thread is pinned to it and spins on epoll_wait() without ever
+    // sleeping, and the client sockets busy-poll the device queue for `socket_busy_poll` microseconds on a read.
+    // -1 blocks in epoll_wait() until there is something to do.
+    int busy_poll_cpu = -1;
+    int socket_busy_poll = 50;
+
+    // SO_RCVBUF and SO_SNDBUF of the client sockets, 0 keeps the kernel defaults.
+    int socket_buffer_size = 0;
+
+    // Drive the sockets through io_uring instead of epoll: multishot accept and receive into buffers provided to the
+    // kernel, sends out of registered buffers, and a single system call per loop iteration to submit everything and
+    // reap the completions. Needs Linux 6.0 or later.
+    bool io_uring = false;
+
+    // Also accept sessions over shared memory from clients on the same host running as the same user, see
+    // ShmChannel. The loop polls their rings, spinning while they are busy and sleeping once they have all been quiet
+    // for a while.
+    bool shared_memory = false;
+
+    // Drop-copy feed of every risk decision, see DropCopy. Disabled unless a port is given.
+    DropCopyOptions drop_copy;
+
+    // Latency statistics per session, on top of the ones per message type. They take about 13 KB a session.
+    bool session_stats = false;
+
+    // Sessions outlive their connection by `session_linger`, keeping their risk state and their latest
+    // `resend_capacity` responses, for a client to take them back with a SessionRequest. Zero ends a session with its
+    // connection.
+    std::chrono::seconds session_linger{0};
+    size_t resend_capacity = 4096;
+
+    uint16_t port = 1234;
+};
+
+// Latency statistics are kept per message type, and per session when asked for, see LatencyStats for the stages. A
+// client gets them with a StatsRequest, SIGUSR1 prints all of them to stderr. The signal is read from a descriptor in
+// the event loop, so it must be blocked in every thread of the process: block it before starting any, as main() does.
 class Server
 {
 public:
-    Server(uint64_t max_buy, uint64_t max_sell);
+    Server(uint64_t max_buy, uint64_t max_sell, ServerOptions options = {});
     ~Server();
 
     void start();
@@ -20,19 +101,222 @@ public:
 private:
     static const uint16_t INTERNET_PROTOCOL = AF_INET; // IPv4
     static const uint16_t TRANSPORT_PROTOCOL = SOCK_STREAM; // TCP
-    static const uint16_t PORT_NUMBER = 1234;
     static const uint16_t PROTOCOL_VERSION = 1;
 
-    static const uint16_t MAX_CONCURRENT_CLIENTS = 5;
-    static const uint16_t BUFFER_SIZE = 64;
+    static const int MAX_EVENTS = 256; // socket events handled per wake-up
+    static const size_t FLUSH_THRESHOLD = 16 * 1024; // queued response bytes sent before the loop iteration ends
+    static const size_t MAX_PENDING_OUTPUT = 4 * 1024 * 1024; // clients not reading their responses are dropped
+    static constexpr unsigned URING_ENTRIES = 1024;
+    static constexpr uint16_t RECEIVE_BUFFERS = 1024; // lent to the kernel, shared by all connections
+    static constexpr uint32_t RECEIVE_BUFFER_SIZE = 16 * 1024;
+    static constexpr uint16_t SEND_BUFFERS = 256;     // registered, one per send in flight
+    static constexpr uint32_t SEND_BUFFER_SIZE = 64 * 1024;
+    static constexpr uint64_t SHM_SPIN = 50'000; // nanoseconds of polling after shared-memory traffic before sleeping
+
+    // Per-connection state owned by the network thread
+    struct Client
+    {
+        Client(uint64_t session, uint64_t connection, size_t receive_buffer_size)
+            : session(session)
+            , connection(connection)
+            , input(receive_buffer_size)
+        {}
+
+        uint64_t session; // unique across restarts, identifies the session in the journal and the engine
+        uint64_t connection; // unique, identifies the connection in its io_uring operations, whatever its session
+        std::unique_ptr<OrderStore> store; // none when the engine owns the session
+        ReceiveBuffer input;
+        SendBuffer output;
+        bool flush_scheduled = false;
+        uint64_t opened = 0;               // LatencyClock time of the connection
+        std::unique_ptr<LatencyStats> latency; // only with ServerOptions::session_stats
+        std::vector<LatencyTrace> unsent;  // messages whose responses are queued in `output`
+        bool sending = false;              // io_uring: a send of the front of `output` is in flight
+        std::unique_ptr<ShmChannel> shm;   // for a shared-memory session, whose socket only tells when it is gone
+        int doorbell = -1;                 // eventfd of a shared-memory client, rung when it waits for responses
+        ResponseRing sent{0};              // numbers the session's OrderResponses, keeps the latest to resend
+        bool resumable = true;             // no order sent yet, the connection may still take over another session
+        uint64_t journaled = 0;            // journal records up to the last message, answered once they are durable
+    };
+
+    // A session whose connection closed, or one recovered from the journal, kept for session_linger_
+    struct Detached
+    {
+        std::unique_ptr<OrderStore> store; // none when the engine owns the session
+        ResponseRing sent;
+        uint64_t since;                    // LatencyClock time of the disconnection, or of the start when recovered
+        bool recovered = false;            // from the journal, its responses numbered by the previous run
+    };
+
+    // What an io_uring completion is for, in the top byte of its user data
+    enum class Operation : uint8_t
+    {
+        ACCEPT,
+        RECEIVE, // of a connection
+        SEND,    // out of a send buffer
+        POLL,    // of a descriptor
+        PROVIDE, // of receive buffers, only reported when it fails
+    };
+    static uint64_t user_data(Operation operation, uint64_t value)
+    {
+        return static_cast<uint64_t>(operation) << 56 | value;
+    }
+
+    // An io_uring send in flight, by send buffer. Zero-copy sends complete twice: once when the bytes are queued on
+    // the socket and once more when the kernel no longer needs the buffer.
+    struct Send
+    {
+        uint64_t connection;
+        int client_socket;
+        uint32_t size;
+        uint32_t sent;
+        unsigned notifications; // still to come
+        bool done;              // every byte queued, or given up on
+    };
+
+    void run_epoll(bool busy_poll);
+    void run_uring(bool busy_poll);
+    bool notified(int fd);
+    void accept_clients();
+    void open_client(int client_socket);
+    Client & open_session(int client_socket);
+    void tune_socket(int client_socket);
+    void read_client(int client_socket);
+    size_t decode(int client_socket, Client & client, const char * data, size_t size);
+    void disconnect(int client_socket);
+    void end_session(uint64_t session);
+    void resume(int client_socket, Client & client, const Messages::SessionRequest & request);
+    bool take_over(int client_socket, Client & client, const Messages::SessionRequest & request);
+    void expire_sessions();
+    void shm_events();
+    void accept_shm();
+    void attach_shm(int client_socket, int file, int doorbell);
+    bool may_sleep(bool busy_poll);
+    bool poll_shared_memory();
+    void write_shared_memory(Client & client);
+    void on_completion(const io_uring_cqe & cqe);
+    void on_accept(const io_uring_cqe & cqe);
+    void on_receive(uint64_t connection, const io_uring_cqe & cqe);
+    void on_send(uint16_t buffer, const io_uring_cqe & cqe);
+    void release_send_buffer(uint16_t buffer);
+    void receive(int client_socket, Client & client, const char * data, size_t size);
+    void arm_accept();
+    void arm_receive(int client_socket, uint64_t connection);
+    void arm_poll(int fd);
+    void send_output(int client_socket, Client & client);
+    void submit_send(uint16_t buffer);
+    template<typename Payload>
+    void consume(int client_socket, Client & client, const Messages::Header & header, const Payload & payload);
+    void respond(int client_socket, const OrderStore::Response & response, const LatencyTrace & trace);
+    void schedule_flush(int client_socket, Client & client);
+    void flush_clients();
+    bool awaiting_journal(const Client & client) const { return journal_ && client.journaled > journal_->durable(); }
+    void record_sent(Client & client);
+    void send_stats(int client_socket, Client & client);
+    void print_stats(std::ostream & out) const;
+    void take_snapshot();
 
     Parser parser_{PROTOCOL_VERSION};
-    std::unordered_map<int, std::unique_ptr<OrderStore>> clients_;
+    Encoder encoder_{PROTOCOL_VERSION};
+    std::unique_ptr<FirmLimits> firm_limits_;
+    SessionKey session_key_;
+    std::unique_ptr<Journal> journal_;
+    std::string snapshot_directory_;                 // none without snapshots
+    std::unique_ptr<SnapshotWriter> snapshot_writer_; // with risk workers, which take the snapshot parts
+    pid_t snapshot_child_ = -1;                      // without, the process writing the last snapshot
+    std::unique_ptr<DropCopy> drop_copy_; // outlives the engine, whose workers publish to it
+    std::unique_ptr<Engine> engine_;
+    std::unordered_map<int, std::unique_ptr<Client>> clients_;
+    std::unordered_map<uint64_t, int> session_sockets_;
+    std::unordered_map<uint64_t, int> connection_sockets_; // by Client::connection, a session may change connection
+    std::unordered_map<uint64_t, Detached> detached_;
+    uint64_t next_session_ = 0;
+    uint64_t next_connection_ = 0;
+    std::vector<int> flush_pending_; // clients with responses queued during this loop iteration
+    std::vector<int> flushing_;      // flush_pending_ while flush_clients() goes through it
+    std::vector<int> awaiting_durable_; // clients whose flush waits for the journal, rescheduled when it syncs
     uint64_t max_buy_;
     uint64_t max_sell_;
+    size_t max_connections_;
+    size_t receive_buffer_size_;
+    uint64_t session_linger_; // nanoseconds
+    bool session_stats_;
+    size_t resend_capacity_;
+    int busy_poll_cpu_;
+    int socket_busy_poll_;
+    int socket_buffer_size_;
+    bool tuning_failed_ = false; // warned about already
 
     int socket_ = -1;
-    uint32_t sequence_number_ = 0;
+    int epoll_ = -1;
+    std::unique_ptr<Uring> uring_; // instead of epoll_ with the io_uring backend
+    std::unique_ptr<ProvidedBuffers> receive_buffers_;
+    std::unique_ptr<FixedBuffers> send_buffers_;
+    std::vector<Send> sends_;
+    std::deque<uint64_t> send_waiters_; // connections with output to send once a send buffer is free
+    int shm_socket_ = -1;   // Unix socket accepting shared-memory sessions
+    int shm_epoll_ = -1;    // watches it and the sockets of the shared-memory sessions, itself watched by the loop
+    int shm_doorbell_ = -1; // eventfd rung by shared-memory clients when the loop sleeps
+    std::vector<int> shm_clients_;           // sockets of the shared-memory sessions, whose rings the loop polls
+    std::unordered_set<int> shm_handshakes_; // accepted, the client's descriptors still to come
+    uint64_t shm_active_ = 0;                // last time a ring had anything
+    bool shm_armed_ = false;                 // the rings ask for the doorbell
+    uint64_t shm_spin_;                      // SHM_SPIN, none on a single core where it only delays the client
+    int snapshot_timer_ = -1;
+    int session_timer_ = -1; // expires the detached sessions
+    int signal_fd_ = -1;
+    Journal::Position last_snapshot_{0, 0};
+
+    // Owned by the network thread, like everything they are recorded from
+    uint64_t started_ = LatencyClock::now();
+    uint64_t read_time_ = 0; // when the bytes being decoded were read
+    uint64_t messages_received_ = 0;
+    struct LoopStats
+    {
+        uint64_t iterations = 0;
+        uint64_t idle = 0;     // busy-poll iterations that found nothing to do
+        uint64_t events = 0;   // or io_uring completions
+        uint64_t working = 0;  // nanoseconds spent handling events
+    };
+    LoopStats loop_;
+    std::array<LatencyStats, ParserTable::SIZE> type_latency_;
 };
 
+template<typename Payload>
+void Server::consume(int client_socket, Client & client, const Messages::Header & header, const Payload & payload)
+{
+    auto trace = LatencyTrace{Payload::MESSAGE_TYPE, read_time_, LatencyClock::now(), 0};
+    ++messages_received_;
+    if constexpr (std::is_same_v<Payload, Messages::StatsRequest>) {
+        send_stats(client_socket, client);
+        return;
+    }
+    if constexpr (std::is_same_v<Payload, Messages::SessionRequest>) {
+        resume(client_socket, client, payload);
+        schedule_flush(client_socket, client);
+        return;
+    }
+    client.resumable = false;
+    if (journal_) {
+        journal_->append(client.session, reinterpret_cast<const char *>(&header), sizeof(header) + header.payloadSize);
+        client.journaled = journal_->appended();
+    }
+    if (engine_) {
+        // The worker needs its own copy, the receive buffer is reused by the next read
+        engine_->submit(client.session, Message{header, payload}, trace);
+        return;
+    }
+    // The risk checks read the payload straight out of the receive buffer
+    try {
+        auto response = client.store->consume(payload);
+        trace.consumed = LatencyClock::now();
+        if (drop_copy_ && !response.no_response)
+            drop_copy_->publish(0, drop_copy_record(client.session, header, payload, response, *client.store));
+        respond(client_socket, response, trace);
+    }
+    catch (const std::runtime_error & err) {
+        std::cerr << "[WARN] " << err.what() << ", message ignored\n";
+    }
+}
+
 #endif //REPO_SERVER_HPP
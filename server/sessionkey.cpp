@@ -0,0 +1,91 @@
+#include "sessionkey.hpp"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <filesystem>
+#include <stdexcept>
+#include <sys/random.h>
+#include <unistd.h>
+
+namespace
+{
+const char * KEY_FILE = "session.key";
+
+uint64_t rotate_left(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+void sip_round(uint64_t (&v)[4])
+{
+    v[0] += v[1];
+    v[1] = rotate_left(v[1], 13) ^ v[0];
+    v[0] = rotate_left(v[0], 32);
+    v[2] += v[3];
+    v[3] = rotate_left(v[3], 16) ^ v[2];
+    v[0] += v[3];
+    v[3] = rotate_left(v[3], 21) ^ v[0];
+    v[2] += v[1];
+    v[1] = rotate_left(v[1], 17) ^ v[2];
+    v[2] = rotate_left(v[2], 32);
+}
+
+void random_key(uint64_t (&key)[2])
+{
+    auto data = reinterpret_cast<char *>(key);
+    size_t filled = 0;
+    while (filled < sizeof(key)) {
+        auto bytes = getrandom(data + filled, sizeof(key) - filled, 0);
+        if (bytes == -1 && errno != EINTR)
+            throw std::runtime_error("Could not generate the session key");
+        if (bytes > 0)
+            filled += static_cast<size_t>(bytes);
+    }
+}
+} // unnamed namespace
+
+SessionKey::SessionKey(const std::string & directory)
+{
+    if (directory.empty()) {
+        random_key(key_);
+        return;
+    }
+
+    std::filesystem::create_directories(directory);
+    auto path = (std::filesystem::path(directory) / KEY_FILE).string();
+    auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd != -1) {
+        auto bytes = read(fd, key_, sizeof(key_));
+        close(fd);
+        if (bytes != static_cast<ssize_t>(sizeof(key_)))
+            throw std::runtime_error("Could not read the session key " + path);
+        return;
+    }
+
+    // Only readable by the server's user, like the journal it goes with
+    random_key(key_);
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd == -1)
+        throw std::runtime_error("Could not create the session key " + path);
+    auto written = write(fd, key_, sizeof(key_)) == static_cast<ssize_t>(sizeof(key_)) && fsync(fd) == 0;
+    close(fd);
+    if (!written)
+        throw std::runtime_error("Could not write the session key " + path);
+}
+
+uint64_t SessionKey::siphash(const uint64_t (&key)[2], uint64_t value)
+{
+    uint64_t v[4] = {key[0] ^ 0x736f6d6570736575ULL, key[1] ^ 0x646f72616e646f6dULL,
+                     key[0] ^ 0x6c7967656e657261ULL, key[1] ^ 0x7465646279746573ULL};
+    // One 8-byte block, then the final block holding only the length
+    for (auto block : {value, uint64_t{8} << 56}) {
+        v[3] ^= block;
+        sip_round(v);
+        sip_round(v);
+        v[0] ^= block;
+    }
+    v[2] ^= 0xff;
+    for (int i = 0; i < 4; ++i)
+        sip_round(v);
+    return v[0] ^ v[1] ^ v[2] ^ v[3];
+}
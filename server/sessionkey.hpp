@@ -0,0 +1,24 @@
+#ifndef SESSIONKEY_HPP
+#define SESSIONKEY_HPP
+
+#include <cstdint>
+#include <string>
+
+// Issues the token a client needs to resume its session: SipHash-2-4 of the session id under a secret key, so tokens
+// cannot be worked out from the session ids, which are consecutive. The key is random. Kept in `directory` when one
+// is given, e.g. the journal's, so the sessions recovered after a restart keep their tokens.
+class SessionKey
+{
+public:
+    explicit SessionKey(const std::string & directory = "");
+
+    uint64_t token(uint64_t session) const { return siphash(key_, session); }
+
+    // SipHash-2-4 of the 8 little-endian bytes of `value`.
+    static uint64_t siphash(const uint64_t (&key)[2], uint64_t value);
+
+private:
+    uint64_t key_[2];
+};
+
+#endif //SESSIONKEY_HPP
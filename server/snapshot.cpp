@@ -0,0 +1,287 @@
+#include "snapshot.hpp"
+#include "../parser.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+const char MAGIC[8] = {'F', 'L', 'O', 'W', 'S', 'N', 'A', 'P'};
+const char * SNAPSHOT_PREFIX = "snapshot-";
+const char * SNAPSHOT_SUFFIX = ".snap";
+const uint16_t PROTOCOL_VERSION = 1;
+
+struct FileHeader
+{
+    char magic[8];
+    uint64_t segment;
+    uint64_t offset;
+    uint64_t sessions;
+    uint64_t size; // bytes of session entries following the header
+};
+
+struct SessionEntry
+{
+    uint64_t session;
+    uint64_t size; // bytes of the image, before padding
+};
+
+size_t padded(size_t size)
+{
+    return (size + 7) & ~size_t{7};
+}
+
+std::vector<std::string> snapshots(const std::string & directory)
+{
+    auto paths = std::vector<std::string>{};
+    if (!std::filesystem::is_directory(directory))
+        return paths;
+    for (const auto & entry : std::filesystem::directory_iterator(directory)) {
+        auto name = entry.path().filename().string();
+        if (name.rfind(SNAPSHOT_PREFIX, 0) == 0 && entry.path().extension() == SNAPSHOT_SUFFIX)
+            paths.push_back(entry.path().string());
+    }
+    std::sort(paths.begin(), paths.end()); // zero-padded positions sort oldest first
+    return paths;
+}
+
+// The journal segment in the name of a snapshot file, which starts with its position
+uint64_t segment_of(const std::string & path)
+{
+    auto name = std::filesystem::path(path).filename().string();
+    return std::stoull(name.substr(std::strlen(SNAPSHOT_PREFIX)));
+}
+
+void write_all(int fd, const char * data, size_t size)
+{
+    while (size != 0) {
+        auto written = ::write(fd, data, size);
+        if (written == -1) {
+            if (errno == EINTR)
+                continue;
+            throw std::runtime_error("Could not write the snapshot");
+        }
+        data += written;
+        size -= written;
+    }
+}
+} // unnamed namespace
+
+Snapshot::Snapshot(Journal::Position position, size_t parts, Completion on_complete)
+    : position_(position)
+    , on_complete_(std::move(on_complete))
+    , parts_pending_(parts)
+{
+}
+
+void Snapshot::add(uint64_t session, const OrderStore & store)
+{
+    auto size = store.image_size();
+    auto lock = std::lock_guard<std::mutex>(mutex_);
+    auto offset = data_.size();
+    data_.resize(offset + sizeof(SessionEntry) + padded(size));
+    auto entry = SessionEntry{session, size};
+    std::memcpy(data_.data() + offset, &entry, sizeof(entry));
+    store.save(data_.data() + offset + sizeof(entry));
+    ++sessions_;
+}
+
+void Snapshot::part_done()
+{
+    {
+        auto lock = std::lock_guard<std::mutex>(mutex_);
+        if (--parts_pending_ != 0)
+            return;
+    }
+    on_complete_(shared_from_this());
+}
+
+void Snapshot::write(const std::string & directory) const
+{
+    char name[64];
+    std::snprintf(name, sizeof(name), "%s%08llu-%012llu%s", SNAPSHOT_PREFIX,
+                  static_cast<unsigned long long>(position_.segment), static_cast<unsigned long long>(position_.offset),
+                  SNAPSHOT_SUFFIX);
+    auto path = (std::filesystem::path(directory) / name).string();
+    auto temporary = path + ".tmp";
+
+    auto fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1)
+        throw std::runtime_error("Could not create snapshot " + temporary);
+    auto header = FileHeader{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.segment = position_.segment;
+    header.offset = position_.offset;
+    header.sessions = sessions_;
+    header.size = data_.size();
+    try {
+        write_all(fd, reinterpret_cast<const char *>(&header), sizeof(header));
+        write_all(fd, data_.data(), data_.size());
+    }
+    catch (...) {
+        ::close(fd);
+        std::filesystem::remove(temporary);
+        throw;
+    }
+    fdatasync(fd);
+    ::close(fd);
+
+    // Publish the complete file under its final name, only then drop the older ones
+    std::filesystem::rename(temporary, path);
+    auto directory_fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (directory_fd != -1) {
+        fsync(directory_fd);
+        ::close(directory_fd);
+    }
+    auto existing = snapshots(directory);
+    for (size_t i = 0; i + KEEP < existing.size(); ++i)
+        std::filesystem::remove(existing[i]);
+
+    // Neither snapshot left replays the journal from before the oldest one's segment
+    auto oldest = existing.size() > KEEP ? existing.size() - KEEP : 0;
+    Journal::prune(directory, segment_of(existing[oldest]));
+}
+
+Journal::Position Snapshot::load(const std::string & directory, const Restorer & restore)
+{
+    auto existing = snapshots(directory);
+    if (existing.empty())
+        return {0, 0};
+
+    const auto & path = existing.back();
+    auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        throw std::runtime_error("Could not open snapshot " + path);
+    struct stat status{};
+    fstat(fd, &status);
+    auto size = static_cast<size_t>(status.st_size);
+    auto mapped = size != 0 ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    ::close(fd);
+    if (mapped == MAP_FAILED)
+        throw std::runtime_error("Could not map snapshot " + path);
+
+    auto data = static_cast<const char *>(mapped);
+    auto header = FileHeader{};
+    if (size >= sizeof(header))
+        std::memcpy(&header, data, sizeof(header));
+    if (size < sizeof(header) || std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0
+        || header.size != size - sizeof(header)) {
+        munmap(mapped, size);
+        throw std::runtime_error("Corrupt snapshot " + path);
+    }
+
+    try {
+        size_t offset = sizeof(header);
+        for (uint64_t i = 0; i < header.sessions; ++i) {
+            auto entry = SessionEntry{};
+            if (size - offset < sizeof(entry))
+                throw std::runtime_error("Corrupt snapshot " + path);
+            std::memcpy(&entry, data + offset, sizeof(entry));
+            offset += sizeof(entry);
+            if (size - offset < entry.size)
+                throw std::runtime_error("Corrupt snapshot " + path);
+            restore(entry.session, data + offset, entry.size);
+            offset += padded(entry.size);
+        }
+    }
+    catch (...) {
+        munmap(mapped, size);
+        throw;
+    }
+    munmap(mapped, size);
+    return {header.segment, header.offset};
+}
+
+auto Snapshot::recover(const std::string & directory, int max_buy, int max_sell, FirmLimits * firm_limits)
+    -> Recovered
+{
+    auto recovered = Recovered{};
+    auto & sessions = recovered.sessions;
+    auto position = load(directory, [&](uint64_t session, const char * image, size_t size) {
+        auto store = std::make_unique<OrderStore>(max_buy, max_sell, firm_limits);
+        store->load(image, size);
+        sessions[session] = std::move(store);
+        recovered.next_session = std::max(recovered.next_session, session + 1);
+    });
+
+    auto parser = Parser(PROTOCOL_VERSION);
+    Journal::read(directory, [&](const Journal::RecordHeader & record, const char * data) {
+        recovered.next_session = std::max(recovered.next_session, record.session + 1);
+        switch (record.kind) {
+            case Journal::RecordKind::OPEN:
+                sessions[record.session] = std::make_unique<OrderStore>(max_buy, max_sell, firm_limits);
+                return;
+            case Journal::RecordKind::CLOSE:
+                sessions.erase(record.session);
+                return;
+            case Journal::RecordKind::MESSAGE:
+                break;
+            case Journal::RecordKind::END:
+                return;
+        }
+        auto store = sessions.find(record.session);
+        if (store == sessions.end())
+            return;
+        try {
+            parser.dispatch(data, [&](const Messages::Header &, const auto & payload) {
+                store->second->consume(payload);
+            });
+        }
+        catch (const std::runtime_error &) { /* not a risk message, it had no effect the first time either */ }
+    }, position);
+    return recovered;
+}
+
+SnapshotWriter::SnapshotWriter(std::string directory)
+    : directory_(std::move(directory))
+{
+    thread_ = std::thread([this]() { run(); });
+}
+
+SnapshotWriter::~SnapshotWriter()
+{
+    {
+        auto lock = std::lock_guard<std::mutex>(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_one();
+    thread_.join();
+}
+
+void SnapshotWriter::submit(std::shared_ptr<Snapshot> snapshot)
+{
+    {
+        auto lock = std::lock_guard<std::mutex>(mutex_);
+        queue_.push_back(std::move(snapshot));
+    }
+    wake_.notify_one();
+}
+
+void SnapshotWriter::run()
+{
+    auto lock = std::unique_lock<std::mutex>(mutex_);
+    while (true) {
+        wake_.wait(lock, [&]() { return stopping_ || !queue_.empty(); });
+        if (queue_.empty())
+            return; // stopping with nothing left to write
+        auto snapshot = std::move(queue_.front());
+        queue_.pop_front();
+        lock.unlock();
+        try {
+            snapshot->write(directory_);
+            std::cerr << "[INFO] Snapshot of " << snapshot->sessions() << " session(s) written\n";
+        }
+        catch (const std::exception & err) {
+            std::cerr << "[WARN] " << err.what() << "\n";
+        }
+        lock.lock();
+    }
+}
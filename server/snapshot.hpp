@@ -0,0 +1,91 @@
+#ifndef SNAPSHOT_HPP
+#define SNAPSHOT_HPP
+
+#include "firmlimits.hpp"
+#include "journal.hpp"
+#include "orderstore.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Point-in-time image of every open session, written next to the journal so that a restart only replays the journal
+// records appended after it. The file is a header holding the journal position, followed by one entry per session:
+// its id, the size of its image and the OrderStore image itself, padded to 8 bytes. Loading maps the file and hands
+// each image to OrderStore::load() as it is.
+//
+// The images are collected in parts, one per thread that owns sessions (the network thread or a risk worker). Each
+// part is taken by its thread in between two messages, so together they reflect the journal up to position() exactly.
+class Snapshot : public std::enable_shared_from_this<Snapshot>
+{
+public:
+    using Completion = std::function<void(std::shared_ptr<Snapshot> snapshot)>;
+    Snapshot(Journal::Position position, size_t parts, Completion on_complete);
+
+    // Must be called from the thread owning the session.
+    void add(uint64_t session, const OrderStore & store);
+    // Marks one part as collected. The last one hands the snapshot to the completion handler.
+    void part_done();
+
+    Journal::Position position() const { return position_; }
+    size_t sessions() const { return sessions_; }
+
+    // Writes the snapshot into `directory`, replacing the file atomically, and removes all but the newest snapshots
+    // along with the journal segments they no longer need.
+    void write(const std::string & directory) const;
+
+    // Loads the newest snapshot in `directory` and calls restore(session, image, size) for every session in it.
+    // Returns the journal position to replay from, which is the start of the journal if there is no snapshot.
+    using Restorer = std::function<void(uint64_t session, const char * image, size_t size)>;
+    static Journal::Position load(const std::string & directory, const Restorer & restore);
+
+    // Rebuilds the sessions that were open when the journal in `directory` was last written, from the newest
+    // snapshot and the journal records appended after it.
+    struct Recovered
+    {
+        std::unordered_map<uint64_t, std::unique_ptr<OrderStore>> sessions;
+        uint64_t next_session = 0; // above every session id found, so new ids never clash with journaled ones
+    };
+    static Recovered recover(const std::string & directory, int max_buy, int max_sell, FirmLimits * firm_limits);
+
+private:
+    static const size_t KEEP = 2; // snapshots left on disk
+
+    Journal::Position position_;
+    Completion on_complete_;
+
+    std::mutex mutex_;
+    std::vector<char> data_;
+    size_t sessions_ = 0;
+    size_t parts_pending_;
+};
+
+// Writes snapshots on a background thread, so the threads owning the sessions never wait for the disk.
+class SnapshotWriter
+{
+public:
+    explicit SnapshotWriter(std::string directory);
+    ~SnapshotWriter(); // writes the snapshots still queued
+    SnapshotWriter(const SnapshotWriter &) = delete;
+    SnapshotWriter & operator=(const SnapshotWriter &) = delete;
+
+    void submit(std::shared_ptr<Snapshot> snapshot);
+
+private:
+    void run();
+
+    std::string directory_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::deque<std::shared_ptr<Snapshot>> queue_;
+    bool stopping_ = false;
+    std::thread thread_;
+};
+
+#endif //SNAPSHOT_HPP
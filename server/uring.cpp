@@ -0,0 +1,187 @@
+#include "uring.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace
+{
+int setup(unsigned entries, io_uring_params & params)
+{
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+}
+
+int register_with(int fd, unsigned opcode, const void * argument, unsigned count)
+{
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, argument, count));
+}
+
+void * map(int fd, size_t size, off_t offset)
+{
+    auto memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+    if (memory == MAP_FAILED)
+        throw std::runtime_error("Could not map the io_uring rings");
+    return memory;
+}
+
+std::runtime_error failure(const std::string & what)
+{
+    return std::runtime_error(what + ": " + std::strerror(errno));
+}
+} // unnamed namespace
+
+Uring::Uring(unsigned entries)
+{
+    // Room for a burst of completions from the multishot operations, and task work only run when the completions
+    // are asked for, i.e. in submit(). Older kernels get a plain ring.
+    auto params = io_uring_params{};
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    params.cq_entries = entries * 4;
+    fd_ = setup(entries, params);
+    if (fd_ == -1 && errno == EINVAL) {
+        params = io_uring_params{};
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = entries * 4;
+        fd_ = setup(entries, params);
+    }
+    if (fd_ == -1)
+        throw failure("Could not set up io_uring");
+
+    try {
+        sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+            sq_ring_ = cq_ring_ = map(fd_, sq_ring_size_, IORING_OFF_SQ_RING);
+        }
+        else {
+            sq_ring_ = map(fd_, sq_ring_size_, IORING_OFF_SQ_RING);
+            cq_ring_ = map(fd_, cq_ring_size_, IORING_OFF_CQ_RING);
+        }
+        sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = static_cast<io_uring_sqe *>(map(fd_, sqes_size_, IORING_OFF_SQES));
+    }
+    catch (...) {
+        release();
+        throw;
+    }
+
+    auto sq = static_cast<char *>(sq_ring_);
+    sq_head_ = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sq_entries_ = params.sq_entries;
+    sq_prepared_ = *sq_tail_;
+    // Submission entries are used in ring order, so the indirection array maps every slot to itself once and for all
+    auto array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    for (unsigned i = 0; i < sq_entries_; ++i)
+        array[i] = i;
+
+    auto cq = static_cast<char *>(cq_ring_);
+    cq_head_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+}
+
+Uring::~Uring()
+{
+    release();
+}
+
+void Uring::release()
+{
+    if (sqes_)
+        munmap(sqes_, sqes_size_);
+    if (cq_ring_ && cq_ring_ != sq_ring_)
+        munmap(cq_ring_, cq_ring_size_);
+    if (sq_ring_)
+        munmap(sq_ring_, sq_ring_size_);
+    if (fd_ != -1)
+        close(fd_);
+}
+
+io_uring_sqe & Uring::prepare(uint8_t opcode, int fd, uint64_t user_data)
+{
+    if (sq_prepared_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) == sq_entries_)
+        enter(0, 0);
+    if (sq_prepared_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) == sq_entries_)
+        throw std::runtime_error("The io_uring submission ring is full");
+
+    auto & sqe = sqes_[sq_prepared_ & sq_mask_];
+    std::memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = opcode;
+    sqe.fd = fd;
+    sqe.user_data = user_data;
+    ++sq_prepared_;
+    ++to_submit_;
+    return sqe;
+}
+
+void Uring::submit(unsigned wait)
+{
+    enter(wait, IORING_ENTER_GETEVENTS);
+}
+
+void Uring::enter(unsigned wait, unsigned flags)
+{
+    __atomic_store_n(sq_tail_, sq_prepared_, __ATOMIC_RELEASE);
+    auto submitted = syscall(__NR_io_uring_enter, fd_, to_submit_, wait, flags, nullptr, 0);
+    if (submitted == -1) {
+        // Interrupted, or the completion ring is backed up: the caller reaps completions and comes back
+        if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+            return;
+        throw failure("Submitting to io_uring failed");
+    }
+    to_submit_ -= static_cast<unsigned>(submitted);
+}
+
+ProvidedBuffers::ProvidedBuffers(Uring & ring, uint16_t group, uint16_t count, uint32_t size, uint64_t user_data)
+    : ring_(ring)
+    , group_(group)
+    , size_(size)
+    , user_data_(user_data)
+    , memory_(static_cast<size_t>(count) * size)
+{
+    provide(0, count);
+}
+
+void ProvidedBuffers::provide(uint16_t first, uint16_t count)
+{
+    auto & sqe = ring_.prepare(IORING_OP_PROVIDE_BUFFERS, count, user_data_);
+    sqe.addr = reinterpret_cast<uint64_t>(data(first));
+    sqe.len = size_;
+    sqe.off = first;
+    sqe.buf_group = group_;
+    sqe.flags = IOSQE_CQE_SKIP_SUCCESS;
+}
+
+FixedBuffers::FixedBuffers(Uring & ring, uint16_t count, uint32_t size)
+    : memory_(static_cast<size_t>(count) * size)
+    , size_(size)
+{
+    auto buffers = std::vector<iovec>(count);
+    for (uint16_t index = 0; index < count; ++index)
+        buffers[index] = {data(index), size};
+    if (register_with(ring.fd(), IORING_REGISTER_BUFFERS, buffers.data(), count) == -1)
+        throw failure("Could not register the send buffers");
+
+    // Taken from the back, lowest index first
+    for (auto index = count; index != 0; --index)
+        free_.push_back(index - 1);
+}
+
+uint16_t FixedBuffers::take()
+{
+    if (free_.empty())
+        return NONE;
+    auto index = free_.back();
+    free_.pop_back();
+    return index;
+}
@@ -0,0 +1,126 @@
+#ifndef URING_HPP
+#define URING_HPP
+
+#include <linux/io_uring.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// An io_uring instance driven through the raw system calls and the kernel header, liburing is not needed. prepare()
+// fills submission entries in memory shared with the kernel, submit() hands all of them over and waits for
+// completions in one io_uring_enter(), and complete() walks the completions, again in shared memory. However many
+// operations a loop iteration starts and finishes, it costs one system call.
+//
+// Not synchronised, the ring belongs to the thread that submits to it.
+class Uring
+{
+public:
+    explicit Uring(unsigned entries);
+    ~Uring();
+    Uring(const Uring &) = delete;
+    Uring & operator=(const Uring &) = delete;
+
+    // A zeroed submission entry for the operation, the caller fills in the rest. Submits what is prepared already
+    // when the submission ring is full.
+    io_uring_sqe & prepare(uint8_t opcode, int fd, uint64_t user_data);
+
+    // Submits everything prepared and waits until at least `wait` completions are ready. Returns early on a signal.
+    // Throws std::runtime_error if the kernel refuses the submissions.
+    void submit(unsigned wait);
+
+    // Hands every ready completion to `handler`, which may prepare new operations. Returns how many there were.
+    template<typename Handler>
+    unsigned complete(Handler && handler);
+
+    int fd() const { return fd_; }
+
+private:
+    void enter(unsigned wait, unsigned flags);
+    void release();
+
+    int fd_ = -1;
+    void * sq_ring_ = nullptr;
+    size_t sq_ring_size_ = 0;
+    void * cq_ring_ = nullptr; // the same mapping as sq_ring_ on kernels with IORING_FEAT_SINGLE_MMAP
+    size_t cq_ring_size_ = 0;
+    io_uring_sqe * sqes_ = nullptr;
+    size_t sqes_size_ = 0;
+
+    unsigned * sq_head_ = nullptr;
+    unsigned * sq_tail_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned sq_entries_ = 0;
+    unsigned sq_prepared_ = 0; // tail including the entries not yet published to the kernel
+    unsigned to_submit_ = 0;
+
+    unsigned * cq_head_ = nullptr;
+    unsigned * cq_tail_ = nullptr;
+    unsigned cq_mask_ = 0;
+    io_uring_cqe * cqes_ = nullptr;
+};
+
+// Receive buffers provided to the kernel. A recv with IOSQE_BUFFER_SELECT in group() takes one only when data arrives,
+// so idle connections tie up no memory, and its completion names the buffer in the upper bits of the flags. The buffer
+// is the caller's until recycle() provides it again, which is one more submission entry in the next batch.
+//
+// Provided with IORING_OP_PROVIDE_BUFFERS rather than through a registered buffer ring: the ring is the cheaper
+// mechanism, but selecting from it failed with ENOBUFS on the kernels this was tested on.
+class ProvidedBuffers
+{
+public:
+    // Successful provisions complete silently, a failed one completes with `user_data`.
+    ProvidedBuffers(Uring & ring, uint16_t group, uint16_t count, uint32_t size, uint64_t user_data);
+
+    uint16_t group() const { return group_; }
+    const char * data(uint16_t id) const { return memory_.data() + static_cast<size_t>(id) * size_; }
+    void recycle(uint16_t id) { provide(id, 1); }
+
+private:
+    void provide(uint16_t first, uint16_t count);
+
+    Uring & ring_;
+    uint16_t group_;
+    uint32_t size_;
+    uint64_t user_data_;
+    std::vector<char> memory_;
+};
+
+// Send buffers registered with the ring once, so that a zero-copy send with IORING_RECVSEND_FIXED_BUF skips pinning and
+// mapping their pages. A buffer belongs to one send from take() until release(), once the kernel has notified that
+// it is done with the memory.
+class FixedBuffers
+{
+public:
+    static constexpr uint16_t NONE = UINT16_MAX;
+
+    FixedBuffers(Uring & ring, uint16_t count, uint32_t size);
+
+    // A free buffer, NONE when all of them are in use.
+    uint16_t take();
+    void release(uint16_t index) { free_.push_back(index); }
+
+    char * data(uint16_t index) { return memory_.data() + static_cast<size_t>(index) * size_; }
+    uint32_t size() const { return size_; }
+
+private:
+    std::vector<char> memory_;
+    std::vector<uint16_t> free_;
+    uint32_t size_;
+};
+
+template<typename Handler>
+unsigned Uring::complete(Handler && handler)
+{
+    auto head = *cq_head_;
+    auto tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    for (auto entry = head; entry != tail; ++entry) {
+        // Copied out as the entry is the kernel's again once the head moves past it
+        auto cqe = cqes_[entry & cq_mask_];
+        __atomic_store_n(cq_head_, entry + 1, __ATOMIC_RELEASE);
+        handler(static_cast<const io_uring_cqe &>(cqe));
+    }
+    return tail - head;
+}
+
+#endif //URING_HPP
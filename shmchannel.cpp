@@ -0,0 +1,275 @@
+#include "shmchannel.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+ShmChannel::ShmChannel(const std::string & name, size_t capacity)
+    : name_(name)
+    , page_size_(static_cast<size_t>(sysconf(_SC_PAGESIZE)))
+{
+    capacity_ = page_size_;
+    while (capacity_ < capacity)
+        capacity_ *= 2;
+    mask_ = capacity_ - 1;
+
+    fd_ = shm_open(name_.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd_ == -1)
+        throw std::runtime_error("Could not create the shared-memory session " + name_);
+    if (ftruncate(fd_, static_cast<off_t>(page_size_ + 2 * capacity_)) == -1) {
+        unlink();
+        close(fd_);
+        throw std::runtime_error("Could not size the shared-memory session " + name_);
+    }
+    try {
+        map(false);
+    }
+    catch (...) {
+        unmap();
+        unlink();
+        close(fd_);
+        throw;
+    }
+    // Fresh pages are zero, only the identification needs writing
+    control_->magic = MAGIC;
+    control_->version = VERSION;
+    control_->capacity = capacity_;
+}
+
+ShmChannel::ShmChannel(int fd)
+    : fd_(fd)
+    , page_size_(static_cast<size_t>(sysconf(_SC_PAGESIZE)))
+{
+    // Checked before trusting anything in the control page
+    struct stat status{};
+    auto control = MAP_FAILED;
+    if (fstat(fd_, &status) == 0 && static_cast<size_t>(status.st_size) > page_size_)
+        control = mmap(nullptr, page_size_, PROT_READ, MAP_SHARED, fd_, 0);
+    if (control == MAP_FAILED)
+        throw std::runtime_error("Not a shared-memory session");
+    auto header = static_cast<const Control *>(control);
+    auto magic = header->magic;
+    auto version = header->version;
+    capacity_ = header->capacity;
+    munmap(control, page_size_);
+    auto size = static_cast<size_t>(status.st_size);
+    if (magic != MAGIC || version != VERSION || capacity_ < page_size_
+        || (capacity_ & (capacity_ - 1)) != 0 || size != page_size_ + 2 * capacity_)
+        throw std::runtime_error("Not a shared-memory session");
+    mask_ = capacity_ - 1;
+    try {
+        map(true);
+    }
+    catch (...) {
+        unmap();
+        throw;
+    }
+}
+
+ShmChannel::~ShmChannel()
+{
+    unlink(); // never handed over
+    unmap();
+    close(fd_);
+}
+
+void ShmChannel::unmap()
+{
+    for (auto & ring : rings_) {
+        if (ring)
+            munmap(ring, 2 * capacity_);
+        ring = nullptr;
+    }
+    if (control_)
+        munmap(control_, page_size_);
+    control_ = nullptr;
+}
+
+void ShmChannel::map(bool server)
+{
+    static_assert(sizeof(Control) <= 4096, "The control block must fit a page");
+    auto control = mmap(nullptr, page_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (control == MAP_FAILED)
+        throw std::runtime_error("Could not map the shared-memory session");
+    control_ = static_cast<Control *>(control);
+
+    for (size_t i = 0; i < 2; ++i) {
+        // Reserve twice the capacity, then lay the ring over both halves
+        auto reserved = mmap(nullptr, 2 * capacity_, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (reserved == MAP_FAILED)
+            throw std::runtime_error("Could not map the shared-memory session");
+        rings_[i] = static_cast<char *>(reserved);
+        auto offset = static_cast<off_t>(page_size_ + i * capacity_);
+        for (auto half : {rings_[i], rings_[i] + capacity_}) {
+            if (mmap(half, capacity_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd_, offset) == MAP_FAILED)
+                throw std::runtime_error("Could not map the shared-memory session");
+        }
+    }
+
+    // The first ring carries the client's messages
+    out_ = server ? &control_->to_client : &control_->to_server;
+    in_ = server ? &control_->to_server : &control_->to_client;
+    out_data_ = server ? rings_[1] : rings_[0];
+    in_data_ = server ? rings_[0] : rings_[1];
+}
+
+void ShmChannel::unlink()
+{
+    if (!name_.empty())
+        shm_unlink(name_.c_str());
+    name_.clear();
+}
+
+size_t ShmChannel::write_space()
+{
+    auto used = out_->tail.load(std::memory_order_relaxed) - out_->head.load(std::memory_order_acquire);
+    return used < capacity_ ? capacity_ - used : 0;
+}
+
+void ShmChannel::commit(size_t bytes)
+{
+    out_->tail.store(out_->tail.load(std::memory_order_relaxed) + bytes, std::memory_order_release);
+}
+
+size_t ShmChannel::pending()
+{
+    auto available = in_->tail.load(std::memory_order_acquire) - in_->head.load(std::memory_order_relaxed);
+    if (available > capacity_)
+        throw std::runtime_error("Corrupt shared-memory ring");
+    return available;
+}
+
+void ShmChannel::consume(size_t bytes)
+{
+    in_->head.store(in_->head.load(std::memory_order_relaxed) + bytes, std::memory_order_release);
+}
+
+size_t ShmChannel::read(char * data, size_t size)
+{
+    auto bytes = std::min(pending(), size);
+    std::memcpy(data, read_data(), bytes);
+    consume(bytes);
+    return bytes;
+}
+
+bool ShmChannel::arm()
+{
+    // Pairs with the fence in peer_waiting(): either the producer sees the flag, or this side sees its commit
+    in_->waiting.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (in_->tail.load(std::memory_order_relaxed) != in_->head.load(std::memory_order_relaxed)) {
+        disarm();
+        return false;
+    }
+    return true;
+}
+
+bool ShmChannel::peer_waiting()
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return out_->waiting.load(std::memory_order_relaxed) != 0 && out_->waiting.exchange(0) != 0;
+}
+
+sockaddr_un ShmChannel::rendezvous_address(uint16_t port, socklen_t & length)
+{
+    auto address = sockaddr_un{};
+    address.sun_family = AF_UNIX;
+    auto name = "flow-" + std::to_string(port);
+    std::memcpy(address.sun_path + 1, name.data(), name.size()); // a leading zero byte names an abstract socket
+    length = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + 1 + name.size());
+    return address;
+}
+
+int ShmChannel::connect(uint16_t port, int doorbell, int & peer_doorbell)
+{
+    auto fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        throw std::runtime_error("Error creating client socket");
+    auto length = socklen_t{};
+    auto address = rendezvous_address(port, length);
+    if (::connect(fd, reinterpret_cast<sockaddr *>(&address), length) == -1) {
+        close(fd);
+        throw std::runtime_error("Could not connect to the server over shared memory");
+    }
+
+    // The server maps the file and answers with its own doorbell, after which the file is no longer needed
+    int fds[] = {fd_, doorbell};
+    if (!send_descriptors(fd, fds, 2) || !receive_descriptors(fd, &peer_doorbell, 1)) {
+        close(fd);
+        throw std::runtime_error("The server refused the shared-memory session");
+    }
+    unlink();
+    return fd;
+}
+
+bool same_user(int socket)
+{
+    auto credentials = ucred{};
+    auto length = socklen_t{sizeof(credentials)};
+    return getsockopt(socket, SOL_SOCKET, SO_PEERCRED, &credentials, &length) == 0 && credentials.uid == geteuid();
+}
+
+bool send_descriptors(int socket, const int * fds, size_t count)
+{
+    char byte = 0;
+    auto data = iovec{&byte, 1};
+    char control[CMSG_SPACE(sizeof(int) * 4)] = {};
+    if (count > 4)
+        throw std::logic_error("Too many descriptors for one message");
+
+    auto message = msghdr{};
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+    auto header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(int) * count);
+    std::memcpy(CMSG_DATA(header), fds, sizeof(int) * count);
+    while (true) {
+        if (sendmsg(socket, &message, MSG_NOSIGNAL) == 1)
+            return true;
+        if (errno != EINTR)
+            return false;
+    }
+}
+
+bool receive_descriptors(int socket, int * fds, size_t count)
+{
+    char byte;
+    auto data = iovec{&byte, 1};
+    char control[CMSG_SPACE(sizeof(int) * 4)] = {};
+    auto message = msghdr{};
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    ssize_t received;
+    do {
+        received = recvmsg(socket, &message, MSG_CMSG_CLOEXEC);
+    } while (received == -1 && errno == EINTR);
+    if (received == 0)
+        errno = ECONNRESET;
+    if (received != 1)
+        return false;
+
+    auto header = CMSG_FIRSTHDR(&message);
+    errno = EPROTO;
+    if (!header || header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS)
+        return false;
+    auto received_count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    auto received_fds = reinterpret_cast<const int *>(CMSG_DATA(header));
+    if (received_count != count || (message.msg_flags & MSG_CTRUNC)) {
+        for (size_t i = 0; i < received_count && i < 4; ++i)
+            close(received_fds[i]);
+        return false;
+    }
+    std::memcpy(fds, received_fds, sizeof(int) * count);
+    return true;
+}
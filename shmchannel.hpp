@@ -0,0 +1,110 @@
+#ifndef SHMCHANNEL_HPP
+#define SHMCHANNEL_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Session between a client and the server on the same host over a file in /dev/shm: a control page followed by two
+// lock-free single-producer/single-consumer byte rings, one per direction, carrying wire frames back to back exactly
+// as they would go over TCP. Each ring is mapped twice in a row, so that whatever is buffered is contiguous in memory
+// even where it wraps: frames are written in place, like in SendBuffer. The other side can still write to the inbound
+// ring, so frames are copied out with read() before they are checked and handled.
+//
+// Neither side makes a system call while the other one is busy. A side that wants to sleep arm()s first, which asks
+// the producer of its inbound ring to ring its doorbell (an eventfd exchanged when connecting) after the next commit.
+class ShmChannel
+{
+public:
+    static constexpr size_t DEFAULT_CAPACITY = 1024 * 1024;
+
+    // Creates /dev/shm/<name> for a new session, client side. The capacity of each ring is rounded up to a power of
+    // two of at least a page.
+    explicit ShmChannel(const std::string & name, size_t capacity = DEFAULT_CAPACITY);
+    // Maps a session file received from a client, server side, and takes ownership of the descriptor unless it throws
+    // std::runtime_error because the file is not a session.
+    explicit ShmChannel(int fd);
+    ~ShmChannel();
+    ShmChannel(const ShmChannel &) = delete;
+    ShmChannel & operator=(const ShmChannel &) = delete;
+
+    int fd() const { return fd_; }
+    // Removes the file from /dev/shm once the server has mapped it, the mappings stay valid. Done on destruction at
+    // the latest.
+    void unlink();
+
+    // Outbound ring: contiguous free space, then makes `bytes` written there visible to the other side.
+    char * write_data() { return out_data_ + (out_->tail.load(std::memory_order_relaxed) & mask_); }
+    size_t write_space();
+    void commit(size_t bytes);
+
+    // Inbound ring: the bytes received, in place, then frees `bytes` from the front once they have been handled.
+    // pending() throws std::runtime_error if the other side corrupted the ring.
+    const char * read_data() const { return in_data_ + (in_->head.load(std::memory_order_relaxed) & mask_); }
+    size_t pending();
+    void consume(size_t bytes);
+    // Copies up to `size` received bytes to `data` and frees them, like read() on a socket. Returns the bytes copied.
+    size_t read(char * data, size_t size);
+
+    // Before sleeping on the own doorbell. Returns false, asking for nothing, if something arrived in the meantime.
+    bool arm();
+    void disarm() { in_->waiting.store(0, std::memory_order_relaxed); }
+    // After a commit: whether the other side asked to be woken up, which it is then owed once.
+    bool peer_waiting();
+
+    // The Unix socket in the abstract namespace where the server listening on TCP `port` accepts sessions. A client
+    // connects, sends the descriptors of its session file and of its doorbell, and gets the server's doorbell back.
+    static sockaddr_un rendezvous_address(uint16_t port, socklen_t & length);
+    // The client side of that exchange, which then unlinks the file. Returns the connected socket and the server's
+    // doorbell in `peer_doorbell`. Throws std::runtime_error.
+    int connect(uint16_t port, int doorbell, int & peer_doorbell);
+
+private:
+    static constexpr uint64_t MAGIC = 0x6c656e6e6168636dULL; // "mchannel"
+    static constexpr uint32_t VERSION = 1;
+
+    struct Ring
+    {
+        alignas(64) std::atomic<uint64_t> head; // bytes consumed, written by the consumer
+        alignas(64) std::atomic<uint64_t> tail; // bytes produced, written by the producer
+        alignas(64) std::atomic<uint32_t> waiting; // the consumer sleeps on its doorbell
+    };
+
+    struct Control
+    {
+        uint64_t magic;
+        uint32_t version;
+        uint64_t capacity;
+        Ring to_server;
+        Ring to_client;
+    };
+
+    void map(bool server);
+    void unmap();
+
+    std::string name_; // empty on the server side
+    int fd_ = -1;
+    size_t capacity_ = 0;
+    size_t mask_ = 0;
+    size_t page_size_;
+    Control * control_ = nullptr;
+    char * rings_[2] = {nullptr, nullptr}; // each twice the capacity of address space, mapping the ring twice
+    Ring * out_ = nullptr;
+    Ring * in_ = nullptr;
+    char * out_data_ = nullptr;
+    char * in_data_ = nullptr;
+};
+
+// Descriptors sent over a Unix socket along with a byte. Both return false on failure with errno set, EPROTO when
+// receive_descriptors() got anything other than `count` of them.
+bool send_descriptors(int socket, const int * fds, size_t count);
+bool receive_descriptors(int socket, int * fds, size_t count);
+
+// Whether the process at the other end of a connected Unix socket runs as the same user as this one, going by
+// SO_PEERCRED. Any local user can connect to a socket in the abstract namespace, which has no permissions.
+bool same_user(int socket);
+
+#endif //SHMCHANNEL_HPP
@@ -0,0 +1,268 @@
+#include "../client/client.hpp"
+#include "helpers.hpp"
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <arpa/inet.h>
+#include <memory>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <thread>
+#include <type_traits>
+#include <unistd.h>
+#include <vector>
+
+using namespace testing;
+using OrderStatus = Messages::OrderResponse::Status;
+
+namespace
+{
+uint16_t next_port = 24400;
+const uint64_t STRAY_ORDER_ID = 0; // never sent by these tests
+const uint64_t REFUSED_SESSION = 123;
+
+// Stands in for the server over either transport, on a thread of its own until the client goes away. It answers the
+// orders `batch` at a time in reverse order, each batch followed by a response for STRAY_ORDER_ID. Session requests
+// are answered at once, accepted unless they are for REFUSED_SESSION.
+class StandIn
+{
+public:
+    StandIn(Client::Transport transport, size_t batch)
+        : port_(next_port++)
+        , transport_(transport)
+        , batch_(batch)
+    {
+        if (transport_ == Client::Transport::SHARED_MEMORY) {
+            listener_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            auto length = socklen_t{};
+            auto address = ShmChannel::rendezvous_address(port_, length);
+            if (bind(listener_, reinterpret_cast<sockaddr *>(&address), length) == -1)
+                throw std::runtime_error("Could not listen");
+        }
+        else {
+            listener_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            int one = 1;
+            setsockopt(listener_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            auto address = sockaddr_in{};
+            address.sin_family = AF_INET;
+            address.sin_port = htons(port_);
+            inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+            if (bind(listener_, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == -1)
+                throw std::runtime_error("Could not listen");
+        }
+        listen(listener_, 1);
+        thread_ = std::thread([this]() { serve(); });
+    }
+
+    ~StandIn()
+    {
+        thread_.join();
+        close(listener_);
+    }
+
+    std::unique_ptr<Client> connect(size_t window) const
+    {
+        return std::make_unique<Client>(window, "127.0.0.1", port_, transport_);
+    }
+
+private:
+    void serve()
+    {
+        socket_ = accept4(listener_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (transport_ == Client::Transport::SHARED_MEMORY) {
+            int fds[2];
+            receive_descriptors(socket_, fds, 2);
+            shm_ = std::make_unique<ShmChannel>(fds[0]);
+            client_doorbell_ = fds[1];
+            doorbell_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            send_descriptors(socket_, &doorbell_, 1);
+        }
+
+        // Over shared memory the socket only tells when the client is gone, the ring is polled
+        auto gone = false;
+        while (!gone) {
+            auto event = pollfd{socket_, POLLIN, 0};
+            poll(&event, 1, 1);
+            if (shm_) {
+                gone = event.revents != 0;
+                while (auto bytes = shm_->read(input_.write_data(), input_.write_space()))
+                    receive(bytes);
+            }
+            else if (event.revents != 0) {
+                auto bytes = read(socket_, input_.write_data(), input_.write_space());
+                gone = bytes <= 0;
+                if (!gone)
+                    receive(bytes);
+            }
+            send();
+        }
+        close(socket_);
+        if (shm_) {
+            close(doorbell_);
+            close(client_doorbell_);
+        }
+    }
+
+    void receive(size_t bytes)
+    {
+        input_.commit(bytes);
+        auto batch = parser_.decode_batch(input_.read_data(), input_.pending(),
+            [&](const Messages::Header &, const auto & payload) {
+                using Payload = std::decay_t<decltype(payload)>;
+                if constexpr (std::is_same_v<Payload, Messages::SessionRequest>) {
+                    answer_session(payload);
+                }
+                else if constexpr (std::is_same_v<Payload, Messages::NewOrder>) {
+                    orders_.push_back(payload.orderId);
+                    if (orders_.size() == batch_)
+                        answer_orders();
+                }
+            });
+        input_.consume(input_.pending() - batch.remaining);
+    }
+
+    void answer_session(const Messages::SessionRequest & request)
+    {
+        auto response = Messages::SessionResponse{Messages::SessionResponse::MESSAGE_TYPE, request.session, 77,
+                                                  sequence_number_, OrderStatus::ACCEPTED};
+        if (request.session == Messages::SessionRequest::CURRENT) {
+            response.session = 5;
+        }
+        else if (request.session == REFUSED_SESSION) {
+            response.token = 0;
+            response.status = OrderStatus::REJECTED;
+        }
+        else {
+            sequence_number_ = request.nextSequenceNumber;
+            response.nextSequenceNumber = sequence_number_;
+        }
+        encoder_.encode(output_, response, sequence_number_, 0);
+    }
+
+    void answer_orders()
+    {
+        std::reverse(orders_.begin(), orders_.end());
+        orders_.push_back(STRAY_ORDER_ID);
+        for (auto order_id : orders_) {
+            auto response = Messages::OrderResponse{Messages::OrderResponse::MESSAGE_TYPE, order_id,
+                                                    OrderStatus::ACCEPTED, Messages::OrderResponse::Reason::NONE};
+            encoder_.encode(output_, response, sequence_number_++, 0);
+        }
+        orders_.clear();
+    }
+
+    void send()
+    {
+        if (!shm_) {
+            output_.flush(socket_);
+            return;
+        }
+        auto written = false;
+        while (output_.pending() != 0) {
+            auto bytes = output_.drain(shm_->write_data(), shm_->write_space());
+            if (bytes == 0)
+                break;
+            shm_->commit(bytes);
+            written = true;
+        }
+        if (written && shm_->peer_waiting()) {
+            uint64_t ring = 1;
+            [[maybe_unused]] auto bytes = write(client_doorbell_, &ring, sizeof(ring));
+        }
+    }
+
+    uint16_t port_;
+    Client::Transport transport_;
+    size_t batch_;
+    int listener_ = -1;
+    int socket_ = -1;
+    std::unique_ptr<ShmChannel> shm_;
+    int doorbell_ = -1;
+    int client_doorbell_ = -1;
+    Parser parser_{1};
+    Encoder encoder_{1};
+    ReceiveBuffer input_;
+    SendBuffer output_;
+    std::vector<uint64_t> orders_;
+    uint32_t sequence_number_ = 0;
+    std::thread thread_;
+};
+
+const Client::Transport TRANSPORTS[] = {Client::Transport::TCP, Client::Transport::SHARED_MEMORY};
+
+Messages::NewOrder buy(uint64_t order_id)
+{
+    return Messages::NewOrder{Messages::NewOrder::MESSAGE_TYPE, 1, order_id, 1, 100, 'B'};
+}
+} // unnamed namespace
+
+TEST(client, window_refuses_more)
+{
+    for (auto transport : TRANSPORTS) {
+        auto stand_in = StandIn(transport, 2);
+        auto client = stand_in.connect(2);
+        auto answered = 0;
+        auto on_response = [&](const Messages::OrderResponse &) { ++answered; };
+        ASSERT_TRUE(client->send(buy(1), on_response));
+        ASSERT_TRUE(client->send(buy(2), on_response));
+        ASSERT_FALSE(client->send(buy(3), on_response));
+        ASSERT_EQ(client->in_flight(), 2);
+
+        ASSERT_TRUE(wait_for(*client, [&]() { return answered == 2; }));
+        ASSERT_EQ(client->in_flight(), 0);
+        ASSERT_TRUE(client->send(buy(3), on_response)) << "The window has room again";
+        ASSERT_EQ(client->in_flight(), 1);
+    }
+}
+
+TEST(client, matches_responses_out_of_order)
+{
+    for (auto transport : TRANSPORTS) {
+        auto stand_in = StandIn(transport, 3);
+        auto client = stand_in.connect(8);
+        auto delivered = std::vector<uint64_t>{};
+        auto unmatched = std::vector<uint64_t>{};
+        client->on_unmatched([&](const Messages::OrderResponse & response) { unmatched.push_back(response.orderId); });
+        for (uint64_t order_id = 1; order_id <= 3; ++order_id) {
+            ASSERT_TRUE(client->send(buy(order_id), [&, order_id](const Messages::OrderResponse & response) {
+                EXPECT_EQ(response.orderId, order_id);
+                delivered.push_back(order_id);
+            }));
+        }
+        ASSERT_TRUE(wait_for(*client, [&]() { return !unmatched.empty(); }));
+        ASSERT_EQ(delivered, (std::vector<uint64_t>{3, 2, 1}));
+        ASSERT_EQ(unmatched, std::vector<uint64_t>{STRAY_ORDER_ID});
+        ASSERT_EQ(client->in_flight(), 0);
+        ASSERT_EQ(client->next_response(), 4);
+    }
+}
+
+TEST(client, session_callbacks_in_order)
+{
+    for (auto transport : TRANSPORTS) {
+        auto stand_in = StandIn(transport, 1);
+        auto client = stand_in.connect(8);
+        auto answers = std::vector<Messages::SessionResponse>{};
+        auto on_session = [&](const Messages::SessionResponse & response) { answers.push_back(response); };
+        client->request_session(on_session);
+        client->resume(5, 77, 10, on_session);
+        client->resume(REFUSED_SESSION, 77, 20, on_session);
+        ASSERT_TRUE(wait_for(*client, [&]() { return answers.size() == 3; }));
+        ASSERT_EQ(answers[0].session, 5);
+        ASSERT_EQ(answers[0].token, 77);
+        ASSERT_EQ(answers[1].status, OrderStatus::ACCEPTED);
+        ASSERT_EQ(answers[1].nextSequenceNumber, 10);
+        ASSERT_EQ(answers[2].session, REFUSED_SESSION);
+        ASSERT_EQ(answers[2].status, OrderStatus::REJECTED);
+        ASSERT_EQ(client->next_response(), 10) << "Only an accepted resume moves the numbering";
+
+        // The responses after the session requests go on from there
+        auto unmatched = false;
+        client->on_unmatched([&](const Messages::OrderResponse &) { unmatched = true; });
+        ASSERT_TRUE(client->send(buy(1), [](const Messages::OrderResponse &) {}));
+        ASSERT_TRUE(wait_for(*client, [&]() { return unmatched; }));
+        ASSERT_EQ(client->next_response(), 12);
+    }
+}
@@ -0,0 +1,255 @@
+#include "../server/dropcopy.hpp"
+#include "../parser.hpp"
+#include "../receivebuffer.hpp"
+
+#include <gtest/gtest.h>
+#include <arpa/inet.h>
+#include <chrono>
+#include <functional>
+#include <netinet/in.h>
+#include <string>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace testing;
+using OrderStatus = Messages::OrderResponse::Status;
+
+namespace
+{
+uint16_t next_port = 23900; // a port per feed, the subscribers close first so none lingers in TIME_WAIT
+
+// Polls `condition` for up to two seconds
+bool eventually(const std::function<bool()> & condition)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while (!condition()) {
+        if (std::chrono::steady_clock::now() > deadline)
+            return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+Messages::DropCopy decision(uint64_t session, uint64_t order_id, uint64_t listing_id, int64_t buy_side)
+{
+    return Messages::DropCopy{Messages::DropCopy::MESSAGE_TYPE, session, Messages::NewOrder::MESSAGE_TYPE, 0, 0,
+                              order_id, 1, 100, 'B', OrderStatus::ACCEPTED,
+                              Messages::OrderResponse::Reason::NONE, listing_id, buy_side, 0, buy_side};
+}
+
+struct Received
+{
+    uint32_t sequence_number;
+    Messages::DropCopy decision;
+};
+
+// Decodes the DropCopy frames of `size` bytes, returns the bytes of a trailing partial frame
+size_t decode(const char * data, size_t size, std::vector<Received> & received)
+{
+    auto parser = Parser(1);
+    auto batch = parser.decode_batch(data, size, [&](const Messages::Header & header, const auto & payload) {
+        if constexpr (std::is_same_v<std::decay_t<decltype(payload)>, Messages::DropCopy>)
+            received.push_back({header.sequenceNumber, payload});
+    });
+    return batch.remaining;
+}
+
+int connect_tcp(uint16_t port)
+{
+    auto fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    auto address = sockaddr_in{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+    if (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// A subscriber over shared memory with a ring of `capacity` bytes
+struct ShmSubscriber
+{
+    explicit ShmSubscriber(uint16_t port, size_t capacity)
+        : channel("/flow-dropcopy-test-" + std::to_string(getpid()) + "-" + std::to_string(port), capacity)
+        , doorbell(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+    {
+        socket = channel.connect(port, doorbell, publisher_doorbell);
+    }
+
+    ~ShmSubscriber()
+    {
+        for (auto fd : {socket, doorbell, publisher_doorbell})
+            close(fd);
+    }
+
+    void read(std::vector<Received> & received)
+    {
+        while (auto bytes = channel.read(input.write_data(), input.write_space())) {
+            input.commit(bytes);
+            input.consume(input.pending() - decode(input.read_data(), input.pending(), received));
+        }
+    }
+
+    ShmChannel channel;
+    ReceiveBuffer input;
+    int doorbell;
+    int publisher_doorbell = -1;
+    int socket = -1;
+};
+} // unnamed namespace
+
+TEST(dropcopy, tcp_subscriber)
+{
+    auto options = DropCopyOptions{};
+    options.port = next_port++;
+    auto feed = DropCopy(2, options);
+    auto subscriber = connect_tcp(options.port);
+    ASSERT_NE(subscriber, -1);
+    ASSERT_TRUE(eventually([&]() { return feed.subscribers() == 1; }));
+
+    // Each producer's decisions keep their order, the feed numbers all of them in the order it publishes them
+    feed.publish(0, decision(1, 10, 7, 5));
+    feed.publish(1, decision(2, 20, 8, 3));
+    feed.publish(0, decision(1, 11, 7, 9));
+
+    auto received = std::vector<Received>{};
+    auto input = ReceiveBuffer();
+    while (received.size() < 3) {
+        auto bytes = read(subscriber, input.write_data(), input.write_space());
+        ASSERT_GT(bytes, 0);
+        input.commit(bytes);
+        input.consume(input.pending() - decode(input.read_data(), input.pending(), received));
+    }
+    ASSERT_EQ(received.size(), 3);
+    std::vector<uint64_t> session_1;
+    for (size_t i = 0; i < received.size(); ++i) {
+        ASSERT_EQ(received[i].sequence_number, i);
+        if (received[i].decision.session == 1)
+            session_1.push_back(received[i].decision.orderId);
+    }
+    ASSERT_EQ(session_1, (std::vector<uint64_t>{10, 11}));
+    auto & last = received[2].decision.session == 2 ? received[2].decision : received[1].decision;
+    ASSERT_EQ(last.session, 2);
+    ASSERT_EQ(last.listingId, 8);
+    ASSERT_EQ(last.buySide, 3);
+    ASSERT_EQ(last.side, 'B');
+    ASSERT_EQ(feed.published(), 3);
+    ASSERT_EQ(feed.lost(), 0);
+
+    close(subscriber);
+    ASSERT_TRUE(eventually([&]() { return feed.subscribers() == 0; }));
+}
+
+TEST(dropcopy, lost_decisions_leave_a_gap)
+{
+    auto options = DropCopyOptions{};
+    options.port = next_port++;
+    options.shared_memory = true;
+    options.queue_capacity = 2;
+    auto feed = DropCopy(1, options);
+    auto subscriber = ShmSubscriber(options.port, 1 << 20);
+    ASSERT_TRUE(eventually([&]() { return feed.subscribers() == 1; }));
+
+    // Far more than the queue holds, then one more once the publisher has caught up
+    for (uint64_t i = 0; i < 1000; ++i)
+        feed.publish(0, decision(1, i, 7, static_cast<int64_t>(i)));
+    ASSERT_TRUE(eventually([&]() { return feed.published() + feed.lost() == 1000; }));
+    ASSERT_GT(feed.lost(), 0);
+    feed.publish(0, decision(1, 1000, 7, 1000));
+
+    auto received = std::vector<Received>{};
+    ASSERT_TRUE(eventually([&]() {
+        subscriber.read(received);
+        return !received.empty() && received.back().decision.orderId == 1000;
+    }));
+    ASSERT_EQ(received.size(), feed.published());
+    for (const auto & record : received)
+        ASSERT_EQ(record.sequence_number, record.decision.orderId) << "Every lost decision leaves its number unused";
+}
+
+TEST(dropcopy, slow_subscriber_is_dropped)
+{
+    auto options = DropCopyOptions{};
+    options.port = next_port++;
+    options.shared_memory = true;
+    options.max_backlog = 1000;
+    auto feed = DropCopy(1, options);
+    auto subscriber = ShmSubscriber(options.port, 4096);
+    ASSERT_TRUE(eventually([&]() { return feed.subscribers() == 1; }));
+
+    // Nothing is read: a page of ring and the backlog hold fewer than 100 frames
+    for (uint64_t i = 0; i < 100; ++i)
+        feed.publish(0, decision(1, i, 7, static_cast<int64_t>(i)));
+    ASSERT_TRUE(eventually([&]() { return feed.dropped() == 1; }));
+    ASSERT_EQ(feed.subscribers(), 0);
+    ASSERT_EQ(feed.published(), 100);
+}
+
+TEST(dropcopy, slow_subscriber_is_conflated)
+{
+    auto options = DropCopyOptions{};
+    options.port = next_port++;
+    options.shared_memory = true;
+    options.max_backlog = 1000;
+    options.conflate = true;
+    auto feed = DropCopy(1, options);
+    auto subscriber = ShmSubscriber(options.port, 4096);
+    ASSERT_TRUE(eventually([&]() { return feed.subscribers() == 1; }));
+
+    for (uint64_t i = 0; i < 100; ++i)
+        feed.publish(0, decision(1 + i % 2, i, 7 + i % 3, static_cast<int64_t>(i)));
+    ASSERT_TRUE(eventually([&]() { return feed.published() == 100; }));
+
+    // Reading lets the publisher catch up, the latest decision per session and listing comes last
+    auto received = std::vector<Received>{};
+    ASSERT_TRUE(eventually([&]() {
+        subscriber.read(received);
+        return !received.empty() && received.back().sequence_number == 99;
+    }));
+    ASSERT_LT(received.size(), 100) << "Decisions were conflated";
+    for (size_t i = 1; i < received.size(); ++i)
+        ASSERT_LT(received[i - 1].sequence_number, received[i].sequence_number);
+    for (uint64_t i = 94; i < 100; ++i) {
+        auto found = false;
+        for (const auto & record : received)
+            found = found || (record.sequence_number == i && record.decision.orderId == i);
+        ASSERT_TRUE(found) << "The latest decision on session " << 1 + i % 2 << ", listing " << 7 + i % 3;
+    }
+    ASSERT_EQ(feed.dropped(), 0);
+    ASSERT_EQ(feed.subscribers(), 1);
+}
+
+TEST(dropcopy, record)
+{
+    auto store = OrderStore(20, 15);
+    auto message = ::Message{};
+    message.header = {1, sizeof(Messages::NewOrder), 42, 1234};
+    message.payload = Messages::NewOrder{Messages::NewOrder::MESSAGE_TYPE, 7, 3, 12, 100, 'B'};
+    auto response = store.consume(::Message(message));
+    auto record = drop_copy_record(5, message, response, store);
+    ASSERT_EQ(record.session, 5);
+    ASSERT_EQ(record.decidedType, Messages::NewOrder::MESSAGE_TYPE);
+    ASSERT_EQ(record.sequenceNumber, 42);
+    ASSERT_EQ(record.timestamp, 1234);
+    ASSERT_EQ(record.orderId, 3);
+    ASSERT_EQ(record.quantity, 12);
+    ASSERT_EQ(record.status, OrderStatus::ACCEPTED);
+    ASSERT_EQ(record.reason, Messages::OrderResponse::Reason::NONE);
+    ASSERT_EQ(record.listingId, 7);
+    ASSERT_EQ(record.buySide, 12);
+    ASSERT_EQ(record.sellSide, 0);
+
+    // Deleting an unknown order names no listing
+    message.payload = Messages::DeleteOrder{Messages::DeleteOrder::MESSAGE_TYPE, 99};
+    response = store.consume(::Message(message));
+    record = drop_copy_record(5, message, response, store);
+    ASSERT_EQ(record.status, OrderStatus::REJECTED);
+    ASSERT_EQ(record.reason, Messages::OrderResponse::Reason::INVALID);
+    ASSERT_EQ(record.listingId, 0);
+    ASSERT_EQ(record.buySide, 0);
+}
@@ -0,0 +1,67 @@
+#include "../encoder.hpp"
+#include "../parser.hpp"
+
+#include <gtest/gtest.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace testing;
+
+TEST(encoder, exact_frame_size)
+{
+    auto encoder = Encoder(1);
+    char buffer[Encoder::MAX_FRAME_SIZE];
+    ASSERT_EQ(Encoder::MAX_FRAME_SIZE, 16 + sizeof(Messages::DropCopy));
+
+    auto response = Messages::OrderResponse{Messages::OrderResponse::MESSAGE_TYPE, 7,
+                                            Messages::OrderResponse::Status::REJECTED,
+                                            Messages::OrderResponse::Reason::FIRM_LIMIT};
+    ASSERT_EQ(encoder.encode(buffer, response, 3, 4), 30);
+
+    auto message = Parser(1).decode(buffer);
+    ASSERT_EQ(message.header.payloadSize, sizeof(Messages::OrderResponse));
+    ASSERT_EQ(message.header.sequenceNumber, 3);
+    ASSERT_EQ(message.header.timestamp, 4);
+    ASSERT_EQ(std::get<Messages::OrderResponse>(message.payload).orderId, 7);
+    ASSERT_EQ(std::get<Messages::OrderResponse>(message.payload).reason, Messages::OrderResponse::Reason::FIRM_LIMIT);
+}
+
+TEST(encoder, message_round_trip)
+{
+    auto encoder = Encoder(1);
+    auto message = ::Message{};
+    message.header = {1, 0, 9, 10}; // payloadSize is filled in by the encoder
+    message.payload = Messages::ModifyOrderQuantity{Messages::ModifyOrderQuantity::MESSAGE_TYPE, 5, 6};
+
+    char buffer[Encoder::MAX_FRAME_SIZE];
+    ASSERT_EQ(encoder.encode(buffer, message), 16 + sizeof(Messages::ModifyOrderQuantity));
+    auto decoded = Parser(1).decode(buffer);
+    ASSERT_EQ(decoded.header.sequenceNumber, 9);
+    ASSERT_EQ(std::get<Messages::ModifyOrderQuantity>(decoded.payload).newQuantity, 6);
+}
+
+TEST(encoder, send_buffer)
+{
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    auto encoder = Encoder(1);
+    auto output = SendBuffer();
+    for (uint64_t id = 0; id < 10; ++id)
+        encoder.encode(output, Messages::DeleteOrder{Messages::DeleteOrder::MESSAGE_TYPE, id}, id, 0);
+    ASSERT_EQ(output.pending(), 10 * Encoder::frame_size<Messages::DeleteOrder>());
+    ASSERT_TRUE(output.flush(fds[0]));
+
+    auto bytes = std::vector<char>(10 * Encoder::frame_size<Messages::DeleteOrder>());
+    ASSERT_EQ(read(fds[1], bytes.data(), bytes.size()), static_cast<ssize_t>(bytes.size()));
+    auto ids = std::vector<uint64_t>();
+    auto batch = Parser(1).decode_batch(
+        bytes.data(), bytes.size(), [&](const Messages::Header &, const auto & payload) {
+            if constexpr (std::is_same_v<std::decay_t<decltype(payload)>, Messages::DeleteOrder>)
+                ids.push_back(payload.orderId);
+        });
+    ASSERT_EQ(batch.messages, 10);
+    ASSERT_EQ(ids.back(), 9);
+    close(fds[0]);
+    close(fds[1]);
+}
@@ -0,0 +1,144 @@
+#include "../server/engine.hpp"
+
+#include <gtest/gtest.h>
+#include <poll.h>
+#include <vector>
+
+using namespace testing;
+using OrderStatus = Messages::OrderResponse::Status;
+
+namespace
+{
+const int MAX_BUY = 20;
+const int MAX_SELL = 15;
+
+::Message makeNewOrder(uint64_t listingId, uint64_t orderId, uint64_t orderQuantity, char side)
+{
+    auto message = ::Message{};
+    message.header = { 1, sizeof(Messages::NewOrder), 0, 0 };
+    message.payload = Messages::NewOrder{ Messages::NewOrder::MESSAGE_TYPE, listingId, orderId, orderQuantity,
+                                          100, side };
+    return message;
+}
+
+struct Collected
+{
+    uint64_t session;
+    OrderStore::Response response;
+};
+
+// Waits on the notification descriptor like the server does until `count` responses were drained.
+void collect(Engine & engine, std::vector<Collected> & responses, size_t count)
+{
+    while (responses.size() < count) {
+        auto fd = pollfd{engine.notify_fd(), POLLIN, 0};
+        ASSERT_GE(poll(&fd, 1, 5000), 1) << "Timed out waiting for responses";
+        engine.drain();
+    }
+}
+} // unnamed namespace
+
+TEST(engine, sessions_are_independent)
+{
+    auto responses = std::vector<Collected>{};
+    auto handler = [&](uint64_t session, const OrderStore::Response & response, const LatencyTrace &) {
+        responses.push_back({session, response});
+    };
+    auto engine = Engine(3, MAX_BUY, MAX_SELL, handler);
+    for (uint64_t session = 0; session < 6; ++session)
+        engine.open(session);
+
+    // every session has its own limits, so all of them accept one order and reject the next
+    for (uint64_t session = 0; session < 6; ++session) {
+        engine.submit(session, makeNewOrder(1, 10 * session, MAX_BUY - 1, 'B'));
+        engine.submit(session, makeNewOrder(1, 10 * session + 1, 1, 'B'));
+    }
+    collect(engine, responses, 12);
+    ASSERT_EQ(responses.size(), 12);
+
+    auto per_session = std::vector<std::vector<OrderStore::Response>>(6);
+    for (const auto & collected : responses)
+        per_session[collected.session].push_back(collected.response);
+    for (uint64_t session = 0; session < 6; ++session) {
+        ASSERT_EQ(per_session[session].size(), 2);
+        ASSERT_EQ(per_session[session][0].order_id, 10 * session) << "Responses are in order within a session";
+        ASSERT_EQ(per_session[session][0].status, OrderStatus::ACCEPTED);
+        ASSERT_EQ(per_session[session][1].status, OrderStatus::REJECTED);
+    }
+}
+
+TEST(engine, backpressure)
+{
+    // far more messages than the queues hold, the producer has to drain while submitting
+    const uint64_t count = 100'000;
+    uint64_t received = 0;
+    auto engine = Engine(2, MAX_BUY, MAX_SELL,
+                         [&](uint64_t, const OrderStore::Response &, const LatencyTrace &) { ++received; });
+    engine.open(1);
+    engine.open(2);
+    for (uint64_t i = 0; i < count; ++i)
+        engine.submit(1 + i % 2, makeNewOrder(i, i, 1, 'S'));
+    while (received < count) {
+        auto fd = pollfd{engine.notify_fd(), POLLIN, 0};
+        ASSERT_GE(poll(&fd, 1, 5000), 1) << "Timed out waiting for responses";
+        engine.drain();
+    }
+    ASSERT_EQ(received, count);
+}
+
+TEST(engine, close_session)
+{
+    auto responses = std::vector<Collected>{};
+    auto handler = [&](uint64_t session, const OrderStore::Response & response, const LatencyTrace &) {
+        responses.push_back({session, response});
+    };
+    auto engine = Engine(1, MAX_BUY, MAX_SELL, handler);
+    engine.open(1);
+    engine.submit(1, makeNewOrder(1, 1, MAX_BUY - 1, 'B'));
+    collect(engine, responses, 1);
+    engine.close(1);
+
+    // a reopened session starts from scratch
+    engine.open(1);
+    engine.submit(1, makeNewOrder(1, 2, MAX_BUY - 1, 'B'));
+    collect(engine, responses, 2);
+    ASSERT_EQ(responses[1].response.status, OrderStatus::ACCEPTED);
+}
+
+TEST(engine, open_with_store)
+{
+    auto responses = std::vector<Collected>{};
+    auto handler = [&](uint64_t session, const OrderStore::Response & response, const LatencyTrace &) {
+        responses.push_back({session, response});
+    };
+    auto engine = Engine(2, MAX_BUY, MAX_SELL, handler);
+
+    // a session recovered elsewhere goes on with its exposure
+    auto store = std::make_unique<OrderStore>(MAX_BUY, MAX_SELL);
+    store->consume(makeNewOrder(1, 1, MAX_BUY - 1, 'B'));
+    engine.open(3, std::move(store));
+    engine.submit(3, makeNewOrder(1, 2, 2, 'B'));
+    collect(engine, responses, 1);
+    ASSERT_EQ(responses[0].response.status, OrderStatus::REJECTED);
+}
+
+TEST(engine, notify_while_draining)
+{
+    // Small rounds keep the workers notifying while the I/O thread drains, a lost notification stalls a round
+    auto received = size_t{0};
+    auto engine = Engine(4, MAX_BUY, MAX_SELL,
+                         [&](uint64_t, const OrderStore::Response &, const LatencyTrace &) { ++received; });
+    for (uint64_t session = 0; session < 8; ++session)
+        engine.open(session);
+    auto expected = size_t{0};
+    for (uint64_t round = 0; round < 5'000; ++round) {
+        for (uint64_t session = 0; session <= round % 8; ++session, ++expected)
+            engine.submit(session, makeNewOrder(round, round, 1, 'S'));
+        while (received < expected) {
+            auto fd = pollfd{engine.notify_fd(), POLLIN, 0};
+            ASSERT_EQ(poll(&fd, 1, 2000), 1) << "Notification lost in round " << round;
+            engine.drain();
+        }
+    }
+    ASSERT_EQ(received, expected);
+}
@@ -5,3 +5,94 @@
 
 
 using namespace testing;
+
+namespace
+{
+const uint64_t MAX_BUY = 20;
+const uint64_t MAX_SELL = 15;
+} // unnamed namespace
+
+TEST(financialinstrument, running_totals)
+{
+    auto instrument = FinancialInstrument();
+    instrument.add_buy({1, 5, 100}, MAX_BUY);
+    instrument.add_buy({2, 7, 100}, MAX_BUY);
+    instrument.add_sell({3, 4, 100}, MAX_SELL);
+    ASSERT_EQ(instrument.buy_side(), 12);
+    ASSERT_EQ(instrument.sell_side(), 4);
+    ASSERT_TRUE(instrument.exposure_consistent());
+
+    instrument.modify_order(1, 2, MAX_BUY, MAX_SELL);
+    ASSERT_EQ(instrument.buy_side(), 9);
+    ASSERT_TRUE(instrument.exposure_consistent());
+
+    instrument.delete_order(2);
+    ASSERT_EQ(instrument.buy_side(), 2);
+    ASSERT_TRUE(instrument.exposure_consistent());
+
+    instrument.add_trade({3, 4, 100}, MAX_BUY, MAX_SELL);
+    ASSERT_EQ(instrument.net_pos(), 4);
+    ASSERT_EQ(instrument.buy_side(), 6);
+    ASSERT_EQ(instrument.sell_side(), 4);
+    ASSERT_TRUE(instrument.exposure_consistent());
+}
+
+TEST(financialinstrument, running_totals_rollback)
+{
+    auto instrument = FinancialInstrument();
+    instrument.add_buy({1, 10, 100}, MAX_BUY);
+    instrument.add_sell({2, 10, 100}, MAX_SELL);
+
+    ASSERT_THROW(instrument.add_buy({3, MAX_BUY, 100}, MAX_BUY), std::logic_error);
+    ASSERT_THROW(instrument.add_sell({4, MAX_SELL, 100}, MAX_SELL), std::logic_error);
+    ASSERT_THROW(instrument.modify_order(1, MAX_BUY, MAX_BUY, MAX_SELL), std::logic_error);
+    ASSERT_THROW(instrument.add_buy({1, MAX_BUY, 100}, MAX_BUY), std::logic_error);
+    ASSERT_EQ(instrument.buys().at(1).quantity, 10);
+    ASSERT_EQ(instrument.buy_side(), 10);
+    ASSERT_EQ(instrument.sell_side(), 10);
+    ASSERT_TRUE(instrument.exposure_consistent());
+}
+
+TEST(financialinstrument, running_totals_deep_book)
+{
+    auto instrument = FinancialInstrument();
+    const uint64_t max = 1'000'000;
+    for (uint64_t id = 0; id < 1000; ++id) {
+        instrument.add_buy({2 * id, 3, 100}, max);
+        instrument.add_sell({2 * id + 1, 2, 100}, max);
+    }
+    for (uint64_t id = 0; id < 1000; id += 3)
+        instrument.delete_order(2 * id);
+    for (uint64_t id = 1; id < 1000; id += 3)
+        instrument.modify_order(2 * id + 1, 5, max, max);
+    for (uint64_t id = 2; id < 1000; id += 3)
+        instrument.add_trade({2 * id, 3, 100}, max, max);
+    ASSERT_TRUE(instrument.exposure_consistent());
+}
+
+TEST(financialinstrument, try_reject_leaves_orders_untouched)
+{
+    using Result = FinancialInstrument::Result;
+    auto instrument = FinancialInstrument();
+    ASSERT_EQ(instrument.try_add_buy({1, 10, 100}, MAX_BUY), Result::ACCEPTED);
+    ASSERT_EQ(instrument.try_add_sell({2, 10, 100}, MAX_SELL), Result::ACCEPTED);
+
+    ASSERT_EQ(instrument.try_add_buy({3, MAX_BUY, 100}, MAX_BUY), Result::EXCEEDED_MAX_BUY);
+    ASSERT_EQ(instrument.try_add_sell({4, MAX_SELL, 100}, MAX_SELL), Result::EXCEEDED_MAX_SELL);
+    ASSERT_EQ(instrument.try_add_buy({1, MAX_BUY, 100}, MAX_BUY), Result::EXCEEDED_MAX_BUY);
+    ASSERT_EQ(instrument.try_modify_order(2, FinancialInstrument::Side::SELL, MAX_SELL, MAX_BUY, MAX_SELL),
+              Result::EXCEEDED_MAX_SELL);
+    ASSERT_EQ(instrument.try_modify_order(2, FinancialInstrument::Side::BUY, 1, MAX_BUY, MAX_SELL),
+              Result::UNKNOWN_ORDER);
+    ASSERT_EQ(instrument.try_add_trade({1, 10, 101}, MAX_BUY, MAX_SELL), Result::NO_MATCHING_ORDER);
+    ASSERT_EQ(instrument.try_add_trade({2, 10, 100}, 11, MAX_SELL), Result::EXCEEDED_MAX_BUY);
+
+    ASSERT_EQ(instrument.buys().size(), 1);
+    ASSERT_EQ(instrument.sells().size(), 1);
+    ASSERT_TRUE(instrument.trades().empty());
+    ASSERT_EQ(instrument.buys().at(1).quantity, 10);
+    ASSERT_EQ(instrument.sells().at(2).quantity, 10);
+    ASSERT_EQ(instrument.buy_side(), 10);
+    ASSERT_EQ(instrument.sell_side(), 10);
+    ASSERT_TRUE(instrument.exposure_consistent());
+}
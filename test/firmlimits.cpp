@@ -0,0 +1,45 @@
+#include "../server/firmlimits.hpp"
+
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+
+using namespace testing;
+
+TEST(firmlimits, try_apply)
+{
+    auto limits = FirmLimits(10, 10);
+    auto & exposure = limits.exposure(1);
+    ASSERT_EQ(&exposure, &limits.exposure(1)) << "Listing exposure is stable";
+    ASSERT_NE(&exposure, &limits.exposure(2));
+
+    ASSERT_TRUE(limits.try_apply(exposure, 9, 5));
+    ASSERT_FALSE(limits.try_apply(exposure, 1, 0));
+    ASSERT_FALSE(limits.try_apply(exposure, -1, 5)) << "Sell increase is over the limit";
+    ASSERT_EQ(exposure.buy_side, 9) << "Rejection left the counters unchanged";
+    ASSERT_EQ(exposure.sell_side, 5);
+    ASSERT_TRUE(limits.try_apply(exposure, -4, 4));
+    ASSERT_EQ(exposure.buy_side, 5);
+    ASSERT_EQ(exposure.sell_side, 9);
+}
+
+TEST(firmlimits, concurrent_sessions)
+{
+    const int64_t max = 1000;
+    auto limits = FirmLimits(max, max);
+    auto threads = std::vector<std::thread>{};
+    for (int session = 0; session < 8; ++session) {
+        threads.emplace_back([&]() {
+            auto & exposure = limits.exposure(7);
+            for (int i = 0; i < 100000; ++i) {
+                if (limits.try_apply(exposure, 3, 0)) {
+                    EXPECT_LT(exposure.buy_side.load(), max);
+                    limits.apply(exposure, -3, 0);
+                }
+            }
+        });
+    }
+    for (auto & thread : threads)
+        thread.join();
+    ASSERT_EQ(limits.exposure(7).buy_side, 0);
+}
@@ -0,0 +1,64 @@
+#include "../server/flatmap.hpp"
+
+#include <gtest/gtest.h>
+#include <random>
+#include <unordered_map>
+
+using namespace testing;
+
+TEST(flatmap, insert_find_erase)
+{
+    auto map = FlatMap<int64_t>();
+    ASSERT_TRUE(map.empty());
+    ASSERT_EQ(map.find(1), map.end());
+
+    ASSERT_TRUE(map.try_emplace(1, 10).second);
+    ASSERT_TRUE(map.try_emplace(2, 20).second);
+    ASSERT_FALSE(map.try_emplace(1, 30).second) << "Existing key is not overwritten";
+    ASSERT_EQ(map.size(), 2);
+    ASSERT_EQ(map.at(1), 10);
+    ASSERT_EQ(map.find(2)->second, 20);
+
+    ASSERT_EQ(map.erase(1), 1);
+    ASSERT_EQ(map.erase(1), 0);
+    ASSERT_EQ(map.find(1), map.end());
+    ASSERT_EQ(map.at(2), 20);
+    ASSERT_THROW(map.at(1), std::out_of_range);
+}
+
+TEST(flatmap, no_allocation_after_reserve)
+{
+    auto map = FlatMap<int64_t>();
+    map.reserve(1000);
+    for (uint64_t key = 0; key < 1000; ++key)
+        map.try_emplace(key, key);
+    auto data = &*map.begin();
+    for (uint64_t key = 0; key < 100000; ++key) {
+        map.erase(key);
+        map.try_emplace(key + 1000, key);
+    }
+    ASSERT_EQ(map.size(), 1000);
+    ASSERT_EQ(&*map.begin(), data) << "Dense storage was not reallocated";
+}
+
+TEST(flatmap, matches_unordered_map)
+{
+    auto map = FlatMap<uint64_t>();
+    auto reference = std::unordered_map<uint64_t, uint64_t>();
+    auto rng = std::mt19937_64(42);
+    for (int i = 0; i < 200000; ++i) {
+        auto key = rng() % 5000;
+        if (rng() % 3 == 0) {
+            ASSERT_EQ(map.erase(key), reference.erase(key));
+        }
+        else {
+            auto value = rng();
+            ASSERT_EQ(map.try_emplace(key, value).second, reference.try_emplace(key, value).second);
+        }
+    }
+    ASSERT_EQ(map.size(), reference.size());
+    for (const auto & [key, value] : reference)
+        ASSERT_EQ(map.at(key), value);
+    for (const auto & [key, value] : map)
+        ASSERT_EQ(reference.at(key), value);
+}
@@ -0,0 +1,47 @@
+#ifndef TEST_HELPERS_HPP
+#define TEST_HELPERS_HPP
+
+#include "../client/client.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <stdexcept>
+#include <string>
+
+// A fresh directory /tmp/<prefix>-XXXXXX, removed with everything in it on destruction
+class TempDirectory
+{
+public:
+    explicit TempDirectory(const std::string & prefix)
+    {
+        auto path = "/tmp/" + prefix + "-XXXXXX";
+        if (mkdtemp(path.data()) == nullptr)
+            throw std::runtime_error("Could not create a temporary directory for " + prefix);
+        path_ = std::move(path);
+    }
+    ~TempDirectory() { std::filesystem::remove_all(path_); }
+    TempDirectory(const TempDirectory &) = delete;
+    TempDirectory & operator=(const TempDirectory &) = delete;
+
+    const std::string & path() const { return path_; }
+
+private:
+    std::string path_;
+};
+
+// Processes the client until `condition` holds, for up to ten seconds as journaled answers wait for a sync that can
+// stall behind the writeback of a busy disk
+inline bool wait_for(Client & client, const std::function<bool()> & condition)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (!condition()) {
+        if (std::chrono::steady_clock::now() > deadline)
+            return false;
+        client.wait(std::chrono::milliseconds(10));
+    }
+    return true;
+}
+
+#endif //TEST_HELPERS_HPP
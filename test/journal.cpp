@@ -0,0 +1,163 @@
+#include "../server/journal.hpp"
+#include "../encoder.hpp"
+#include "../parser.hpp"
+#include "helpers.hpp"
+
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <poll.h>
+#include <vector>
+
+using namespace testing;
+
+namespace
+{
+struct Record
+{
+    uint64_t session;
+    Journal::RecordKind kind;
+    uint64_t order_id;
+};
+
+std::vector<Record> read_all(const std::string & directory)
+{
+    auto records = std::vector<Record>{};
+    Journal::read(directory, [&](const Journal::RecordHeader & record, const char * data) {
+        auto order_id = uint64_t{0};
+        if (record.kind == Journal::RecordKind::MESSAGE)
+            order_id = std::get<Messages::DeleteOrder>(Parser(1).decode(data).payload).orderId;
+        records.push_back({record.session, record.kind, order_id});
+    });
+    return records;
+}
+} // unnamed namespace
+
+TEST(journal, append_and_read)
+{
+    auto directory = TempDirectory("journal-test");
+    auto encoder = Encoder(1);
+    char frame[Encoder::MAX_FRAME_SIZE];
+    {
+        auto options = JournalOptions{directory.path(), 4096, 16};
+        auto journal = Journal(options);
+        journal.open(3);
+        for (uint64_t id = 0; id < 500; ++id) { // several segments
+            auto size = encoder.encode(frame, Messages::DeleteOrder{Messages::DeleteOrder::MESSAGE_TYPE, id}, 0, 0);
+            journal.append(3, frame, size);
+        }
+        journal.sync();
+        ASSERT_EQ(read_all(directory.path()).size(), 501) << "Synced records are readable while the journal is open";
+        journal.close(3);
+    }
+
+    auto records = read_all(directory.path());
+    ASSERT_EQ(records.size(), 502);
+    ASSERT_EQ(records.front().kind, Journal::RecordKind::OPEN);
+    ASSERT_EQ(records.back().kind, Journal::RecordKind::CLOSE);
+    for (uint64_t id = 0; id < 500; ++id) {
+        ASSERT_EQ(records[id + 1].session, 3);
+        ASSERT_EQ(records[id + 1].order_id, id);
+    }
+    auto segments = std::distance(std::filesystem::directory_iterator(directory.path()),
+                                  std::filesystem::directory_iterator());
+    ASSERT_GT(segments, 5);
+}
+
+TEST(journal, request_sync_notifies)
+{
+    auto directory = TempDirectory("journal-test");
+    auto options = JournalOptions{directory.path(), 4096};
+    options.window = std::chrono::seconds(60); // only the request makes the flusher sync
+    auto journal = Journal(options);
+    journal.open(1);
+    journal.open(2);
+    ASSERT_EQ(journal.appended(), 2);
+    ASSERT_EQ(journal.durable(), 0);
+
+    journal.request_sync();
+    auto notification = pollfd{journal.notify_fd(), POLLIN, 0};
+    ASSERT_EQ(poll(&notification, 1, 5000), 1) << "No notification once the records were synced";
+    ASSERT_EQ(journal.durable(), 2);
+}
+
+TEST(journal, restart_appends_new_segment)
+{
+    auto directory = TempDirectory("journal-test");
+    auto options = JournalOptions{directory.path(), 4096};
+    {
+        auto journal = Journal(options);
+        journal.open(1);
+    }
+    {
+        auto journal = Journal(options);
+        journal.close(1);
+    }
+    auto records = read_all(directory.path());
+    ASSERT_EQ(records.size(), 2);
+    ASSERT_EQ(records[0].kind, Journal::RecordKind::OPEN);
+    ASSERT_EQ(records[1].kind, Journal::RecordKind::CLOSE);
+}
+
+TEST(journal, torn_record)
+{
+    auto directory = TempDirectory("journal-test");
+    {
+        auto journal = Journal(JournalOptions{directory.path(), 4096});
+        journal.open(1);
+        journal.open(2);
+    }
+    // Corrupt the second record as if only its header made it to disk
+    auto path = std::filesystem::directory_iterator(directory.path())->path();
+    auto file = std::fopen(path.c_str(), "r+b");
+    auto header = Journal::RecordHeader{2, Journal::RecordKind::MESSAGE, 28};
+    std::fseek(file, sizeof(header), SEEK_SET);
+    std::fwrite(&header, sizeof(header), 1, file);
+    std::fclose(file);
+
+    ASSERT_EQ(read_all(directory.path()).size(), 1);
+}
+
+TEST(journal, corrupt_record)
+{
+    auto directory = TempDirectory("journal-test");
+    auto encoder = Encoder(1);
+    char frame[Encoder::MAX_FRAME_SIZE];
+    auto size = encoder.encode(frame, Messages::DeleteOrder{Messages::DeleteOrder::MESSAGE_TYPE, 5}, 0, 0);
+    {
+        auto journal = Journal(JournalOptions{directory.path(), 4096});
+        journal.open(1);
+        journal.append(1, frame, size);
+        journal.append(1, frame, size);
+    }
+    // Flip a bit of the order id in the first message, right after the OPEN record, its sizes still agree
+    auto path = std::filesystem::directory_iterator(directory.path())->path();
+    auto file = std::fopen(path.c_str(), "r+b");
+    auto offset = 2 * sizeof(Journal::RecordHeader) + sizeof(Messages::Header)
+                  + offsetof(Messages::DeleteOrder, orderId);
+    std::fseek(file, static_cast<long>(offset), SEEK_SET);
+    std::fputc(5 ^ 1, file);
+    std::fclose(file);
+
+    auto records = read_all(directory.path());
+    ASSERT_EQ(records.size(), 1) << "Reading went on past a record that fails its checksum";
+    ASSERT_EQ(records[0].kind, Journal::RecordKind::OPEN);
+}
+
+TEST(journal, rotation_overtakes_flusher)
+{
+    auto directory = TempDirectory("journal-test");
+    auto encoder = Encoder(1);
+    char frame[Encoder::MAX_FRAME_SIZE];
+    {
+        // Two records per segment: most rotations find the flusher still preparing and create the segment themselves
+        auto journal = Journal(JournalOptions{directory.path(), 128});
+        for (uint64_t id = 0; id < 400; ++id) {
+            auto size = encoder.encode(frame, Messages::DeleteOrder{Messages::DeleteOrder::MESSAGE_TYPE, id}, 0, 0);
+            journal.append(1, frame, size);
+        }
+    }
+    auto records = read_all(directory.path());
+    ASSERT_EQ(records.size(), 400);
+    for (uint64_t id = 0; id < 400; ++id)
+        ASSERT_EQ(records[id].order_id, id);
+}
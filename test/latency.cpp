@@ -0,0 +1,45 @@
+#include "../server/latency.hpp"
+
+#include <gtest/gtest.h>
+
+using namespace testing;
+
+TEST(latency, percentiles)
+{
+    auto histogram = LatencyHistogram{};
+    ASSERT_EQ(histogram.percentile(50), 0);
+    for (uint64_t value = 1; value <= 1000; ++value)
+        histogram.record(value);
+    ASSERT_EQ(histogram.count(), 1000);
+    ASSERT_EQ(histogram.max(), 1000);
+
+    // Within the 1/16 bucket precision, never below the true value
+    auto p50 = histogram.percentile(50);
+    ASSERT_GE(p50, 500);
+    ASSERT_LE(p50, 500 + 500 / 16);
+    auto p99 = histogram.percentile(99);
+    ASSERT_GE(p99, 990);
+    ASSERT_LE(p99, 1000) << "Never above the maximum";
+    ASSERT_EQ(histogram.percentile(100), 1000);
+}
+
+TEST(latency, small_and_huge_values)
+{
+    auto histogram = LatencyHistogram{};
+    for (uint64_t value = 0; value < 16; ++value)
+        histogram.record(value);
+    ASSERT_EQ(histogram.percentile(50), 7) << "Values below 16 are exact";
+
+    histogram.record(uint64_t{1} << 50);
+    ASSERT_EQ(histogram.max(), uint64_t{1} << 50);
+    ASSERT_EQ(histogram.percentile(100), uint64_t{1} << 50);
+}
+
+TEST(latency, stages)
+{
+    auto stats = LatencyStats{};
+    stats.record(LatencyTrace{1, 100, 110, 1110}, 11110);
+    ASSERT_EQ(stats.stage(LatencyStats::Stage::READ_TO_DECODE).max(), 10);
+    ASSERT_EQ(stats.stage(LatencyStats::Stage::DECODE_TO_CONSUME).max(), 1000);
+    ASSERT_EQ(stats.stage(LatencyStats::Stage::CONSUME_TO_SEND).max(), 10000);
+}
@@ -0,0 +1,182 @@
+#include "../client/loadgenerator.hpp"
+#include "../encoder.hpp"
+#include "../parser.hpp"
+#include "../receivebuffer.hpp"
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <thread>
+#include <type_traits>
+#include <unistd.h>
+#include <vector>
+
+using namespace testing;
+
+namespace
+{
+uint16_t next_port = 24300;
+
+// Stands in for the server on `connections` connections. It answers every message with an ACCEPTED OrderResponse,
+// `batch` messages at a time in reverse order and in one write, after a response for an order never sent. A batch of
+// zero answers nothing.
+class FakeServer
+{
+public:
+    FakeServer(size_t connections, size_t batch)
+        : port_(next_port++)
+        , batch_(batch)
+    {
+        listener_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int one = 1;
+        setsockopt(listener_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        auto address = sockaddr_in{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port_);
+        inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+        if (bind(listener_, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == -1
+            || listen(listener_, SOMAXCONN) == -1)
+            throw std::runtime_error("Could not listen");
+        thread_ = std::thread([this, connections]() { serve(connections); });
+    }
+
+    ~FakeServer()
+    {
+        thread_.join();
+        close(listener_);
+    }
+
+    uint16_t port() const { return port_; }
+    size_t received() const { return received_; }
+    size_t max_outstanding() const { return max_outstanding_; } // received and not answered, per connection
+
+private:
+    struct Peer
+    {
+        int fd;
+        ReceiveBuffer input;
+        std::vector<uint64_t> unanswered;
+        uint32_t sequence_number = 0;
+    };
+
+    void serve(size_t connections)
+    {
+        auto peers = std::vector<Peer>{};
+        for (size_t i = 0; i < connections; ++i)
+            peers.push_back(Peer{accept4(listener_, nullptr, nullptr, SOCK_CLOEXEC), ReceiveBuffer(), {}});
+        uint64_t never_sent = 999999;
+        for (auto & peer : peers)
+            answer(peer, &never_sent, 1);
+
+        auto open = peers.size();
+        while (open != 0) {
+            auto fds = std::vector<pollfd>{};
+            for (const auto & peer : peers)
+                fds.push_back(pollfd{peer.fd, POLLIN, 0});
+            poll(fds.data(), fds.size(), -1);
+            for (size_t i = 0; i < peers.size(); ++i) {
+                if (fds[i].fd != -1 && (fds[i].revents & (POLLIN | POLLHUP)) != 0 && !serve(peers[i])) {
+                    close(peers[i].fd);
+                    peers[i].fd = -1;
+                    --open;
+                }
+            }
+        }
+    }
+
+    // Returns false once the connection is closed
+    bool serve(Peer & peer)
+    {
+        auto bytes = read(peer.fd, peer.input.write_data(), peer.input.write_space());
+        if (bytes <= 0)
+            return false;
+        peer.input.commit(bytes);
+        auto batch = parser_.decode_batch(peer.input.read_data(), peer.input.pending(),
+            [&](const Messages::Header &, const auto & payload) {
+                using Payload = std::decay_t<decltype(payload)>;
+                if constexpr (std::is_same_v<Payload, Messages::Trade>)
+                    peer.unanswered.push_back(payload.tradeId);
+                else if constexpr (std::is_same_v<Payload, Messages::NewOrder>
+                                   || std::is_same_v<Payload, Messages::DeleteOrder>
+                                   || std::is_same_v<Payload, Messages::ModifyOrderQuantity>)
+                    peer.unanswered.push_back(payload.orderId);
+                ++received_;
+            });
+        peer.input.consume(peer.input.pending() - batch.remaining);
+        max_outstanding_ = std::max(max_outstanding_.load(), peer.unanswered.size());
+        while (batch_ != 0 && peer.unanswered.size() >= batch_) {
+            std::reverse(peer.unanswered.begin(), peer.unanswered.begin() + batch_);
+            answer(peer, peer.unanswered.data(), batch_);
+            peer.unanswered.erase(peer.unanswered.begin(), peer.unanswered.begin() + batch_);
+        }
+        return true;
+    }
+
+    // A batch split over several writes could be read in part, and the generator refill its window in between
+    void answer(Peer & peer, const uint64_t * order_ids, size_t count)
+    {
+        if (batch_ == 0)
+            return;
+        auto frames = std::vector<char>(count * Encoder::MAX_FRAME_SIZE);
+        size_t size = 0;
+        for (size_t i = 0; i < count; ++i) {
+            auto response = Messages::OrderResponse{Messages::OrderResponse::MESSAGE_TYPE, order_ids[i],
+                                                    Messages::OrderResponse::Status::ACCEPTED,
+                                                    Messages::OrderResponse::Reason::NONE};
+            size += encoder_.encode(frames.data() + size, response, peer.sequence_number++, 0);
+        }
+        [[maybe_unused]] auto written = write(peer.fd, frames.data(), size);
+    }
+
+    uint16_t port_;
+    size_t batch_;
+    int listener_ = -1;
+    Parser parser_{1};
+    Encoder encoder_{1};
+    std::atomic<size_t> received_{0};
+    std::atomic<size_t> max_outstanding_{0};
+    std::thread thread_;
+};
+
+LoadOptions load_options(uint16_t port, size_t connections, size_t window)
+{
+    auto options = LoadOptions{};
+    options.port = port;
+    options.connections = connections;
+    options.window = window;
+    options.duration = std::chrono::seconds(1);
+    options.listings = 5;
+    return options;
+}
+} // unnamed namespace
+
+TEST(loadgenerator, matches_responses_by_order_id)
+{
+    auto server = FakeServer(2, 2);
+    {
+        auto generator = LoadGenerator(load_options(server.port(), 2, 4));
+        generator.run();
+        ASSERT_GT(generator.sent(), 8) << "The window kept moving";
+        ASSERT_EQ(generator.answered(), generator.sent());
+        ASSERT_EQ(generator.unanswered(), 0);
+        ASSERT_EQ(generator.unmatched(), 2) << "One response per connection for an order never sent";
+    }
+    ASSERT_LE(server.max_outstanding(), 4);
+}
+
+TEST(loadgenerator, window_limits_messages_in_flight)
+{
+    auto server = FakeServer(2, 0);
+    {
+        auto generator = LoadGenerator(load_options(server.port(), 2, 3));
+        generator.run();
+        ASSERT_EQ(generator.sent(), 6);
+        ASSERT_EQ(generator.answered(), 0);
+        ASSERT_EQ(generator.unanswered(), 6);
+    }
+    ASSERT_EQ(server.received(), 6);
+}
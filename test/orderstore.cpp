@@ -9,6 +9,7 @@ public:
     static const int MAX_BUY = 20;
     static const int MAX_SELL = 15;
     Fixture() : OrderStore(MAX_BUY, MAX_SELL) {}
+    explicit Fixture(FirmLimits * firm_limits) : OrderStore(MAX_BUY, MAX_SELL, firm_limits) {}
 
     Message makeNewOrder(uint64_t listingId, uint64_t orderId, uint64_t orderQuantity, uint64_t orderPrice, char side) {
         auto message = Message{};
@@ -285,4 +286,113 @@ TEST(orderstore, trade_mismatch)
     response = store.consume(store.makeTradeOrder(listingId, trade_id_3, orderQuantity, orderPrice));
     ASSERT_EQ(response.status, OrderStatus::REJECTED);
     ASSERT_TRUE(store.instruments().find(listingId)->second.trades().empty());
-}
\ No newline at end of file
+}
+TEST(orderstore, delete_and_modify_across_listings)
+{
+    auto store = Fixture();
+    uint64_t orderQuantity = 3;
+    uint64_t orderPrice = 1000;
+    for (uint64_t listingId = 1; listingId <= 10; ++listingId) {
+        store.consume(store.makeNewOrder(listingId, 100 + listingId, orderQuantity, orderPrice, 'B'));
+        store.consume(store.makeNewOrder(listingId, 200 + listingId, orderQuantity, orderPrice, 'S'));
+    }
+
+    auto response = store.consume(store.makeModifyOrder(207, orderQuantity + 1));
+    ASSERT_EQ(response.status, OrderStatus::ACCEPTED);
+    ASSERT_EQ(store.instruments().find(7)->second.sells().find(207)->second.quantity, orderQuantity + 1);
+
+    response = store.consume(store.makeDeleteOrder(104));
+    ASSERT_EQ(response.status, OrderStatus::ACCEPTED);
+    ASSERT_TRUE(store.instruments().find(4)->second.buys().empty());
+    ASSERT_FALSE(store.instruments().find(4)->second.sells().empty());
+
+    // a deleted order cannot be deleted or modified again
+    response = store.consume(store.makeDeleteOrder(104));
+    ASSERT_EQ(response.status, OrderStatus::REJECTED);
+    response = store.consume(store.makeModifyOrder(104, orderQuantity));
+    ASSERT_EQ(response.status, OrderStatus::REJECTED);
+}
+
+TEST(orderstore, new_order_duplicate_id)
+{
+    auto store = Fixture();
+    uint64_t orderId = 5;
+    uint64_t orderQuantity = 3;
+    uint64_t orderPrice = 1000;
+    store.consume(store.makeNewOrder(1, orderId, orderQuantity, orderPrice, 'B'));
+
+    // reusing a live id on another listing or side is rejected
+    auto response = store.consume(store.makeNewOrder(2, orderId, orderQuantity, orderPrice, 'B'));
+    ASSERT_EQ(response.status, OrderStatus::REJECTED);
+    response = store.consume(store.makeNewOrder(1, orderId, orderQuantity, orderPrice, 'S'));
+    ASSERT_EQ(response.status, OrderStatus::REJECTED);
+    ASSERT_TRUE(store.instruments().find(1)->second.sells().empty());
+
+    // but it replaces the order on the same listing and side
+    response = store.consume(store.makeNewOrder(1, orderId, orderQuantity + 1, orderPrice, 'B'));
+    ASSERT_EQ(response.status, OrderStatus::ACCEPTED);
+    ASSERT_EQ(store.instruments().find(1)->second.buys().find(orderId)->second.quantity, orderQuantity + 1);
+}
+
+TEST(orderstore, session_aggregates)
+{
+    auto store = Fixture();
+    uint64_t orderPrice = 1000;
+    store.consume(store.makeNewOrder(1, 1, 4, orderPrice, 'B'));
+    store.consume(store.makeNewOrder(2, 2, Fixture::MAX_BUY - 1, orderPrice, 'B'));
+    store.consume(store.makeNewOrder(3, 3, Fixture::MAX_SELL - 1, orderPrice, 'S'));
+    store.consume(store.makeNewOrder(4, 4, 2, orderPrice, 'S'));
+    ASSERT_EQ(store.total_buy_side(), 4 + Fixture::MAX_BUY - 1);
+    ASSERT_EQ(store.total_sell_side(), Fixture::MAX_SELL - 1 + 2);
+
+    auto expected = std::vector<uint64_t>{2, 3};
+    ASSERT_EQ(store.listings_near_limit(0.1), expected);
+
+    // rejected and deleted orders are reflected as well
+    store.consume(store.makeNewOrder(1, 5, Fixture::MAX_BUY, orderPrice, 'B'));
+    store.consume(store.makeDeleteOrder(2));
+    ASSERT_EQ(store.total_buy_side(), 4);
+    expected = std::vector<uint64_t>{3};
+    ASSERT_EQ(store.listings_near_limit(0.1), expected);
+}
+
+TEST(orderstore, firm_limit)
+{
+    using Reason = OrderStore::Response::Reason;
+    auto firm_limits = FirmLimits(Fixture::MAX_BUY, Fixture::MAX_SELL);
+    auto store_1 = Fixture(&firm_limits);
+    uint64_t listingId = 1;
+    uint64_t orderPrice = 1000;
+    auto response = store_1.consume(store_1.makeNewOrder(listingId, 1, 12, orderPrice, 'B'));
+    ASSERT_EQ(response.status, OrderStatus::ACCEPTED);
+
+    {
+        // within the session limit but not within what is left of the firm limit
+        auto store_2 = Fixture(&firm_limits);
+        response = store_2.consume(store_2.makeNewOrder(listingId, 2, 12, orderPrice, 'B'));
+        ASSERT_EQ(response.status, OrderStatus::REJECTED);
+        ASSERT_EQ(response.reason, Reason::FIRM_LIMIT);
+        ASSERT_TRUE(store_2.instruments().find(listingId)->second.buys().empty());
+
+        response = store_2.consume(store_2.makeNewOrder(listingId, 2, Fixture::MAX_BUY, orderPrice, 'B'));
+        ASSERT_EQ(response.status, OrderStatus::REJECTED);
+        ASSERT_EQ(response.reason, Reason::SESSION_LIMIT);
+
+        response = store_2.consume(store_2.makeNewOrder(listingId, 2, 7, orderPrice, 'B'));
+        ASSERT_EQ(response.status, OrderStatus::ACCEPTED);
+        response = store_1.consume(store_1.makeModifyOrder(1, 13));
+        ASSERT_EQ(response.reason, Reason::FIRM_LIMIT);
+    }
+
+    // the closed session released its exposure
+    response = store_1.consume(store_1.makeModifyOrder(1, 19));
+    ASSERT_EQ(response.status, OrderStatus::ACCEPTED);
+
+    // and deletes release it as well
+    auto store_3 = Fixture(&firm_limits);
+    response = store_3.consume(store_3.makeNewOrder(listingId, 3, 5, orderPrice, 'B'));
+    ASSERT_EQ(response.reason, Reason::FIRM_LIMIT);
+    store_1.consume(store_1.makeDeleteOrder(1));
+    response = store_3.consume(store_3.makeNewOrder(listingId, 3, 5, orderPrice, 'B'));
+    ASSERT_EQ(response.status, OrderStatus::ACCEPTED);
+}
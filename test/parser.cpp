@@ -0,0 +1,112 @@
+#include "../parser.hpp"
+
+#include <gtest/gtest.h>
+#include <cstring>
+#include <vector>
+
+using namespace testing;
+
+namespace
+{
+template<typename Payload>
+std::vector<char> frame(const Payload & payload, uint16_t version = 1)
+{
+    auto header = Messages::Header{version, sizeof(payload), 7, 42};
+    auto bytes = std::vector<char>(sizeof(header) + sizeof(payload) + 1); // one byte past the frame, misaligned views
+    std::memcpy(bytes.data() + 1, &header, sizeof(header));
+    std::memcpy(bytes.data() + 1 + sizeof(header), &payload, sizeof(payload));
+    return bytes;
+}
+} // unnamed namespace
+
+TEST(parser, dispatch_in_place)
+{
+    auto parser = Parser(1);
+    auto bytes = frame(Messages::Trade{Messages::Trade::MESSAGE_TYPE, 3, 4, 5, 6});
+    auto data = bytes.data() + 1;
+
+    auto type = parser.dispatch(data, [&](const Messages::Header & header, const auto & payload) {
+        EXPECT_EQ(header.sequenceNumber, 7);
+        EXPECT_EQ(reinterpret_cast<const char *>(&payload), data + sizeof(header)) << "No copy is made";
+        return std::decay_t<decltype(payload)>::MESSAGE_TYPE;
+    });
+    ASSERT_EQ(type, Messages::Trade::MESSAGE_TYPE);
+
+    auto quantity = parser.dispatch(data, [](const Messages::Header &, const auto & payload) -> uint64_t {
+        if constexpr (std::is_same_v<std::decay_t<decltype(payload)>, Messages::Trade>)
+            return payload.tradeQuantity;
+        return 0;
+    });
+    ASSERT_EQ(quantity, 5);
+}
+
+TEST(parser, decode_copies)
+{
+    auto parser = Parser(1);
+    auto bytes = frame(Messages::NewOrder{Messages::NewOrder::MESSAGE_TYPE, 1, 2, 3, 4, 'S'});
+    auto message = parser.decode(bytes.data() + 1);
+    ASSERT_EQ(message.header.timestamp, 42);
+    auto order = std::get<Messages::NewOrder>(message.payload);
+    ASSERT_EQ(order.orderId, 2);
+    ASSERT_EQ(order.side, 'S');
+}
+
+TEST(parser, invalid_frames)
+{
+    auto parser = Parser(1);
+    auto ignore = [](const Messages::Header &, const auto &) {};
+
+    auto old_version = frame(Messages::DeleteOrder{Messages::DeleteOrder::MESSAGE_TYPE, 1}, 2);
+    ASSERT_THROW(parser.dispatch(old_version.data() + 1, ignore), std::runtime_error);
+
+    auto unknown_type = frame(Messages::DeleteOrder{11, 1});
+    ASSERT_THROW(parser.dispatch(unknown_type.data() + 1, ignore), std::runtime_error);
+
+    // An unused slot of the type table has a payload size of zero, which must not make an empty frame valid
+    auto empty = frame(uint16_t{11});
+    auto header = Messages::Header{1, 0, 7, 42};
+    std::memcpy(empty.data() + 1, &header, sizeof(header));
+    ASSERT_THROW(parser.dispatch(empty.data() + 1, ignore), std::runtime_error);
+
+    auto wrong_size = frame(Messages::DeleteOrder{Messages::ModifyOrderQuantity::MESSAGE_TYPE, 1});
+    ASSERT_THROW(parser.dispatch(wrong_size.data() + 1, ignore), std::runtime_error);
+}
+
+TEST(parser, decode_batch)
+{
+    auto parser = Parser(1);
+    auto stream = std::vector<char>();
+    auto append = [&](const std::vector<char> & bytes) { stream.insert(stream.end(), bytes.begin() + 1, bytes.end()); };
+    for (uint64_t id = 0; id < 150; ++id) // spans several blocks
+        append(frame(Messages::DeleteOrder{Messages::DeleteOrder::MESSAGE_TYPE, id}));
+    append(frame(Messages::DeleteOrder{Messages::DeleteOrder::MESSAGE_TYPE, 1000}, 2)); // skipped
+    append(frame(Messages::DeleteOrder{Messages::DeleteOrder::MESSAGE_TYPE, 150}));
+    auto partial = frame(Messages::NewOrder{Messages::NewOrder::MESSAGE_TYPE, 1, 2, 3, 4, 'B'});
+    stream.insert(stream.end(), partial.begin() + 1, partial.begin() + 20);
+
+    auto ids = std::vector<uint64_t>();
+    auto batch = parser.decode_batch(stream.data(), stream.size(), [&](const Messages::Header &, const auto & payload) {
+        if constexpr (std::is_same_v<std::decay_t<decltype(payload)>, Messages::DeleteOrder>)
+            ids.push_back(payload.orderId);
+    });
+    ASSERT_EQ(batch.messages, 152);
+    ASSERT_EQ(batch.invalid, 1);
+    ASSERT_EQ(batch.remaining, 19);
+    ASSERT_EQ(ids.size(), 151);
+    for (uint64_t id = 0; id < ids.size(); ++id)
+        ASSERT_EQ(ids[id], id) << "Frames are handled in stream order";
+
+    auto empty = parser.decode_batch(stream.data(), 10, [](const Messages::Header &, const auto &) {});
+    ASSERT_EQ(empty.messages, 0);
+    ASSERT_EQ(empty.remaining, 10);
+}
+
+TEST(parser, decode_batch_corrupt)
+{
+    auto parser = Parser(1);
+    auto header = Messages::Header{1, 1, 0, 0};
+    auto bytes = std::vector<char>(64);
+    std::memcpy(bytes.data(), &header, sizeof(header));
+    auto ignore = [](const Messages::Header &, const auto &) {};
+    ASSERT_THROW(parser.decode_batch(bytes.data(), bytes.size(), ignore), std::runtime_error);
+}
@@ -0,0 +1,109 @@
+#include "../receivebuffer.hpp"
+#include "../messages.hpp"
+#include "../parser.hpp"
+
+#include <gtest/gtest.h>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+using namespace testing;
+
+namespace
+{
+std::vector<char> frame(uint64_t order_id)
+{
+    auto payload = Messages::DeleteOrder{Messages::DeleteOrder::MESSAGE_TYPE, order_id};
+    auto header = Messages::Header{1, sizeof(payload), 0, 0};
+    auto bytes = std::vector<char>(sizeof(header) + sizeof(payload));
+    std::memcpy(bytes.data(), &header, sizeof(header));
+    std::memcpy(bytes.data() + sizeof(header), &payload, sizeof(payload));
+    return bytes;
+}
+
+void receive(ReceiveBuffer & buffer, const char * data, size_t size)
+{
+    ASSERT_GE(buffer.write_space(), size);
+    std::memcpy(buffer.write_data(), data, size);
+    buffer.commit(size);
+}
+
+// Decodes the complete frames at the front of `buffer` and consumes them, returns their order ids
+std::vector<uint64_t> decode(ReceiveBuffer & buffer)
+{
+    auto ids = std::vector<uint64_t>{};
+    auto batch = Parser(1).decode_batch(buffer.read_data(), buffer.pending(),
+        [&](const Messages::Header &, const auto & payload) {
+            if constexpr (std::is_same_v<std::decay_t<decltype(payload)>, Messages::DeleteOrder>)
+                ids.push_back(payload.orderId);
+        });
+    buffer.consume(buffer.pending() - batch.remaining);
+    return ids;
+}
+} // unnamed namespace
+
+TEST(receivebuffer, coalesced_frames)
+{
+    auto buffer = ReceiveBuffer(256);
+    auto stream = std::vector<char>();
+    for (uint64_t id = 1; id <= 3; ++id) {
+        auto bytes = frame(id);
+        stream.insert(stream.end(), bytes.begin(), bytes.end());
+    }
+    receive(buffer, stream.data(), stream.size());
+    ASSERT_EQ(decode(buffer), (std::vector<uint64_t>{1, 2, 3}));
+    ASSERT_EQ(buffer.pending(), 0);
+}
+
+TEST(receivebuffer, split_frames)
+{
+    auto buffer = ReceiveBuffer(64);
+    auto first = frame(1);
+    auto second = frame(2);
+
+    // Header only partially received
+    receive(buffer, first.data(), 5);
+    ASSERT_TRUE(decode(buffer).empty());
+    ASSERT_EQ(buffer.pending(), 5);
+    // Rest of the first frame plus the start of the second one
+    receive(buffer, first.data() + 5, first.size() - 5);
+    receive(buffer, second.data(), 20);
+    ASSERT_EQ(decode(buffer), (std::vector<uint64_t>{1}));
+    ASSERT_EQ(buffer.pending(), 20);
+
+    // The partial tail is moved to the front so a small buffer never runs out of space
+    receive(buffer, second.data() + 20, second.size() - 20);
+    ASSERT_EQ(decode(buffer), (std::vector<uint64_t>{2}));
+    ASSERT_EQ(buffer.write_space(), 64);
+}
+
+TEST(receivebuffer, full_buffer)
+{
+    // A frame that fills the whole buffer without completing can never be handed out
+    auto buffer = ReceiveBuffer(64);
+    auto header = Messages::Header{1, 60, 0, 0};
+    auto bytes = std::vector<char>(64);
+    std::memcpy(bytes.data(), &header, sizeof(header));
+    receive(buffer, bytes.data(), bytes.size());
+    ASSERT_THROW(buffer.write_space(), std::runtime_error);
+
+    auto batch = ReceiveBuffer(64);
+    auto first = frame(1);
+    receive(batch, first.data(), first.size());
+    receive(batch, first.data(), 4);
+    ASSERT_EQ(batch.pending(), first.size() + 4);
+    batch.consume(first.size());
+    ASSERT_EQ(batch.pending(), 4);
+    ASSERT_EQ(batch.read_data()[0], first[0]);
+}
+
+TEST(receivebuffer, payload_size_mismatch)
+{
+    auto bytes = frame(1);
+    auto header = Messages::Header{};
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    header.payloadSize = sizeof(Messages::NewOrder);
+    std::memcpy(bytes.data(), &header, sizeof(header));
+    bytes.resize(sizeof(header) + header.payloadSize);
+    ASSERT_THROW(Parser(1).decode(bytes.data()), std::runtime_error);
+}
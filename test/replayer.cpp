@@ -0,0 +1,110 @@
+#include "../replay/replayer.hpp"
+#include "../encoder.hpp"
+#include "../server/journal.hpp"
+#include "helpers.hpp"
+
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace testing;
+
+namespace
+{
+Messages::NewOrder new_order(uint64_t id, uint64_t quantity)
+{
+    return {Messages::NewOrder::MESSAGE_TYPE, 1, id, quantity, 10, 'B'};
+}
+
+// Appends the frame of `payload`, sent at `timestamp`, to `frames`
+template<typename Payload>
+void frame(std::string & frames, const Payload & payload, uint64_t timestamp = 0)
+{
+    char buffer[Encoder::MAX_FRAME_SIZE];
+    frames.append(buffer, Encoder(1).encode(buffer, payload, 0, timestamp));
+}
+
+ReplayOptions options(uint64_t max_buy)
+{
+    auto options = ReplayOptions{};
+    options.max_buy = max_buy;
+    options.max_sell = max_buy;
+    return options;
+}
+} // unnamed namespace
+
+TEST(replayer, frame_file)
+{
+    auto directory = TempDirectory("replayer-test");
+    auto frames = std::string{};
+    frame(frames, new_order(1, 6));
+    frame(frames, new_order(2, 6)); // over the limit of 10
+    frame(frames, Messages::DeleteOrder{Messages::DeleteOrder::MESSAGE_TYPE, 1});
+    frame(frames, Messages::DeleteOrder{Messages::DeleteOrder::MESSAGE_TYPE, 1}); // gone already
+    auto path = directory.path() + "/frames";
+    std::ofstream(path, std::ios::binary) << frames;
+
+    auto replayer = Replayer(options(10));
+    replayer.replay_file(path);
+    ASSERT_EQ(replayer.messages(), 4);
+    ASSERT_EQ(replayer.accepted(Messages::NewOrder::MESSAGE_TYPE), 1);
+    ASSERT_EQ(replayer.rejected(Messages::NewOrder::MESSAGE_TYPE), 1);
+    ASSERT_EQ(replayer.accepted(Messages::DeleteOrder::MESSAGE_TYPE), 1);
+    ASSERT_EQ(replayer.rejected(Messages::DeleteOrder::MESSAGE_TYPE), 1);
+    ASSERT_EQ(replayer.rejected(Messages::OrderResponse::Reason::SESSION_LIMIT), 1);
+    ASSERT_EQ(replayer.rejected(Messages::OrderResponse::Reason::INVALID), 1);
+
+    auto report = std::ostringstream{};
+    replayer.report(report);
+    ASSERT_NE(report.str().find("Replayed 4 messages"), std::string::npos);
+    ASSERT_NE(report.str().find("NewOrder"), std::string::npos);
+    ASSERT_NE(report.str().find("session limit: 1 invalid: 1"), std::string::npos);
+}
+
+TEST(replayer, journal_sessions)
+{
+    auto directory = TempDirectory("replayer-test");
+    {
+        auto journal = Journal(JournalOptions{directory.path(), 4096});
+        char buffer[Encoder::MAX_FRAME_SIZE];
+        auto append = [&](uint64_t session, const Messages::NewOrder & order) {
+            journal.append(session, buffer, Encoder(1).encode(buffer, order, 0, 0));
+        };
+        journal.open(1);
+        journal.open(2);
+        append(1, new_order(1, 8));
+        append(2, new_order(1, 8)); // a session of its own, within its limit
+        append(1, new_order(2, 8));
+        journal.close(2);
+        append(2, new_order(3, 1)); // closed, not replayed
+    }
+
+    auto replayer = Replayer(options(10));
+    replayer.replay_journal(directory.path());
+    ASSERT_EQ(replayer.messages(), 3);
+    ASSERT_EQ(replayer.accepted(Messages::NewOrder::MESSAGE_TYPE), 2);
+    ASSERT_EQ(replayer.rejected(Messages::NewOrder::MESSAGE_TYPE), 1);
+    ASSERT_EQ(replayer.invalid(), 0);
+}
+
+TEST(replayer, pacing_is_not_busy_time)
+{
+    auto directory = TempDirectory("replayer-test");
+    auto frames = std::string{};
+    frame(frames, new_order(1, 1), 1000000000);
+    frame(frames, new_order(2, 1), 1200000000); // 200 ms later, replayed 100 ms later at double speed
+    auto path = directory.path() + "/frames";
+    std::ofstream(path, std::ios::binary) << frames;
+
+    auto paced = options(10);
+    paced.paced = true;
+    paced.speed = 2.0;
+    auto replayer = Replayer(paced);
+    replayer.replay_file(path);
+    ASSERT_EQ(replayer.messages(), 2);
+    ASSERT_GE(replayer.elapsed(), std::chrono::milliseconds(100));
+    ASSERT_LT(replayer.busy(), std::chrono::milliseconds(50));
+}
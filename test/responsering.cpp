@@ -0,0 +1,63 @@
+#include "../server/responsering.hpp"
+
+#include <gtest/gtest.h>
+#include <vector>
+
+using namespace testing;
+using OrderStatus = Messages::OrderResponse::Status;
+
+namespace
+{
+Messages::OrderResponse response(uint64_t order_id)
+{
+    return {Messages::OrderResponse::MESSAGE_TYPE, order_id, OrderStatus::ACCEPTED,
+            Messages::OrderResponse::Reason::NONE};
+}
+
+// The sequence numbers and order ids replayed from `from`
+std::vector<std::pair<uint32_t, uint64_t>> replayed(const ResponseRing & ring, uint32_t from)
+{
+    auto result = std::vector<std::pair<uint32_t, uint64_t>>{};
+    ring.replay(from, [&](uint32_t sequence_number, uint64_t timestamp, const Messages::OrderResponse & sent) {
+        EXPECT_EQ(timestamp, 1000 + sent.orderId);
+        result.emplace_back(sequence_number, sent.orderId);
+    });
+    return result;
+}
+} // unnamed namespace
+
+TEST(responsering, replay)
+{
+    auto ring = ResponseRing(4);
+    for (uint64_t order_id = 0; order_id < 3; ++order_id)
+        ASSERT_EQ(ring.record(response(order_id), 1000 + order_id), order_id);
+    ASSERT_EQ(ring.next_sequence_number(), 3);
+
+    using Replayed = std::vector<std::pair<uint32_t, uint64_t>>;
+    ASSERT_EQ(replayed(ring, 1), (Replayed{{1, 1}, {2, 2}}));
+    ASSERT_TRUE(replayed(ring, 3).empty()) << "Nothing missed";
+
+    // Only the latest four are kept, a replay from before them starts at the oldest
+    for (uint64_t order_id = 3; order_id < 10; ++order_id)
+        ring.record(response(order_id), 1000 + order_id);
+    ASSERT_EQ(ring.first_sequence_number(), 6);
+    ASSERT_EQ(ring.replay_start(2), 6);
+    ASSERT_EQ(replayed(ring, 2), (Replayed{{6, 6}, {7, 7}, {8, 8}, {9, 9}}));
+    ASSERT_EQ(replayed(ring, 8), (Replayed{{8, 8}, {9, 9}}));
+}
+
+TEST(responsering, numbering_only)
+{
+    // Without a capacity the responses are numbered but none can be replayed, numbering may start anywhere
+    auto ring = ResponseRing(0, UINT32_MAX);
+    ASSERT_EQ(ring.record(response(1), 1001), UINT32_MAX);
+    ASSERT_EQ(ring.record(response(2), 1002), 0) << "Sequence numbers wrap around";
+    ASSERT_EQ(ring.replay_start(UINT32_MAX), 1);
+    ASSERT_TRUE(replayed(ring, UINT32_MAX).empty());
+
+    auto wrapping = ResponseRing(2, UINT32_MAX);
+    wrapping.record(response(1), 1001);
+    wrapping.record(response(2), 1002);
+    using Replayed = std::vector<std::pair<uint32_t, uint64_t>>;
+    ASSERT_EQ(replayed(wrapping, UINT32_MAX), (Replayed{{UINT32_MAX, 1}, {0, 2}}));
+}
@@ -0,0 +1,59 @@
+#include "../server/risktable.hpp"
+
+#include <gtest/gtest.h>
+#include <random>
+#include <utility>
+
+using namespace testing;
+
+TEST(risktable, totals)
+{
+    auto table = RiskTable();
+    ASSERT_EQ(table.total_buy_side(), 0);
+    for (uint64_t listing = 0; listing < 1000; ++listing) {
+        auto index = table.add(listing + 100);
+        table.update(index, 2, 3, -1);
+    }
+    ASSERT_EQ(table.size(), 1000);
+    ASSERT_EQ(table.listing_id(10), 110);
+    ASSERT_EQ(table.total_buy_side(), 2000);
+    ASSERT_EQ(table.total_sell_side(), 3000);
+    ASSERT_EQ(table.total_net_pos(), -1000);
+}
+
+TEST(risktable, at_or_above)
+{
+    auto table = RiskTable();
+    for (uint64_t listing = 0; listing < 100; ++listing)
+        table.add(listing);
+    table.update(3, 9, 0, 0);
+    table.update(50, 0, 7, 0);
+    table.update(51, 8, 6, 0);
+    table.update(99, 10, 10, 0);
+
+    auto expected = std::vector<uint32_t>{3, 50, 99};
+    ASSERT_EQ(table.at_or_above(9, 7), expected);
+    ASSERT_TRUE(table.at_or_above(11, 11).empty());
+}
+
+TEST(risktable, at_or_above_any_size)
+{
+    // Sizes around the blocks of the vector scan, with short and negative sides
+    auto random = std::mt19937_64(7);
+    for (uint32_t listings : {0u, 1u, 3u, 4u, 5u, 63u, 64u, 1001u}) {
+        auto table = RiskTable();
+        for (uint32_t listing = 0; listing < listings; ++listing) {
+            auto index = table.add(listing);
+            table.update(index, static_cast<int64_t>(random() % 200) - 100, static_cast<int64_t>(random() % 200) - 100,
+                         0);
+        }
+        for (auto [buy_threshold, sell_threshold] : {std::pair<int64_t, int64_t>{90, 90}, {-50, 200}, {0, 0}}) {
+            auto expected = std::vector<uint32_t>{};
+            for (uint32_t index = 0; index < listings; ++index) {
+                if (table.buy_side(index) >= buy_threshold || table.sell_side(index) >= sell_threshold)
+                    expected.push_back(index);
+            }
+            ASSERT_EQ(table.at_or_above(buy_threshold, sell_threshold), expected) << listings << " listings";
+        }
+    }
+}
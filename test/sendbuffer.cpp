@@ -0,0 +1,122 @@
+#include "../sendbuffer.hpp"
+
+#include <gtest/gtest.h>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace testing;
+
+namespace
+{
+struct SocketPair
+{
+    SocketPair()
+    {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1)
+            throw std::runtime_error("socketpair");
+        writer = fds[0];
+        reader = fds[1];
+        fcntl(writer, F_SETFL, fcntl(writer, F_GETFL) | O_NONBLOCK);
+        fcntl(reader, F_SETFL, fcntl(reader, F_GETFL) | O_NONBLOCK);
+    }
+    ~SocketPair()
+    {
+        close(writer);
+        if (reader != -1)
+            close(reader);
+    }
+
+    std::vector<char> receive()
+    {
+        auto bytes = std::vector<char>();
+        char buffer[4096];
+        ssize_t size;
+        while ((size = read(reader, buffer, sizeof(buffer))) > 0)
+            bytes.insert(bytes.end(), buffer, buffer + size);
+        return bytes;
+    }
+
+    int writer;
+    int reader;
+};
+
+void append(SendBuffer & buffer, std::vector<char> & expected, uint32_t value, size_t size)
+{
+    auto frame = buffer.append(size);
+    for (size_t i = 0; i < size; ++i)
+        frame[i] = static_cast<char>(value + i);
+    expected.insert(expected.end(), frame, frame + size);
+}
+} // unnamed namespace
+
+TEST(sendbuffer, frames_across_chunks)
+{
+    auto sockets = SocketPair();
+    auto buffer = SendBuffer(64);
+    auto expected = std::vector<char>();
+    for (uint32_t i = 0; i < 20; ++i)
+        append(buffer, expected, i, 28);
+    ASSERT_EQ(buffer.pending(), 20 * 28);
+    ASSERT_THROW(buffer.append(65), std::logic_error);
+
+    ASSERT_TRUE(buffer.flush(sockets.writer));
+    ASSERT_EQ(buffer.pending(), 0);
+    ASSERT_EQ(sockets.receive(), expected) << "Frames never straddle chunks and arrive in order";
+}
+
+TEST(sendbuffer, partial_flush)
+{
+    auto sockets = SocketPair();
+    auto buffer = SendBuffer(1024);
+    auto expected = std::vector<char>();
+
+    // Queue more than the socket takes, the rest is kept for the next flush
+    uint32_t value = 0;
+    while (buffer.pending() == 0) {
+        for (int i = 0; i < 100; ++i)
+            append(buffer, expected, value++, 28);
+        ASSERT_TRUE(buffer.flush(sockets.writer));
+    }
+
+    auto received = std::vector<char>();
+    while (buffer.pending() != 0) {
+        auto bytes = sockets.receive();
+        received.insert(received.end(), bytes.begin(), bytes.end());
+        ASSERT_TRUE(buffer.flush(sockets.writer));
+    }
+    auto bytes = sockets.receive();
+    received.insert(received.end(), bytes.begin(), bytes.end());
+    ASSERT_EQ(received, expected);
+}
+
+TEST(sendbuffer, closed_peer)
+{
+    auto sockets = SocketPair();
+    auto buffer = SendBuffer(64);
+    auto expected = std::vector<char>();
+    append(buffer, expected, 1, 28);
+    close(sockets.reader);
+    sockets.reader = -1;
+    ASSERT_FALSE(buffer.flush(sockets.writer));
+}
+
+TEST(sendbuffer, drain)
+{
+    auto buffer = SendBuffer(64);
+    auto expected = std::vector<char>();
+    for (uint32_t i = 0; i < 5; ++i)
+        append(buffer, expected, i, 28);
+
+    // Drained in pieces that do not line up with the frames or the chunks
+    auto drained = std::vector<char>(expected.size());
+    ASSERT_EQ(buffer.drain(drained.data(), 50), 50);
+    ASSERT_EQ(buffer.pending(), 5 * 28 - 50);
+    ASSERT_EQ(buffer.drain(drained.data() + 50, 1000), 5 * 28 - 50);
+    ASSERT_EQ(buffer.pending(), 0);
+    ASSERT_EQ(drained, expected);
+    ASSERT_EQ(buffer.drain(drained.data(), 1000), 0);
+}
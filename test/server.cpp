@@ -0,0 +1,367 @@
+#include "../server/server.hpp"
+#include "../client/client.hpp"
+#include "helpers.hpp"
+
+#include <gtest/gtest.h>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace testing;
+using OrderStatus = Messages::OrderResponse::Status;
+
+namespace
+{
+uint16_t next_port = 24100; // a port per server, none is reused while the previous one lingers in TIME_WAIT
+
+// A server in a child process, killed when it goes out of scope
+class ServerProcess
+{
+public:
+    explicit ServerProcess(ServerOptions options, uint64_t max_buy = 20, uint64_t max_sell = 20)
+        : port_(next_port++)
+    {
+        options.port = port_;
+        std::fflush(nullptr);
+        pid_ = fork();
+        if (pid_ == -1)
+            throw std::runtime_error("Could not start the server");
+        if (pid_ == 0) {
+            try {
+                auto server = Server(max_buy, max_sell, options);
+                server.start();
+            }
+            catch (const std::exception & err) {
+                std::fprintf(stderr, "[ERR] %s\n", err.what());
+            }
+            _exit(1);
+        }
+    }
+
+    ~ServerProcess()
+    {
+        kill(pid_, SIGKILL);
+        waitpid(pid_, nullptr, 0);
+    }
+
+    // Connects a client, retrying while the server is starting up
+    std::unique_ptr<Client> connect(Client::Transport transport = Client::Transport::TCP, size_t window = 16) const
+    {
+        for (int attempt = 0;; ++attempt) {
+            try {
+                return std::make_unique<Client>(window, "127.0.0.1", port_, transport);
+            }
+            catch (const std::runtime_error &) {
+                if (attempt == 500)
+                    throw;
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+        }
+    }
+
+private:
+    uint16_t port_;
+    pid_t pid_;
+};
+
+Messages::NewOrder buy(uint64_t order_id, uint64_t quantity)
+{
+    return Messages::NewOrder{Messages::NewOrder::MESSAGE_TYPE, 1, order_id, quantity, 100, 'B'};
+}
+
+Messages::SessionResponse request_session(Client & client)
+{
+    auto answer = Messages::SessionResponse{};
+    auto answered = false;
+    client.request_session([&](const Messages::SessionResponse & response) {
+        answer = response;
+        answered = true;
+    });
+    EXPECT_TRUE(wait_for(client, [&]() { return answered; }));
+    return answer;
+}
+
+// Resumes `session` on a new connection, retrying until the server has noticed that the old one is gone
+std::unique_ptr<Client> resume(const ServerProcess & server, const Messages::SessionResponse & session,
+                               uint32_t next, std::vector<Messages::OrderResponse> & resent,
+                               Client::Transport transport = Client::Transport::TCP)
+{
+    for (int attempt = 0; attempt < 100; ++attempt) {
+        auto client = server.connect(transport);
+        client->on_unmatched([&](const Messages::OrderResponse & response) { resent.push_back(response); });
+        auto answer = Messages::SessionResponse{};
+        auto answered = false;
+        client->resume(session.session, session.token, next, [&](const Messages::SessionResponse & response) {
+            answer = response;
+            answered = true;
+        });
+        if (!wait_for(*client, [&]() { return answered; }))
+            return nullptr;
+        if (answer.status == OrderStatus::ACCEPTED) {
+            EXPECT_EQ(answer.session, session.session);
+            EXPECT_EQ(answer.token, session.token);
+            EXPECT_EQ(answer.nextSequenceNumber, next);
+            return client;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    return nullptr;
+}
+
+// Sends `order` and waits for its status
+OrderStatus decide(Client & client, const Messages::NewOrder & order)
+{
+    auto status = OrderStatus{};
+    auto answered = false;
+    EXPECT_TRUE(client.send(order, [&](const Messages::OrderResponse & response) {
+        status = response.status;
+        answered = true;
+    }));
+    EXPECT_TRUE(wait_for(client, [&]() { return answered; }));
+    return status;
+}
+
+// Journals a session holding a buy of 8 under a firm limit of 11, then kills its server
+Messages::SessionResponse journal_session(const ServerOptions & options)
+{
+    auto server = ServerProcess(options);
+    auto client = server.connect();
+    auto session = request_session(*client);
+    EXPECT_EQ(decide(*client, buy(1, 8)), OrderStatus::ACCEPTED);
+    return session;
+}
+
+ServerOptions journaled(const TempDirectory & directory)
+{
+    auto options = ServerOptions{};
+    options.journal.directory = directory.path();
+    options.firm_max_buy = 11; // exposure stays below it
+    options.session_linger = std::chrono::seconds(30);
+    return options;
+}
+
+void resume_session(ServerOptions options, Client::Transport transport = Client::Transport::TCP)
+{
+    options.session_linger = std::chrono::seconds(30);
+    auto server = ServerProcess(options);
+
+    // Two orders answered, a third one sent just before the connection goes away
+    auto session = Messages::SessionResponse{};
+    auto next = uint32_t{0};
+    {
+        auto client = server.connect(transport);
+        session = request_session(*client);
+        ASSERT_EQ(session.status, OrderStatus::ACCEPTED);
+        auto answered = 0;
+        for (uint64_t order_id = 1; order_id <= 2; ++order_id)
+            ASSERT_TRUE(client->send(buy(order_id, 5), [&](const Messages::OrderResponse &) { ++answered; }));
+        ASSERT_TRUE(wait_for(*client, [&]() { return answered == 2; }));
+        next = client->next_response();
+        ASSERT_EQ(next, 2);
+        ASSERT_TRUE(client->send(buy(3, 5), [](const Messages::OrderResponse &) {}));
+        client->process();
+    }
+
+    auto resent = std::vector<Messages::OrderResponse>{};
+    auto client = resume(server, session, next, resent, transport);
+    ASSERT_NE(client, nullptr);
+    ASSERT_TRUE(wait_for(*client, [&]() { return resent.size() == 1; }));
+    ASSERT_EQ(resent[0].orderId, 3);
+    ASSERT_EQ(resent[0].status, OrderStatus::ACCEPTED);
+
+    // The new connection carries on with the session's exposure of 15
+    auto responses = std::vector<Messages::OrderResponse>{};
+    auto collect = [&](const Messages::OrderResponse & response) { responses.push_back(response); };
+    ASSERT_TRUE(client->send(buy(4, 2), collect));
+    ASSERT_TRUE(client->send(buy(5, 10), collect));
+    ASSERT_TRUE(wait_for(*client, [&]() { return responses.size() == 2; })) << "Input after the resume was lost";
+    ASSERT_EQ(responses[0].status, OrderStatus::ACCEPTED);
+    ASSERT_EQ(responses[1].status, OrderStatus::REJECTED);
+    ASSERT_EQ(responses[1].reason, Messages::OrderResponse::Reason::SESSION_LIMIT);
+    ASSERT_EQ(client->next_response(), 5);
+}
+} // unnamed namespace
+
+TEST(server, resume_epoll)
+{
+    resume_session(ServerOptions{});
+}
+
+TEST(server, resume_io_uring)
+{
+    auto options = ServerOptions{};
+    options.io_uring = true;
+    resume_session(options);
+}
+
+TEST(server, resume_with_workers)
+{
+    auto options = ServerOptions{};
+    options.workers = 2;
+    options.io_uring = true;
+    resume_session(options);
+}
+
+TEST(server, resume_over_shared_memory)
+{
+    auto options = ServerOptions{};
+    options.shared_memory = true;
+    resume_session(options, Client::Transport::SHARED_MEMORY);
+}
+
+TEST(server, resume_refused)
+{
+    auto options = ServerOptions{};
+    options.session_linger = std::chrono::seconds(30);
+    auto server = ServerProcess(options);
+    auto session = Messages::SessionResponse{};
+    {
+        auto first = server.connect();
+        session = request_session(*first);
+        ASSERT_NE(session.token, 0);
+
+        // Still attached to its connection
+        auto second = server.connect();
+        ASSERT_NE(request_session(*second).token, session.token) << "Every session has a token of its own";
+        auto answer = Messages::SessionResponse{};
+        second->resume(session.session, session.token, 0,
+                       [&](const Messages::SessionResponse & response) { answer = response; });
+        ASSERT_TRUE(wait_for(*second, [&]() { return answer.messageType != 0; }));
+        ASSERT_EQ(answer.status, OrderStatus::REJECTED);
+        ASSERT_EQ(answer.token, 0);
+    }
+
+    // Detached now, but only the right token takes it over
+    for (auto token : {uint64_t{0}, session.token + 1}) {
+        auto client = server.connect();
+        auto answer = Messages::SessionResponse{};
+        client->resume(session.session, token, 0,
+                       [&](const Messages::SessionResponse & response) { answer = response; });
+        ASSERT_TRUE(wait_for(*client, [&]() { return answer.messageType != 0; }));
+        ASSERT_EQ(answer.status, OrderStatus::REJECTED);
+    }
+    auto resent = std::vector<Messages::OrderResponse>{};
+    ASSERT_NE(resume(server, session, 0, resent), nullptr);
+
+    // A session that never existed
+    auto client = server.connect();
+    auto answer = Messages::SessionResponse{};
+    client->resume(session.session + 100, session.token, 0,
+                   [&](const Messages::SessionResponse & response) { answer = response; });
+    ASSERT_TRUE(wait_for(*client, [&]() { return answer.messageType != 0; }));
+    ASSERT_EQ(answer.status, OrderStatus::REJECTED);
+}
+
+// Responses wait for the journal to sync what they answer, which the server asks for rather than wait out the window
+TEST(server, journaled_responses_wait_for_sync)
+{
+    for (auto io_uring : {false, true}) {
+        auto directory = TempDirectory("server-test");
+        auto options = journaled(directory);
+        options.io_uring = io_uring;
+        options.journal.window = std::chrono::seconds(60);
+        auto server = ServerProcess(options);
+        auto client = server.connect(Client::Transport::TCP, 64);
+        auto answered = 0;
+        for (uint64_t order_id = 1; order_id <= 64; ++order_id)
+            ASSERT_TRUE(client->send(buy(order_id, 0), [&](const Messages::OrderResponse &) { ++answered; }));
+        ASSERT_TRUE(wait_for(*client, [&]() { return answered == 64; })) << "Held until the window passed";
+    }
+}
+
+TEST(server, recovered_session_resumed)
+{
+    for (auto workers : {0, 2}) {
+        auto directory = TempDirectory("server-test");
+        auto options = journaled(directory);
+        options.workers = workers;
+        auto session = journal_session(options);
+
+        auto server = ServerProcess(options);
+        auto resent = std::vector<Messages::OrderResponse>{};
+        auto client = resume(server, session, 1, resent);
+        ASSERT_NE(client, nullptr);
+        ASSERT_TRUE(resent.empty()) << "The responses went with the previous run";
+        ASSERT_EQ(decide(*client, buy(2, 2)), OrderStatus::ACCEPTED);
+        ASSERT_EQ(decide(*client, buy(3, 1)), OrderStatus::REJECTED) << "The recovered buy of 8 still counts";
+    }
+}
+
+TEST(server, recovered_session_expires)
+{
+    auto directory = TempDirectory("server-test");
+    auto options = journaled(directory);
+    auto session = journal_session(options);
+
+    options.session_linger = std::chrono::seconds(1);
+    auto server = ServerProcess(options);
+    auto client = server.connect();
+    ASSERT_EQ(request_session(*client).status, OrderStatus::ACCEPTED);
+    ASSERT_EQ(decide(*client, buy(1, 5)), OrderStatus::REJECTED) << "Held by the recovered session";
+
+    // Expired within a second of its linger, which releases its firm exposure
+    std::this_thread::sleep_for(std::chrono::milliseconds(2500));
+    ASSERT_EQ(decide(*client, buy(2, 5)), OrderStatus::ACCEPTED);
+    auto resent = std::vector<Messages::OrderResponse>{};
+    auto other = server.connect();
+    auto answer = Messages::SessionResponse{};
+    other->resume(session.session, session.token, 1,
+                  [&](const Messages::SessionResponse & response) { answer = response; });
+    ASSERT_TRUE(wait_for(*other, [&]() { return answer.messageType != 0; }));
+    ASSERT_EQ(answer.status, OrderStatus::REJECTED);
+}
+
+TEST(server, recovered_session_ends_without_linger)
+{
+    auto directory = TempDirectory("server-test");
+    auto options = journaled(directory);
+    journal_session(options);
+
+    options.session_linger = std::chrono::seconds(0);
+    auto server = ServerProcess(options);
+    auto client = server.connect();
+    ASSERT_EQ(request_session(*client).status, OrderStatus::ACCEPTED);
+    ASSERT_EQ(decide(*client, buy(1, 10)), OrderStatus::ACCEPTED);
+}
+
+TEST(server, snapshot_without_workers)
+{
+    auto directory = TempDirectory("server-test");
+    auto options = journaled(directory);
+    options.snapshot_interval = std::chrono::seconds(1);
+    auto snapshots = [&]() {
+        auto count = 0;
+        for (const auto & entry : std::filesystem::directory_iterator(directory.path()))
+            count += entry.path().extension() == ".snap";
+        return count;
+    };
+    auto session = Messages::SessionResponse{};
+    {
+        auto server = ServerProcess(options);
+        auto client = server.connect();
+        session = request_session(*client);
+        ASSERT_EQ(decide(*client, buy(1, 8)), OrderStatus::ACCEPTED);
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(3);
+        while (snapshots() == 0 && std::chrono::steady_clock::now() < deadline)
+            client->wait(std::chrono::milliseconds(10));
+        ASSERT_EQ(snapshots(), 1);
+    }
+
+    // The session comes back from the snapshot alone
+    for (const auto & entry : std::filesystem::directory_iterator(directory.path())) {
+        if (entry.path().extension() == ".seg")
+            std::filesystem::remove(entry.path());
+    }
+    auto server = ServerProcess(options);
+    auto resent = std::vector<Messages::OrderResponse>{};
+    auto client = resume(server, session, 1, resent);
+    ASSERT_NE(client, nullptr);
+    ASSERT_EQ(decide(*client, buy(2, 3)), OrderStatus::REJECTED);
+    ASSERT_EQ(decide(*client, buy(3, 2)), OrderStatus::ACCEPTED);
+}
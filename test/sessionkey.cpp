@@ -0,0 +1,29 @@
+#include "../server/sessionkey.hpp"
+#include "helpers.hpp"
+
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+
+using namespace testing;
+
+TEST(sessionkey, siphash_reference_vector)
+{
+    // Key 00 01 .. 0f and message 00 01 .. 07, from the SipHash paper
+    const uint64_t key[2] = {0x0706050403020100ULL, 0x0f0e0d0c0b0a0908ULL};
+    ASSERT_EQ(SessionKey::siphash(key, 0x0706050403020100ULL), 0x93f5f5799a932462ULL);
+}
+
+TEST(sessionkey, kept_in_directory)
+{
+    auto directory = TempDirectory("sessionkey-test");
+    auto first = SessionKey(directory.path());
+    auto again = SessionKey(directory.path());
+    ASSERT_EQ(first.token(3), again.token(3)) << "Tokens survive a restart";
+    ASSERT_NE(first.token(3), first.token(4));
+    struct stat status{};
+    ASSERT_EQ(stat((directory.path() + "/session.key").c_str(), &status), 0);
+    ASSERT_EQ(status.st_mode & 0777, 0600);
+
+    // Without a directory every server has a key of its own
+    ASSERT_NE(SessionKey().token(3), SessionKey().token(3));
+}
@@ -0,0 +1,160 @@
+#include "../shmchannel.hpp"
+
+#include <gtest/gtest.h>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace testing;
+
+namespace
+{
+std::string session_name()
+{
+    static int count = 0;
+    return "/flow-test-" + std::to_string(getpid()) + "-" + std::to_string(count++);
+}
+
+// Both ends of a session in one process, the way the server maps what the client created
+struct Session
+{
+    Session(size_t capacity = 4096)
+        : client(session_name(), capacity)
+        , server(dup(client.fd()))
+    {
+        client.unlink();
+    }
+
+    ShmChannel client;
+    ShmChannel server;
+};
+} // unnamed namespace
+
+TEST(shmchannel, frames_wrap_around)
+{
+    auto session = Session();
+    // Frames of an odd size eventually straddle the end of the ring, the double mapping keeps them contiguous
+    char frame[97];
+    for (int i = 0; i < 1000; ++i) {
+        std::memset(frame, 'a' + i % 26, sizeof(frame));
+        ASSERT_GE(session.client.write_space(), sizeof(frame));
+        std::memcpy(session.client.write_data(), frame, sizeof(frame));
+        session.client.commit(sizeof(frame));
+
+        ASSERT_EQ(session.server.pending(), sizeof(frame));
+        ASSERT_EQ(std::memcmp(session.server.read_data(), frame, sizeof(frame)), 0);
+        session.server.consume(sizeof(frame));
+        ASSERT_EQ(session.server.pending(), 0);
+    }
+
+    // The other direction is a ring of its own
+    std::memcpy(session.server.write_data(), "response", 8);
+    session.server.commit(8);
+    ASSERT_EQ(session.client.pending(), 8);
+    ASSERT_EQ(std::string(session.client.read_data(), 8), "response");
+}
+
+TEST(shmchannel, full_ring)
+{
+    auto session = Session();
+    auto capacity = session.client.write_space();
+    ASSERT_EQ(capacity, static_cast<size_t>(sysconf(_SC_PAGESIZE)));
+    session.client.commit(capacity);
+    ASSERT_EQ(session.client.write_space(), 0);
+
+    ASSERT_EQ(session.server.pending(), capacity);
+    session.server.consume(100);
+    ASSERT_EQ(session.client.write_space(), 100);
+    ASSERT_EQ(session.server.pending(), capacity - 100);
+
+    // read() copies out what fits and frees exactly that
+    char copy[200];
+    ASSERT_EQ(session.server.read(copy, sizeof(copy)), sizeof(copy));
+    ASSERT_EQ(session.server.pending(), capacity - 300);
+    ASSERT_EQ(session.server.read(copy, sizeof(copy)), sizeof(copy));
+    session.server.consume(session.server.pending() - 50);
+    ASSERT_EQ(session.server.read(copy, sizeof(copy)), 50);
+    ASSERT_EQ(session.server.read(copy, sizeof(copy)), 0);
+}
+
+TEST(shmchannel, doorbell_protocol)
+{
+    auto session = Session();
+    ASSERT_FALSE(session.client.peer_waiting()) << "Nobody sleeps yet";
+
+    // The server asks to be woken up, the next commit owes it exactly one ring
+    ASSERT_TRUE(session.server.arm());
+    session.client.commit(10);
+    ASSERT_TRUE(session.client.peer_waiting());
+    ASSERT_FALSE(session.client.peer_waiting());
+
+    // Nothing is asked for while there is something to read
+    ASSERT_FALSE(session.server.arm());
+    session.client.commit(10);
+    ASSERT_FALSE(session.client.peer_waiting());
+
+    session.server.consume(session.server.pending());
+    ASSERT_TRUE(session.server.arm());
+    session.server.disarm();
+    session.client.commit(10);
+    ASSERT_FALSE(session.client.peer_waiting());
+}
+
+TEST(shmchannel, rejects_other_files)
+{
+    auto fd = memfd_create("not-a-session", MFD_CLOEXEC);
+    ASSERT_NE(fd, -1);
+    ASSERT_EQ(ftruncate(fd, 3 * sysconf(_SC_PAGESIZE)), 0);
+    ASSERT_THROW(ShmChannel{fd}, std::runtime_error);
+    close(fd);
+
+    // A corrupt index is caught before anything is read past the ring
+    auto session = Session();
+    session.client.commit(3 * 4096);
+    ASSERT_THROW(session.server.pending(), std::runtime_error);
+}
+
+TEST(shmchannel, descriptors)
+{
+    int sockets[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sockets), 0);
+    int received[2];
+    ASSERT_FALSE(receive_descriptors(sockets[1], received, 2));
+    ASSERT_EQ(errno, EAGAIN);
+
+    int pipe_fds[2];
+    ASSERT_EQ(pipe(pipe_fds), 0);
+    ASSERT_TRUE(send_descriptors(sockets[0], pipe_fds, 2));
+    ASSERT_TRUE(receive_descriptors(sockets[1], received, 2));
+    ASSERT_EQ(write(received[1], "x", 1), 1);
+    char byte;
+    ASSERT_EQ(read(pipe_fds[0], &byte, 1), 1);
+    ASSERT_EQ(byte, 'x');
+
+    // Fewer than expected is a protocol error, not a partial success
+    ASSERT_TRUE(send_descriptors(sockets[0], pipe_fds, 1));
+    ASSERT_FALSE(receive_descriptors(sockets[1], received + 1, 2));
+    ASSERT_EQ(errno, EPROTO);
+
+    for (auto fd : {sockets[0], sockets[1], pipe_fds[0], pipe_fds[1], received[0], received[1]})
+        close(fd);
+}
+
+TEST(shmchannel, same_user)
+{
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    ASSERT_TRUE(same_user(fds[0]));
+    close(fds[0]);
+    close(fds[1]);
+
+    // Not a Unix socket, so no peer to check
+    int pipe_fds[2];
+    ASSERT_EQ(pipe(pipe_fds), 0);
+    ASSERT_FALSE(same_user(pipe_fds[0]));
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+}
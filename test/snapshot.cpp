@@ -0,0 +1,166 @@
+#include "../server/snapshot.hpp"
+#include "../encoder.hpp"
+#include "helpers.hpp"
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <vector>
+
+using namespace testing;
+
+namespace
+{
+const int MAX_BUY = 100;
+const int MAX_SELL = 100;
+
+Messages::NewOrder new_order(uint64_t listing, uint64_t id, uint64_t quantity, char side)
+{
+    return {Messages::NewOrder::MESSAGE_TYPE, listing, id, quantity, 10, side};
+}
+
+// Applies the message to the store and journals it, as the server does
+template<typename Payload>
+OrderStore::Response apply(Journal & journal, uint64_t session, OrderStore & store, const Payload & payload)
+{
+    char frame[Encoder::MAX_FRAME_SIZE];
+    journal.append(session, frame, Encoder(1).encode(frame, payload, 0, 0));
+    return store.consume(payload);
+}
+
+void expect_same(OrderStore & lhs, OrderStore & rhs)
+{
+    EXPECT_EQ(lhs.total_buy_side(), rhs.total_buy_side());
+    EXPECT_EQ(lhs.total_sell_side(), rhs.total_sell_side());
+    EXPECT_EQ(lhs.total_net_pos(), rhs.total_net_pos());
+    EXPECT_EQ(lhs.listings_near_limit(1.0), rhs.listings_near_limit(1.0));
+}
+} // unnamed namespace
+
+TEST(snapshot, order_store_image)
+{
+    auto firm_limits = FirmLimits(1000, 1000);
+    auto store = OrderStore(MAX_BUY, MAX_SELL);
+    for (uint64_t id = 0; id < 50; ++id)
+        store.consume(new_order(id % 5, id, 1, id % 2 ? 'B' : 'S'));
+    store.consume(Messages::Trade{Messages::Trade::MESSAGE_TYPE, 0, 0, 1, 10});
+    store.consume(Messages::ModifyOrderQuantity{Messages::ModifyOrderQuantity::MESSAGE_TYPE, 1, 3});
+
+    auto image = std::vector<char>(store.image_size());
+    store.save(image.data());
+    auto restored = OrderStore(MAX_BUY, MAX_SELL, &firm_limits);
+    restored.load(image.data(), image.size());
+    expect_same(store, restored);
+    // Listing 1 holds the buys 1 (modified to 3), 11, 21, 31 and 41
+    ASSERT_EQ(firm_limits.exposure(1).buy_side.load(), 7) << "Restored exposure counts against the firm limits";
+
+    // The order index is rebuilt, so the restored orders can be deleted and matched as before
+    auto deleted = restored.consume(Messages::DeleteOrder{Messages::DeleteOrder::MESSAGE_TYPE, 2});
+    ASSERT_EQ(deleted.status, Messages::OrderResponse::Status::ACCEPTED);
+    auto traded = restored.consume(Messages::Trade{Messages::Trade::MESSAGE_TYPE, 3, 3, 1, 10});
+    ASSERT_EQ(traded.status, Messages::OrderResponse::Status::ACCEPTED);
+
+    ASSERT_THROW(OrderStore(MAX_BUY, MAX_SELL).load(image.data(), image.size() - 8), std::runtime_error);
+}
+
+TEST(snapshot, recover_from_snapshot_and_journal_tail)
+{
+    auto directory = TempDirectory("snapshot-test");
+    auto first = OrderStore(MAX_BUY, MAX_SELL);
+    auto second = OrderStore(MAX_BUY, MAX_SELL);
+    {
+        auto journal = Journal(JournalOptions{directory.path(), 4096});
+        journal.open(1);
+        journal.open(2);
+        journal.open(3);
+        for (uint64_t id = 0; id < 40; ++id) {
+            apply(journal, 1, first, new_order(id % 3, id, 2, 'B'));
+            apply(journal, 2, second, new_order(id % 4, 100 + id, 1, 'S'));
+        }
+
+        auto snapshot = std::make_shared<Snapshot>(journal.position(), 1, [](std::shared_ptr<Snapshot>) {});
+        snapshot->add(1, first);
+        snapshot->add(2, second);
+        snapshot->part_done();
+        snapshot->write(directory.path());
+
+        // Only these are replayed on recovery
+        for (uint64_t id = 0; id < 10; ++id)
+            apply(journal, 1, first, Messages::DeleteOrder{Messages::DeleteOrder::MESSAGE_TYPE, id});
+        apply(journal, 2, second, Messages::ModifyOrderQuantity{Messages::ModifyOrderQuantity::MESSAGE_TYPE, 100, 5});
+        journal.close(3);
+        journal.open(7);
+    }
+
+    auto recovered = Snapshot::recover(directory.path(), MAX_BUY, MAX_SELL, nullptr);
+    ASSERT_EQ(recovered.sessions.size(), 3);
+    ASSERT_EQ(recovered.next_session, 8);
+    expect_same(*recovered.sessions.at(1), first);
+    expect_same(*recovered.sessions.at(2), second);
+    ASSERT_EQ(recovered.sessions.at(7)->total_buy_side(), 0);
+    ASSERT_EQ(recovered.sessions.count(3), 0) << "Closed after the snapshot";
+}
+
+TEST(snapshot, writer_keeps_newest)
+{
+    auto directory = TempDirectory("snapshot-test");
+    auto store = OrderStore(MAX_BUY, MAX_SELL);
+    store.consume(new_order(1, 1, 4, 'B'));
+    {
+        auto writer = SnapshotWriter(directory.path());
+        for (uint64_t offset = 1; offset <= 4; ++offset) {
+            auto snapshot = std::make_shared<Snapshot>(Journal::Position{0, offset * 8}, 2,
+                                                       [&](std::shared_ptr<Snapshot> done) { writer.submit(done); });
+            snapshot->add(offset, store);
+            snapshot->part_done();
+            snapshot->part_done();
+        }
+    }
+    auto files = std::distance(std::filesystem::directory_iterator(directory.path()),
+                               std::filesystem::directory_iterator());
+    ASSERT_EQ(files, 2);
+
+    auto sessions = std::vector<uint64_t>{};
+    auto position = Snapshot::load(directory.path(), [&](uint64_t session, const char *, size_t) {
+        sessions.push_back(session);
+    });
+    ASSERT_EQ(position.offset, 32);
+    ASSERT_EQ(sessions, std::vector<uint64_t>{4});
+}
+
+TEST(snapshot, prunes_the_journal)
+{
+    auto directory = TempDirectory("snapshot-test");
+    auto store = OrderStore(MAX_BUY, MAX_SELL);
+    auto oldest_segment = [&]() {
+        auto oldest = UINT64_MAX;
+        for (const auto & entry : std::filesystem::directory_iterator(directory.path())) {
+            auto name = entry.path().filename().string();
+            if (entry.path().extension() == ".seg")
+                oldest = std::min<uint64_t>(oldest, std::stoull(name.substr(std::strlen("journal-"))));
+        }
+        return oldest;
+    };
+    {
+        auto journal = Journal(JournalOptions{directory.path(), 4096});
+        journal.open(1);
+        auto positions = std::vector<Journal::Position>{};
+        for (uint64_t id = 0; id < 300; ++id) {
+            apply(journal, 1, store, new_order(id % 5, id, 1, id % 2 == 0 ? 'B' : 'S'));
+            if (id % 100 == 99) {
+                auto snapshot = std::make_shared<Snapshot>(journal.position(), 1, [](std::shared_ptr<Snapshot>) {});
+                snapshot->add(1, store);
+                snapshot->part_done();
+                snapshot->write(directory.path());
+                positions.push_back(snapshot->position());
+                ASSERT_EQ(oldest_segment(), positions[positions.size() < 2 ? 0 : positions.size() - 2].segment);
+            }
+        }
+        ASSERT_GT(positions[1].segment, 0) << "The records span several segments";
+    }
+
+    auto recovered = Snapshot::recover(directory.path(), MAX_BUY, MAX_SELL, nullptr);
+    ASSERT_EQ(recovered.sessions.size(), 1);
+    expect_same(*recovered.sessions.at(1), store);
+}
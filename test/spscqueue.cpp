@@ -0,0 +1,46 @@
+#include "../server/spscqueue.hpp"
+
+#include <gtest/gtest.h>
+#include <thread>
+
+using namespace testing;
+
+TEST(spscqueue, push_pop)
+{
+    auto queue = SpscQueue<int>(3);
+    int value;
+    ASSERT_TRUE(queue.empty());
+    ASSERT_FALSE(queue.try_pop(value));
+    for (int i = 0; i < 4; ++i)
+        ASSERT_TRUE(queue.try_push(int{i})) << "Capacity is rounded up to a power of two";
+    ASSERT_FALSE(queue.try_push(4));
+    ASSERT_TRUE(queue.try_pop(value));
+    ASSERT_EQ(value, 0);
+    ASSERT_TRUE(queue.try_push(4));
+    for (int i = 1; i < 5; ++i) {
+        ASSERT_TRUE(queue.try_pop(value));
+        ASSERT_EQ(value, i);
+    }
+    ASSERT_TRUE(queue.empty());
+}
+
+TEST(spscqueue, threads)
+{
+    const uint64_t count = 1'000'000;
+    auto queue = SpscQueue<uint64_t>(64);
+    auto producer = std::thread([&queue]() {
+        for (uint64_t i = 0; i < count; ++i) {
+            while (!queue.try_push(uint64_t{i}))
+                std::this_thread::yield();
+        }
+    });
+    uint64_t expected = 0;
+    uint64_t value;
+    while (expected < count) {
+        if (queue.try_pop(value))
+            ASSERT_EQ(value, expected++);
+        else
+            std::this_thread::yield();
+    }
+    producer.join();
+}
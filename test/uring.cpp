@@ -0,0 +1,123 @@
+#include "../server/uring.hpp"
+
+#include <gtest/gtest.h>
+#include <cstring>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace testing;
+
+namespace
+{
+struct SocketPair
+{
+    SocketPair()
+    {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) == -1)
+            throw std::runtime_error("socketpair");
+        ours = fds[0];
+        theirs = fds[1];
+    }
+    ~SocketPair()
+    {
+        close(ours);
+        close(theirs);
+    }
+
+    int ours;
+    int theirs;
+};
+
+std::vector<io_uring_cqe> wait_for(Uring & ring, size_t count)
+{
+    auto completions = std::vector<io_uring_cqe>();
+    while (completions.size() < count) {
+        ring.submit(1);
+        ring.complete([&completions](const io_uring_cqe & cqe) { completions.push_back(cqe); });
+    }
+    return completions;
+}
+} // unnamed namespace
+
+TEST(uring, batch_of_operations)
+{
+    auto ring = Uring(8);
+    // More than the submission ring holds, prepare() submits the first ones to make room
+    for (uint64_t i = 0; i < 20; ++i)
+        ring.prepare(IORING_OP_NOP, -1, i);
+    auto completions = wait_for(ring, 20);
+    ASSERT_EQ(completions.size(), 20);
+    for (uint64_t i = 0; i < 20; ++i) {
+        ASSERT_EQ(completions[i].user_data, i);
+        ASSERT_EQ(completions[i].res, 0);
+    }
+}
+
+TEST(uring, provided_buffers)
+{
+    auto ring = Uring(8);
+    auto buffers = ProvidedBuffers(ring, 1, 2, 64, 99);
+    auto sockets = SocketPair();
+
+    auto receive = [&]() {
+        auto & sqe = ring.prepare(IORING_OP_RECV, sockets.ours, 7);
+        sqe.flags = IOSQE_BUFFER_SELECT;
+        sqe.buf_group = buffers.group();
+        auto cqe = wait_for(ring, 1).front();
+        EXPECT_EQ(cqe.user_data, 7) << "Provisions complete silently";
+        EXPECT_TRUE(cqe.flags & IORING_CQE_F_BUFFER);
+        return cqe;
+    };
+
+    // Each receive takes a buffer of its own, none is left for a third one until one is recycled
+    ASSERT_EQ(write(sockets.theirs, "first", 5), 5);
+    auto first = receive();
+    ASSERT_EQ(first.res, 5);
+    ASSERT_EQ(write(sockets.theirs, "second", 6), 6);
+    auto second = receive();
+    ASSERT_EQ(second.res, 6);
+    auto first_id = static_cast<uint16_t>(first.flags >> IORING_CQE_BUFFER_SHIFT);
+    auto second_id = static_cast<uint16_t>(second.flags >> IORING_CQE_BUFFER_SHIFT);
+    ASSERT_NE(first_id, second_id);
+    ASSERT_EQ(std::string(buffers.data(first_id), 5), "first");
+    ASSERT_EQ(std::string(buffers.data(second_id), 6), "second");
+
+    ASSERT_EQ(write(sockets.theirs, "third", 5), 5);
+    auto & sqe = ring.prepare(IORING_OP_RECV, sockets.ours, 8);
+    sqe.flags = IOSQE_BUFFER_SELECT;
+    sqe.buf_group = buffers.group();
+    ASSERT_EQ(wait_for(ring, 1).front().res, -ENOBUFS);
+
+    buffers.recycle(first_id);
+    auto third = receive();
+    ASSERT_EQ(third.res, 5);
+    ASSERT_EQ(static_cast<uint16_t>(third.flags >> IORING_CQE_BUFFER_SHIFT), first_id);
+    ASSERT_EQ(std::string(buffers.data(first_id), 5), "third");
+}
+
+TEST(uring, fixed_buffers)
+{
+    auto ring = Uring(8);
+    auto buffers = FixedBuffers(ring, 2, 64);
+    auto first = buffers.take();
+    auto second = buffers.take();
+    ASSERT_NE(first, second);
+    ASSERT_EQ(buffers.take(), FixedBuffers::NONE);
+    buffers.release(first);
+    ASSERT_EQ(buffers.take(), first);
+
+    // The registered memory is what the kernel reads from
+    auto sockets = SocketPair();
+    std::memcpy(buffers.data(second), "registered", 10);
+    auto & sqe = ring.prepare(IORING_OP_WRITE_FIXED, sockets.ours, 1);
+    sqe.addr = reinterpret_cast<uint64_t>(buffers.data(second));
+    sqe.len = 10;
+    sqe.buf_index = second;
+    ASSERT_EQ(wait_for(ring, 1).front().res, 10);
+    char received[16];
+    ASSERT_EQ(read(sockets.theirs, received, sizeof(received)), 10);
+    ASSERT_EQ(std::string(received, 10), "registered");
+}
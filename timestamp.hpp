@@ -0,0 +1,14 @@
+#ifndef TIMESTAMP_HPP
+#define TIMESTAMP_HPP
+
+#include <chrono>
+#include <cstdint>
+
+// Wall-clock nanoseconds since the epoch, as carried by Messages::Header::timestamp.
+inline uint64_t timestamp()
+{
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count();
+}
+
+#endif //TIMESTAMP_HPP